@@ -0,0 +1,266 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "Audio.h"
+#include "stft.h"
+
+// Whole-file analysis for batch processing.
+//
+// One sequential pass over PCMAudio::Read gathers sample peak and RMS per channel,
+// ITU-R BS.1770-4 loudness (K-weighting, 400 ms gated integrated loudness, maximum
+// momentary loudness and EBU Tech 3342 loudness range), and, through fft::Stft, the dB
+// spectrogram and the strongest peaks of the long-term average spectrum. The source is
+// read front to back only, so streaming sources work too.
+struct AnalysisSettings {
+	size_t fftSize = 2048;
+	size_t hop = 512;
+	fft::Window window = fft::Window::Hann;
+	int spectralPeaks = 8;
+	bool isSpectrogram = true;	// keep the frames, otherwise only the average spectrum is used
+};
+
+struct SpectralPeak {
+	double frequency;	// Hz, interpolated between bins
+	double level;		// dBFS of the average spectrum
+};
+
+struct AudioAnalysis {
+	int channels = 0;
+	int sampleRate = 0;
+	int64_t frames = 0;
+	std::vector<float> peak;	// linear, per channel
+	std::vector<float> rms;		// linear, per channel
+	double integratedLoudness = -HUGE_VAL;	// LUFS, -inf for silence
+	double maxMomentaryLoudness = -HUGE_VAL;	// LUFS
+	double loudnessRange = 0.0;				// LU
+	std::vector<SpectralPeak> spectralPeaks;
+	size_t fftSize = 0;
+	size_t hop = 0;
+	size_t bins = 0;
+	std::vector<float> spectrogram;	// dBFS, bins values per frame, row-major
+	size_t GetSpectrogramFrames() const { return bins ? spectrogram.size() / bins : 0; }
+};
+
+namespace analysis_detail {
+	// biquad in direct form I, double precision
+	struct Biquad {
+		double b0, b1, b2, a1, a2;
+		double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;
+		double Process(double x) {
+			const double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+			x2 = x1; x1 = x;
+			y2 = y1; y1 = y;
+			return y;
+		}
+	};
+
+	// The two K-weighting stages of BS.1770 by bilinear transform for any sample rate; at
+	// 48 kHz they reproduce the coefficients given in the recommendation.
+	inline Biquad HighShelf(double sampleRate) {
+		const double fc = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+		const double K = std::tan(A_PI * fc / sampleRate);
+		const double Vh = std::pow(10.0, gain / 20.0);
+		const double Vb = std::pow(Vh, 0.4996667741545416);
+		const double a0 = 1.0 + K / q + K * K;
+		Biquad f;
+		f.b0 = (Vh + Vb * K / q + K * K) / a0;
+		f.b1 = 2.0 * (K * K - Vh) / a0;
+		f.b2 = (Vh - Vb * K / q + K * K) / a0;
+		f.a1 = 2.0 * (K * K - 1.0) / a0;
+		f.a2 = (1.0 - K / q + K * K) / a0;
+		return f;
+	}
+	inline Biquad HighPass(double sampleRate) {
+		const double fc = 38.13547087602444, q = 0.5003270373238773;
+		const double K = std::tan(A_PI * fc / sampleRate);
+		const double a0 = 1.0 + K / q + K * K;
+		Biquad f;
+		f.b0 = 1.0;
+		f.b1 = -2.0;
+		f.b2 = 1.0;
+		f.a1 = 2.0 * (K * K - 1.0) / a0;
+		f.a2 = (1.0 - K / q + K * K) / a0;
+		return f;
+	}
+
+	// channel weights of BS.1770: surrounds of 5.1 count 1.41, the LFE not at all
+	inline double ChannelWeight(int channel, int channels) {
+		if (channels == 6) {
+			if (channel == 3) {
+				return 0.0;
+			}
+			if (channel >= 4) {
+				return 1.41;
+			}
+		}
+		return 1.0;
+	}
+
+	inline double EnergyToLoudness(double meanSquare) {
+		return meanSquare > 0.0 ? -0.691 + 10.0 * std::log10(meanSquare) : -HUGE_VAL;
+	}
+
+	// mean square of the blocks above gate, or 0
+	inline double GatedMean(const std::vector<double>& blocks, double gate) {
+		double sum = 0.0;
+		size_t count = 0;
+		for (double e : blocks) {
+			if (EnergyToLoudness(e) > gate) {
+				sum += e;
+				count++;
+			}
+		}
+		return count ? sum / count : 0.0;
+	}
+}
+
+inline AudioAnalysis AnalyzeAudio(PCMAudio& audio, const AnalysisSettings& settings = AnalysisSettings()) {
+	using namespace analysis_detail;
+	AudioAnalysis result;
+	const int channels = std::max(audio.GetChannels(), 1);
+	const int64_t frames = audio.GetSamples() / channels;
+	result.channels = channels;
+	result.sampleRate = audio.GetSampleRate();
+	result.frames = frames;
+	result.peak.assign(channels, 0.0f);
+	result.rms.assign(channels, 0.0f);
+	result.fftSize = settings.fftSize;
+	result.hop = settings.hop;
+
+	fft::Stft stft(settings.fftSize, settings.hop, settings.window);
+	const size_t bins = stft.bins();
+	result.bins = bins;
+	if (settings.isSpectrogram) {
+		result.spectrogram.reserve((size_t)((frames + settings.hop - 1) / settings.hop) * bins);
+	}
+	std::vector<double> averagePower(bins, 0.0);
+	size_t spectrumFrames = 0;
+	std::vector<float> magnitudes(bins * 16);
+	auto pullSpectrum = [&]() {
+		size_t n;
+		while ((n = stft.pullMagnitudes(magnitudes.data(), 16, false)) > 0) {
+			for (size_t i = 0; i < n * bins; i++) {
+				const float m = magnitudes[i];
+				averagePower[i % bins] += (double)m * m;
+				magnitudes[i] = 20.0f * std::log10(m + 1e-10f);
+			}
+			if (settings.isSpectrogram) {
+				result.spectrogram.insert(result.spectrogram.end(), magnitudes.begin(), magnitudes.begin() + n * bins);
+			}
+			spectrumFrames += n;
+		}
+	};
+
+	// K-weighted energy per 100 ms step; gating blocks are built from 4 (momentary) and
+	// 30 (short-term) steps
+	const int64_t stepFrames = std::max<int64_t>(result.sampleRate / 10, 1);
+	std::vector<Biquad> shelves(channels, HighShelf(result.sampleRate)), passes(channels, HighPass(result.sampleRate));
+	std::vector<double> weights(channels);
+	for (int c = 0; c < channels; c++) {
+		weights[c] = ChannelWeight(c, channels);
+	}
+	std::vector<double> steps;
+	double stepEnergy = 0.0;
+	int64_t stepFill = 0;
+	std::vector<double> squares(channels, 0.0);
+
+	const int blockFrames = 1 << 14;
+	std::vector<float> block((size_t)blockFrames * channels);
+	for (int64_t position = 0; position < frames; ) {
+		const int n = audio.Read(block.data(), (int)(position * channels), (int)std::min<int64_t>(blockFrames, frames - position) * channels) / channels;
+		if (n <= 0) {
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			const float* frame = &block[(size_t)i * channels];
+			for (int c = 0; c < channels; c++) {
+				const float x = frame[c];
+				result.peak[c] = std::max(result.peak[c], std::fabs(x));
+				squares[c] += (double)x * x;
+				const double k = passes[c].Process(shelves[c].Process(x));
+				stepEnergy += weights[c] * k * k;
+			}
+			if (++stepFill == stepFrames) {
+				steps.push_back(stepEnergy);
+				stepEnergy = 0.0;
+				stepFill = 0;
+			}
+		}
+		stft.push(block.data(), n, channels);
+		pullSpectrum();
+		position += n;
+	}
+	stft.flush();
+	pullSpectrum();
+
+	for (int c = 0; c < channels; c++) {
+		result.rms[c] = frames > 0 ? (float)std::sqrt(squares[c] / frames) : 0.0f;
+	}
+
+	// mean square of every window of the given number of steps, one per step
+	auto windows = [&](size_t length) {
+		std::vector<double> blocks;
+		double sum = 0.0;
+		for (size_t i = 0; i < steps.size(); i++) {
+			sum += steps[i];
+			if (i >= length) {
+				sum -= steps[i - length];
+			}
+			if (i + 1 >= length) {
+				blocks.push_back(std::max(sum, 0.0) / (double)(length * stepFrames));
+			}
+		}
+		return blocks;
+	};
+	const std::vector<double> momentary = windows(4);
+	for (double e : momentary) {
+		result.maxMomentaryLoudness = std::max(result.maxMomentaryLoudness, EnergyToLoudness(e));
+	}
+	// blocks have to clear both the absolute and the relative gate; below -60 LUFS the
+	// relative gate alone would let silence back in
+	const double absolute = GatedMean(momentary, -70.0);
+	if (absolute > 0.0) {
+		result.integratedLoudness = EnergyToLoudness(GatedMean(momentary, std::max(-70.0, EnergyToLoudness(absolute) - 10.0)));
+	}
+	const std::vector<double> shortTerm = windows(30);
+	const double shortAbsolute = GatedMean(shortTerm, -70.0);
+	if (shortAbsolute > 0.0) {
+		const double gate = std::max(-70.0, EnergyToLoudness(shortAbsolute) - 20.0);
+		std::vector<double> levels;
+		for (double e : shortTerm) {
+			const double l = EnergyToLoudness(e);
+			if (l > gate) {
+				levels.push_back(l);
+			}
+		}
+		std::sort(levels.begin(), levels.end());
+		auto percentile = [&](double p) { return levels[(size_t)std::lround(p * (levels.size() - 1))]; };
+		result.loudnessRange = percentile(0.95) - percentile(0.10);
+	}
+
+	// local maxima of the average spectrum in dB, refined with a parabola through the
+	// neighbouring bins
+	if (spectrumFrames > 0 && bins >= 3) {
+		std::vector<double> level(bins);
+		const double gain = 1.0 / (double)spectrumFrames;
+		for (size_t k = 0; k < bins; k++) {
+			level[k] = 10.0 * std::log10(averagePower[k] * gain + 1e-20);
+		}
+		for (size_t k = 1; k + 1 < bins; k++) {
+			if (level[k] > level[k - 1] && level[k] >= level[k + 1]) {
+				const double a = level[k - 1], b = level[k], c = level[k + 1];
+				const double denominator = a - 2.0 * b + c;
+				const double offset = denominator != 0.0 ? 0.5 * (a - c) / denominator : 0.0;
+				result.spectralPeaks.push_back({ ((double)k + offset) * result.sampleRate / (double)settings.fftSize, b - 0.25 * (a - c) * offset });
+			}
+		}
+		const size_t keep = std::min(result.spectralPeaks.size(), (size_t)std::max(settings.spectralPeaks, 0));
+		std::partial_sort(result.spectralPeaks.begin(), result.spectralPeaks.begin() + keep, result.spectralPeaks.end(),
+			[](const SpectralPeak& x, const SpectralPeak& y) { return x.level > y.level; });
+		result.spectralPeaks.resize(keep);
+	}
+	return result;
+}
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+#include "Audio.h"
+#include "Analysis.h"
+
+// On-disk cache of everything that is derived from an audio file.
+//
+// Entries are directory/<key>.<kind>, where the key is the XXH64 of the file contents
+// seeded with the decoder version, so a renamed or copied file hits and an edited one or
+// a new decoder misses. LoadAudio keeps decoded PCM as raw float32 that is memory-mapped
+// on reuse instead of decoded again; other users store their own kinds (the waveform
+// pyramid, spectrograms, the analysis summary) through GetPath. Files are written next to
+// their target and renamed. Every hit touches the file. The size of the directory is
+// counted at Open and kept up to date by Store; only when it goes over maxBytes does Evict
+// list the directory and delete the least recently used files, down to 90% of maxBytes
+// so that a full cache is not listed again on the next store.
+namespace analysis_cache_detail {
+	const char* const DecoderVersion = "minimp3 float 1";
+	const uint32_t PcmMagic = 0x4d435047u;		// "GPCM"
+	const uint32_t AnalysisMagic = 0x4e415347u;	// "GSAN"
+
+	inline uint64_t Rotate(uint64_t x, int bits) {
+		return (x << bits) | (x >> (64 - bits));
+	}
+	inline uint64_t Load64(const uint8_t* p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	inline uint32_t Load32(const uint8_t* p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// XXH64 (little endian hosts)
+	inline uint64_t XXH64(const void* data, size_t size, uint64_t seed = 0) {
+		const uint64_t P1 = 11400714785074694791ull, P2 = 14029467366897019727ull, P3 = 1609587929392839161ull;
+		const uint64_t P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+		auto round = [&](uint64_t acc, uint64_t input) {
+			return Rotate(acc + input * P2, 31) * P1;
+		};
+		auto merge = [&](uint64_t acc, uint64_t v) {
+			return (acc ^ round(0, v)) * P1 + P4;
+		};
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		const uint8_t* end = p + size;
+		uint64_t h;
+		if (size >= 32) {
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32) {
+				v1 = round(v1, Load64(p));
+				v2 = round(v2, Load64(p + 8));
+				v3 = round(v3, Load64(p + 16));
+				v4 = round(v4, Load64(p + 24));
+			}
+			h = Rotate(v1, 1) + Rotate(v2, 7) + Rotate(v3, 12) + Rotate(v4, 18);
+			h = merge(h, v1);
+			h = merge(h, v2);
+			h = merge(h, v3);
+			h = merge(h, v4);
+		}
+		else {
+			h = seed + P5;
+		}
+		h += (uint64_t)size;
+		for (; p + 8 <= end; p += 8) {
+			h = Rotate(h ^ round(0, Load64(p)), 27) * P1 + P4;
+		}
+		if (p + 4 <= end) {
+			h = Rotate(h ^ (Load32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; p++) {
+			h = Rotate(h ^ (*p * P5), 11) * P1;
+		}
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	struct FileEntry {
+		std::string path;
+		uint64_t bytes;
+		int64_t used;	// modification time
+	};
+
+	inline std::vector<FileEntry> ListFiles(const std::string& directory) {
+		std::vector<FileEntry> files;
+#ifdef _WIN32
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE) {
+			return files;
+		}
+		do {
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				const uint64_t bytes = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+				const int64_t used = (int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+				files.push_back({ directory + "/" + data.cFileName, bytes, used });
+			}
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR* dir = opendir(directory.c_str());
+		if (!dir) {
+			return files;
+		}
+		while (const dirent* entry = readdir(dir)) {
+			const std::string path = directory + "/" + entry->d_name;
+			struct stat st;
+			if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+				files.push_back({ path, (uint64_t)st.st_size, (int64_t)st.st_mtime });
+			}
+		}
+		closedir(dir);
+#endif
+		return files;
+	}
+
+	inline bool IsFile(const std::string& path) {
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+	}
+
+	// 0 when there is no such file
+	inline uint64_t FileBytes(const std::string& path) {
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG ? (uint64_t)st.st_size : 0;
+	}
+}
+
+// Decoded PCM from the cache, mapped rather than read: GetBuffer points into the mapping.
+class CachedAudio : public PCMAudio {
+public:
+	bool Open(const std::string& path) {
+		using namespace analysis_cache_detail;
+		file.Close();
+		buffer = nullptr;
+		if (!file.Open(path) || file.GetSize() < 32) {
+			return false;
+		}
+		uint32_t header[8];
+		memcpy(header, file.GetData(), sizeof(header));
+		const uint64_t samples = header[5];
+		if (header[0] != PcmMagic || header[1] != 1 || header[2] == 0 || samples > INT32_MAX ||
+			file.GetSize() != sizeof(header) + samples * sizeof(float)) {
+			file.Close();
+			return false;
+		}
+		// the header keeps the samples 4 byte aligned; nothing writes through the buffer
+		Initialize((float*)(file.GetData() + sizeof(header)), (int)header[2], (int)header[4], (int)header[3], (int)samples);
+		return true;
+	}
+	bool IsValid() override {
+		return file.IsOpen();
+	}
+private:
+	MappedFile file;
+};
+
+class AnalysisCache {
+public:
+	// an empty directory turns the cache off
+	void Open(const std::string& directory, uint64_t maxBytes = (uint64_t)4 << 30) {
+		this->directory = directory;
+		this->maxBytes = maxBytes;
+		if (!directory.empty()) {
+#ifdef _WIN32
+			_mkdir(directory.c_str());
+#else
+			mkdir(directory.c_str(), 0755);
+#endif
+		}
+		Evict();
+	}
+	bool IsEnabled() const { return !directory.empty(); }
+
+	// Key of the contents of filename, empty when it can not be read.
+	static std::string GetKey(const std::string& filename) {
+		using namespace analysis_cache_detail;
+		MappedFile file;
+		if (!file.Open(filename)) {
+			return std::string();
+		}
+		const uint64_t seed = XXH64(DecoderVersion, strlen(DecoderVersion));
+		char key[32];
+		snprintf(key, sizeof(key), "%016llx", (unsigned long long)XXH64(file.GetData(), file.GetSize(), seed));
+		return key;
+	}
+
+	// kind names what is stored, including any settings it depends on
+	std::string GetPath(const std::string& key, const std::string& kind) const {
+		return directory + "/" + key + "." + kind;
+	}
+
+	// Whether path is in the cache; a hit counts as a use for the eviction order.
+	bool Touch(const std::string& path) const {
+		if (!IsEnabled() || !analysis_cache_detail::IsFile(path)) {
+			return false;
+		}
+#ifdef _WIN32
+		_utime(path.c_str(), nullptr);
+#else
+		utime(path.c_str(), nullptr);
+#endif
+		return true;
+	}
+
+	// Calls write with a temporary path and moves what it wrote to path when it returns
+	// true, then evicts. Returns whether path was stored.
+	bool Store(const std::string& path, const std::function<bool(const std::string&)>& write) {
+		if (!IsEnabled()) {
+			return false;
+		}
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+		const std::string temporary = path + suffix;
+		bool ok = false;
+		try {
+			ok = write(temporary);
+		}
+		catch (const std::exception&) {
+			ok = false;
+		}
+		if (!ok) {
+			remove(temporary.c_str());
+			return false;
+		}
+		const uint64_t stored = analysis_cache_detail::FileBytes(temporary);
+		const uint64_t replaced = analysis_cache_detail::FileBytes(path);
+		remove(path.c_str());
+		if (rename(temporary.c_str(), path.c_str()) != 0) {
+			remove(temporary.c_str());
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		bytes = std::max(bytes + stored, replaced) - replaced;
+		if (bytes > maxBytes) {
+			EvictLocked();
+		}
+		return true;
+	}
+
+	// Recounts the cache and deletes the least recently used files until it fits in 90%
+	// of maxBytes. Files that are in use can not be deleted on Windows and are skipped.
+	void Evict() {
+		if (!IsEnabled()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		EvictLocked();
+	}
+
+	// LoadAudioFile through the cache: decoded PCM is stored once and mapped afterwards.
+	// Sources that are mapped already (MappedAudio) are not copied.
+	// key is computed when not given.
+	std::unique_ptr<PCMAudio> LoadAudio(const std::string& filename, int threads = 1, std::string key = std::string()) {
+		using namespace analysis_cache_detail;
+		if (IsEnabled() && key.empty()) {
+			key = GetKey(filename);
+		}
+		if (!IsEnabled() || key.empty()) {
+			return LoadAudioFile(filename, threads);
+		}
+		const std::string path = GetPath(key, "pcm");
+		std::unique_ptr<CachedAudio> cached(new CachedAudio());
+		if (cached->Open(path)) {
+			Touch(path);
+			return std::move(cached);
+		}
+		std::unique_ptr<PCMAudio> audio = LoadAudioFile(filename, threads);
+		if (audio->GetBuffer()) {
+			PCMAudio& source = *audio;
+			Store(path, [&](const std::string& temporary) {
+				FILE* fp = fopen(temporary.c_str(), "wb");
+				if (!fp) {
+					return false;
+				}
+				const uint32_t header[8] = { PcmMagic, 1u, (uint32_t)source.GetChannels(), (uint32_t)source.GetSampleRate(),
+					(uint32_t)source.GetBitDepth(), (uint32_t)source.GetSamples(), 0u, 0u };
+				bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+				ok = ok && fwrite(source.GetBuffer(), sizeof(float), (size_t)source.GetSamples(), fp) == (size_t)source.GetSamples();
+				return fclose(fp) == 0 && ok;
+			});
+		}
+		return audio;
+	}
+
+private:
+	void EvictLocked() {
+		using namespace analysis_cache_detail;
+		std::vector<FileEntry> files = ListFiles(directory);
+		bytes = 0;
+		for (const auto& f : files) {
+			bytes += f.bytes;
+		}
+		if (bytes <= maxBytes) {
+			return;
+		}
+		const uint64_t target = maxBytes / 10 * 9;
+		std::sort(files.begin(), files.end(), [](const FileEntry& a, const FileEntry& b) { return a.used < b.used; });
+		for (size_t i = 0; i < files.size() && bytes > target; i++) {
+			if (remove(files[i].path.c_str()) == 0) {
+				bytes -= files[i].bytes;
+			}
+		}
+	}
+
+	std::string directory;
+	uint64_t maxBytes = 0;
+	uint64_t bytes = 0;		// running total of the directory, recounted by Evict
+	std::mutex mutex;
+};
+
+// AudioAnalysis without its spectrogram, for AnalysisCache entries.
+inline bool SaveAnalysis(const std::string& path, const AudioAnalysis& a) {
+	using namespace analysis_cache_detail;
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	const uint32_t header[6] = { AnalysisMagic, 1u, (uint32_t)a.channels, (uint32_t)a.sampleRate, (uint32_t)a.bins, (uint32_t)a.spectralPeaks.size() };
+	const int64_t frames = a.frames;
+	const double loudness[3] = { a.integratedLoudness, a.maxMomentaryLoudness, a.loudnessRange };
+	const uint64_t sizes[2] = { (uint64_t)a.fftSize, (uint64_t)a.hop };
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(&frames, sizeof(frames), 1, fp) == 1 &&
+		fwrite(loudness, sizeof(loudness), 1, fp) == 1 && fwrite(sizes, sizeof(sizes), 1, fp) == 1 &&
+		fwrite(a.peak.data(), sizeof(float), a.peak.size(), fp) == a.peak.size() &&
+		fwrite(a.rms.data(), sizeof(float), a.rms.size(), fp) == a.rms.size();
+	for (const SpectralPeak& p : a.spectralPeaks) {
+		ok = ok && fwrite(&p, sizeof(p), 1, fp) == 1;
+	}
+	return fclose(fp) == 0 && ok;
+}
+
+inline bool LoadAnalysis(const std::string& path, AudioAnalysis& a) {
+	using namespace analysis_cache_detail;
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return false;
+	}
+	uint32_t header[6];
+	double loudness[3];
+	uint64_t sizes[2];
+	AudioAnalysis result;
+	bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == AnalysisMagic && header[1] == 1u &&
+		header[2] > 0 && header[2] < 1024 && header[5] < (1u << 20) &&
+		fread(&result.frames, sizeof(result.frames), 1, fp) == 1 && fread(loudness, sizeof(loudness), 1, fp) == 1 &&
+		fread(sizes, sizeof(sizes), 1, fp) == 1;
+	if (ok) {
+		result.channels = (int)header[2];
+		result.sampleRate = (int)header[3];
+		result.bins = header[4];
+		result.integratedLoudness = loudness[0];
+		result.maxMomentaryLoudness = loudness[1];
+		result.loudnessRange = loudness[2];
+		result.fftSize = (size_t)sizes[0];
+		result.hop = (size_t)sizes[1];
+		result.peak.resize(result.channels);
+		result.rms.resize(result.channels);
+		result.spectralPeaks.resize(header[5]);
+		ok = fread(result.peak.data(), sizeof(float), result.peak.size(), fp) == result.peak.size() &&
+			fread(result.rms.data(), sizeof(float), result.rms.size(), fp) == result.rms.size() &&
+			(result.spectralPeaks.empty() || fread(result.spectralPeaks.data(), sizeof(SpectralPeak), result.spectralPeaks.size(), fp) == result.spectralPeaks.size());
+	}
+	fclose(fp);
+	if (ok) {
+		a = std::move(result);
+	}
+	return ok;
+}
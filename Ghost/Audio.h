@@ -1,5 +1,4 @@
 #pragma once
-#pragma comment(lib, "winmm")
 
 #define MINIMP3_IMPLEMENTATION
 #define MINIMP3_FLOAT_OUTPUT
@@ -9,8 +8,25 @@
 #include <map>
 #include <random>
 #include <exception>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <stdexcept>
 #include "minimp3_ex.h"
+#include "MP3Parallel.h"
 #include "AudioFile.h"
+#include "AudioBuffer.h"
+#include "AudioOutput.h"
+#include "SampleConvert.h"
+#include "SampleQueue.h"
+#include "MappedAudioFile.h"
+#include "WaveWriter.h"
 
 #define A_PI 3.14159265358979323846
 
@@ -18,17 +34,32 @@
 class PCMAudio {
 public:
 	PCMAudio() {}
+	virtual ~PCMAudio() {}
 	float* GetBuffer() const { return this->buffer; }
 	int GetChannels() const { return this->channels; }
 	int GetBitDepth() const { return this->bitDepth; }
 	int GetSampleRate() const { return this->sampleRate; }
 	int GetSamples() const { return this->samples; }
+	// the whole buffer as frames, empty for sources that have no buffer
+	InterleavedView<const float> GetView() const {
+		return InterleavedView<const float>(buffer, channels, buffer ? (size_t)(samples / channels) : 0);
+	}
 	int GetIntSampleAt(int index) const {
 		return (int)(buffer[index] * (float)((1 << bitDepth) / 2 - 1));
 	}
-	bool IsValid() {
+	virtual bool IsValid() {
 		return this->buffer != nullptr;
 	}
+	// position/count are interleaved sample indices (same unit as GetSamples)
+	// returns the number of samples written to dst
+	virtual int Read(float* dst, int position, int count) {
+		if (!IsValid() || position < 0 || position >= samples) {
+			return 0;
+		}
+		int n = std::min(count, samples - position);
+		memcpy(dst, buffer + position, n * sizeof(float));
+		return n;
+	}
 protected:
 	void Initialize(float* buffer, int channels, int bitDepth, int sampleRate, int samples) {
 		this->buffer = buffer;
@@ -50,10 +81,14 @@ public:
 	~MP3Audio() {
 		free(buffer);
 	}
-	void LoadFromFile(std::string filename) {
+	// threads != 1 decodes chunks of the file in parallel (0 = all cores)
+	void LoadFromFile(std::string filename, int threads = 1) {
 		mp3dec_t mp3d;
 		mp3dec_file_info_t info;
-		if (mp3dec_load(&mp3d, filename.c_str(), &info, NULL, NULL))
+		int error = threads == 1 ?
+			mp3dec_load(&mp3d, filename.c_str(), &info, NULL, NULL) :
+			LoadMP3Parallel(filename, &info, threads);
+		if (error)
 		{
 			throw std::runtime_error("mp3 failed to load");
 		}
@@ -62,247 +97,348 @@ public:
 private:
 };
 
-class SinAudio : public PCMAudio {
+// WAV or AIFF (8, 16 or 24 bit) through AudioFile. AudioFile decodes into an interleaved
+// buffer already, which is taken over as is.
+class WaveAudio : public PCMAudio {
 public:
-	SinAudio() {}
-	~SinAudio() {
-		delete buffer;
-	}
-	void Create(float hz) {
-		int samples = 44100 * 10;
-		float *buf = new float[samples];
-		for (int i = 0; i < samples; i++) {
-			buf[i] = sinf(hz * (i / 44100.0) * A_PI * 2.0);
+	WaveAudio() {}
+	void LoadFromFile(std::string filename) {
+		AudioFile<float> file;
+		if (!file.load(filename) || file.getNumChannels() == 0) {
+			throw std::runtime_error("wave failed to load");
 		}
-		Initialize(buf, 1, 16, 44100, samples);
+		data = std::move(file.samples);
+		// an empty vector may have no storage, buffer must not be null for a loaded file
+		data.Reserve(1);
+		Initialize(data.Data(), data.GetChannels(), file.getBitDepth(), (int)file.getSampleRate(), (int)(data.GetFrames() * data.GetChannels()));
 	}
 private:
+	InterleavedBuffer<float> data;
 };
 
-class NokogiriAudio : public PCMAudio {
+// WAV or AIFF read straight from a memory mapping: nothing is loaded up front and Read
+// converts only the requested block, so GetBuffer() is null.
+class MappedAudio : public PCMAudio {
 public:
-	NokogiriAudio() {}
-	~NokogiriAudio() {
-		delete buffer;
-	}
-	void Create(float hz) {
-		double rate = 44100.0;
-		int samples = (int)(rate) * 1;
-		float* buf = new float[samples];
-		for (int i = 0; i < samples; i++) {
-			double t = i / rate;
-			buf[i] = fmod(t * hz, 1.0) * 2.0 - 1.0;
-			//buf[i] = sinf(440.0 * t * A_PI * 2.0);
-			//buf[i] = sin(2 * A_PI * 400 * t);
-			//buf[i] = sin(2 * A_PI * 400 * t) + 2 * sin(2 * A_PI * 800 * t) + 2 * sin(2 * A_PI * 1280 * t);
+	void LoadFromFile(std::string filename) {
+		file.Open(filename);
+		const int64_t samples = file.GetFrames() * file.GetChannels();
+		if (samples > INT32_MAX) {
+			file.Close();
+			throw std::runtime_error("wave too long");
 		}
-		Initialize(buf, 1, 16, (int)rate, samples);
+		Initialize(nullptr, file.GetChannels(), file.GetBitDepth(), file.GetSampleRate(), (int)samples);
+	}
+	bool IsValid() override {
+		return file.IsOpen();
+	}
+	int Read(float* dst, int position, int count) override {
+		return (int)file.Read(dst, position, count);
 	}
+	const MappedAudioFile& GetFile() const { return file; }
 private:
+	MappedAudioFile file;
 };
 
-class NoiseAudio : public PCMAudio {
-public:
-	NoiseAudio() {}
-	~NoiseAudio() {
-		delete buffer;
-	}
-	void Create(float hz) {
-		double rate = 44100.0;
-		int samples = (int)(rate) * 10;
-
-		std::random_device rd;
-		std::mt19937 mt(rd());
-		std::uniform_real_distribution<double> score(-1.0, 1.0);
-
-		float* buf = new float[samples];
-		for (int i = 0; i < samples; i++) {
-			double t = i / rate;
-			buf[i] = hash11(floor(t * 440.0f));
-			//buf[i] = hardRain(t);
-			//buf[i] = sin(t * 10000.0f);
-		}
-		Initialize(buf, 1, 16, (int)rate, samples);
+// Picks the loader by extension: .mp3 through MP3Audio, anything else through a mapping,
+// falling back to WaveAudio for what MappedAudio can not read.
+inline std::unique_ptr<PCMAudio> LoadAudioFile(std::string filename, int threads = 1) {
+	std::string extension = filename.substr(std::min(filename.find_last_of('.'), filename.size()));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	if (extension == ".mp3") {
+		std::unique_ptr<MP3Audio> audio(new MP3Audio());
+		audio->LoadFromFile(filename, threads);
+		return std::move(audio);
 	}
-private:
-	float hash11(float p)
-	{
-		p = fmodf(p * 0.1031f, 1.0f);
-		p *= p + 33.33;
-		p *= p + p;
-		return fmodf(p, 1.0f) * 2.0 - 1.0;
+	try {
+		std::unique_ptr<MappedAudio> audio(new MappedAudio());
+		audio->LoadFromFile(filename);
+		return std::move(audio);
 	}
-	float hardRain(float t) {
-		float g = fmodf(sin(t * 10000.0) * 10000.0, 1.0f) + 6.0;
-		return exp(-0.08 * g * g) * 40.0 - 1.0;
+	catch (const std::runtime_error&) {
+		std::unique_ptr<WaveAudio> audio(new WaveAudio());
+		audio->LoadFromFile(filename);
+		return std::move(audio);
 	}
-};
+}
 
+// Plays a PCMAudio through an AudioSink.
+// A render thread pulls the source through Read() into bufferCount buffers of
+// bufferFrames frames each, so memory does not depend on the length of the source, and
+// the loop point is stitched inside a buffer, so looping is gapless.
+// The defaults keep about 17 ms in flight at 44.1 kHz.
 class PCMAudioPlayer {
 public:
-	PCMAudioPlayer() {}
+	PCMAudioPlayer(AudioSink* sink = CreateDefaultAudioSink(), int bufferFrames = 256, int bufferCount = 3)
+		: sink(sink), bufferFrames(bufferFrames), bufferCount(bufferCount) {}
 	~PCMAudioPlayer() {
 		Close();
 	}
 
-	void SetAudio(PCMAudio const& audio) {
-		Close();
-		samples = audio.GetSamples();
-		wfe.wFormatTag = WAVE_FORMAT_PCM;
-		wfe.nChannels = audio.GetChannels();								// Channels
-		wfe.wBitsPerSample = audio.GetBitDepth();									// Bit Depth
-		wfe.nBlockAlign = wfe.nChannels * wfe.wBitsPerSample / 8;	// Byte per Minimum Unit
-		wfe.nSamplesPerSec = audio.GetSampleRate();								// Sample Rate
-		wfe.nAvgBytesPerSec = wfe.nSamplesPerSec * wfe.nBlockAlign;	// Byte per One Second
-
-		waveOutOpen(&hWaveOut, WAVE_MAPPER, &wfe, (DWORD)waveOutProc, 0, CALLBACK_FUNCTION);
-		playerMap[hWaveOut] = this;
-
-		switch (wfe.wBitsPerSample)
+	void SetAudio(PCMAudio& audio) {
+		Stop();
+		AudioFormat newFormat = { audio.GetChannels(), audio.GetSampleRate(), audio.GetBitDepth() };
+		// throws for depths the sinks can not take; the render thread is idle after Stop
+		converter.SetBitDepth(newFormat.bitDepth);
+		if (!isOpen || memcmp(&newFormat, &format, sizeof(AudioFormat)) != 0) {
+			sink->Close();
+			isOpen = sink->Open(newFormat, bufferFrames, bufferCount);
+			if (!isOpen) {
+				throw std::runtime_error("audio device failed to open");
+			}
+			format = newFormat;
+		}
 		{
-		case 8:
-			wave = new BYTE[audio.GetSamples()];
-			break;
-		case 16:
-			wave = new short[audio.GetSamples()];
-			break;
-		default:
-			throw std::runtime_error("Not support this bit depth");
-			break;
+			std::lock_guard<std::mutex> lock(mutex);
+			source = &audio;
+			frames = audio.GetSamples() / std::max(audio.GetChannels(), 1);
 		}
-
-		for (unsigned int i = 0; i < audio.GetSamples(); i++) {
-
-			switch (wfe.wBitsPerSample)
-			{
-			case 8:
-				((BYTE*)wave)[i] = (BYTE)(audio.GetIntSampleAt(i));
-				break;
-			case 16:
-				((short*)wave)[i] = (short)(audio.GetIntSampleAt(i));
-				break;
-
-			default:
-				throw std::runtime_error("Not support this bit depth");
-				break;
-			}
+		if (!renderer.joinable()) {
+			isQuit = false;
+			renderer = std::thread(&PCMAudioPlayer::RenderThread, this);
 		}
-
-		whdr.lpData = (LPSTR)wave;
-		whdr.dwBufferLength = audio.GetSamples() * (audio.GetBitDepth()/8);
-		whdr.dwFlags = WHDR_BEGINLOOP | WHDR_ENDLOOP;
-		whdr.dwLoops = 1;
-
-		waveOutPrepareHeader(hWaveOut, &whdr, sizeof(WAVEHDR));
 	}
 
+	// Plays from the beginning, or continues after Pause.
 	void Start() {
-		waveOutWrite(hWaveOut, &whdr, sizeof(WAVEHDR));
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!source) {
+			return;
+		}
+		if (state == State::Paused) {
+			state = State::Playing;
+			lock.unlock();
+			sink->Resume();
+			wake.notify_all();
+			return;
+		}
+		if (state == State::Playing && !IsFinished()) {
+			return;
+		}
+		lock.unlock();
+		Stop();
+		lock.lock();
+		state = State::Playing;
+		lock.unlock();
+		sink->Resume();
+		wake.notify_all();
 	}
 	void Pause() {
-		waveOutPause(hWaveOut);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (state == State::Playing) {
+			state = State::Paused;
+			sink->Pause();
+		}
 	}
 	void Restart() {
-		waveOutRestart(hWaveOut);
+		std::unique_lock<std::mutex> lock(mutex);
+		if (state == State::Paused) {
+			state = State::Playing;
+			lock.unlock();
+			sink->Resume();
+			wake.notify_all();
+		}
 	}
+	// Stops and rewinds to the beginning.
 	void Stop() {
-		isStopping = true;
-		waveOutReset(hWaveOut);
+		std::unique_lock<std::mutex> lock(mutex);
+		state = State::Stopped;
+		generation++;
+		readPosition = 0;
+		queuedFrames = 0;
+		isDrained = false;
+		hasSegment = false;
+		lock.unlock();
+		// wake a Write blocked on a full (or paused) device, let the render thread see the
+		// new generation, then drop whatever it queued in the meantime
+		sink->Reset();
+		lock.lock();
+		idle.wait(lock, [&] { return !isRendering; });
+		lock.unlock();
+		sink->Reset();
 	}
 	void Close() {
-		Stop();
-		waveOutUnprepareHeader(hWaveOut, &whdr, sizeof(WAVEHDR));
-		waveOutClose(hWaveOut);
-		playerMap[hWaveOut] = nullptr;
-		isStopping = false;
-		delete wave;
+		if (renderer.joinable()) {
+			Stop();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				isQuit = true;
+			}
+			wake.notify_all();
+			renderer.join();
+		}
+		if (isOpen) {
+			sink->Close();
+			isOpen = false;
+		}
+		source = nullptr;
 	}
+	// Frame of the source that is being heard.
+	// Lock-free; call it from the thread that calls Start/Stop (the UI thread).
 	int GetPosition() {
-		MMTIME mmt;
-		int ms;
-		mmt.wType = TIME_SAMPLES;
-		waveOutGetPosition(hWaveOut, &mmt, sizeof(MMTIME));
-		ms = mmt.u.ms;
-		return ms % std::max(samples / std::max((int)wfe.nChannels, 1), 1);
+		const int64_t played = sink->GetPlayedFrames();
+		const int64_t currentGeneration = generation;
+		Segment next;
+		while (positions.Peek(&next, 1) == 1 && (next.generation != currentGeneration || next.queued <= played)) {
+			positions.Skip(1);
+			if (next.generation == currentGeneration) {
+				segment = next;
+				hasSegment = true;
+			}
+		}
+		if (!hasSegment || segment.generation != currentGeneration || frames == 0) {
+			return 0;
+		}
+		int64_t position = segment.position + std::max<int64_t>(played - segment.queued, 0);
+		if (position >= frames) {
+			position = isLoop ? position % frames : frames - 1;
+		}
+		return (int)position;
 	}
 	void SetLoop(bool loop) {
 		isLoop = loop;
 	}
+	// TPDF dither when quantizing to 8, 16 or 24 bit output
+	void SetDither(bool dither) {
+		isDither = dither;
+	}
+	// Every rendered block is also pushed to tap (dropped when it does not fit), so an
+	// analyzer can follow the output without reading the source from another thread.
+	void SetTap(SampleQueue<float>* tap) {
+		this->tap = tap;
+	}
+	bool IsPlaying() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return state == State::Playing && !IsFinished();
+	}
 private:
-	WAVEFORMATEX wfe;
-	HWAVEOUT hWaveOut;
-	WAVEHDR whdr;
-	void* wave;
-	int samples;
-	bool isLoop;
-	bool isStopping;
+	enum class State {
+		Stopped,
+		Playing,
+		Paused,
+	};
+	// queued: first frame of the segment in the sink, position: first source frame
+	struct Segment {
+		int64_t queued;
+		int64_t position;
+		int64_t generation;
+	};
 
-	static std::map<HWAVEOUT, PCMAudioPlayer*> playerMap;
+	bool IsFinished() {
+		return isDrained && sink->GetPlayedFrames() >= queuedFrames;
+	}
 
-	static 	void CALLBACK waveOutProc(
-		HWAVEOUT hwo,
-		UINT uMsg,
-		DWORD dwInstance,
-		DWORD dwParam1,
-		DWORD dwParam2
-	)
-	{
-		switch (uMsg)
-		{
-		case WOM_OPEN:
-			printf("waveOutOpen\n");
-			break;
-		case WOM_CLOSE:
-			printf("waveOutClose\n");
-			break;
-		case WOM_DONE:
-			printf("End\n");
-			
-			// FIXME:
-			// ǂR[obNAPI𗘗pƃt[Y邱Ƃ炵iۂɂj
-			// [v@\AL[ɕύXKv
-			auto player = playerMap[hwo];
-			if (player->isStopping) {
-				player->isStopping = false;
+	void RenderThread() {
+		std::vector<float> block;
+		std::vector<Segment> filled;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&] { return isQuit || (state != State::Stopped && !isDrained); });
+			if (isQuit) {
+				break;
 			}
-			else {
-				if (player->isLoop) {
-					player->Start();
+			const int64_t renderGeneration = generation;
+			const int channels = format.channels;
+			int64_t position = readPosition;
+			int64_t queued = queuedFrames;
+			isRendering = true;
+			lock.unlock();
+
+			block.resize((size_t)bufferFrames * channels);
+			filled.clear();
+			bool isEnd = false;
+			int count = 0;
+			while (count < bufferFrames) {
+				if (position >= frames) {
+					if (!isLoop || frames == 0) {
+						isEnd = true;
+						break;
+					}
+					position = 0;
+				}
+				int n = source->Read(&block[(size_t)count * channels], (int)(position * channels), (bufferFrames - count) * channels) / channels;
+				if (n <= 0) {
+					isEnd = true;
+					break;
 				}
+				filled.push_back({ queued + count, position, renderGeneration });
+				count += n;
+				position += n;
 			}
-			break;
+			std::fill(block.begin() + (size_t)count * channels, block.end(), 0.0f);
+			converter.SetDither(isDither);
+			// a short last buffer still goes out whole, the tail is silence
+			bool isWritten = count > 0 && sink->WriteSamples(block.data(), bufferFrames, channels, converter);
+			SampleQueue<float>* analyzer = tap;
+			if (isWritten && analyzer && analyzer->Space() >= (size_t)count * channels) {
+				analyzer->Push(block.data(), (size_t)count * channels);
+			}
+
+			lock.lock();
+			isRendering = false;
+			idle.notify_all();
+			if (renderGeneration != generation) {
+				continue;
+			}
+			if (isWritten) {
+				for (const Segment& s : filled) {
+					positions.Push(s);
+				}
+				readPosition = position;
+				queuedFrames = queued + count;
+			}
+			isDrained = isEnd;
 		}
 	}
-};
-std::map<HWAVEOUT, PCMAudioPlayer*> PCMAudioPlayer::playerMap;
-
-void SaveAudioToWaveFile(PCMAudio const& audio, std::string filename) {
-	AudioFile<double> audioFile;
-	AudioFile<double>::AudioBuffer buffer;
 
-	int numChannels = audio.GetChannels();
-	int numSamplesPerChannel = audio.GetSamples() / numChannels;
-	float sampleRate = (float)audio.GetSampleRate();
-
-	buffer.resize(numChannels);
+	std::unique_ptr<AudioSink> sink;
+	AudioFormat format = {};
+	int bufferFrames;
+	int bufferCount;
+	PCMAudio* source = nullptr;
+	int frames = 0;
+	std::thread renderer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	SampleQueue<Segment> positions{ 1024 };	// render thread -> GetPosition, maps sink frames to source frames
+	Segment segment = {};					// segment being heard, owned by GetPosition
+	bool hasSegment = false;
+	std::atomic<SampleQueue<float>*> tap{ nullptr };
+	SampleConverter converter;		// render thread, bit depth set by SetAudio
+	std::atomic<bool> isDither{ false };
+	State state = State::Stopped;
+	std::atomic<int64_t> generation{ 0 };	// bumped by Stop, buffers rendered before it are dropped
+	int64_t readPosition = 0;		// next source frame to render
+	int64_t queuedFrames = 0;		// frames written to the sink since the last Reset
+	std::atomic<bool> isLoop{ false };
+	bool isOpen = false;
+	bool isRendering = false;
+	bool isDrained = false;		// the last buffer of a non looping source is queued
+	bool isQuit = false;
+};
 
-	buffer[0].resize(numSamplesPerChannel);
 
-	if (numChannels == 2) {
-		buffer[1].resize(numSamplesPerChannel);
-	}
-
-	for (int i = 0; i < numSamplesPerChannel; i++)
-	{
-		for (int channel = 0; channel < numChannels; channel++)
-		{
-			buffer[channel][i] = audio.GetBuffer()[i * numChannels + channel];
+// Streams the source through Read into a WAV file at its bit depth (32 bit is written
+// as IEEE float), so memory does not depend on the length of the source.
+void SaveAudioToWaveFile(PCMAudio& audio, std::string filename) {
+	const int channels = std::max(audio.GetChannels(), 1);
+	const int frames = audio.GetSamples() / channels;
+	const int bitDepth = audio.GetBitDepth();
+	WaveWriter writer;
+	writer.Open(filename, channels, audio.GetSampleRate(), bitDepth, bitDepth == 32);
+	const int blockFrames = 1 << 14;
+	std::vector<float> block((size_t)blockFrames * channels);
+	bool isWritten = true;
+	for (int position = 0; position < frames && isWritten; ) {
+		const int n = audio.Read(block.data(), position * channels, std::min(blockFrames, frames - position) * channels) / channels;
+		if (n <= 0) {
+			break;
 		}
+		isWritten = writer.Write(block.data(), n);
+		position += n;
+	}
+	if (!writer.Close() || !isWritten) {
+		throw std::runtime_error("wave failed to save");
 	}
-
-	audioFile.setAudioBuffer(buffer);
-
-	audioFile.setBitDepth(audio.GetBitDepth());
-	audioFile.setSampleRate(audio.GetSampleRate());
-	audioFile.save(filename.c_str());
 }
\ No newline at end of file
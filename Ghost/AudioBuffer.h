@@ -0,0 +1,244 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_BUFFER_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Interleaved audio in one contiguous allocation, the layout PCMAudio and the output
+// devices use, with views that give planar style access without copying:
+//
+//   buffer.Frame(i)[c]     sample c of frame i
+//   buffer[c][i]           the same through a StridedView of channel c
+//
+// Interleave/Deinterleave convert to and from separate channel arrays where an API
+// needs them, with SSE2 kernels for stereo.
+
+// One channel of interleaved data: every stride-th element starting at data.
+template <class T>
+class StridedView {
+public:
+	class iterator {
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef T* pointer;
+		typedef T& reference;
+
+		iterator() {}
+		iterator(T* data, std::ptrdiff_t stride, std::ptrdiff_t index) : data(data), stride(stride), index(index) {}
+		T& operator*() const { return data[index * stride]; }
+		T* operator->() const { return &data[index * stride]; }
+		T& operator[](std::ptrdiff_t n) const { return data[(index + n) * stride]; }
+		iterator& operator++() { index++; return *this; }
+		iterator operator++(int) { iterator t = *this; index++; return t; }
+		iterator& operator--() { index--; return *this; }
+		iterator operator--(int) { iterator t = *this; index--; return t; }
+		iterator& operator+=(std::ptrdiff_t n) { index += n; return *this; }
+		iterator& operator-=(std::ptrdiff_t n) { index -= n; return *this; }
+		iterator operator+(std::ptrdiff_t n) const { return iterator(data, stride, index + n); }
+		iterator operator-(std::ptrdiff_t n) const { return iterator(data, stride, index - n); }
+		friend iterator operator+(std::ptrdiff_t n, const iterator& it) { return it + n; }
+		std::ptrdiff_t operator-(const iterator& other) const { return index - other.index; }
+		bool operator==(const iterator& other) const { return index == other.index; }
+		bool operator!=(const iterator& other) const { return index != other.index; }
+		bool operator<(const iterator& other) const { return index < other.index; }
+		bool operator>(const iterator& other) const { return index > other.index; }
+		bool operator<=(const iterator& other) const { return index <= other.index; }
+		bool operator>=(const iterator& other) const { return index >= other.index; }
+	private:
+		T* data = nullptr;
+		std::ptrdiff_t stride = 1;
+		std::ptrdiff_t index = 0;
+	};
+
+	StridedView(T* data, size_t count, size_t stride) : data(data), count(count), stride(stride) {}
+	T& operator[](size_t index) const { return data[index * stride]; }
+	size_t size() const { return count; }
+	size_t GetStride() const { return stride; }
+	// iterators keep an index and only form the address of an element they dereference,
+	// so end() of a channel other than the first never points past the buffer
+	iterator begin() const { return iterator(data, (std::ptrdiff_t)stride, 0); }
+	iterator end() const { return iterator(data, (std::ptrdiff_t)stride, (std::ptrdiff_t)count); }
+	void Fill(T value) const {
+		for (size_t i = 0; i < count; i++) {
+			data[i * stride] = value;
+		}
+	}
+private:
+	T* data;
+	size_t count;
+	size_t stride;
+};
+
+// Non-owning view of interleaved frames.
+template <class T>
+class InterleavedView {
+public:
+	InterleavedView(T* data, int channels, size_t frames) : data(data), channels(channels), frames(frames) {}
+	T* Data() const { return data; }
+	int GetChannels() const { return channels; }
+	size_t GetFrames() const { return frames; }
+	T* Frame(size_t index) const { return data + index * channels; }
+	StridedView<T> Channel(int channel) const { return StridedView<T>(data + channel, frames, (size_t)channels); }
+	StridedView<T> operator[](int channel) const { return Channel(channel); }
+private:
+	T* data;
+	int channels;
+	size_t frames;
+};
+
+namespace audio_buffer_detail {
+	template <class T>
+	void Interleave(const T* const* planes, int channels, size_t frames, T* out) {
+		for (int c = 0; c < channels; c++) {
+			const T* in = planes[c];
+			for (size_t i = 0; i < frames; i++) {
+				out[i * channels + c] = in[i];
+			}
+		}
+	}
+	template <class T>
+	void Deinterleave(const T* in, int channels, size_t frames, T* const* planes) {
+		for (int c = 0; c < channels; c++) {
+			T* out = planes[c];
+			for (size_t i = 0; i < frames; i++) {
+				out[i] = in[i * channels + c];
+			}
+		}
+	}
+}
+
+// planes[c] holds frames samples of channel c; out gets frames * channels samples
+template <class T>
+void Interleave(const T* const* planes, int channels, size_t frames, T* out) {
+	audio_buffer_detail::Interleave(planes, channels, frames, out);
+}
+template <class T>
+void Deinterleave(const T* in, int channels, size_t frames, T* const* planes) {
+	audio_buffer_detail::Deinterleave(in, channels, frames, planes);
+}
+
+#if AUDIO_BUFFER_HAVE_SSE2
+template <>
+inline void Interleave<float>(const float* const* planes, int channels, size_t frames, float* out) {
+	if (channels == 1) {
+		memcpy(out, planes[0], frames * sizeof(float));
+		return;
+	}
+	if (channels != 2) {
+		audio_buffer_detail::Interleave(planes, channels, frames, out);
+		return;
+	}
+	const float* l = planes[0];
+	const float* r = planes[1];
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		const __m128 a = _mm_loadu_ps(l + i);
+		const __m128 b = _mm_loadu_ps(r + i);
+		_mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(a, b));
+		_mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(a, b));
+	}
+	for (; i < frames; i++) {
+		out[i * 2] = l[i];
+		out[i * 2 + 1] = r[i];
+	}
+}
+template <>
+inline void Deinterleave<float>(const float* in, int channels, size_t frames, float* const* planes) {
+	if (channels == 1) {
+		memcpy(planes[0], in, frames * sizeof(float));
+		return;
+	}
+	if (channels != 2) {
+		audio_buffer_detail::Deinterleave(in, channels, frames, planes);
+		return;
+	}
+	float* l = planes[0];
+	float* r = planes[1];
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		const __m128 a = _mm_loadu_ps(in + i * 2);		// l0 r0 l1 r1
+		const __m128 b = _mm_loadu_ps(in + i * 2 + 4);	// l2 r2 l3 r3
+		_mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	for (; i < frames; i++) {
+		l[i] = in[i * 2];
+		r[i] = in[i * 2 + 1];
+	}
+}
+#endif
+
+// Owning interleaved buffer.
+template <class T>
+class InterleavedBuffer {
+public:
+	InterleavedBuffer() {}
+	InterleavedBuffer(int channels, size_t frames) {
+		Resize(channels, frames);
+	}
+
+	int GetChannels() const { return channels; }
+	size_t GetFrames() const { return frames; }
+	T* Data() { return data.data(); }
+	const T* Data() const { return data.data(); }
+	T* Frame(size_t index) { return data.data() + index * channels; }
+	const T* Frame(size_t index) const { return data.data() + index * channels; }
+	StridedView<T> Channel(int channel) { return View().Channel(channel); }
+	StridedView<const T> Channel(int channel) const { return View().Channel(channel); }
+	StridedView<T> operator[](int channel) { return Channel(channel); }
+	StridedView<const T> operator[](int channel) const { return Channel(channel); }
+	InterleavedView<T> View() { return InterleavedView<T>(data.data(), channels, frames); }
+	InterleavedView<const T> View() const { return InterleavedView<const T>(data.data(), channels, frames); }
+
+	// Keeps the samples of the frames and channels that remain, new ones are zero.
+	void Resize(int newChannels, size_t newFrames) {
+		newChannels = std::max(newChannels, 0);
+		if (newChannels == channels) {
+			data.resize((size_t)newChannels * newFrames, (T)0);
+		}
+		else {
+			std::vector<T> resized((size_t)newChannels * newFrames, (T)0);
+			const int keepChannels = std::min(channels, newChannels);
+			const size_t keepFrames = std::min(frames, newFrames);
+			for (size_t i = 0; i < keepFrames; i++) {
+				std::copy(&data[i * channels], &data[i * channels] + keepChannels, &resized[i * newChannels]);
+			}
+			data.swap(resized);
+		}
+		channels = newChannels;
+		frames = newFrames;
+	}
+	// capacity in samples, for frames appended with Resize later
+	void Reserve(size_t samples) {
+		data.reserve(samples);
+	}
+	void Clear() {
+		data.clear();
+		data.shrink_to_fit();
+		channels = 0;
+		frames = 0;
+	}
+
+	void CopyFromPlanar(const T* const* planes, int channels, size_t frames) {
+		this->channels = channels;
+		this->frames = frames;
+		data.resize((size_t)channels * frames);
+		Interleave(planes, channels, frames, data.data());
+	}
+	void CopyToPlanar(T* const* planes) const {
+		Deinterleave(data.data(), channels, frames, planes);
+	}
+
+private:
+	std::vector<T> data;
+	int channels = 0;
+	size_t frames = 0;
+};
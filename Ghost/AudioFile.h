@@ -31,6 +31,7 @@
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
+#include "AudioBuffer.h"
 
 //=============================================================
 /** The different types of audio file, plus some other types to 
@@ -52,7 +53,8 @@ class AudioFile
 public:
     
     //=============================================================
-    typedef std::vector<std::vector<T> > AudioBuffer;
+    typedef InterleavedBuffer<T> AudioBuffer;
+    typedef std::vector<std::vector<T> > PlanarBuffer;
     
     //=============================================================
     /** Constructor */
@@ -101,6 +103,11 @@ public:
      */
     bool setAudioBuffer (AudioBuffer& newBuffer);
     
+    /** Set the audio buffer from separate channel vectors, interleaving them into this AudioFile.
+     * @Returns true if the buffer was copied successfully
+     */
+    bool setAudioBuffer (PlanarBuffer& newBuffer);
+    
     /** Sets the audio buffer to a given number of channels and number of samples per channel. This will try to preserve
      * the existing audio, adding zeros to any new channels or new samples in a given channel.
      */
@@ -121,10 +128,12 @@ public:
     void setSampleRate (uint32_t newSampleRate);
     
     //=============================================================
-    /** A vector of vectors holding the audio samples for the AudioFile. You can 
+    /** An interleaved buffer holding the audio samples for the AudioFile. You can 
      * access the samples by channel and then by sample index, i.e:
      *
      *      samples[channel][sampleIndex]
+     *
+     * or a whole frame at a time with samples.Frame (sampleIndex)[channel]
      */
     AudioBuffer samples;
     
@@ -216,8 +225,7 @@ AudioFile<T>::AudioFile()
 {
     bitDepth = 16;
     sampleRate = 44100;
-    samples.resize (1);
-    samples[0].resize (0);
+    samples.Resize (1, 0);
     audioFileFormat = AudioFileFormat::NotLoaded;
 }
 
@@ -232,7 +240,7 @@ uint32_t AudioFile<T>::getSampleRate() const
 template <class T>
 int AudioFile<T>::getNumChannels() const
 {
-    return (int)samples.size();
+    return samples.GetChannels();
 }
 
 //=============================================================
@@ -260,10 +268,7 @@ int AudioFile<T>::getBitDepth() const
 template <class T>
 int AudioFile<T>::getNumSamplesPerChannel() const
 {
-    if (samples.size() > 0)
-        return (int) samples[0].size();
-    else
-        return 0;
+    return (int) samples.GetFrames();
 }
 
 //=============================================================
@@ -289,6 +294,21 @@ void AudioFile<T>::printSummary() const
 //=============================================================
 template <class T>
 bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
+{
+    if (newBuffer.GetChannels() <= 0)
+    {
+        assert (false && "The buffer your are trying to use has no channels");
+        return false;
+    }
+    
+    samples = newBuffer;
+    
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::setAudioBuffer (PlanarBuffer& newBuffer)
 {
     int numChannels = (int)newBuffer.size();
     
@@ -298,23 +318,17 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
         return false;
     }
     
-    int numSamples = (int)newBuffer[0].size();
+    size_t numSamples = newBuffer[0].size();
+    std::vector<const T*> channels (numChannels);
     
-    // set the number of channels
-    samples.resize (newBuffer.size());
-    
-    for (int k = 0; k < getNumChannels(); k++)
+    for (int k = 0; k < numChannels; k++)
     {
         assert (newBuffer[k].size() == numSamples);
-        
-        samples[k].resize (numSamples);
-        
-        for (int i = 0; i < numSamples; i++)
-        {
-            samples[k][i] = newBuffer[k][i];
-        }
+        channels[k] = newBuffer[k].data();
     }
     
+    samples.CopyFromPlanar (channels.data(), numChannels, numSamples);
+    
     return true;
 }
 
@@ -322,45 +336,23 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
 template <class T>
 void AudioFile<T>::setAudioBufferSize (int numChannels, int numSamples)
 {
-    samples.resize (numChannels);
-    setNumSamplesPerChannel (numSamples);
+    samples.Resize (numChannels, (size_t)std::max (numSamples, 0));
 }
 
 //=============================================================
 template <class T>
 void AudioFile<T>::setNumSamplesPerChannel (int numSamples)
 {
-    int originalSize = getNumSamplesPerChannel();
-    
-    for (int i = 0; i < getNumChannels();i++)
-    {
-        samples[i].resize (numSamples);
-        
-        // set any new samples to zero
-        if (numSamples > originalSize)
-            std::fill (samples[i].begin() + originalSize, samples[i].end(), (T)0.);
-    }
+    // any new samples are set to zero
+    samples.Resize (getNumChannels(), (size_t)std::max (numSamples, 0));
 }
 
 //=============================================================
 template <class T>
 void AudioFile<T>::setNumChannels (int numChannels)
 {
-    int originalNumChannels = getNumChannels();
-    int originalNumSamplesPerChannel = getNumSamplesPerChannel();
-    
-    samples.resize (numChannels);
-    
-    // make sure any new channels are set to the right size
-    // and filled with zeros
-    if (numChannels > originalNumChannels)
-    {
-        for (int i = originalNumChannels; i < numChannels; i++)
-        {
-            samples[i].resize (originalNumSamplesPerChannel);
-            std::fill (samples[i].begin(), samples[i].end(), (T)0.);
-        }
-    }
+    // any new channels are filled with zeros
+    samples.Resize (numChannels, samples.GetFrames());
 }
 
 //=============================================================
@@ -488,7 +480,7 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     int samplesStartIndex = indexOfDataChunk + 8;
     
     clearAudioBuffer();
-    samples.resize (numChannels);
+    samples.Resize (numChannels, (size_t)std::max (numSamples, 0));
     
     for (int i = 0; i < numSamples; i++)
     {
@@ -499,13 +491,13 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
             if (bitDepth == 8)
             {
                 T sample = singleByteToSample (fileData[sampleIndex]);
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else if (bitDepth == 16)
             {
                 int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex);
                 T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else if (bitDepth == 24)
             {
@@ -516,7 +508,7 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
                     sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
 
                 T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else
             {
@@ -603,7 +595,7 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
     }
     
     clearAudioBuffer();
-    samples.resize (numChannels);
+    samples.Resize (numChannels, (size_t)std::max (numSamplesPerChannel, 0));
     
     for (int i = 0; i < numSamplesPerChannel; i++)
     {
@@ -615,13 +607,13 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
             {
                 int8_t sampleAsSigned8Bit = (int8_t)fileData[sampleIndex];
                 T sample = (T)sampleAsSigned8Bit / (T)128.;
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else if (bitDepth == 16)
             {
                 int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
                 T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else if (bitDepth == 24)
             {
@@ -632,7 +624,7 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
                     sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
                 
                 T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
+                samples.Frame (i)[channel] = sample;
             }
             else
             {
@@ -743,17 +735,17 @@ bool AudioFile<T>::saveToWaveFile (std::string filePath)
         {
             if (bitDepth == 8)
             {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
+                uint8_t byte = sampleToSingleByte (samples.Frame (i)[channel]);
                 fileData.push_back (byte);
             }
             else if (bitDepth == 16)
             {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
+                int16_t sampleAsInt = sampleToSixteenBitInt (samples.Frame (i)[channel]);
                 addInt16ToFileData (fileData, sampleAsInt);
             }
             else if (bitDepth == 24)
             {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
+                int32_t sampleAsIntAgain = (int32_t) (samples.Frame (i)[channel] * (T)8388608.);
                 
                 uint8_t bytes[3];
                 bytes[2] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
@@ -827,17 +819,17 @@ bool AudioFile<T>::saveToAiffFile (std::string filePath)
         {
             if (bitDepth == 8)
             {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
+                uint8_t byte = sampleToSingleByte (samples.Frame (i)[channel]);
                 fileData.push_back (byte);
             }
             else if (bitDepth == 16)
             {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
+                int16_t sampleAsInt = sampleToSixteenBitInt (samples.Frame (i)[channel]);
                 addInt16ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
             }
             else if (bitDepth == 24)
             {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
+                int32_t sampleAsIntAgain = (int32_t) (samples.Frame (i)[channel] * (T)8388608.);
                 
                 uint8_t bytes[3];
                 bytes[0] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
@@ -947,12 +939,7 @@ void AudioFile<T>::addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i
 template <class T>
 void AudioFile<T>::clearAudioBuffer()
 {
-    for (int i = 0; i < samples.size();i++)
-    {
-        samples[i].clear();
-    }
-    
-    samples.clear();
+    samples.Clear();
 }
 
 //=============================================================
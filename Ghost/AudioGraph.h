@@ -0,0 +1,763 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Audio.h"
+#include "OscillatorBank.h"
+#include "Noise.h"
+#include "Resampler.h"
+
+// Pull based audio graph rendered in fixed size blocks.
+//
+//   AudioGraph graph;
+//   auto osc = graph.Add<OscillatorNode>(OscillatorNode::Waveform::Saw, 110.0f);
+//   auto lp = graph.Add<FilterNode>(FilterNode::Type::LowPass, 800.0f);
+//   graph.Connect(osc, lp);
+//   graph.Prepare(lp, 44100);
+//   graph.Process();    // next block, lp->GetBlock()
+//
+// Prepare orders the nodes that feed the output by depth (sources first) and gives every
+// node one preallocated block, so Process does no allocation and its cost only depends on
+// the graph, not on how long it has been running. Nodes of the same depth do not depend
+// on each other and are spread over worker threads when the graph is prepared with more
+// than one. Node parameters are atomics and may be changed from any thread between
+// blocks. GraphAudio plays a graph through PCMAudio, as long as PCMAudio can count.
+
+class AudioGraph;
+
+// A node renders its block from the blocks of its inputs. The output has a fixed number of
+// channels chosen in Prepare; inputs with fewer channels are repeated over the channels
+// that Mix writes (a mono input feeds both sides of a stereo node).
+class AudioNode {
+public:
+	virtual ~AudioNode() {}
+	int GetChannels() const { return block.GetChannels(); }
+	int GetSampleRate() const { return sampleRate; }
+	// the block rendered last
+	const InterleavedBuffer<float>& GetBlock() const { return block; }
+protected:
+	// Returns the channels of the output; inputChannels is the most any input has, 0 for
+	// a node without inputs. Called by AudioGraph::Prepare before the first block.
+	virtual int Prepare(int sampleRate, int inputChannels) {
+		return std::max(inputChannels, 1);
+	}
+	// Renders block.GetFrames() frames that start at frame; the inputs are ready.
+	virtual void Process(int64_t frame) = 0;
+	// The next block starts at frame instead of where the last one ended.
+	virtual void Seek(int64_t frame) {}
+
+	size_t GetInputCount() const { return inputs.size(); }
+	const InterleavedBuffer<float>& GetInput(size_t index) const { return inputs[index]->block; }
+	InterleavedBuffer<float> block;
+private:
+	friend class AudioGraph;
+	std::vector<AudioNode*> inputs;
+	int sampleRate = 0;
+};
+
+namespace audio_graph_detail {
+	// out = (isAdd ? out : 0) + in * gain, with gain moving linearly from gain0 to gain1 over
+	// the block so that parameter changes do not click. Channels of in repeat over out.
+	inline void Mix(const InterleavedBuffer<float>& in, InterleavedBuffer<float>& out, float gain0, float gain1, bool isAdd) {
+		const int frames = (int)out.GetFrames();
+		const int channels = out.GetChannels();
+		const int inChannels = in.GetChannels();
+		const float step = (gain1 - gain0) / (float)std::max(frames, 1);
+		const float* src = in.Data();
+		float* dst = out.Data();
+		if (!isAdd) {
+			std::fill(dst, dst + (size_t)frames * channels, 0.0f);
+		}
+		if (inChannels == channels) {
+			for (int i = 0; i < frames; i++) {
+				const float gain = gain0 + step * i;
+				for (int c = 0; c < channels; c++) {
+					dst[i * channels + c] += src[i * channels + c] * gain;
+				}
+			}
+		}
+		else if (inChannels == 1) {
+			for (int i = 0; i < frames; i++) {
+				const float x = src[i] * (gain0 + step * i);
+				for (int c = 0; c < channels; c++) {
+					dst[i * channels + c] += x;
+				}
+			}
+		}
+		else if (inChannels > 0) {
+			for (int i = 0; i < frames; i++) {
+				const float gain = gain0 + step * i;
+				for (int c = 0; c < channels; c++) {
+					dst[i * channels + c] += src[i * inChannels + c % inChannels] * gain;
+				}
+			}
+		}
+	}
+
+	// Threads that stay around between blocks; Run hands them the nodes of one depth.
+	class Workers {
+	public:
+		~Workers() {
+			Stop();
+		}
+		void Start(int count) {
+			Stop();
+			isQuit = false;
+			for (int i = 0; i < count; i++) {
+				threads.emplace_back(&Workers::Thread, this);
+			}
+		}
+		void Stop() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				isQuit = true;
+			}
+			wake.notify_all();
+			for (auto& thread : threads) {
+				thread.join();
+			}
+			threads.clear();
+		}
+		size_t GetCount() const { return threads.size(); }
+		// runs task(0) .. task(count - 1) on the workers and the calling thread
+		void Run(int count, const std::function<void(int)>& task) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				this->task = &task;
+				this->count = count;
+				next = 0;
+				busy = (int)threads.size();
+				generation++;
+			}
+			wake.notify_all();
+			Work();
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&] { return busy == 0; });
+			this->task = nullptr;
+		}
+	private:
+		void Work() {
+			for (int i = next++; i < count; i = next++) {
+				(*task)(i);
+			}
+		}
+		void Thread() {
+			uint64_t seen = 0;
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				wake.wait(lock, [&] { return isQuit || generation != seen; });
+				if (isQuit) {
+					return;
+				}
+				seen = generation;
+				lock.unlock();
+				Work();
+				lock.lock();
+				if (--busy == 0) {
+					done.notify_one();
+				}
+			}
+		}
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		const std::function<void(int)>* task = nullptr;
+		std::atomic<int> next{ 0 };
+		int count = 0;
+		int busy = 0;
+		uint64_t generation = 0;
+		bool isQuit = false;
+	};
+}
+
+class AudioGraph {
+public:
+	AudioGraph() {}
+	AudioGraph(const AudioGraph&) = delete;
+	AudioGraph& operator=(const AudioGraph&) = delete;
+
+	// The graph owns its nodes.
+	template <class T, class... Args>
+	T* Add(Args&&... args) {
+		T* node = new T(std::forward<Args>(args)...);
+		nodes.emplace_back(node);
+		isPrepared = false;
+		return node;
+	}
+	// from feeds to; the graph has to be prepared again
+	void Connect(AudioNode* from, AudioNode* to) {
+		if (!from || !to) {
+			throw std::runtime_error("audio graph: null node");
+		}
+		to->inputs.push_back(from);
+		isPrepared = false;
+	}
+
+	// Orders the nodes that output depends on and allocates their blocks of blockFrames
+	// frames. threads > 1 renders nodes of the same depth in parallel (0 = all cores).
+	// Throws for cycles.
+	void Prepare(AudioNode* output, int sampleRate, int blockFrames = 512, int threads = 1) {
+		if (!output || sampleRate <= 0 || blockFrames <= 0) {
+			throw std::runtime_error("audio graph: invalid settings");
+		}
+		isPrepared = false;
+		levels.clear();
+		std::map<AudioNode*, int> depths;
+		Order(output, depths);
+		for (auto& level : levels) {
+			for (AudioNode* node : level) {
+				int inputChannels = 0;
+				for (AudioNode* input : node->inputs) {
+					inputChannels = std::max(inputChannels, input->GetChannels());
+				}
+				node->sampleRate = sampleRate;
+				node->block.Resize(std::max(node->Prepare(sampleRate, inputChannels), 1), (size_t)blockFrames);
+				node->Seek(0);
+			}
+		}
+		if (threads <= 0) {
+			threads = (int)std::thread::hardware_concurrency();
+		}
+		size_t widest = 0;
+		for (auto& level : levels) {
+			widest = std::max(widest, level.size());
+		}
+		threads = (int)std::max<size_t>(1, std::min<size_t>((size_t)threads, widest));
+		if (workers.GetCount() != (size_t)threads - 1) {
+			workers.Start(threads - 1);
+		}
+		this->output = output;
+		this->sampleRate = sampleRate;
+		this->blockFrames = blockFrames;
+		position = 0;
+		isPrepared = true;
+	}
+	bool IsPrepared() const { return isPrepared; }
+	AudioNode* GetOutput() const { return output; }
+	int GetSampleRate() const { return sampleRate; }
+	int GetBlockFrames() const { return blockFrames; }
+	// first frame of the next block
+	int64_t GetPosition() const { return position; }
+
+	// Renders the next block and returns the block of the output node.
+	const InterleavedBuffer<float>& Process() {
+		if (!isPrepared) {
+			throw std::runtime_error("audio graph: not prepared");
+		}
+		for (auto& level : levels) {
+			if (level.size() > 1 && workers.GetCount() > 0) {
+				const std::function<void(int)> task = [&](int i) { level[i]->Process(position); };
+				workers.Run((int)level.size(), task);
+			}
+			else {
+				for (AudioNode* node : level) {
+					node->Process(position);
+				}
+			}
+		}
+		position += blockFrames;
+		return output->block;
+	}
+	void Seek(int64_t frame) {
+		for (auto& level : levels) {
+			for (AudioNode* node : level) {
+				node->Seek(frame);
+			}
+		}
+		position = frame;
+	}
+
+private:
+	// depth first from the output; a node's depth is one more than its deepest input
+	int Order(AudioNode* node, std::map<AudioNode*, int>& depths) {
+		auto found = depths.find(node);
+		if (found != depths.end()) {
+			if (found->second < 0) {
+				throw std::runtime_error("audio graph: cycle");
+			}
+			return found->second;
+		}
+		depths[node] = -1;
+		int depth = 0;
+		for (AudioNode* input : node->inputs) {
+			depth = std::max(depth, Order(input, depths) + 1);
+		}
+		depths[node] = depth;
+		if (levels.size() <= (size_t)depth) {
+			levels.resize(depth + 1);
+		}
+		levels[depth].push_back(node);
+		return depth;
+	}
+
+	std::vector<std::unique_ptr<AudioNode> > nodes;
+	std::vector<std::vector<AudioNode*> > levels;
+	audio_graph_detail::Workers workers;
+	AudioNode* output = nullptr;
+	int sampleRate = 0;
+	int blockFrames = 0;
+	int64_t position = 0;
+	bool isPrepared = false;
+};
+
+// Mono oscillator. The phase is kept in double, so the pitch does not drift over hours;
+// the sine runs as a rotation resynchronized to the phase every block, the other
+// waveforms are band-limited like the ones of OscillatorBank.
+class OscillatorNode : public AudioNode {
+public:
+	typedef OscillatorWaveform Waveform;
+	OscillatorNode(Waveform waveform = Waveform::Sine, float hz = 440.0f, float amplitude = 1.0f)
+		: waveform(waveform), hz(hz), amplitude(amplitude) {}
+	void SetFrequency(float hz) { this->hz = hz; }
+	void SetAmplitude(float amplitude) { this->amplitude = amplitude; }
+protected:
+	int Prepare(int sampleRate, int inputChannels) override {
+		return 1;
+	}
+	void Seek(int64_t frame) override {
+		const double cycles = (double)frame * hz / GetSampleRate();
+		phase = cycles - std::floor(cycles);
+	}
+	void Process(int64_t frame) override {
+		const int frames = (int)block.GetFrames();
+		const double increment = (double)hz / GetSampleRate();
+		const float a = amplitude;
+		float* out = block.Data();
+		if (waveform == Waveform::Sine) {
+			const double w = 2.0 * A_PI * increment;
+			const double dc = std::cos(w), ds = std::sin(w);
+			double c = std::cos(2.0 * A_PI * phase), s = std::sin(2.0 * A_PI * phase);
+			for (int i = 0; i < frames; i++) {
+				out[i] = (float)s * a;
+				const double t = c * dc - s * ds;
+				s = s * dc + c * ds;
+				c = t;
+			}
+		}
+		else {
+			const float dt = oscillator_detail::ClampIncrement((float)increment);
+			const float inverse = dt > 0.0f ? 1.0f / dt : 0.0f;
+			double p = phase;
+			for (int i = 0; i < frames; i++) {
+				out[i] = oscillator_detail::Wave(waveform, (float)p, dt, inverse) * a;
+				p += increment;
+				p -= std::floor(p);
+			}
+		}
+		phase += increment * frames;
+		phase -= std::floor(phase);
+	}
+private:
+	Waveform waveform;
+	std::atomic<float> hz;
+	std::atomic<float> amplitude;
+	double phase = 0.0;
+};
+
+// Stereo sum of an OscillatorBank. Voice changes are queued from any thread and applied
+// at the start of the next block; the ids AddVoice returns can be used right away.
+class OscillatorBankNode : public AudioNode {
+public:
+	int AddVoice(OscillatorWaveform waveform, float hz, float amplitude = 1.0f, float pan = 0.0f) {
+		std::lock_guard<std::mutex> lock(mutex);
+		changes.push_back({ Change::Add, voices, waveform, hz, amplitude, pan });
+		return voices++;
+	}
+	void SetFrequency(int voice, float hz) {
+		Queue(Change::Frequency, voice, hz);
+	}
+	void SetAmplitude(int voice, float amplitude) {
+		Queue(Change::Amplitude, voice, amplitude);
+	}
+	void SetPan(int voice, float pan) {
+		Queue(Change::Pan, voice, pan);
+	}
+	int GetVoiceCount() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return voices;
+	}
+protected:
+	int Prepare(int sampleRate, int inputChannels) override {
+		return 2;
+	}
+	void Seek(int64_t frame) override {
+		Apply();
+		bank.Seek(frame, GetSampleRate());
+	}
+	void Process(int64_t frame) override {
+		Apply();
+		std::fill(block.Data(), block.Data() + block.GetFrames() * 2, 0.0f);
+		bank.Render(block.Data(), (int)block.GetFrames(), GetSampleRate());
+	}
+private:
+	struct Change {
+		enum Kind { Add, Frequency, Amplitude, Pan } kind;
+		int voice;
+		OscillatorWaveform waveform;
+		float hz, amplitude, pan;
+	};
+	void Queue(Change::Kind kind, int voice, float value) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (voice < 0 || voice >= voices) {
+			throw std::runtime_error("oscillator bank: no such voice");
+		}
+		changes.push_back({ kind, voice, OscillatorWaveform::Sine, value, value, value });
+	}
+	// the render thread does not wait for a thread that is queueing, it picks the changes
+	// up a block later
+	void Apply() {
+		std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+		if (!lock.owns_lock() || changes.empty()) {
+			return;
+		}
+		for (const Change& change : changes) {
+			switch (change.kind) {
+			case Change::Add: bank.AddVoice(change.waveform, change.hz, change.amplitude, change.pan); break;
+			case Change::Frequency: bank.SetFrequency(change.voice, change.hz); break;
+			case Change::Amplitude: bank.SetAmplitude(change.voice, change.amplitude); break;
+			case Change::Pan: bank.SetPan(change.voice, change.pan); break;
+			}
+		}
+		changes.clear();
+	}
+
+	OscillatorBank bank;
+	std::mutex mutex;
+	std::vector<Change> changes;
+	int voices = 0;
+};
+
+// Mono NoiseGenerator output. holdHz > 0 holds white noise values for 1 / holdHz seconds.
+class NoiseNode : public AudioNode {
+public:
+	NoiseNode(NoiseShape shape = NoiseShape::White, float amplitude = 1.0f, uint64_t seed = 0)
+		: shape(shape), amplitude(amplitude), holdHz(0.0f), seed(seed) {}
+	void SetAmplitude(float amplitude) { this->amplitude = amplitude; }
+	void SetHold(float holdHz) { this->holdHz = holdHz; }
+protected:
+	int Prepare(int sampleRate, int inputChannels) override {
+		generator = NoiseGenerator(shape, seed, sampleRate);
+		return 1;
+	}
+	void Seek(int64_t frame) override {
+		generator.Seek(frame);
+	}
+	void Process(int64_t frame) override {
+		const int frames = (int)block.GetFrames();
+		const float a = amplitude;
+		const double hold = holdHz;
+		float* out = block.Data();
+		if (hold > 0.0 && shape == NoiseShape::White) {
+			const double step = hold / GetSampleRate();
+			for (int i = 0; i < frames; i++) {
+				const uint64_t counter = (uint64_t)std::floor((double)(frame + i) * step);
+				if (counter != heldCounter) {
+					heldCounter = counter;
+					held = NoiseValue(seed, 0, counter);
+				}
+				out[i] = held * a;
+			}
+			return;
+		}
+		if (generator.GetPosition() != frame) {
+			generator.Seek(frame);
+		}
+		generator.Generate(out, frames);
+		for (int i = 0; i < frames; i++) {
+			out[i] *= a;
+		}
+	}
+private:
+	NoiseShape shape;
+	std::atomic<float> amplitude;
+	std::atomic<float> holdHz;
+	uint64_t seed;
+	NoiseGenerator generator;
+	uint64_t heldCounter = UINT64_MAX;
+	float held = 0.0f;
+};
+
+// Input times gain, ramped over a block when it changes.
+class GainNode : public AudioNode {
+public:
+	GainNode(float gain = 1.0f) : gain(gain), current(gain) {}
+	void SetGain(float gain) { this->gain = gain; }
+protected:
+	void Process(int64_t frame) override {
+		const float target = gain;
+		if (GetInputCount() == 0) {
+			std::fill(block.Data(), block.Data() + block.GetFrames() * block.GetChannels(), 0.0f);
+		}
+		else {
+			audio_graph_detail::Mix(GetInput(0), block, current, target, false);
+		}
+		current = target;
+	}
+private:
+	std::atomic<float> gain;
+	float current;
+};
+
+// Sum of all inputs.
+class MixNode : public AudioNode {
+protected:
+	void Process(int64_t frame) override {
+		std::fill(block.Data(), block.Data() + block.GetFrames() * block.GetChannels(), 0.0f);
+		for (size_t i = 0; i < GetInputCount(); i++) {
+			audio_graph_detail::Mix(GetInput(i), block, 1.0f, 1.0f, true);
+		}
+	}
+};
+
+// RBJ cookbook biquad over every channel of its input, in transposed direct form II with
+// double precision state. The coefficients follow SetFrequency/SetQ at the next block.
+class FilterNode : public AudioNode {
+public:
+	enum class Type {
+		LowPass,
+		HighPass,
+		BandPass,
+	};
+	FilterNode(Type type = Type::LowPass, float hz = 1000.0f, float q = 0.7071f)
+		: type(type), hz(hz), q(q) {}
+	void SetFrequency(float hz) { this->hz = hz; }
+	void SetQ(float q) { this->q = q; }
+protected:
+	int Prepare(int sampleRate, int inputChannels) override {
+		const int channels = std::max(inputChannels, 1);
+		state.assign((size_t)channels * 2, 0.0);
+		designedHz = designedQ = -1.0f;
+		return channels;
+	}
+	void Seek(int64_t frame) override {
+		std::fill(state.begin(), state.end(), 0.0);
+	}
+	void Process(int64_t frame) override {
+		const int frames = (int)block.GetFrames();
+		const int channels = block.GetChannels();
+		if (GetInputCount() == 0) {
+			std::fill(block.Data(), block.Data() + (size_t)frames * channels, 0.0f);
+			return;
+		}
+		Design();
+		// the input lands in block first, repeated over the channels when it has fewer
+		audio_graph_detail::Mix(GetInput(0), block, 1.0f, 1.0f, false);
+		float* data = block.Data();
+		for (int c = 0; c < channels; c++) {
+			double z1 = state[c * 2], z2 = state[c * 2 + 1];
+			for (int i = 0; i < frames; i++) {
+				const double x = data[i * channels + c];
+				const double y = b0 * x + z1;
+				z1 = b1 * x - a1 * y + z2;
+				z2 = b2 * x - a2 * y;
+				data[i * channels + c] = (float)y;
+			}
+			state[c * 2] = z1;
+			state[c * 2 + 1] = z2;
+		}
+	}
+private:
+	void Design() {
+		const float f = hz, resonance = q;
+		if (f == designedHz && resonance == designedQ) {
+			return;
+		}
+		designedHz = f;
+		designedQ = resonance;
+		const double w = 2.0 * A_PI * std::min(std::max((double)f, 1.0), GetSampleRate() * 0.49) / GetSampleRate();
+		const double alpha = std::sin(w) / (2.0 * std::max((double)resonance, 0.01));
+		const double cosw = std::cos(w);
+		const double a0 = 1.0 + alpha;
+		switch (type) {
+		case Type::LowPass:
+			b0 = (1.0 - cosw) / 2.0 / a0;
+			b1 = (1.0 - cosw) / a0;
+			b2 = b0;
+			break;
+		case Type::HighPass:
+			b0 = (1.0 + cosw) / 2.0 / a0;
+			b1 = -(1.0 + cosw) / a0;
+			b2 = b0;
+			break;
+		case Type::BandPass:
+			b0 = alpha / a0;
+			b1 = 0.0;
+			b2 = -alpha / a0;
+			break;
+		}
+		a1 = -2.0 * cosw / a0;
+		a2 = (1.0 - alpha) / a0;
+	}
+
+	Type type;
+	std::atomic<float> hz;
+	std::atomic<float> q;
+	float designedHz = -1.0f, designedQ = -1.0f;
+	double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+	std::vector<double> state;
+};
+
+// Plays a PCMAudio through Read, looped or followed by silence. A source at another
+// sample rate than the graph is played through a ResampledAudio.
+class FilePlayerNode : public AudioNode {
+public:
+	FilePlayerNode(PCMAudio& source, bool isLoop = true, ResamplerQuality quality = ResamplerQuality::Medium) : source(source), isLoop(isLoop), quality(quality) {}
+protected:
+	int Prepare(int sampleRate, int inputChannels) override {
+		if (!source.IsValid() || source.GetChannels() <= 0) {
+			throw std::runtime_error("audio graph: file player source not loaded");
+		}
+		if (source.GetSampleRate() != sampleRate) {
+			resampled.reset(new ResampledAudio());
+			resampled->Create(source, sampleRate, quality);
+		}
+		else {
+			resampled.reset();
+		}
+		return source.GetChannels();
+	}
+	void Seek(int64_t frame) override {
+		const int64_t frames = GetSource().GetSamples() / GetSource().GetChannels();
+		position = isLoop && frames > 0 ? frame % frames : frame;
+	}
+	void Process(int64_t frame) override {
+		PCMAudio& source = GetSource();
+		const int channels = block.GetChannels();
+		const int64_t frames = source.GetSamples() / channels;
+		const int count = (int)block.GetFrames();
+		float* out = block.Data();
+		int done = 0;
+		while (done < count) {
+			if (position >= frames) {
+				if (!isLoop || frames == 0) {
+					break;
+				}
+				position = 0;
+			}
+			const int want = (int)std::min<int64_t>(count - done, frames - position);
+			const int read = source.Read(out + (size_t)done * channels, (int)(position * channels), want * channels) / channels;
+			if (read <= 0) {
+				break;
+			}
+			done += read;
+			position += read;
+		}
+		std::fill(out + (size_t)done * channels, out + (size_t)count * channels, 0.0f);
+	}
+private:
+	PCMAudio& GetSource() { return resampled ? *resampled : source; }
+
+	PCMAudio& source;
+	bool isLoop;
+	ResamplerQuality quality;
+	std::unique_ptr<ResampledAudio> resampled;
+	int64_t position = 0;
+};
+
+// The output of a graph as PCMAudio. There is no buffer: Read renders blocks on demand,
+// sequential reads continue the graph and anything else seeks it. seconds = 0 plays for as
+// long as an int can count samples (about 6.7 hours of stereo at 44.1 kHz).
+class GraphAudio : public PCMAudio {
+public:
+	AudioGraph& GetGraph() { return graph; }
+	void Create(AudioNode* output, int channels = 2, double seconds = 0.0, int sampleRate = 44100, int blockFrames = 512, int threads = 1) {
+		if (channels <= 0) {
+			throw std::runtime_error("audio graph: invalid channels");
+		}
+		graph.Prepare(output, sampleRate, blockFrames, threads);
+		const int64_t longest = INT32_MAX / channels * channels;
+		const int64_t length = seconds > 0.0 ? (int64_t)(seconds * sampleRate) * channels : longest;
+		block.Resize(channels, (size_t)blockFrames);
+		blockStart = -1;
+		Initialize(nullptr, channels, 16, sampleRate, (int)std::min(length, longest));
+	}
+	bool IsValid() override {
+		return graph.IsPrepared();
+	}
+	int Read(float* dst, int position, int count) override {
+		if (!IsValid() || position < 0 || position >= samples) {
+			return 0;
+		}
+		count = std::min(count, samples - position);
+		const int64_t blockSamples = (int64_t)block.GetFrames() * channels;
+		int written = 0;
+		while (written < count) {
+			const int64_t sample = (int64_t)position + written;
+			const int64_t frame = sample / channels;
+			if (blockStart < 0 || frame < blockStart || frame >= blockStart + (int64_t)block.GetFrames()) {
+				if (frame != graph.GetPosition()) {
+					graph.Seek(frame);
+				}
+				blockStart = frame;
+				audio_graph_detail::Mix(graph.Process(), block, 1.0f, 1.0f, false);
+			}
+			const int64_t offset = sample - blockStart * channels;
+			const int n = (int)std::min<int64_t>(count - written, blockSamples - offset);
+			memcpy(dst + written, block.Data() + offset, n * sizeof(float));
+			written += n;
+		}
+		return written;
+	}
+private:
+	AudioGraph graph;
+	InterleavedBuffer<float> block;
+	int64_t blockStart = -1;
+};
+
+// Single tone sources, built on a graph. Create again only changes the frequency.
+class SinAudio : public GraphAudio {
+public:
+	void Create(float hz) {
+		if (oscillator) {
+			oscillator->SetFrequency(hz);
+			return;
+		}
+		oscillator = GetGraph().Add<OscillatorNode>(OscillatorNode::Waveform::Sine, hz);
+		GraphAudio::Create(oscillator, 1);
+	}
+private:
+	OscillatorNode* oscillator = nullptr;
+};
+
+class NokogiriAudio : public GraphAudio {
+public:
+	void Create(float hz) {
+		if (oscillator) {
+			oscillator->SetFrequency(hz);
+			return;
+		}
+		oscillator = GetGraph().Add<OscillatorNode>(OscillatorNode::Waveform::Saw, hz);
+		GraphAudio::Create(oscillator, 1);
+	}
+private:
+	OscillatorNode* oscillator = nullptr;
+};
+
+// noise held for 1 / hz seconds
+class NoiseAudio : public GraphAudio {
+public:
+	void Create(float hz) {
+		if (noise) {
+			noise->SetHold(hz);
+			return;
+		}
+		noise = GetGraph().Add<NoiseNode>();
+		noise->SetHold(hz);
+		GraphAudio::Create(noise, 1);
+	}
+private:
+	NoiseNode* noise = nullptr;
+};
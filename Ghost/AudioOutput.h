@@ -0,0 +1,454 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "SampleConvert.h"
+#include "WaveWriter.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm")
+#endif
+#ifdef GHOST_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+struct AudioFormat {
+	int channels;
+	int sampleRate;
+	int bitDepth;	// integer PCM: 8 (unsigned), 16, 24 or 32
+	int GetBlockAlign() const { return channels * (bitDepth / 8); }
+};
+
+// Output device with a fixed number of fixed size buffers in flight.
+// Write is called by one thread (the render thread of PCMAudioPlayer), the other
+// methods may be called from any thread.
+class AudioSink {
+public:
+	virtual ~AudioSink() {}
+	virtual bool Open(const AudioFormat& format, int bufferFrames, int bufferCount) = 0;
+	virtual void Close() = 0;
+	// Queues up to bufferFrames frames, blocking while every buffer is in flight.
+	virtual bool Write(const void* data, int frames) = 0;
+	// Like Write for float samples in [-1, 1]. Sinks that own their buffers override it to
+	// convert straight into the next free one; the default converts through a scratch block.
+	virtual bool WriteSamples(const float* samples, int frames, int channels, SampleConverter& converter) {
+		scratch.resize((size_t)frames * channels * (converter.GetBitDepth() / 8));
+		converter.Convert(samples, scratch.data(), (size_t)frames * channels);
+		return Write(scratch.data(), frames);
+	}
+	virtual void Pause() = 0;
+	virtual void Resume() = 0;
+	// Drops the queued buffers, wakes a blocked Write and restarts the played count.
+	virtual void Reset() = 0;
+	// Frames that have been played since Open or the last Reset.
+	virtual int64_t GetPlayedFrames() = 0;
+
+private:
+	std::vector<char> scratch;
+};
+
+// Headless device driven by a virtual clock, optionally storing the samples in a WAV
+// file (an empty filename discards them). In real time mode the samples are consumed at
+// the sample rate of the format, like a sound card would; otherwise every buffer is
+// consumed as soon as it is written, so playback runs as fast as the source renders.
+class FileAudioSink : public AudioSink {
+public:
+	FileAudioSink(std::string filename = "", bool realtime = true) : filename(filename), isRealtime(realtime) {}
+	~FileAudioSink() {
+		Close();
+	}
+	bool Open(const AudioFormat& format, int bufferFrames, int bufferCount) override {
+		Close();
+		if (!filename.empty()) {
+			try {
+				file.Open(filename, format.channels, format.sampleRate, format.bitDepth);
+			}
+			catch (const std::runtime_error&) {
+				return false;
+			}
+		}
+		this->format = format;
+		this->bufferFrames = bufferFrames;
+		this->bufferCount = bufferCount;
+		isOpen = true;
+		Reset();
+		return true;
+	}
+	void Close() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		file.Close();
+		isOpen = false;
+		done.notify_all();
+	}
+	bool Write(const void* data, int frames) override {
+		std::unique_lock<std::mutex> lock(mutex);
+		const int64_t generation = resets;
+		const int64_t limit = (int64_t)bufferFrames * (bufferCount - 1);
+		while (isOpen && resets == generation && written - Played() > limit) {
+			if (isPaused) {
+				done.wait(lock);
+				continue;
+			}
+			// sleep until the oldest buffer has been played
+			const int64_t excess = written - limit - Played();
+			done.wait_for(lock, std::chrono::microseconds(std::max<int64_t>(excess * 1000000 / format.sampleRate, 100)));
+		}
+		if (!isOpen) {
+			return false;
+		}
+		file.WriteRaw(data, frames);
+		written += frames;
+		return true;
+	}
+	void Pause() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!isPaused) {
+			played = Played();
+			isPaused = true;
+		}
+	}
+	void Resume() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (isPaused) {
+			start = Clock::now();
+			isPaused = false;
+			done.notify_all();
+		}
+	}
+	void Reset() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		written = played = 0;
+		start = Clock::now();
+		resets++;
+		done.notify_all();
+	}
+	int64_t GetPlayedFrames() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		return Played();
+	}
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// the clock stops on underrun, like a device that plays silence until the next buffer
+	int64_t Played() {
+		if (isPaused) {
+			return played;
+		}
+		if (!isRealtime) {
+			return played = written;
+		}
+		const auto now = Clock::now();
+		const int64_t elapsed = (int64_t)(std::chrono::duration<double>(now - start).count() * format.sampleRate);
+		if (played + elapsed >= written) {
+			played = written;
+			start = now;
+		}
+		return std::min(played + elapsed, written);
+	}
+
+	std::string filename;
+	bool isRealtime;
+	WaveWriter file;
+	AudioFormat format = {};
+	int bufferFrames = 0;
+	int bufferCount = 0;
+	std::mutex mutex;
+	std::condition_variable done;
+	Clock::time_point start;
+	int64_t written = 0;		// frames accepted since Reset
+	int64_t played = 0;			// frames played up to start
+	int64_t resets = 0;
+	bool isPaused = false;
+	bool isOpen = false;
+};
+
+#ifdef _WIN32
+// winmm device. The driver signals an event when a buffer is done, so no waveOut call
+// is made from a driver callback.
+class WaveOutAudioSink : public AudioSink {
+public:
+	WaveOutAudioSink() {}
+	~WaveOutAudioSink() {
+		Close();
+	}
+	bool Open(const AudioFormat& format, int bufferFrames, int bufferCount) override {
+		Close();
+		WAVEFORMATEX wfe = {};
+		wfe.wFormatTag = WAVE_FORMAT_PCM;
+		wfe.nChannels = (WORD)format.channels;								// Channels
+		wfe.wBitsPerSample = (WORD)format.bitDepth;							// Bit Depth
+		wfe.nBlockAlign = (WORD)format.GetBlockAlign();						// Byte per Minimum Unit
+		wfe.nSamplesPerSec = format.sampleRate;								// Sample Rate
+		wfe.nAvgBytesPerSec = wfe.nSamplesPerSec * wfe.nBlockAlign;		// Byte per One Second
+
+		event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (waveOutOpen(&hWaveOut, WAVE_MAPPER, &wfe, (DWORD_PTR)event, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+			CloseHandle(event);
+			hWaveOut = nullptr;
+			return false;
+		}
+		blockAlign = wfe.nBlockAlign;
+		buffers.assign(bufferCount, std::vector<char>((size_t)bufferFrames * blockAlign));
+		headers.assign(bufferCount, WAVEHDR());
+		for (int i = 0; i < bufferCount; i++) {
+			headers[i].lpData = buffers[i].data();
+			headers[i].dwBufferLength = (DWORD)buffers[i].size();
+			waveOutPrepareHeader(hWaveOut, &headers[i], sizeof(WAVEHDR));
+		}
+		next = 0;
+		isOpen = true;
+		return true;
+	}
+	void Close() override {
+		if (!hWaveOut) {
+			return;
+		}
+		isOpen = false;
+		Reset();
+		for (auto& header : headers) {
+			waveOutUnprepareHeader(hWaveOut, &header, sizeof(WAVEHDR));
+		}
+		waveOutClose(hWaveOut);
+		CloseHandle(event);
+		hWaveOut = nullptr;
+	}
+	bool Write(const void* data, int frames) override {
+		WAVEHDR* header = NextHeader();
+		if (!header) {
+			return false;
+		}
+		memcpy(header->lpData, data, (size_t)frames * blockAlign);
+		return Submit(*header, frames);
+	}
+	bool WriteSamples(const float* samples, int frames, int channels, SampleConverter& converter) override {
+		WAVEHDR* header = NextHeader();
+		if (!header) {
+			return false;
+		}
+		converter.Convert(samples, header->lpData, (size_t)frames * channels);
+		return Submit(*header, frames);
+	}
+	void Pause() override {
+		waveOutPause(hWaveOut);
+	}
+	void Resume() override {
+		waveOutRestart(hWaveOut);
+	}
+	void Reset() override {
+		// returns every queued buffer as done and sets the position to 0
+		waveOutReset(hWaveOut);
+		SetEvent(event);
+	}
+	int64_t GetPlayedFrames() override {
+		MMTIME mmt;
+		mmt.wType = TIME_SAMPLES;
+		waveOutGetPosition(hWaveOut, &mmt, sizeof(MMTIME));
+		return mmt.u.sample;
+	}
+private:
+	// waits until the next buffer in the ring has come back from the device
+	WAVEHDR* NextHeader() {
+		if (!isOpen) {
+			return nullptr;
+		}
+		WAVEHDR& header = headers[next];
+		while (header.dwFlags & WHDR_INQUEUE) {
+			WaitForSingleObject(event, 100);
+			if (!isOpen) {
+				return nullptr;
+			}
+		}
+		return &header;
+	}
+	bool Submit(WAVEHDR& header, int frames) {
+		header.dwBufferLength = frames * blockAlign;
+		waveOutWrite(hWaveOut, &header, sizeof(WAVEHDR));
+		next = (next + 1) % (int)headers.size();
+		return true;
+	}
+
+	HWAVEOUT hWaveOut = nullptr;
+	HANDLE event = nullptr;
+	std::vector<WAVEHDR> headers;
+	std::vector<std::vector<char> > buffers;
+	int blockAlign = 0;
+	int next = 0;
+	std::atomic<bool> isOpen{ false };
+};
+#endif
+
+#ifdef GHOST_ALSA
+// ALSA device (build with GHOST_ALSA defined and link asound).
+// The PCM is used in non-blocking mode behind a mutex, so Pause/Reset/GetPlayedFrames
+// from other threads never race with a Write waiting for room in the device buffer.
+class AlsaAudioSink : public AudioSink {
+public:
+	AlsaAudioSink(std::string device = "default") : device(device) {}
+	~AlsaAudioSink() {
+		Close();
+	}
+	bool Open(const AudioFormat& format, int bufferFrames, int bufferCount) override {
+		Close();
+		snd_pcm_format_t pcmFormat;
+		switch (format.bitDepth)
+		{
+		case 8: pcmFormat = SND_PCM_FORMAT_U8; break;
+		case 16: pcmFormat = SND_PCM_FORMAT_S16_LE; break;
+		case 24: pcmFormat = SND_PCM_FORMAT_S24_3LE; break;
+		case 32: pcmFormat = SND_PCM_FORMAT_S32_LE; break;
+		default: return false;
+		}
+		if (snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) < 0) {
+			pcm = nullptr;
+			return false;
+		}
+		const unsigned int latency = (unsigned int)((int64_t)bufferFrames * bufferCount * 1000000 / format.sampleRate);
+		if (snd_pcm_set_params(pcm, pcmFormat, SND_PCM_ACCESS_RW_INTERLEAVED, format.channels, format.sampleRate, 1, latency) < 0) {
+			snd_pcm_close(pcm);
+			pcm = nullptr;
+			return false;
+		}
+		blockAlign = format.GetBlockAlign();
+		written = 0;
+		isPaused = false;
+		isOpen = true;
+		return true;
+	}
+	void Close() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pcm) {
+			snd_pcm_drop(pcm);
+			snd_pcm_close(pcm);
+			pcm = nullptr;
+		}
+		isOpen = false;
+	}
+	bool Write(const void* data, int frames) override {
+		const char* p = (const char*)data;
+		std::unique_lock<std::mutex> lock(mutex);
+		const int64_t generation = resets;
+		while (frames > 0) {
+			if (!isOpen || resets != generation) {
+				return isOpen;
+			}
+			snd_pcm_sframes_t n = isPaused ? -EAGAIN : snd_pcm_writei(pcm, p, frames);
+			if (n == -EAGAIN) {
+				// device buffer full: wait a fraction of a buffer without holding the lock
+				lock.unlock();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				lock.lock();
+				continue;
+			}
+			if (n < 0) {
+				if (snd_pcm_recover(pcm, (int)n, 1) < 0) {
+					return false;
+				}
+				continue;
+			}
+			p += n * blockAlign;
+			frames -= (int)n;
+			written += n;
+		}
+		return true;
+	}
+	void Pause() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pcm && !isPaused) {
+			snd_pcm_pause(pcm, 1);	// devices that can not pause just drain what is queued
+			isPaused = true;
+		}
+	}
+	void Resume() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pcm && isPaused) {
+			if (snd_pcm_state(pcm) == SND_PCM_STATE_PAUSED) {
+				snd_pcm_pause(pcm, 0);
+			}
+			isPaused = false;
+		}
+	}
+	void Reset() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pcm) {
+			snd_pcm_drop(pcm);
+			snd_pcm_prepare(pcm);
+		}
+		written = 0;
+		resets++;
+	}
+	int64_t GetPlayedFrames() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		snd_pcm_sframes_t delay = 0;
+		if (!pcm || snd_pcm_delay(pcm, &delay) < 0) {
+			delay = 0;
+		}
+		return std::max<int64_t>(written - std::max<snd_pcm_sframes_t>(delay, 0), 0);
+	}
+private:
+	std::string device;
+	snd_pcm_t* pcm = nullptr;
+	std::mutex mutex;
+	int blockAlign = 0;
+	int64_t written = 0;	// frames accepted since Reset
+	int64_t resets = 0;
+	bool isPaused = false;
+	bool isOpen = false;
+};
+#endif
+
+// Creates a device from a name:
+//   "default"          the sound card of the platform, a real time null device without one
+//   "winmm"            waveOut (Windows)
+//   "alsa[:device]"    ALSA PCM, "default" when no device is given (GHOST_ALSA builds)
+//   "null"             real time virtual clock, samples are discarded
+//   "file:path"        real time virtual clock writing a WAV file
+//   "fast:path"        virtual clock that runs as fast as possible, path may be empty
+// Returns nullptr for names that are not available in this build.
+inline AudioSink* CreateAudioSink(const std::string& name) {
+	const size_t colon = name.find(':');
+	const std::string type = name.substr(0, colon);
+	const std::string argument = colon == std::string::npos ? "" : name.substr(colon + 1);
+	if (type == "default") {
+#if defined(_WIN32)
+		return new WaveOutAudioSink();
+#elif defined(GHOST_ALSA)
+		return new AlsaAudioSink();
+#else
+		return new FileAudioSink();
+#endif
+	}
+#ifdef _WIN32
+	if (type == "winmm") {
+		return new WaveOutAudioSink();
+	}
+#endif
+#ifdef GHOST_ALSA
+	if (type == "alsa") {
+		return new AlsaAudioSink(argument.empty() ? "default" : argument);
+	}
+#endif
+	if (type == "null") {
+		return new FileAudioSink();
+	}
+	if (type == "file") {
+		return new FileAudioSink(argument);
+	}
+	if (type == "fast") {
+		return new FileAudioSink(argument, false);
+	}
+	return nullptr;
+}
+
+inline AudioSink* CreateDefaultAudioSink() {
+	return CreateAudioSink("default");
+}
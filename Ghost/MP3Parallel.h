@@ -0,0 +1,199 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "minimp3_ex.h"
+
+// Multithreaded whole-file MP3 decode.
+//
+// The frame list from mp3dec_iterate_buf is split into chunks that are decoded
+// independently. Each chunk starts decoding a few frames early (warm-up) and drops
+// their output: once the bit reservoir holds MAX_BITRESERVOIR_BYTES of main data and
+// one frame has been decoded, the decoder state (reservoir, MDCT overlap, QMF history)
+// is the same as in a sequential decode, so the stitched PCM is bit-exact with
+// mp3dec_load for well-formed streams.
+
+struct MP3FrameEntry {
+	size_t offset;
+	int bytes;
+	int samples;	// channels included
+};
+
+static int MP3CollectFrame(void* user_data, const uint8_t* frame, int frame_size, size_t offset, mp3dec_frame_info_t* info) {
+	auto frames = (std::vector<MP3FrameEntry>*)user_data;
+	if (!frames->empty()) {
+		// mp3dec_load_buf stops on a format change, so does the index
+		const uint8_t* first = frame - offset + frames->front().offset;
+		if (hdr_sample_rate_hz(first) != (unsigned)info->hz || 4 - HDR_GET_LAYER(first) != info->layer ||
+			(HDR_IS_MONO(first) ? 1 : 2) != info->channels) {
+			return 1;
+		}
+	}
+	frames->push_back({ offset, frame_size, (int)hdr_frame_samples(frame) * info->channels });
+	return 0;
+}
+
+// Decodes the whole file with `threads` workers (0 = hardware concurrency).
+// On success info->buffer is malloc'd like mp3dec_load and 0 is returned.
+inline int LoadMP3Parallel(std::string filename, mp3dec_file_info_t* info, int threads = 0) {
+	memset(info, 0, sizeof(*info));
+	mp3dec_map_info_t map;
+	if (mp3dec_open_file(filename.c_str(), &map)) {
+		return -1;
+	}
+
+	std::vector<MP3FrameEntry> frames;
+	mp3dec_iterate_buf(map.buffer, map.size, MP3CollectFrame, &frames);
+	if (frames.empty()) {
+		mp3dec_close_file(&map);
+		return -1;
+	}
+
+	if (threads <= 0) {
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	const int minFramesPerChunk = 256;
+	int numChunks = std::max(1, std::min(threads * 4, (int)frames.size() / minFramesPerChunk));
+
+	// expected output offset of every chunk; frames that fail to decode are compacted afterwards
+	std::vector<size_t> chunkFrame(numChunks + 1), chunkOffset(numChunks + 1), chunkDecoded(numChunks, 0);
+	size_t totalSamples = 0;
+	for (int c = 0, f = 0; c <= numChunks; c++) {
+		int end = (int)((uint64_t)frames.size() * c / numChunks);
+		for (; f < end; f++) {
+			totalSamples += frames[f].samples;
+		}
+		chunkFrame[c] = end;
+		chunkOffset[c] = totalSamples;
+	}
+	mp3d_sample_t* pcm = (mp3d_sample_t*)malloc(std::max<size_t>(totalSamples, 1) * sizeof(mp3d_sample_t));
+	if (!pcm) {
+		mp3dec_close_file(&map);
+		return MP3D_E_MEMORY;
+	}
+
+	std::atomic<int> nextChunk(0);
+	std::vector<int> hz(numChunks, 0), layer(numChunks, 0), channels(numChunks, 0), bitrate(numChunks, 0), decodedFrames(numChunks, 0);
+	auto worker = [&]() {
+		mp3dec_t dec;
+		mp3dec_frame_info_t frameInfo;
+		mp3d_sample_t warmup[MINIMP3_MAX_SAMPLES_PER_FRAME];
+		for (int c; (c = nextChunk++) < numChunks; ) {
+			int begin = (int)chunkFrame[c], end = (int)chunkFrame[c + 1];
+			// go back until the frames before begin - 1 carry a full bit reservoir
+			int start = begin;
+			if (begin > 0) {
+				start = begin - 1;
+				int mainData = 0;
+				bool isLayer3 = HDR_GET_LAYER((map.buffer + frames[start].offset)) == 1;
+				while (isLayer3 && start > 0 && mainData < MAX_BITRESERVOIR_BYTES) {
+					start--;
+					// header + largest side info + crc, so this underestimates the main data
+					mainData += std::max(frames[start].bytes - HDR_SIZE - 32 - 2, 1);
+				}
+			}
+			mp3dec_init(&dec);
+			mp3d_sample_t* out = pcm + chunkOffset[c];
+			for (int f = start; f < end; f++) {
+				const uint8_t* buf = map.buffer + frames[f].offset;
+				int bufSize = (int)std::min<size_t>(map.size - frames[f].offset, INT32_MAX);
+				int samples = mp3dec_decode_frame(&dec, buf, bufSize, f < begin ? warmup : out, &frameInfo);
+				if (f < begin || !samples) {
+					continue;
+				}
+				out += samples * frameInfo.channels;
+				if (!hz[c]) {
+					hz[c] = frameInfo.hz;
+					layer[c] = frameInfo.layer;
+					channels[c] = frameInfo.channels;
+				}
+				bitrate[c] += frameInfo.bitrate_kbps;
+				decodedFrames[c]++;
+			}
+			chunkDecoded[c] = out - (pcm + chunkOffset[c]);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < std::min(threads, numChunks); i++) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : pool) {
+		t.join();
+	}
+	mp3dec_close_file(&map);
+
+	// stitch: chunks are normally already contiguous, only short ones need moving
+	size_t samples = 0;
+	int frameCount = 0, bitrateSum = 0;
+	for (int c = 0; c < numChunks; c++) {
+		if (samples != chunkOffset[c]) {
+			memmove(pcm + samples, pcm + chunkOffset[c], chunkDecoded[c] * sizeof(mp3d_sample_t));
+		}
+		samples += chunkDecoded[c];
+		if (!info->hz && hz[c]) {
+			info->hz = hz[c];
+			info->layer = layer[c];
+			info->channels = channels[c];
+		}
+		frameCount += decodedFrames[c];
+		bitrateSum += bitrate[c];
+	}
+	if (!samples) {
+		free(pcm);
+		return -1;
+	}
+	if (samples != totalSamples) {
+		pcm = (mp3d_sample_t*)realloc(pcm, samples * sizeof(mp3d_sample_t));
+	}
+	info->buffer = pcm;
+	info->samples = samples;
+	info->avg_bitrate_kbps = bitrateSum / std::max(frameCount, 1);
+	return 0;
+}
+
+// Compares mp3dec_load with LoadMP3Parallel on the given file and prints the timings.
+inline void BenchmarkMP3Load(std::string filename, int threads = 0, int repeat = 3) {
+	using Clock = std::chrono::steady_clock;
+	double single = 1e30, parallel = 1e30;
+	mp3dec_file_info_t reference = {}, result = {};
+	for (int i = 0; i < repeat; i++) {
+		mp3dec_t mp3d;
+		free(reference.buffer);
+		auto t0 = Clock::now();
+		if (mp3dec_load(&mp3d, filename.c_str(), &reference, NULL, NULL)) {
+			printf("mp3dec_load failed: %s\n", filename.c_str());
+			return;
+		}
+		auto t1 = Clock::now();
+		single = std::min(single, std::chrono::duration<double>(t1 - t0).count());
+
+		free(result.buffer);
+		t0 = Clock::now();
+		if (LoadMP3Parallel(filename, &result, threads)) {
+			printf("LoadMP3Parallel failed: %s\n", filename.c_str());
+			free(reference.buffer);
+			return;
+		}
+		t1 = Clock::now();
+		parallel = std::min(parallel, std::chrono::duration<double>(t1 - t0).count());
+	}
+
+	bool exact = reference.samples == result.samples &&
+		memcmp(reference.buffer, result.buffer, reference.samples * sizeof(mp3d_sample_t)) == 0;
+	double seconds = reference.channels ? (double)reference.samples / reference.channels / reference.hz : 0.0;
+	printf("%s: %.1f s of audio, %d threads\n", filename.c_str(), seconds,
+		threads > 0 ? threads : (int)std::thread::hardware_concurrency());
+	printf("  mp3dec_load     %8.3f s (%7.1fx realtime)\n", single, seconds / single);
+	printf("  LoadMP3Parallel %8.3f s (%7.1fx realtime, %.2fx speedup)\n", parallel, seconds / parallel, single / parallel);
+	printf("  output %s\n", exact ? "bit-exact" : "MISMATCH");
+	free(reference.buffer);
+	free(result.buffer);
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "MP3Parallel.h"
+
+// Frame index of an MP3 file for sample accurate seeking, and a sidecar to keep it.
+//
+// mp3dec_ex_open with MP3D_SEEK_TO_SAMPLE walks every frame header of the file on each
+// open and then seeks by a linear search. The index holds the byte offset of every frame
+// and, for layer III, how many frames back its main data starts in the bit reservoir
+// (main_data_begin). Like mp3dec_load_buf it ends at the first change of sample rate,
+// layer or channels, so all frames have the same number of samples: the first sample of
+// a frame is frame * GetFrameSamples() and the frame of a sample is a division.
+//
+// Saved, offsets are varint deltas and reservoir depths one byte each, about three bytes
+// per frame. Load checks the file size and a fingerprint of 64 blocks spread over the
+// file, so reopening a file with its sidecar reads those blocks and nothing else.
+namespace mp3_seek_index_detail {
+	const uint32_t Magic = 0x4b455347u;	// "GSEK"
+	const uint32_t Version = 1;
+	const size_t FingerprintBlock = 4096;
+
+	// FNV-1a over the size and 64 blocks of the file
+	inline uint64_t Fingerprint(const uint8_t* data, size_t size) {
+		uint64_t hash = 1469598103934665603ull;
+		auto mix = [&](const uint8_t* p, size_t n) {
+			for (size_t i = 0; i < n; i++) {
+				hash = (hash ^ p[i]) * 1099511628211ull;
+			}
+		};
+		const uint64_t size64 = size;
+		mix(reinterpret_cast<const uint8_t*>(&size64), sizeof(size64));
+		for (int i = 0; i < 64; i++) {
+			const size_t offset = (size_t)((uint64_t)size * i / 64);
+			mix(data + offset, std::min(FingerprintBlock, size - offset));
+		}
+		return hash;
+	}
+
+	inline int SideInfoBytes(const uint8_t* hdr) {
+		return HDR_TEST_MPEG1(hdr) ? (HDR_IS_MONO(hdr) ? 17 : 32) : (HDR_IS_MONO(hdr) ? 9 : 17);
+	}
+
+	// main data a layer III frame carries: what follows its header, crc and side info
+	inline int MainDataBytes(const uint8_t* hdr, int frameBytes) {
+		return std::max(frameBytes - HDR_SIZE - (HDR_IS_CRC(hdr) ? 2 : 0) - SideInfoBytes(hdr), 0);
+	}
+
+	// bytes before the frame's own main data where it starts reading the reservoir
+	inline int MainDataBegin(const uint8_t* hdr, int frameBytes) {
+		const int side = HDR_SIZE + (HDR_IS_CRC(hdr) ? 2 : 0);
+		if (frameBytes < side + 2) {
+			return 0;
+		}
+		return HDR_TEST_MPEG1(hdr) ? (hdr[side] << 1 | hdr[side + 1] >> 7) : hdr[side];
+	}
+
+	inline void PutVarint(std::vector<uint8_t>& out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t)value);
+	}
+
+	inline bool GetVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+		value = 0;
+		for (int shift = 0; p < end && shift < 64; shift += 7) {
+			const uint8_t byte = *p++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+class MP3SeekIndex {
+public:
+	bool IsValid() const { return !offsets.empty(); }
+	size_t GetFrames() const { return offsets.size(); }
+	int GetChannels() const { return channels; }
+	int GetSampleRate() const { return sampleRate; }
+	int GetLayer() const { return layer; }
+	int GetFrameSamples() const { return frameSamples; }	// per channel
+	int64_t GetSamples() const { return (int64_t)offsets.size() * frameSamples * channels; }	// channels included
+	size_t GetOffset(size_t frame) const { return (size_t)offsets[frame]; }
+	void Clear() {
+		offsets.clear();
+		reservoirFrames.clear();
+		channels = sampleRate = layer = frameSamples = 0;
+		fileSize = fingerprint = 0;
+	}
+
+	// Scans the frame headers of the whole file; false when it has no frames.
+	bool Build(const uint8_t* data, size_t size) {
+		using namespace mp3_seek_index_detail;
+		Clear();
+		std::vector<MP3FrameEntry> frames;
+		mp3dec_iterate_buf(data, size, MP3CollectFrame, &frames);
+		if (frames.empty()) {
+			return false;
+		}
+		const uint8_t* first = data + frames[0].offset;
+		channels = HDR_IS_MONO(first) ? 1 : 2;
+		sampleRate = (int)hdr_sample_rate_hz(first);
+		layer = 4 - HDR_GET_LAYER(first);
+		frameSamples = (int)hdr_frame_samples(first);
+		offsets.resize(frames.size());
+		reservoirFrames.assign(frames.size(), 0);
+		for (size_t i = 0; i < frames.size(); i++) {
+			offsets[i] = frames[i].offset;
+			if (layer != 3) {
+				continue;
+			}
+			// walk back over the main data of earlier frames until main_data_begin is covered
+			const uint8_t* hdr = data + frames[i].offset;
+			int begin = MainDataBegin(hdr, frames[i].bytes);
+			size_t j = i;
+			while (begin > 0 && j > 0 && i - j < 255) {
+				j--;
+				begin -= MainDataBytes(data + frames[j].offset, frames[j].bytes);
+			}
+			reservoirFrames[i] = (uint8_t)(i - j);
+		}
+		fileSize = size;
+		fingerprint = Fingerprint(data, size);
+		return true;
+	}
+
+	// Frame that holds sample (channels included, like PCMAudio positions).
+	size_t FindFrame(int64_t sample) const {
+		if (sample <= 0 || offsets.empty()) {
+			return 0;
+		}
+		return (size_t)std::min<int64_t>(sample / ((int64_t)frameSamples * channels), (int64_t)offsets.size() - 1);
+	}
+
+	// First frame to decode, output dropped, so that frame comes out as in a sequential
+	// decode: the frame before it gets its whole reservoir and, decoded, leaves the MDCT
+	// overlap and synthesis history frame needs.
+	size_t GetWarmupFrame(size_t frame) const {
+		if (frame == 0) {
+			return 0;
+		}
+		return frame - 1 - std::min<size_t>(reservoirFrames[frame - 1], frame - 1);
+	}
+
+	bool Save(const std::string& path) const {
+		using namespace mp3_seek_index_detail;
+		if (!IsValid()) {
+			return false;
+		}
+		std::vector<uint8_t> deltas;
+		deltas.reserve(offsets.size() * 2 + 8);
+		uint64_t previous = 0;
+		for (uint64_t offset : offsets) {
+			PutVarint(deltas, offset - previous);
+			previous = offset;
+		}
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (!fp) {
+			return false;
+		}
+		const uint32_t header[6] = { Magic, Version, (uint32_t)channels, (uint32_t)sampleRate, (uint32_t)layer, (uint32_t)frameSamples };
+		const uint64_t tail[4] = { fileSize, fingerprint, (uint64_t)offsets.size(), (uint64_t)deltas.size() };
+		bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(tail, sizeof(tail), 1, fp) == 1 &&
+			fwrite(deltas.data(), 1, deltas.size(), fp) == deltas.size() &&
+			fwrite(reservoirFrames.data(), 1, reservoirFrames.size(), fp) == reservoirFrames.size();
+		return fclose(fp) == 0 && ok;
+	}
+
+	// Loads an index saved for the same file content; false when there is none or it
+	// belongs to something else.
+	bool Load(const std::string& path, const uint8_t* data, size_t size) {
+		using namespace mp3_seek_index_detail;
+		Clear();
+		FILE* fp = fopen(path.c_str(), "rb");
+		if (!fp) {
+			return false;
+		}
+		uint32_t header[6];
+		uint64_t tail[4];
+		bool ok = fread(header, sizeof(header), 1, fp) == 1 && fread(tail, sizeof(tail), 1, fp) == 1 &&
+			header[0] == Magic && header[1] == Version && (header[2] == 1 || header[2] == 2) &&
+			header[3] > 0 && header[4] >= 1 && header[4] <= 3 && header[5] > 0 && header[5] <= 1152 &&
+			tail[0] == (uint64_t)size && tail[2] > 0 && tail[2] <= size && tail[3] <= (uint64_t)size * 10 &&
+			tail[1] == Fingerprint(data, size);
+		std::vector<uint8_t> deltas;
+		if (ok) {
+			deltas.resize((size_t)tail[3]);
+			offsets.resize((size_t)tail[2]);
+			reservoirFrames.resize((size_t)tail[2]);
+			ok = fread(deltas.data(), 1, deltas.size(), fp) == deltas.size() &&
+				fread(reservoirFrames.data(), 1, reservoirFrames.size(), fp) == reservoirFrames.size();
+		}
+		fclose(fp);
+		const uint8_t* p = deltas.data();
+		const uint8_t* end = p + deltas.size();
+		uint64_t offset = 0, delta;
+		for (size_t i = 0; ok && i < offsets.size(); i++) {
+			ok = GetVarint(p, end, delta) && (i == 0 || delta > 0) && (offset += delta) + HDR_SIZE <= size;
+			offsets[i] = offset;
+		}
+		// the ends must still be frame headers of that format
+		ok = ok && p == end && hdr_valid(data + offsets.front()) && hdr_compare(data + offsets.front(), data + offsets.back());
+		if (!ok) {
+			Clear();
+			return false;
+		}
+		channels = (int)header[2];
+		sampleRate = (int)header[3];
+		layer = (int)header[4];
+		frameSamples = (int)header[5];
+		fileSize = tail[0];
+		fingerprint = tail[1];
+		return true;
+	}
+
+private:
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t> reservoirFrames;	// layer III: frames back to where the main data starts
+	int channels = 0;
+	int sampleRate = 0;
+	int layer = 0;
+	int frameSamples = 0;
+	uint64_t fileSize = 0;
+	uint64_t fingerprint = 0;
+};
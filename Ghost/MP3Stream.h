@@ -0,0 +1,199 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <climits>
+#include "Audio.h"
+#include "SampleQueue.h"
+#include "MP3SeekIndex.h"
+
+// Streaming MP3 source.
+// Frames are decoded by a background thread into a fixed size lock-free queue that runs
+// ahead of the reader, so memory does not depend on the length of the file and the
+// first samples are available as soon as the first frame is decoded.
+// Read is meant for one sequential reader (the player's render thread); reading
+// anywhere else than the next sample seeks the decoder.
+// The file is mapped, not read, and decoded frame by frame through an MP3SeekIndex: with
+// a sidecar of the index, opening touches a few pages, and a seek starts decoding a few
+// frames early and drops their output, so it gives the samples a decode from the start does.
+class MP3StreamAudio : public PCMAudio {
+public:
+	MP3StreamAudio(int queueSamples = 1 << 18) : queue(queueSamples) {}
+	~MP3StreamAudio() {
+		Close();
+	}
+	// indexPath is the sidecar of the frame index: loaded when it belongs to this file,
+	// written after a scan otherwise. Empty scans the file on every load.
+	void LoadFromFile(std::string filename, std::string indexPath = "") {
+		Close();
+		// the sidecar check reads 64 blocks and playback a few KB a second, so the file is
+		// mapped without read-ahead unless it has to be scanned
+		if (!file.Open(filename, false)) {
+			throw std::runtime_error("mp3 failed to load");
+		}
+		if (indexPath.empty() || !index.Load(indexPath, file.GetData(), file.GetSize())) {
+			if (file.Open(filename) && index.Build(file.GetData(), file.GetSize()) && !indexPath.empty()) {
+				index.Save(indexPath);
+			}
+		}
+		if (!index.IsValid()) {
+			file.Close();
+			throw std::runtime_error("mp3 failed to load");
+		}
+		// positions are int: longer files play their first INT_MAX samples
+		const int64_t total = std::min<int64_t>(index.GetSamples(), INT_MAX / index.GetChannels() * index.GetChannels());
+		Initialize(nullptr, index.GetChannels(), 16, index.GetSampleRate(), (int)total);
+		// start like after a seek to 0, so the reader drops whatever a previous file left
+		cursor = 0;
+		seekPosition = 0;
+		requestedSeek++;
+		isQuit = false;
+		isOpen = true;
+		decoder = std::thread(&MP3StreamAudio::DecodeThread, this);
+	}
+	void Close() {
+		if (!isOpen) {
+			return;
+		}
+		isQuit = true;
+		decoder.join();
+		file.Close();
+		index.Clear();
+		isOpen = false;
+	}
+	bool IsValid() override {
+		return isOpen;
+	}
+	// Waits for the decoder when the requested range is not decoded yet.
+	int Read(float* dst, int position, int count) override {
+		if (!isOpen || position < 0 || position >= samples) {
+			return 0;
+		}
+		count = std::min(count, samples - position);
+		if (position != cursor) {
+			const int skip = position - cursor;
+			if (requestedSeek == decodedSeek && skip > 0 && (size_t)skip <= queue.Available()) {
+				queue.Skip(skip);
+				cursor = position;
+			}
+			else {
+				Seek(position);
+			}
+		}
+
+		int copied = 0;
+		while (copied < count) {
+			if (requestedSeek != decodedSeek) {
+				if (!WaitForSeek()) {
+					break;
+				}
+				// the seek lands on the first channel of position
+				while (cursor < position) {
+					if (!Wait()) {
+						return 0;
+					}
+					cursor += (int)queue.Skip(position - cursor);
+				}
+			}
+			int n = (int)queue.Pop(dst + copied, count - copied);
+			copied += n;
+			cursor += n;
+			if (n == 0 && !Wait()) {
+				break;
+			}
+		}
+		return copied;
+	}
+private:
+	// Seeks are handed to the decoder through requestedSeek/seekPosition; the decoder
+	// answers with decodedSeek and the queue position where the new samples start.
+	void Seek(int position) {
+		seekPosition = position - position % channels;
+		requestedSeek++;
+		cursor = position;
+	}
+	bool WaitForSeek() {
+		const int64_t request = requestedSeek;
+		while (decodedSeek != request) {
+			if (isQuit) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		queue.Skip(seekQueuePosition - queue.Popped());
+		cursor = seekPosition;
+		return true;
+	}
+	// Sleeps a little while the queue is empty; false once nothing more will come.
+	bool Wait() {
+		if (queue.Available() > 0) {
+			return true;
+		}
+		if (isQuit || (endSeek == decodedSeek && queue.Available() == 0)) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		return true;
+	}
+
+	// Decodes the frames of the index in order from the warm-up frame of a seek. A frame
+	// that does not decode (warm-up without reservoir, damage) counts as silence, so the
+	// output stays at the sample positions of the index.
+	void DecodeThread() {
+		std::vector<mp3d_sample_t> pcm(MINIMP3_MAX_SAMPLES_PER_FRAME);
+		const size_t frameSamples = (size_t)index.GetFrameSamples() * channels;
+		mp3dec_t mp3d;
+		mp3dec_frame_info_t info = {};
+		size_t frame = 0, skip = 0;
+		int64_t seek = decodedSeek;
+		bool isEnd = false;
+		while (!isQuit) {
+			const int64_t request = requestedSeek;
+			if (request != seek) {
+				const int position = seekPosition;
+				frame = index.GetWarmupFrame(index.FindFrame(position));
+				skip = (size_t)position - frame * frameSamples;
+				mp3dec_init(&mp3d);
+				seek = request;
+				isEnd = false;
+				seekQueuePosition = queue.Pushed();
+				decodedSeek = seek;
+			}
+			if (isEnd || queue.Space() < frameSamples) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			if (frame >= index.GetFrames()) {
+				isEnd = true;
+				endSeek = seek;
+				continue;
+			}
+			const size_t offset = index.GetOffset(frame++);
+			const int bytes = (int)std::min<size_t>(file.GetSize() - offset, INT32_MAX);
+			const int decoded = mp3dec_decode_frame(&mp3d, file.GetData() + offset, bytes, pcm.data(), &info);
+			if ((size_t)decoded * info.channels != frameSamples) {
+				std::fill(pcm.begin(), pcm.begin() + frameSamples, (mp3d_sample_t)0);
+			}
+			const size_t drop = std::min(skip, frameSamples);
+			skip -= drop;
+			queue.Push(pcm.data() + drop, frameSamples - drop);
+		}
+	}
+
+	MappedFile file;
+	MP3SeekIndex index;
+	SampleQueue<float> queue;
+	std::thread decoder;
+	int cursor = 0;								// reader: source position of the next queued sample
+	std::atomic<int> seekPosition{ 0 };
+	std::atomic<int64_t> requestedSeek{ 0 };	// reader -> decoder
+	std::atomic<int64_t> decodedSeek{ 0 };		// decoder -> reader
+	std::atomic<size_t> seekQueuePosition{ 0 };	// queue position where decodedSeek starts
+	std::atomic<int64_t> endSeek{ -1 };			// seek whose samples have all been queued
+	std::atomic<bool> isQuit{ false };
+	bool isOpen = false;
+};
@@ -0,0 +1,473 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. Pages are only read from disk when touched,
+// so opening is instant and resident memory follows what is actually accessed.
+// A 32 bit process can only map files that fit in its address space.
+// isSequential asks the OS for aggressive read-ahead, otherwise for none at all, which
+// suits files that are only probed here and there.
+class MappedFile {
+public:
+	MappedFile() {}
+	~MappedFile() {
+		Close();
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& filename, bool isSequential = true) {
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, isSequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (uint64_t)fileSize.QuadPart > (uint64_t)SIZE_MAX) {
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		size = (size_t)fileSize.QuadPart;
+#else
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+			Close();
+			return false;
+		}
+		void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		data = view == MAP_FAILED ? nullptr : (const uint8_t*)view;
+		size = (size_t)st.st_size;
+		if (data) {
+			madvise(view, size, isSequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+		}
+#endif
+		if (!data) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+	void Close() {
+#ifdef _WIN32
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data) {
+			munmap((void*)data, size);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+	bool IsOpen() const { return data != nullptr; }
+	const uint8_t* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+enum class SampleFormat {
+	UInt8,		// WAV 8 bit, offset binary
+	Int8,		// AIFF 8 bit
+	Int16,
+	Int24,		// packed in 3 bytes
+	Int32,
+	Float32,
+};
+
+// tag type for packed 24 bit samples in SampleView
+struct Int24 {};
+
+namespace mapped_detail {
+	template <class T> struct SampleType {
+		typedef T Value;
+		static const size_t Bytes = sizeof(T);
+		static T Load(const uint8_t* p, bool isBigEndian) {
+			uint8_t bytes[sizeof(T)];
+			for (size_t i = 0; i < sizeof(T); i++) {
+				bytes[i] = isBigEndian ? p[sizeof(T) - 1 - i] : p[i];
+			}
+			T value;
+			memcpy(&value, bytes, sizeof(T));
+			return value;
+		}
+	};
+	template <> struct SampleType<Int24> {
+		typedef int32_t Value;
+		static const size_t Bytes = 3;
+		static int32_t Load(const uint8_t* p, bool isBigEndian) {
+			const uint32_t v = isBigEndian ?
+				((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) :
+				((uint32_t)p[2] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 8);
+			return (int32_t)v >> 8;
+		}
+	};
+
+	inline uint16_t Read16(const uint8_t* p, bool isBigEndian) {
+		return isBigEndian ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+	}
+	inline uint32_t Read32(const uint8_t* p, bool isBigEndian) {
+		return isBigEndian ?
+			(uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3] :
+			(uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+	}
+	inline uint64_t Read64(const uint8_t* p) {
+		return (uint64_t)Read32(p + 4, false) << 32 | Read32(p, false);
+	}
+	// Wave64 chunk ids: the RIFF four character code followed by a fixed GUID tail
+	inline bool IsGuid(const uint8_t* p, const char* id) {
+		static const uint8_t riff[12] = { 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 };
+		static const uint8_t other[12] = { 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+		return memcmp(p, id, 4) == 0 && memcmp(p + 4, memcmp(id, "riff", 4) == 0 ? riff : other, 12) == 0;
+	}
+	// 80 bit IEEE extended, the AIFF sample rate
+	inline double ReadExtended(const uint8_t* p) {
+		const int exponent = ((p[0] & 0x7F) << 8 | p[1]) - 16383 - 63;
+		uint64_t mantissa = 0;
+		for (int i = 0; i < 8; i++) {
+			mantissa = mantissa << 8 | p[2 + i];
+		}
+		const double value = std::ldexp((double)mantissa, exponent);
+		return (p[0] & 0x80) ? -value : value;
+	}
+}
+
+// Zero copy view of the interleaved samples of a MappedAudioFile, T being the stored
+// type (uint8_t, int8_t, int16_t, Int24, int32_t or float). Elements are loaded with
+// byte order handled, so views of big endian AIFF data work the same.
+template <class T>
+class SampleView {
+public:
+	typedef typename mapped_detail::SampleType<T>::Value Value;
+	SampleView(const uint8_t* data, size_t count, bool isBigEndian) : data(data), count(count), isBigEndian(isBigEndian) {}
+	size_t Size() const { return count; }
+	Value operator[](size_t index) const {
+		return mapped_detail::SampleType<T>::Load(data + index * mapped_detail::SampleType<T>::Bytes, isBigEndian);
+	}
+private:
+	const uint8_t* data;
+	size_t count;
+	bool isBigEndian;
+};
+
+// WAV (PCM, IEEE float, extensible; RIFF, RF64/BW64 and Sony Wave64) or AIFF/AIFC (NONE, twos, sowt, fl32) opened through
+// a memory mapping. Only the headers are parsed on Open; samples stay in the file until
+// they are read, either through a typed SampleView or converted to float block by block
+// by Read. Read only touches the mapping, so any number of threads may call it.
+class MappedAudioFile {
+public:
+	void Open(const std::string& filename) {
+		Close();
+		if (!file.Open(filename)) {
+			throw std::runtime_error("failed to map " + filename);
+		}
+		const uint8_t* p = file.GetData();
+		const size_t size = file.GetSize();
+		bool isParsed = false;
+		if (size >= 12 && (memcmp(p, "RIFF", 4) == 0 || memcmp(p, "RF64", 4) == 0 || memcmp(p, "BW64", 4) == 0) && memcmp(p + 8, "WAVE", 4) == 0) {
+			isParsed = ParseWave(p, size);
+		}
+		else if (size >= 40 && mapped_detail::IsGuid(p, "riff") && mapped_detail::IsGuid(p + 24, "wave")) {
+			isParsed = ParseWave64(p, size);
+		}
+		else if (size >= 12 && memcmp(p, "FORM", 4) == 0 && (memcmp(p + 8, "AIFF", 4) == 0 || memcmp(p + 8, "AIFC", 4) == 0)) {
+			isParsed = ParseAiff(p, size, memcmp(p + 8, "AIFC", 4) == 0);
+		}
+		if (!isParsed) {
+			Close();
+			throw std::runtime_error("unsupported audio file " + filename);
+		}
+	}
+	void Close() {
+		file.Close();
+		samples = nullptr;
+		frames = 0;
+		channels = 0;
+	}
+	bool IsOpen() const { return samples != nullptr; }
+
+	int GetChannels() const { return channels; }
+	int GetSampleRate() const { return sampleRate; }
+	int GetBitDepth() const { return bitDepth; }
+	int64_t GetFrames() const { return frames; }
+	SampleFormat GetSampleFormat() const { return format; }
+	bool IsBigEndian() const { return isBigEndian; }
+	// interleaved sample data inside the mapping
+	const uint8_t* GetData() const { return samples; }
+
+	// throws when T is not the stored type
+	template <class T>
+	SampleView<T> GetView() const {
+		if (!Matches<T>()) {
+			throw std::runtime_error("sample view does not match the file format");
+		}
+		return SampleView<T>(samples, (size_t)frames * channels, isBigEndian);
+	}
+
+	// Converts count interleaved samples starting at sample position to float in
+	// [-1, 1). Returns the number of samples written.
+	int64_t Read(float* dst, int64_t position, int64_t count) const {
+		const int64_t total = frames * channels;
+		if (!samples || position < 0 || position >= total) {
+			return 0;
+		}
+		count = std::min(count, total - position);
+		const uint8_t* src = samples + (size_t)position * (bitDepth / 8);
+		switch (format)
+		{
+		case SampleFormat::UInt8:
+			for (int64_t i = 0; i < count; i++) {
+				dst[i] = ((int)src[i] - 128) * (1.0f / 128.0f);
+			}
+			break;
+		case SampleFormat::Int8:
+			for (int64_t i = 0; i < count; i++) {
+				dst[i] = (int8_t)src[i] * (1.0f / 128.0f);
+			}
+			break;
+		case SampleFormat::Int16:
+			Convert<int16_t>(src, dst, count, 1.0f / 32768.0f);
+			break;
+		case SampleFormat::Int24:
+			Convert<Int24>(src, dst, count, 1.0f / 8388608.0f);
+			break;
+		case SampleFormat::Int32:
+			Convert<int32_t>(src, dst, count, 1.0f / 2147483648.0f);
+			break;
+		case SampleFormat::Float32:
+			if (isBigEndian) {
+				Convert<float>(src, dst, count, 1.0f);
+			}
+			else {
+				memcpy(dst, src, (size_t)count * sizeof(float));
+			}
+			break;
+		}
+		return count;
+	}
+
+private:
+	template <class T>
+	bool Matches() const {
+		switch (format)
+		{
+		case SampleFormat::UInt8: return std::is_same<T, uint8_t>::value;
+		case SampleFormat::Int8: return std::is_same<T, int8_t>::value;
+		case SampleFormat::Int16: return std::is_same<T, int16_t>::value;
+		case SampleFormat::Int24: return std::is_same<T, Int24>::value;
+		case SampleFormat::Int32: return std::is_same<T, int32_t>::value;
+		case SampleFormat::Float32: return std::is_same<T, float>::value;
+		}
+		return false;
+	}
+	// the byte order test is outside the loop, so the little endian case vectorizes
+	template <class T>
+	void Convert(const uint8_t* src, float* dst, int64_t count, float scale) const {
+		typedef mapped_detail::SampleType<T> Type;
+		if (isBigEndian) {
+			for (int64_t i = 0; i < count; i++) {
+				dst[i] = (float)Type::Load(src + i * Type::Bytes, true) * scale;
+			}
+		}
+		else {
+			for (int64_t i = 0; i < count; i++) {
+				dst[i] = (float)Type::Load(src + i * Type::Bytes, false) * scale;
+			}
+		}
+	}
+
+	bool SetFormat(int formatTag, int bits) {
+		bitDepth = bits;
+		if (formatTag == 3 && bits == 32) {
+			format = SampleFormat::Float32;
+			return true;
+		}
+		if (formatTag != 1) {
+			return false;
+		}
+		switch (bits)
+		{
+		case 8: format = isBigEndian ? SampleFormat::Int8 : SampleFormat::UInt8; return true;
+		case 16: format = SampleFormat::Int16; return true;
+		case 24: format = SampleFormat::Int24; return true;
+		case 32: format = SampleFormat::Int32; return true;
+		}
+		return false;
+	}
+	// data of at most available bytes starting at offset; a size past the end of the file
+	// (an unfinished recording) is cut to what is there
+	bool SetData(const uint8_t* base, size_t offset, uint64_t dataSize, size_t fileSize) {
+		if (channels <= 0 || sampleRate <= 0 || offset > fileSize) {
+			return false;
+		}
+		dataSize = std::min<uint64_t>(dataSize, fileSize - offset);
+		samples = base + offset;
+		frames = (int64_t)(dataSize / ((size_t)channels * (bitDepth / 8)));
+		return true;
+	}
+
+	// WAVEFORMATEX or WAVEFORMATEXTENSIBLE
+	bool ParseFormat(const uint8_t* chunk, uint64_t chunkSize) {
+		using namespace mapped_detail;
+		int formatTag = Read16(chunk, false);
+		channels = Read16(chunk + 2, false);
+		sampleRate = (int)Read32(chunk + 4, false);
+		const int bits = Read16(chunk + 14, false);
+		// WAVE_FORMAT_EXTENSIBLE: the real tag starts the sub format GUID
+		if (formatTag == 0xFFFE && chunkSize >= 40) {
+			formatTag = Read16(chunk + 24, false);
+		}
+		return SetFormat(formatTag, bits);
+	}
+
+	// RIFF, or RF64/BW64 where a ds64 chunk right after WAVE holds the 64 bit data size
+	// and the 32 bit one is 0xFFFFFFFF
+	bool ParseWave(const uint8_t* p, size_t size) {
+		using namespace mapped_detail;
+		isBigEndian = false;
+		bool hasFormat = false;
+		uint64_t dataSize64 = 0;
+		for (size_t offset = 12; offset + 8 <= size; ) {
+			const uint32_t chunkSize = Read32(p + offset + 4, false);
+			const uint8_t* chunk = p + offset + 8;
+			const bool isComplete = offset + 8 + (uint64_t)chunkSize <= size;
+			if (memcmp(p + offset, "ds64", 4) == 0 && chunkSize >= 24 && isComplete) {
+				dataSize64 = Read64(chunk + 8);
+			}
+			else if (memcmp(p + offset, "fmt ", 4) == 0 && chunkSize >= 16 && isComplete) {
+				if (!ParseFormat(chunk, chunkSize)) {
+					return false;
+				}
+				hasFormat = true;
+			}
+			else if (memcmp(p + offset, "data", 4) == 0) {
+				return hasFormat && SetData(p, offset + 8, chunkSize == 0xFFFFFFFF && dataSize64 ? dataSize64 : chunkSize, size);
+			}
+			offset += 8 + (size_t)chunkSize + (chunkSize & 1);
+		}
+		return false;
+	}
+
+	// Sony Wave64: GUID chunk ids, 64 bit sizes that include the 24 byte chunk header,
+	// chunks aligned to 8 bytes
+	bool ParseWave64(const uint8_t* p, size_t size) {
+		using namespace mapped_detail;
+		isBigEndian = false;
+		bool hasFormat = false;
+		for (size_t offset = 40; offset + 24 <= size; ) {
+			const uint64_t chunkSize = Read64(p + offset + 16);
+			if (chunkSize < 24) {
+				return false;
+			}
+			const uint8_t* chunk = p + offset + 24;
+			if (IsGuid(p + offset, "fmt ") && chunkSize >= 24 + 16 && offset + chunkSize <= size) {
+				if (!ParseFormat(chunk, chunkSize - 24)) {
+					return false;
+				}
+				hasFormat = true;
+			}
+			else if (IsGuid(p + offset, "data")) {
+				return hasFormat && SetData(p, offset + 24, chunkSize - 24, size);
+			}
+			if (chunkSize > size - offset) {
+				return false;
+			}
+			offset += (size_t)((chunkSize + 7) / 8 * 8);
+		}
+		return false;
+	}
+
+	bool ParseAiff(const uint8_t* p, size_t size, bool isAifc) {
+		using namespace mapped_detail;
+		isBigEndian = true;
+		bool hasFormat = false;
+		for (size_t offset = 12; offset + 8 <= size; ) {
+			const uint32_t chunkSize = Read32(p + offset + 4, true);
+			const uint8_t* chunk = p + offset + 8;
+			if (memcmp(p + offset, "COMM", 4) == 0 && chunkSize >= 18 && offset + 8 + 18 <= size) {
+				channels = Read16(chunk, true);
+				const int bits = Read16(chunk + 6, true);
+				sampleRate = (int)std::lround(ReadExtended(chunk + 8));
+				int formatTag = 1;
+				if (isAifc && chunkSize >= 22 && offset + 8 + 22 <= size) {
+					const uint8_t* compression = chunk + 18;
+					if (memcmp(compression, "sowt", 4) == 0) {
+						isBigEndian = false;
+					}
+					else if (memcmp(compression, "fl32", 4) == 0 || memcmp(compression, "FL32", 4) == 0) {
+						formatTag = 3;
+					}
+					else if (memcmp(compression, "NONE", 4) != 0 && memcmp(compression, "twos", 4) != 0) {
+						return false;
+					}
+				}
+				if (!SetFormat(formatTag, bits)) {
+					return false;
+				}
+				// 8 bit AIFF is signed even when stored little endian
+				if (bits == 8) {
+					format = SampleFormat::Int8;
+				}
+				hasFormat = true;
+			}
+			else if (memcmp(p + offset, "SSND", 4) == 0 && chunkSize >= 8 && offset + 16 <= size) {
+				const uint32_t dataOffset = Read32(chunk, true);
+				return hasFormat && chunkSize >= 8 + dataOffset && SetData(p, offset + 16 + dataOffset, chunkSize - 8 - dataOffset, size);
+			}
+			offset += 8 + (size_t)chunkSize + (chunkSize & 1);
+		}
+		return false;
+	}
+
+	MappedFile file;
+	const uint8_t* samples = nullptr;
+	int64_t frames = 0;
+	int channels = 0;
+	int sampleRate = 0;
+	int bitDepth = 0;
+	SampleFormat format = SampleFormat::Int16;
+	bool isBigEndian = false;
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOISE_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Deterministic noise addressed by sample index.
+//
+// Every value comes from Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy
+// as 1, 2, 3", SC 2011), a counter based generator: sample n of stream s under seed k is
+// word n % 4 of Philox(counter = { n / 4, s }, key = k). Nothing carries over from one
+// sample to the next, so any block can be generated on its own, on any thread, and gives
+// the samples a sequential run would. With SSE2 four counters (16 samples) are done per
+// step.
+//
+// NoiseGenerator shapes it (mono):
+//   White   uniform in [-1, 1)
+//   Pink    Voss-McCartney with 16 rows, row k held for 2^(k + 1) samples and read from
+//           its own stream, so it is exact at any index too; -3 dB per octave from
+//           about 1 Hz, in [-1, 1)
+//   Brown   white noise through a leaky integrator at 10 Hz, -6 dB per octave above
+//           that, RMS about 0.25. A seek runs the integrator over the 16384 samples
+//           before the new position, which matches a sequential run to float rounding.
+//   Velvet  one impulse of +1 or -1 at a random position in every cell of
+//           sampleRate / density samples, zero elsewhere
+enum class NoiseShape {
+	White,
+	Pink,
+	Brown,
+	Velvet,
+};
+
+namespace noise_detail {
+	const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+	const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+	const int PinkRows = 16;
+	const int BrownWarmUp = 16384;
+
+	// Philox4x32-10 on one counter, in place
+	inline void Philox(uint32_t x[4], uint64_t seed) {
+		uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+		for (int round = 0; round < 10; round++) {
+			const uint64_t p0 = (uint64_t)M0 * x[0];
+			const uint64_t p1 = (uint64_t)M1 * x[2];
+			const uint32_t y0 = (uint32_t)(p1 >> 32) ^ x[1] ^ k0;
+			const uint32_t y2 = (uint32_t)(p0 >> 32) ^ x[3] ^ k1;
+			x[0] = y0;
+			x[1] = (uint32_t)p1;
+			x[2] = y2;
+			x[3] = (uint32_t)p0;
+			k0 += W0;
+			k1 += W1;
+		}
+	}
+	inline void Block(uint32_t out[4], uint64_t counter, uint32_t stream, uint64_t seed) {
+		out[0] = (uint32_t)counter;
+		out[1] = (uint32_t)(counter >> 32);
+		out[2] = stream;
+		out[3] = 0;
+		Philox(out, seed);
+	}
+
+#if NOISE_HAVE_SSE2
+	// 32x32 bit products of four lanes with m, split into high and low words
+	inline void MulHiLo(__m128i a, __m128i m, __m128i& hi, __m128i& lo) {
+		const __m128i even = _mm_mul_epu32(a, m);
+		const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+		const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+		lo = _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi64(odd, 32));
+		hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low, odd));
+	}
+	// Philox on the counters counter .. counter + 3 at once; word j of counter i lands in
+	// out[i * 4 + j], the order of the samples
+	inline void Block4(uint32_t* out, uint64_t counter, uint32_t stream, uint64_t seed) {
+		__m128i x0 = _mm_set_epi32((int)(uint32_t)(counter + 3), (int)(uint32_t)(counter + 2), (int)(uint32_t)(counter + 1), (int)(uint32_t)counter);
+		__m128i x1 = _mm_set_epi32((int)(uint32_t)((counter + 3) >> 32), (int)(uint32_t)((counter + 2) >> 32), (int)(uint32_t)((counter + 1) >> 32), (int)(uint32_t)(counter >> 32));
+		__m128i x2 = _mm_set1_epi32((int)stream);
+		__m128i x3 = _mm_setzero_si128();
+		const __m128i m0 = _mm_set1_epi32((int)M0), m1 = _mm_set1_epi32((int)M1);
+		uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+		for (int round = 0; round < 10; round++) {
+			__m128i hi0, lo0, hi1, lo1;
+			MulHiLo(x0, m0, hi0, lo0);
+			MulHiLo(x2, m1, hi1, lo1);
+			x0 = _mm_xor_si128(_mm_xor_si128(hi1, x1), _mm_set1_epi32((int)k0));
+			x1 = lo1;
+			x2 = _mm_xor_si128(_mm_xor_si128(hi0, x3), _mm_set1_epi32((int)k1));
+			x3 = lo0;
+			k0 += W0;
+			k1 += W1;
+		}
+		// transpose, so that every counter's four words are contiguous
+		const __m128i t0 = _mm_unpacklo_epi32(x0, x1);
+		const __m128i t1 = _mm_unpacklo_epi32(x2, x3);
+		const __m128i t2 = _mm_unpackhi_epi32(x0, x1);
+		const __m128i t3 = _mm_unpackhi_epi32(x2, x3);
+		_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi64(t2, t3));
+	}
+#endif
+
+	// raw words of samples index .. index + count - 1
+	inline void Fill(uint32_t* out, uint64_t index, size_t count, uint32_t stream, uint64_t seed) {
+		uint32_t words[16];
+		while (count > 0) {
+			const size_t offset = (size_t)(index % 4);
+#if NOISE_HAVE_SSE2
+			if (offset == 0 && count >= 16) {
+				Block4(out, index / 4, stream, seed);
+				out += 16;
+				index += 16;
+				count -= 16;
+				continue;
+			}
+#endif
+			Block(words, index / 4, stream, seed);
+			const size_t n = std::min(count, 4 - offset);
+			memcpy(out, words + offset, n * sizeof(uint32_t));
+			out += n;
+			index += n;
+			count -= n;
+		}
+	}
+
+	// the top 24 bits as a signed value, so that the float is exact and stays below 1
+	inline int32_t Signed(uint32_t word) {
+		return (int32_t)word >> 8;
+	}
+	inline void ToFloat(const uint32_t* in, float* out, size_t count, float scale) {
+		size_t i = 0;
+#if NOISE_HAVE_SSE2
+		const __m128 s = _mm_set1_ps(scale);
+		for (; i + 4 <= count; i += 4) {
+			const __m128i w = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(in + i)), 8);
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(w), s));
+		}
+#endif
+		for (; i < count; i++) {
+			out[i] = (float)Signed(in[i]) * scale;
+		}
+	}
+}
+
+// Sample index of a white noise stream, uniform in [-1, 1).
+inline float NoiseValue(uint64_t seed, uint32_t stream, uint64_t index) {
+	uint32_t words[4];
+	noise_detail::Block(words, index / 4, stream, seed);
+	return (float)noise_detail::Signed(words[index % 4]) * (1.0f / 8388608.0f);
+}
+
+// Fills out with white noise samples index .. index + count - 1 of a stream.
+inline void FillNoise(float* out, uint64_t index, size_t count, uint32_t stream = 0, uint64_t seed = 0) {
+	uint32_t words[256];
+	while (count > 0) {
+		const size_t n = std::min<size_t>(count, 256);
+		noise_detail::Fill(words, index, n, stream, seed);
+		noise_detail::ToFloat(words, out, n, 1.0f / 8388608.0f);
+		out += n;
+		index += n;
+		count -= n;
+	}
+}
+
+class NoiseGenerator {
+public:
+	// density: impulses per second of velvet noise
+	NoiseGenerator(NoiseShape shape = NoiseShape::White, uint64_t seed = 0, int sampleRate = 44100, float density = 2000.0f)
+		: shape(shape), seed(seed), sampleRate(sampleRate), density(density) {
+		Seek(0);
+	}
+	NoiseShape GetShape() const { return shape; }
+	int64_t GetPosition() const { return position; }
+	void Seek(int64_t frame) {
+		position = std::max<int64_t>(frame, 0);
+		if (shape == NoiseShape::Brown) {
+			const int64_t from = std::max<int64_t>(position - noise_detail::BrownWarmUp, 0);
+			std::vector<float> warmUp((size_t)(position - from));
+			brown = 0.0;
+			position = from;
+			Brown(warmUp.data(), (int)warmUp.size());
+		}
+	}
+	// the next frames samples
+	void Generate(float* out, int frames) {
+		if (frames <= 0) {
+			return;
+		}
+		switch (shape) {
+		case NoiseShape::White:
+			FillNoise(out, (uint64_t)position, (size_t)frames, 0, seed);
+			position += frames;
+			break;
+		case NoiseShape::Pink:
+			Pink(out, frames);
+			break;
+		case NoiseShape::Brown:
+			Brown(out, frames);
+			break;
+		case NoiseShape::Velvet:
+			Velvet(out, frames);
+			break;
+		}
+	}
+
+private:
+	// Row k changes at the samples n = 2^k (mod 2^(k + 1)) and holds word (n + 2^k) >> (k + 1)
+	// of stream k + 1; stream 0 adds white noise on every sample. Exactly one row changes
+	// per sample, so a running integer sum is exact.
+	void Pink(float* out, int frames) {
+		using namespace noise_detail;
+		const uint64_t first = (uint64_t)position;
+		const uint64_t last = first + frames - 1;
+		words.resize((size_t)frames * 2 + PinkRows * 2);
+		uint32_t* white = words.data();
+		Fill(white, first, (size_t)frames, 0, seed);
+		uint32_t* rows[PinkRows];
+		uint64_t bases[PinkRows];
+		uint32_t* next = white + frames;
+		for (int k = 0; k < PinkRows; k++) {
+			const uint64_t half = (uint64_t)1 << k;
+			bases[k] = (first + half) >> (k + 1);
+			const size_t count = (size_t)(((last + half) >> (k + 1)) - bases[k] + 1);
+			rows[k] = next;
+			Fill(rows[k], bases[k], count, (uint32_t)(k + 1), seed);
+			next += count;
+		}
+		int32_t values[PinkRows];
+		int32_t sum = 0;
+		for (int k = 0; k < PinkRows; k++) {
+			values[k] = Signed(rows[k][0]);
+			sum += values[k];
+		}
+		const float scale = 1.0f / (8388608.0f * (PinkRows + 1));
+		for (int i = 0; i < frames; i++) {
+			const uint64_t n = first + i;
+			if (i > 0) {
+				int k = 0;
+				while (k < PinkRows && !((n >> k) & 1)) {
+					k++;
+				}
+				if (k < PinkRows) {
+					const int32_t value = Signed(rows[k][((n + ((uint64_t)1 << k)) >> (k + 1)) - bases[k]]);
+					sum += value - values[k];
+					values[k] = value;
+				}
+			}
+			out[i] = (float)(sum + Signed(white[i])) * scale;
+		}
+		position += frames;
+	}
+	void Brown(float* out, int frames) {
+		const double a = std::exp(-2.0 * 3.14159265358979323846 * 10.0 / sampleRate);
+		// white noise has an RMS of 1 / sqrt(3); the integrator's gain is 1 / sqrt(1 - a^2)
+		const double gain = 0.25 * std::sqrt(3.0) * std::sqrt(1.0 - a * a);
+		FillNoise(out, (uint64_t)position, (size_t)frames, 0, seed);
+		double y = brown;
+		for (int i = 0; i < frames; i++) {
+			y = a * y + gain * out[i];
+			out[i] = (float)y;
+		}
+		brown = y;
+		position += frames;
+	}
+	void Velvet(float* out, int frames) {
+		std::fill(out, out + frames, 0.0f);
+		const double cell = std::max((double)sampleRate / std::max((double)density, 1e-3), 1.0);
+		const int64_t end = position + frames;
+		for (int64_t m = (int64_t)std::floor(position / cell); (double)m * cell < (double)end; m++) {
+			uint32_t w[4];
+			noise_detail::Block(w, (uint64_t)m, 1, seed);
+			const int64_t at = (int64_t)std::floor(((double)m + (w[0] >> 8) * (1.0 / 16777216.0)) * cell);
+			if (at >= position && at < end) {
+				out[at - position] = (w[1] & 1) ? 1.0f : -1.0f;
+			}
+		}
+		position = end;
+	}
+
+	NoiseShape shape;
+	uint64_t seed;
+	int sampleRate;
+	float density;
+	int64_t position = 0;
+	double brown = 0.0;
+	std::vector<uint32_t> words;
+};
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OSCILLATOR_BANK_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Band-limited oscillators for many voices at once.
+//
+// Saw and square are corrected with PolyBLEP and triangle with PolyBLAMP, the two sample
+// polynomial residuals of a step and of a corner, which take the aliasing of the naive
+// waveforms down by 10-15 dB at a fraction of the cost of minBLEP tables. Sine is an odd
+// polynomial over a quarter cycle (error below 1e-6), so no sinf is called per sample.
+//
+// OscillatorBank keeps its voices as structure of arrays, one set per waveform padded to
+// OSCILLATOR_BANK_LANES voices, and renders a group of lanes per frame: with SSE2 four
+// lanes per register, otherwise through branch free lane loops. Every lane mixes into its
+// own column of a scratch block, which is summed once per block, so there is no
+// horizontal reduction per sample.
+#ifndef OSCILLATOR_BANK_LANES
+#define OSCILLATOR_BANK_LANES 16
+#endif
+
+enum class OscillatorWaveform {
+	Sine,
+	Saw,
+	Square,
+	Triangle,
+};
+
+namespace oscillator_detail {
+	const int Lanes = OSCILLATOR_BANK_LANES;
+	const int Waveforms = 4;
+	const float Pi = 3.14159265358979323846f;
+
+	// sin(2 pi p) for p in [0, 1): folded onto [-1/4, 1/4] and evaluated as a degree 11
+	// Taylor polynomial, error below 1e-6
+	inline float SinCycle(float p) {
+		float u = p + 0.25f;
+		u -= u >= 1.0f ? 1.0f : 0.0f;
+		const float x = (0.25f - std::fabs(u - 0.5f)) * (2.0f * Pi);
+		const float x2 = x * x;
+		return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f +
+			x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+	}
+	// Residual of a band-limited step from -1 to 1 at phase 0, for phase p, increment dt
+	// and inverse = 1 / dt (0 for a voice that does not move).
+	inline float PolyBlep(float p, float dt, float inverse) {
+		const float a = p * inverse;
+		const float b = (p - 1.0f) * inverse;
+		return p < dt ? a + a - a * a - 1.0f : (p > 1.0f - dt ? b * b + b + b + 1.0f : 0.0f);
+	}
+	// Residual of a band-limited corner whose slope grows by 2 per sample, the integral of
+	// PolyBlep.
+	inline float PolyBlamp(float p, float dt, float inverse) {
+		const float a = p * inverse - 1.0f;
+		const float b = (p - 1.0f) * inverse + 1.0f;
+		return p < dt ? a * a * a * (-1.0f / 3.0f) : (p > 1.0f - dt ? b * b * b * (1.0f / 3.0f) : 0.0f);
+	}
+	inline float Half(float p) {
+		const float h = p + 0.5f;
+		return h >= 1.0f ? h - 1.0f : h;
+	}
+
+	// one sample of waveform W at phase p in [0, 1), branch free
+	template <int W>
+	inline float Wave(float p, float dt, float inverse) {
+		switch ((OscillatorWaveform)W) {
+		case OscillatorWaveform::Sine:
+			return SinCycle(p);
+		case OscillatorWaveform::Saw:
+			return p * 2.0f - 1.0f - PolyBlep(p, dt, inverse);
+		case OscillatorWaveform::Square:
+			return (p < 0.5f ? 1.0f : -1.0f) + PolyBlep(p, dt, inverse) - PolyBlep(Half(p), dt, inverse);
+		default:
+			// the slope turns by -8 dt at phase 0 and by +8 dt at one half, 4 dt residuals
+			return std::fabs(p - 0.5f) * 4.0f - 1.0f + 4.0f * dt * (PolyBlamp(Half(p), dt, inverse) - PolyBlamp(p, dt, inverse));
+		}
+	}
+	inline float Wave(OscillatorWaveform waveform, float p, float dt, float inverse) {
+		switch (waveform) {
+		case OscillatorWaveform::Sine: return Wave<0>(p, dt, inverse);
+		case OscillatorWaveform::Saw: return Wave<1>(p, dt, inverse);
+		case OscillatorWaveform::Square: return Wave<2>(p, dt, inverse);
+		default: return Wave<3>(p, dt, inverse);
+		}
+	}
+
+#if OSCILLATOR_BANK_HAVE_SSE2
+	// The same functions on four lanes; comparisons give masks instead of branches.
+	inline __m128 Select(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+	inline __m128 Wrap4(__m128 p) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		return _mm_sub_ps(p, _mm_and_ps(_mm_cmpge_ps(p, one), one));
+	}
+	inline __m128 Abs4(__m128 x) {
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+	inline __m128 SinCycle4(__m128 p) {
+		const __m128 u = Wrap4(_mm_add_ps(p, _mm_set1_ps(0.25f)));
+		const __m128 x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(0.25f), Abs4(_mm_sub_ps(u, _mm_set1_ps(0.5f)))), _mm_set1_ps(2.0f * Pi));
+		const __m128 x2 = _mm_mul_ps(x, x);
+		__m128 y = _mm_set1_ps(-1.0f / 39916800.0f);
+		y = _mm_add_ps(_mm_mul_ps(y, x2), _mm_set1_ps(1.0f / 362880.0f));
+		y = _mm_add_ps(_mm_mul_ps(y, x2), _mm_set1_ps(-1.0f / 5040.0f));
+		y = _mm_add_ps(_mm_mul_ps(y, x2), _mm_set1_ps(1.0f / 120.0f));
+		y = _mm_add_ps(_mm_mul_ps(y, x2), _mm_set1_ps(-1.0f / 6.0f));
+		y = _mm_add_ps(_mm_mul_ps(y, x2), _mm_set1_ps(1.0f));
+		return _mm_mul_ps(y, x);
+	}
+	inline __m128 PolyBlep4(__m128 p, __m128 dt, __m128 inverse) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 a = _mm_mul_ps(p, inverse);
+		const __m128 b = _mm_mul_ps(_mm_sub_ps(p, one), inverse);
+		const __m128 before = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(a, a), _mm_mul_ps(a, a)), one);
+		const __m128 after = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b, b), _mm_add_ps(b, b)), one);
+		return _mm_add_ps(_mm_and_ps(_mm_cmplt_ps(p, dt), before), _mm_and_ps(_mm_cmpgt_ps(p, _mm_sub_ps(one, dt)), after));
+	}
+	inline __m128 PolyBlamp4(__m128 p, __m128 dt, __m128 inverse) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+		const __m128 a = _mm_sub_ps(_mm_mul_ps(p, inverse), one);
+		const __m128 b = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(p, one), inverse), one);
+		const __m128 before = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(a, a), a), _mm_set1_ps(-1.0f / 3.0f));
+		const __m128 after = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(b, b), b), third);
+		return _mm_add_ps(_mm_and_ps(_mm_cmplt_ps(p, dt), before), _mm_and_ps(_mm_cmpgt_ps(p, _mm_sub_ps(one, dt)), after));
+	}
+	template <int W>
+	inline __m128 Wave4(__m128 p, __m128 dt, __m128 inverse) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		switch ((OscillatorWaveform)W) {
+		case OscillatorWaveform::Sine:
+			return SinCycle4(p);
+		case OscillatorWaveform::Saw:
+			return _mm_sub_ps(_mm_sub_ps(_mm_add_ps(p, p), one), PolyBlep4(p, dt, inverse));
+		case OscillatorWaveform::Square: {
+			const __m128 naive = Select(_mm_cmplt_ps(p, half), one, _mm_set1_ps(-1.0f));
+			return _mm_sub_ps(_mm_add_ps(naive, PolyBlep4(p, dt, inverse)), PolyBlep4(Wrap4(_mm_add_ps(p, half)), dt, inverse));
+		}
+		default: {
+			const __m128 naive = _mm_sub_ps(_mm_mul_ps(Abs4(_mm_sub_ps(p, half)), _mm_set1_ps(4.0f)), one);
+			const __m128 corners = _mm_sub_ps(PolyBlamp4(Wrap4(_mm_add_ps(p, half)), dt, inverse), PolyBlamp4(p, dt, inverse));
+			return _mm_add_ps(naive, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), dt), corners));
+		}
+		}
+	}
+#endif
+
+	// increment in cycles per sample, kept below Nyquist where the residuals stop working
+	inline float ClampIncrement(float cycles) {
+		return std::min(std::max(cycles, 0.0f), 0.49f);
+	}
+	inline float Increment(float hz, int sampleRate) {
+		return ClampIncrement(hz / (float)sampleRate);
+	}
+}
+
+class OscillatorBank {
+public:
+	// Returns the id of the new voice; ids count up from 0 until Clear.
+	// pan -1 (left) .. 1 (right), constant power
+	int AddVoice(OscillatorWaveform waveform, float hz, float amplitude = 1.0f, float pan = 0.0f) {
+		Voices& set = sets[(int)waveform];
+		const int index = set.count++;
+		if ((size_t)set.count > set.phase.size()) {
+			const size_t padded = set.phase.size() + oscillator_detail::Lanes;
+			set.phase.resize(padded, 0.0f);
+			set.increment.resize(padded, 0.0f);
+			set.inverse.resize(padded, 0.0f);
+			set.left.resize(padded, 0.0f);
+			set.right.resize(padded, 0.0f);
+			set.hz.resize(padded, 0.0f);
+			set.amplitude.resize(padded, 0.0f);
+			set.pan.resize(padded, 0.0f);
+		}
+		set.hz[index] = hz;
+		set.amplitude[index] = amplitude;
+		set.pan[index] = pan;
+		set.isDirty = true;
+		ids.push_back(std::make_pair((int)waveform, index));
+		return (int)ids.size() - 1;
+	}
+	void SetFrequency(int voice, float hz) {
+		Voices& set = Find(voice);
+		set.hz[ids[voice].second] = hz;
+		set.isDirty = true;
+	}
+	void SetAmplitude(int voice, float amplitude) {
+		Voices& set = Find(voice);
+		set.amplitude[ids[voice].second] = amplitude;
+		set.isDirty = true;
+	}
+	void SetPan(int voice, float pan) {
+		Voices& set = Find(voice);
+		set.pan[ids[voice].second] = pan;
+		set.isDirty = true;
+	}
+	// phase in cycles, 0 .. 1
+	void SetPhase(int voice, float phase) {
+		Voices& set = Find(voice);
+		set.phase[ids[voice].second] = phase - std::floor(phase);
+	}
+	int GetVoiceCount() const { return (int)ids.size(); }
+	void Clear() {
+		for (Voices& set : sets) {
+			set = Voices();
+		}
+		ids.clear();
+	}
+	// every phase as if the voices had run at their current frequency since frame 0
+	void Seek(int64_t frame, int sampleRate) {
+		for (Voices& set : sets) {
+			for (int v = 0; v < set.count; v++) {
+				const double cycles = (double)frame * oscillator_detail::Increment(set.hz[v], sampleRate);
+				set.phase[v] = (float)(cycles - std::floor(cycles));
+			}
+		}
+	}
+
+	// Adds frames frames of every voice to the stereo frames in out.
+	void Render(float* out, int frames, int sampleRate) {
+		using namespace oscillator_detail;
+		if (sampleRate != designedRate) {
+			for (Voices& set : sets) {
+				set.isDirty = true;
+			}
+			designedRate = sampleRate;
+		}
+		scratch.assign((size_t)frames * Lanes * 2, 0.0f);
+		float* left = scratch.data();
+		float* right = left + (size_t)frames * Lanes;
+		RenderSet<0>(sets[0], left, right, frames, sampleRate);
+		RenderSet<1>(sets[1], left, right, frames, sampleRate);
+		RenderSet<2>(sets[2], left, right, frames, sampleRate);
+		RenderSet<3>(sets[3], left, right, frames, sampleRate);
+		for (int i = 0; i < frames; i++) {
+			float l = 0.0f, r = 0.0f;
+			for (int lane = 0; lane < Lanes; lane++) {
+				l += left[i * Lanes + lane];
+				r += right[i * Lanes + lane];
+			}
+			out[i * 2] += l;
+			out[i * 2 + 1] += r;
+		}
+	}
+
+private:
+	// one waveform; arrays are padded to whole groups of lanes with silent voices
+	struct Voices {
+		std::vector<float> phase;
+		std::vector<float> increment;
+		std::vector<float> inverse;
+		std::vector<float> left;
+		std::vector<float> right;
+		std::vector<float> hz;
+		std::vector<float> amplitude;
+		std::vector<float> pan;
+		int count = 0;
+		bool isDirty = false;
+	};
+
+	Voices& Find(int voice) {
+		if (voice < 0 || voice >= (int)ids.size()) {
+			throw std::runtime_error("oscillator bank: no such voice");
+		}
+		return sets[ids[voice].first];
+	}
+
+	template <int W>
+	static void RenderSet(Voices& set, float* left, float* right, int frames, int sampleRate) {
+		using namespace oscillator_detail;
+		if (set.count == 0) {
+			return;
+		}
+		if (set.isDirty) {
+			for (int v = 0; v < set.count; v++) {
+				const float dt = Increment(set.hz[v], sampleRate);
+				const float angle = (std::min(std::max(set.pan[v], -1.0f), 1.0f) + 1.0f) * (Pi / 4.0f);
+				set.increment[v] = dt;
+				set.inverse[v] = dt > 0.0f ? 1.0f / dt : 0.0f;
+				set.left[v] = set.amplitude[v] * std::cos(angle);
+				set.right[v] = set.amplitude[v] * std::sin(angle);
+			}
+			set.isDirty = false;
+		}
+#if OSCILLATOR_BANK_HAVE_SSE2
+		if (Lanes % 4 == 0) {
+			const int Vectors = Lanes / 4;
+			for (size_t group = 0; group < (size_t)set.count; group += Lanes) {
+				__m128 p[Vectors], dt[Vectors], inverse[Vectors], gl[Vectors], gr[Vectors];
+				for (int k = 0; k < Vectors; k++) {
+					p[k] = _mm_loadu_ps(&set.phase[group + k * 4]);
+					dt[k] = _mm_loadu_ps(&set.increment[group + k * 4]);
+					inverse[k] = _mm_loadu_ps(&set.inverse[group + k * 4]);
+					gl[k] = _mm_loadu_ps(&set.left[group + k * 4]);
+					gr[k] = _mm_loadu_ps(&set.right[group + k * 4]);
+				}
+				for (int i = 0; i < frames; i++) {
+					float* l = left + (size_t)i * Lanes;
+					float* r = right + (size_t)i * Lanes;
+					for (int k = 0; k < Vectors; k++) {
+						const __m128 y = Wave4<W>(p[k], dt[k], inverse[k]);
+						_mm_storeu_ps(l + k * 4, _mm_add_ps(_mm_loadu_ps(l + k * 4), _mm_mul_ps(y, gl[k])));
+						_mm_storeu_ps(r + k * 4, _mm_add_ps(_mm_loadu_ps(r + k * 4), _mm_mul_ps(y, gr[k])));
+						p[k] = Wrap4(_mm_add_ps(p[k], dt[k]));
+					}
+				}
+				for (int k = 0; k < Vectors; k++) {
+					_mm_storeu_ps(&set.phase[group + k * 4], p[k]);
+				}
+			}
+			return;
+		}
+#endif
+		for (size_t group = 0; group < (size_t)set.count; group += Lanes) {
+			float p[Lanes], dt[Lanes], inverse[Lanes], gl[Lanes], gr[Lanes];
+			for (int lane = 0; lane < Lanes; lane++) {
+				p[lane] = set.phase[group + lane];
+				dt[lane] = set.increment[group + lane];
+				inverse[lane] = set.inverse[group + lane];
+				gl[lane] = set.left[group + lane];
+				gr[lane] = set.right[group + lane];
+			}
+			for (int i = 0; i < frames; i++) {
+				float* l = left + (size_t)i * Lanes;
+				float* r = right + (size_t)i * Lanes;
+				for (int lane = 0; lane < Lanes; lane++) {
+					const float y = Wave<W>(p[lane], dt[lane], inverse[lane]);
+					l[lane] += y * gl[lane];
+					r[lane] += y * gr[lane];
+					const float next = p[lane] + dt[lane];
+					p[lane] = next >= 1.0f ? next - 1.0f : next;
+				}
+			}
+			for (int lane = 0; lane < Lanes; lane++) {
+				set.phase[group + lane] = p[lane];
+			}
+		}
+	}
+
+	Voices sets[oscillator_detail::Waveforms];
+	std::vector<std::pair<int, int> > ids;	// voice -> set, index in the set
+	std::vector<float> scratch;
+	int designedRate = 0;
+};
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Streaming PNG writer.
+//
+// Rows are filtered as they come (the PNG filter with the smallest sum of absolute
+// differences per row) and deflated in blocks of BlockBytes with a small LZ77 encoder and
+// the fixed Huffman codes of RFC 1951, each block going out as its own IDAT chunk, so
+// memory stays at one block and two rows for images of any height. 8 bit gray, RGB,
+// RGBA or palette images.
+namespace png_detail {
+	const size_t BlockBytes = 1 << 18;
+	const int HashBits = 15;
+	const int MaxChain = 32;
+	const int WindowSize = 32768;
+
+	inline uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size) {
+		static uint32_t table[256];
+		static bool isTable = [] {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++) {
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				table[i] = c;
+			}
+			return true;
+		}();
+		(void)isTable;
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++) {
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	inline uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t size) {
+		uint32_t a = adler & 0xffff, b = adler >> 16;
+		while (size > 0) {
+			// 5552 bytes is the most that can be summed before b overflows
+			const size_t n = std::min<size_t>(size, 5552);
+			for (size_t i = 0; i < n; i++) {
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			data += n;
+			size -= n;
+		}
+		return (b << 16) | a;
+	}
+
+	// deflate bit stream, least significant bit first
+	class BitWriter {
+	public:
+		std::vector<uint8_t> bytes;
+		void Put(uint32_t value, int count) {
+			bits |= (uint64_t)value << used;
+			used += count;
+			while (used >= 8) {
+				bytes.push_back((uint8_t)bits);
+				bits >>= 8;
+				used -= 8;
+			}
+		}
+		// Huffman codes are stored most significant bit first
+		void PutCode(uint32_t code, int count) {
+			uint32_t reversed = 0;
+			for (int i = 0; i < count; i++) {
+				reversed = (reversed << 1) | ((code >> i) & 1);
+			}
+			Put(reversed, count);
+		}
+		void Align() {
+			if (used > 0) {
+				Put(0, 8 - used);
+			}
+		}
+	private:
+		uint64_t bits = 0;
+		int used = 0;
+	};
+
+	// literal/length symbol in the fixed code
+	inline void PutSymbol(BitWriter& out, int symbol) {
+		if (symbol < 144) {
+			out.PutCode(0x30 + symbol, 8);
+		}
+		else if (symbol < 256) {
+			out.PutCode(0x190 + symbol - 144, 9);
+		}
+		else if (symbol < 280) {
+			out.PutCode(symbol - 256, 7);
+		}
+		else {
+			out.PutCode(0xc0 + symbol - 280, 8);
+		}
+	}
+
+	inline void PutMatch(BitWriter& out, int length, int distance) {
+		static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		int l = 28;
+		while (lengthBase[l] > length) {
+			l--;
+		}
+		PutSymbol(out, 257 + l);
+		out.Put(length - lengthBase[l], lengthExtra[l]);
+		int d = 29;
+		while (distanceBase[d] > distance) {
+			d--;
+		}
+		out.PutCode(d, 5);
+		out.Put(distance - distanceBase[d], distanceExtra[d]);
+	}
+
+	// one fixed Huffman block of data, greedy matches through hash chains
+	inline void Deflate(BitWriter& out, const uint8_t* data, size_t size, bool isFinal) {
+		out.Put(isFinal ? 1 : 0, 1);
+		out.Put(1, 2);
+		std::vector<int32_t> head((size_t)1 << HashBits, -1);
+		std::vector<int32_t> previous(size);
+		auto hash = [&](size_t i) {
+			const uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+			return (v * 2654435761u) >> (32 - HashBits);
+		};
+		auto insert = [&](size_t i) {
+			if (i + 3 <= size) {
+				const uint32_t h = hash(i);
+				previous[i] = head[h];
+				head[h] = (int32_t)i;
+			}
+		};
+		size_t i = 0;
+		while (i < size) {
+			int best = 0, distance = 0;
+			if (i + 3 <= size) {
+				const int longest = (int)std::min<size_t>(258, size - i);
+				int32_t candidate = head[hash(i)];
+				for (int chain = 0; candidate >= 0 && i - candidate <= WindowSize && chain < MaxChain; chain++) {
+					int length = 0;
+					while (length < longest && data[candidate + length] == data[i + length]) {
+						length++;
+					}
+					if (length > best) {
+						best = length;
+						distance = (int)(i - candidate);
+						if (length == longest) {
+							break;
+						}
+					}
+					candidate = previous[candidate];
+				}
+			}
+			if (best >= 3) {
+				PutMatch(out, best, distance);
+				for (int k = 0; k < best; k++) {
+					insert(i + k);
+				}
+				i += best;
+			}
+			else {
+				PutSymbol(out, data[i]);
+				insert(i);
+				i++;
+			}
+		}
+		PutSymbol(out, 256);
+	}
+
+	inline uint8_t Paeth(int a, int b, int c) {
+		const int p = a + b - c;
+		const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		return (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+	}
+}
+
+class PngWriter {
+public:
+	PngWriter() {}
+	~PngWriter() {
+		if (file) {
+			fclose(file);
+		}
+	}
+	PngWriter(const PngWriter&) = delete;
+	PngWriter& operator=(const PngWriter&) = delete;
+
+	// channels 1 (gray), 3 (RGB) or 4 (RGBA); a palette of up to 256 RGB triples makes a
+	// paletted image of one byte per pixel
+	void Open(const std::string& filename, int width, int height, int channels = 1, const std::vector<uint8_t>& palette = std::vector<uint8_t>()) {
+		Close();
+		const bool isPalette = !palette.empty();
+		if (width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4) ||
+			(isPalette && (channels != 1 || palette.size() % 3 != 0 || palette.size() > 768))) {
+			throw std::runtime_error("Not support this png format");
+		}
+		this->width = width;
+		this->height = height;
+		this->channels = channels;
+		rowBytes = (size_t)width * channels;
+		previous.assign(rowBytes, 0);
+		filtered.resize(rowBytes + 1);
+		pending.clear();
+		pending.reserve(png_detail::BlockBytes + rowBytes + 1);
+		rows = 0;
+		adler = 1;
+		isFailed = false;
+		file = fopen(filename.c_str(), "wb");
+		if (!file) {
+			throw std::runtime_error("failed to create " + filename);
+		}
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		if (fwrite(signature, 1, sizeof(signature), file) != sizeof(signature)) {
+			isFailed = true;
+		}
+		uint8_t header[13];
+		Store32(header, (uint32_t)width);
+		Store32(header + 4, (uint32_t)height);
+		header[8] = 8;
+		header[9] = isPalette ? 3 : channels == 1 ? 0 : channels == 3 ? 2 : 6;
+		header[10] = 0;
+		header[11] = 0;
+		header[12] = 0;
+		WriteChunk("IHDR", header, sizeof(header));
+		if (isPalette) {
+			WriteChunk("PLTE", palette.data(), palette.size());
+		}
+		// zlib header: deflate, 32 KB window, no dictionary
+		bits.Put(0x78, 8);
+		bits.Put(0x01, 8);
+	}
+
+	bool IsOpen() const { return file != nullptr; }
+	int GetRows() const { return rows; }
+
+	// width * channels bytes, top row first
+	bool WriteRow(const uint8_t* row) {
+		if (!file || rows >= height) {
+			return false;
+		}
+		const size_t bpp = (size_t)channels;
+		uint8_t* out = filtered.data() + 1;
+		size_t bestCost = SIZE_MAX;
+		int bestFilter = 0;
+		for (int filter = 0; filter < 5; filter++) {
+			size_t cost = 0;
+			for (size_t i = 0; i < rowBytes; i++) {
+				cost += std::abs((int)(int8_t)Filter(filter, row, i, bpp));
+			}
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestFilter = filter;
+			}
+		}
+		filtered[0] = (uint8_t)bestFilter;
+		for (size_t i = 0; i < rowBytes; i++) {
+			out[i] = Filter(bestFilter, row, i, bpp);
+		}
+		pending.insert(pending.end(), filtered.begin(), filtered.end());
+		memcpy(previous.data(), row, rowBytes);
+		rows++;
+		if (pending.size() >= png_detail::BlockBytes) {
+			Flush(false);
+		}
+		return !isFailed;
+	}
+
+	// Writes the rest of the data and closes the file. Rows that were not written are
+	// filled with zeros. Returns false when anything failed to write.
+	bool Close() {
+		if (!file) {
+			return false;
+		}
+		std::vector<uint8_t> zeros(rowBytes, 0);
+		while (rows < height) {
+			WriteRow(zeros.data());
+		}
+		Flush(true);
+		WriteChunk("IEND", nullptr, 0);
+		if (fclose(file) != 0) {
+			isFailed = true;
+		}
+		file = nullptr;
+		return !isFailed;
+	}
+
+private:
+	uint8_t Filter(int filter, const uint8_t* row, size_t i, size_t bpp) const {
+		const int a = i >= bpp ? row[i - bpp] : 0;
+		const int b = previous[i];
+		const int c = i >= bpp ? previous[i - bpp] : 0;
+		switch (filter) {
+		case 1: return (uint8_t)(row[i] - a);
+		case 2: return (uint8_t)(row[i] - b);
+		case 3: return (uint8_t)(row[i] - ((a + b) >> 1));
+		case 4: return (uint8_t)(row[i] - png_detail::Paeth(a, b, c));
+		default: return row[i];
+		}
+	}
+
+	void Flush(bool isFinal) {
+		adler = png_detail::Adler32(adler, pending.data(), pending.size());
+		png_detail::Deflate(bits, pending.data(), pending.size(), isFinal);
+		pending.clear();
+		if (isFinal) {
+			bits.Align();
+			bits.Put(adler >> 24, 8);
+			bits.Put((adler >> 16) & 0xff, 8);
+			bits.Put((adler >> 8) & 0xff, 8);
+			bits.Put(adler & 0xff, 8);
+		}
+		// a partial byte stays in the bit writer for the next block
+		WriteChunk("IDAT", bits.bytes.data(), bits.bytes.size());
+		bits.bytes.clear();
+	}
+
+	void WriteChunk(const char* type, const uint8_t* data, size_t size) {
+		uint8_t head[8];
+		Store32(head, (uint32_t)size);
+		memcpy(head + 4, type, 4);
+		uint32_t crc = png_detail::Crc32(0, head + 4, 4);
+		crc = png_detail::Crc32(crc, data, size);
+		uint8_t tail[4];
+		Store32(tail, crc);
+		if (fwrite(head, 1, 8, file) != 8 || (size && fwrite(data, 1, size, file) != size) || fwrite(tail, 1, 4, file) != 4) {
+			isFailed = true;
+		}
+	}
+
+	static void Store32(uint8_t* p, uint32_t v) {
+		p[0] = (uint8_t)(v >> 24);
+		p[1] = (uint8_t)(v >> 16);
+		p[2] = (uint8_t)(v >> 8);
+		p[3] = (uint8_t)v;
+	}
+
+	FILE* file = nullptr;
+	int width = 0;
+	int height = 0;
+	int channels = 1;
+	size_t rowBytes = 0;
+	int rows = 0;
+	uint32_t adler = 1;
+	bool isFailed = false;
+	std::vector<uint8_t> previous;
+	std::vector<uint8_t> filtered;
+	std::vector<uint8_t> pending;
+	png_detail::BitWriter bits;
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Audio.h"
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define RESAMPLER_HAVE_AVX2 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_HAVE_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLER_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Polyphase windowed sinc sample rate conversion.
+//
+// The read position is kept as an exact fraction: with L = outRate / g and M = inRate / g
+// (g the gcd), output frame k sits at input frame k * M / L, so there is no drift however
+// long a stream runs. When L is at most 1024 (every pair of the common rates) each of the
+// L phases gets its own precomputed row of the Kaiser windowed sinc; otherwise 512 rows
+// are precomputed and the two nearest are blended.
+//
+// A preset is a stopband attenuation and the edge of the passband in the lower Nyquist of
+// the two rates. The transition band runs from that edge to Nyquist, so nothing above
+// Nyquist folds back louder than the attenuation: the sinc cutoff sits in the middle of
+// it and the taps and the Kaiser beta follow from Kaiser's formulas. For downsampling the
+// band is narrower in input samples and the filter gets longer by the same ratio, the
+// taps given are for upsampling:
+//
+//   Fast     60 dB stopband, flat to 80% of Nyquist (17.6kHz at 44.1kHz), 40 taps
+//   Medium   90 dB, 90% (19.8kHz), 120 taps
+//   Best    120 dB, 95% (20.9kHz), 320 taps
+//
+// The dot products run on AVX2 + FMA (/arch:AVX2, -mavx2 -mfma), NEON or SSE2, whichever
+// the build targets. Resampler is the streaming block API; ResampledAudio presents any
+// PCMAudio at another rate, with random access.
+enum class ResamplerQuality {
+	Fast,
+	Medium,
+	Best,
+};
+
+namespace resampler_detail {
+	const int MaxExactPhases = 1024;
+	const int InterpolatedPhases = 512;
+
+	struct Preset {
+		double attenuation;	// stopband, dB
+		double rolloff;		// passband edge over Nyquist
+	};
+	inline Preset GetPreset(ResamplerQuality quality) {
+		switch (quality) {
+		case ResamplerQuality::Fast: return { 60.0, 0.80 };
+		case ResamplerQuality::Best: return { 120.0, 0.95 };
+		default: return { 90.0, 0.90 };
+		}
+	}
+
+	inline int64_t Gcd(int64_t a, int64_t b) {
+		while (b) {
+			const int64_t t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+	// modified Bessel function of the first kind, order 0
+	inline double BesselI0(double x) {
+		double sum = 1.0, term = 1.0;
+		for (int k = 1; k < 64; k++) {
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+			if (term < sum * 1e-17) {
+				break;
+			}
+		}
+		return sum;
+	}
+
+	inline float Dot(const float* x, const float* h, int n) {
+		int i = 0;
+		float sum = 0.0f;
+#if RESAMPLER_HAVE_AVX2
+		__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+		for (; i + 16 <= n; i += 16) {
+			a0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), a0);
+			a1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(h + i + 8), a1);
+		}
+		for (; i + 8 <= n; i += 8) {
+			a0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), a0);
+		}
+		a0 = _mm256_add_ps(a0, a1);
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		sum = _mm_cvtss_f32(s);
+#elif RESAMPLER_HAVE_NEON
+		float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+		for (; i + 8 <= n; i += 8) {
+			a0 = vmlaq_f32(a0, vld1q_f32(x + i), vld1q_f32(h + i));
+			a1 = vmlaq_f32(a1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+		}
+		a0 = vaddq_f32(a0, a1);
+		const float32x2_t s = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+		sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#elif RESAMPLER_HAVE_SSE2
+		__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+		for (; i + 8 <= n; i += 8) {
+			a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+		}
+		__m128 s = _mm_add_ps(a0, a1);
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		sum = _mm_cvtss_f32(s);
+#endif
+		for (; i < n; i++) {
+			sum += x[i] * h[i];
+		}
+		return sum;
+	}
+}
+
+class Resampler {
+public:
+	Resampler() {}
+	Resampler(int channels, int inputRate, int outputRate, ResamplerQuality quality = ResamplerQuality::Medium) {
+		Create(channels, inputRate, outputRate, quality);
+	}
+
+	void Create(int channels, int inputRate, int outputRate, ResamplerQuality quality = ResamplerQuality::Medium) {
+		using namespace resampler_detail;
+		if (channels <= 0 || inputRate <= 0 || outputRate <= 0) {
+			throw std::runtime_error("resampler: invalid format");
+		}
+		this->channels = channels;
+		this->inputRate = inputRate;
+		this->outputRate = outputRate;
+		const int64_t g = Gcd(inputRate, outputRate);
+		L = outputRate / g;
+		M = inputRate / g;
+		const Preset preset = GetPreset(quality);
+		const double scale = std::min(1.0, (double)outputRate / inputRate);
+		// in input Nyquists: passband to scale * rolloff, stopband from scale
+		const double cutoff = scale * (1.0 + preset.rolloff) * 0.5;
+		const double transition = A_PI * scale * (1.0 - preset.rolloff);
+		const double beta = 0.1102 * (preset.attenuation - 8.7);
+		// taps in input samples, a multiple of 8 for the vector loops
+		const int order = (int)std::ceil((preset.attenuation - 7.95) / (2.285 * transition));
+		taps = (order + 1 + 7) / 8 * 8;
+		isExact = L <= MaxExactPhases;
+		rows = isExact ? (int)L : InterpolatedPhases + 1;
+		bank.assign((size_t)rows * taps, 0.0f);
+		// row r is the filter for the fraction r / phases between input frames; tap j of it
+		// weighs input frame start + j, and the output lies between taps taps / 2 - 1 and taps / 2
+		const double phases = isExact ? (double)L : (double)InterpolatedPhases;
+		const double window = taps / 2.0;
+		const double norm = BesselI0(beta);
+		for (int r = 0; r < rows; r++) {
+			const double fraction = r / phases;
+			float* row = &bank[(size_t)r * taps];
+			double sum = 0.0;
+			for (int j = 0; j < taps; j++) {
+				const double x = j - (taps / 2 - 1) - fraction;
+				const double w = std::fabs(x) >= window ? 0.0 : BesselI0(beta * std::sqrt(1.0 - (x / window) * (x / window))) / norm;
+				const double sinc = x == 0.0 ? 1.0 : std::sin(A_PI * cutoff * x) / (A_PI * cutoff * x);
+				row[j] = (float)(cutoff * sinc * w);
+				sum += row[j];
+			}
+			// unity gain at DC for every phase
+			for (int j = 0; j < taps; j++) {
+				row[j] = (float)(row[j] / sum);
+			}
+		}
+		history.assign(channels, std::vector<float>());
+		Reset();
+	}
+	bool IsCreated() const { return channels > 0; }
+	int GetChannels() const { return channels; }
+	int GetInputRate() const { return inputRate; }
+	int GetOutputRate() const { return outputRate; }
+	int GetTaps() const { return taps; }
+
+	// Starts over at input frame 0 (before which the input counts as silence).
+	void Reset() {
+		Seek(0);
+		for (auto& h : history) {
+			h.assign(taps / 2 - 1, 0.0f);
+		}
+	}
+	// Starts over at output frame frame and returns the input frame the next Process call
+	// has to begin with; the history is empty, so that many frames before frame have to be
+	// fed too (silence for negative frames).
+	int64_t Seek(int64_t frame) {
+		const int64_t time = frame * M;
+		position = time / L - (taps / 2 - 1);
+		phase = time % L;
+		start = 0;
+		isFlushed = false;
+		for (auto& h : history) {
+			h.clear();
+		}
+		return position;
+	}
+	// output frames for inputFrames input frames from the start of a stream
+	int64_t GetOutputFrames(int64_t inputFrames) const {
+		return (inputFrames * L + M - 1) / M;
+	}
+	// input frames still missing to produce outputFrames output frames
+	int64_t GetInputNeeded(int64_t outputFrames) const {
+		if (outputFrames <= 0) {
+			return 0;
+		}
+		const int64_t end = start + (phase + (outputFrames - 1) * M) / L + taps;
+		return std::max<int64_t>(end - (int64_t)(history.empty() ? 0 : history[0].size()), 0);
+	}
+
+	// Takes inputFrames interleaved frames and writes at most outputFrames interleaved
+	// frames; returns the number written. Input that is not used yet is kept.
+	size_t Process(const float* input, size_t inputFrames, float* output, size_t outputFrames) {
+		using namespace resampler_detail;
+		for (int c = 0; c < channels; c++) {
+			std::vector<float>& h = history[c];
+			const size_t filled = h.size();
+			h.resize(filled + inputFrames);
+			for (size_t i = 0; i < inputFrames; i++) {
+				h[filled + i] = input[i * channels + c];
+			}
+		}
+		const int64_t filled = (int64_t)history[0].size();
+		size_t produced = 0;
+		while (produced < outputFrames && start + taps <= filled) {
+			float* out = output + produced * channels;
+			if (isExact) {
+				const float* row = &bank[(size_t)phase * taps];
+				for (int c = 0; c < channels; c++) {
+					out[c] = Dot(history[c].data() + start, row, taps);
+				}
+			}
+			else {
+				const double at = (double)phase / L * InterpolatedPhases;
+				const int r = std::min((int)at, InterpolatedPhases - 1);
+				const float blend = (float)(at - r);
+				const float* row0 = &bank[(size_t)r * taps];
+				const float* row1 = row0 + taps;
+				for (int c = 0; c < channels; c++) {
+					const float* x = history[c].data() + start;
+					const float a = Dot(x, row0, taps);
+					out[c] = a + (Dot(x, row1, taps) - a) * blend;
+				}
+			}
+			produced++;
+			phase += M;
+			start += phase / L;
+			phase %= L;
+		}
+		// drop what no later output can reach, once it is worth the move
+		if (start >= 4096 || start * 2 >= filled) {
+			for (auto& h : history) {
+				h.erase(h.begin(), h.begin() + (size_t)std::min<int64_t>(start, (int64_t)h.size()));
+			}
+			position += start;
+			start = 0;
+		}
+		return produced;
+	}
+	// Ends the stream: feeds the silence that lets the last input frames out, once.
+	size_t Flush(float* output, size_t outputFrames) {
+		if (!isFlushed) {
+			std::vector<float> silence((size_t)(taps / 2) * channels, 0.0f);
+			isFlushed = true;
+			return Process(silence.data(), taps / 2, output, outputFrames);
+		}
+		return Process(nullptr, 0, output, outputFrames);
+	}
+
+private:
+	int channels = 0;
+	int inputRate = 0;
+	int outputRate = 0;
+	int64_t L = 1;
+	int64_t M = 1;
+	int taps = 0;
+	int rows = 0;
+	bool isExact = true;
+	std::vector<float> bank;
+	std::vector<std::vector<float> > history;	// planar, per channel
+	int64_t position = 0;	// input frame of history[0]
+	int64_t start = 0;		// index in history of the first tap of the next output
+	int64_t phase = 0;		// over L
+	bool isFlushed = false;
+};
+
+// A PCMAudio at another sample rate. Read renders on demand; sequential reads stream, any
+// other position seeks, which gives the same samples since the filter only looks at a
+// fixed window of the source.
+class ResampledAudio : public PCMAudio {
+public:
+	void Create(PCMAudio& source, int sampleRate, ResamplerQuality quality = ResamplerQuality::Medium) {
+		if (!source.IsValid()) {
+			throw std::runtime_error("resampler: source not loaded");
+		}
+		this->source = &source;
+		resampler.Create(source.GetChannels(), source.GetSampleRate(), sampleRate, quality);
+		const int channels = source.GetChannels();
+		sourceFrames = source.GetSamples() / channels;
+		const int64_t frames = resampler.GetOutputFrames(sourceFrames);
+		const int64_t longest = INT32_MAX / channels;
+		nextFrame = -1;
+		Initialize(nullptr, channels, source.GetBitDepth(), sampleRate, (int)(std::min(frames, longest) * channels));
+	}
+	bool IsValid() override {
+		return source && source->IsValid();
+	}
+	int Read(float* dst, int position, int count) override {
+		if (!IsValid() || position < 0 || position >= samples) {
+			return 0;
+		}
+		count = std::min(count, samples - position);
+		const int64_t frame = position / channels;
+		const int offset = position % channels;
+		const int64_t frames = (offset + count + channels - 1) / channels;
+		if (frame != nextFrame) {
+			inputFrame = resampler.Seek(frame);
+		}
+		rendered.resize((size_t)frames * channels);
+		int64_t done = 0;
+		while (done < frames) {
+			const int64_t needed = resampler.GetInputNeeded(frames - done);
+			Feed(needed);
+			done += (int64_t)resampler.Process(input.data(), (size_t)needed, rendered.data() + done * channels, (size_t)(frames - done));
+		}
+		nextFrame = frame + frames;
+		if (offset != 0 || count % channels != 0) {
+			// a partial frame at either end; the next read seeks
+			nextFrame = -1;
+		}
+		memcpy(dst, rendered.data() + offset, count * sizeof(float));
+		return count;
+	}
+private:
+	// reads needed source frames from inputFrame into input, silence outside the source
+	void Feed(int64_t needed) {
+		const int channels = this->channels;
+		input.assign((size_t)needed * channels, 0.0f);
+		const int64_t from = std::max<int64_t>(inputFrame, 0);
+		const int64_t to = std::min<int64_t>(inputFrame + needed, sourceFrames);
+		int64_t at = from;
+		while (at < to) {
+			const int n = source->Read(input.data() + (at - inputFrame) * channels, (int)(at * channels), (int)((to - at) * channels));
+			if (n <= 0) {
+				break;
+			}
+			at += n / channels;
+		}
+		inputFrame += needed;
+	}
+
+	PCMAudio* source = nullptr;
+	Resampler resampler;
+	int64_t sourceFrames = 0;
+	int64_t nextFrame = -1;
+	int64_t inputFrame = 0;
+	std::vector<float> input;
+	std::vector<float> rendered;
+};
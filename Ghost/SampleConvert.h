@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#if defined(__AVX2__)
+#define SAMPLE_CONVERT_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLE_CONVERT_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Float to integer PCM conversion for the output path.
+//
+// Samples are converted in two passes over small blocks that stay in L1: the first
+// scales, optionally dithers, clamps and rounds to int32 (AVX2 / SSE2 / scalar, chosen
+// at compile time like fft.h), the second narrows to the output format with SSE2 packs
+// (8 bit is unsigned, 24 bit packed little endian). The bit depth is fixed per converter,
+// so nothing branches per sample.
+//
+// Dither is TPDF of +-1 LSB from per lane xorshift generators and only applies to 8, 16
+// and 24 bit; 32 bit output is already finer than float precision.
+class SampleConverter {
+public:
+	explicit SampleConverter(int bitDepth = 16, bool isDither = false, uint32_t seed = 0x2545F491u) {
+		SetBitDepth(bitDepth);
+		SetDither(isDither);
+		for (int i = 0; i < Lanes; i++) {
+			noise[i] = (seed ^ (0x9E3779B9u * (uint32_t)(i + 1))) | 1u;
+		}
+	}
+
+	void SetBitDepth(int bitDepth) {
+		switch (bitDepth)
+		{
+		case 8:
+		case 16:
+		case 24:
+			// scaled by 2^(n-1) like the readers divide, so integer PCM round trips exactly;
+			// +1.0 clips to the largest code
+			scale = (float)(1 << (bitDepth - 1));
+			low = -scale;
+			high = scale - 1.0f;
+			break;
+		case 32:
+			// the top is the largest float below 2^31
+			scale = 2147483648.0f;
+			low = -2147483648.0f;
+			high = 2147483520.0f;
+			break;
+		default:
+			throw std::runtime_error("Not support this bit depth");
+		}
+		this->bitDepth = bitDepth;
+	}
+	int GetBitDepth() const { return bitDepth; }
+	void SetDither(bool isDither) { this->isDither = isDither; }
+	bool IsDither() const { return isDither; }
+
+	// count: number of samples (frames * channels)
+	void Convert(const float* in, void* out, size_t count) {
+		const bool dither = isDither && bitDepth != 32;
+		if (bitDepth == 32) {
+			Quantize(in, (int32_t*)out, count, false);
+			return;
+		}
+		int32_t block[BlockSize];
+		uint8_t* dst = (uint8_t*)out;
+		const size_t sampleBytes = bitDepth / 8;
+		for (size_t done = 0; done < count; ) {
+			const size_t n = std::min(count - done, (size_t)BlockSize);
+			Quantize(in + done, block, n, dither);
+			switch (bitDepth)
+			{
+			case 8:
+				Narrow8(block, dst, n);
+				break;
+			case 16:
+				Narrow16(block, (int16_t*)dst, n);
+				break;
+			case 24:
+				Narrow24(block, dst, n);
+				break;
+			}
+			dst += n * sampleBytes;
+			done += n;
+		}
+	}
+
+private:
+	static const int Lanes = 8;
+	static const int BlockSize = 512;
+
+	static uint32_t NextNoise(uint32_t x) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+	// uniform [1, 2) from the top 23 bits
+	static float NoiseToFloat(uint32_t x) {
+		const uint32_t bits = (x >> 9) | 0x3F800000u;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	void Quantize(const float* in, int32_t* out, size_t count, bool dither) {
+		size_t i = 0;
+#if SAMPLE_CONVERT_HAVE_AVX2
+		{
+			const __m256 s = _mm256_set1_ps(scale), lo = _mm256_set1_ps(low), hi = _mm256_set1_ps(high);
+			const __m256i one = _mm256_set1_epi32(0x3F800000);
+			__m256i state = _mm256_loadu_si256((const __m256i*)noise);
+			for (; i + 8 <= count; i += 8) {
+				__m256 v = _mm256_mul_ps(_mm256_loadu_ps(in + i), s);
+				if (dither) {
+					const __m256i a = Next(state);
+					state = Next(a);
+					const __m256 fa = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(a, 9), one));
+					const __m256 fb = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(state, 9), one));
+					v = _mm256_add_ps(v, _mm256_sub_ps(fa, fb));
+				}
+				v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+				_mm256_storeu_si256((__m256i*)(out + i), _mm256_cvtps_epi32(v));
+			}
+			_mm256_storeu_si256((__m256i*)noise, state);
+		}
+#elif SAMPLE_CONVERT_HAVE_SSE2
+		{
+			const __m128 s = _mm_set1_ps(scale), lo = _mm_set1_ps(low), hi = _mm_set1_ps(high);
+			const __m128i one = _mm_set1_epi32(0x3F800000);
+			__m128i state = _mm_loadu_si128((const __m128i*)noise);
+			for (; i + 4 <= count; i += 4) {
+				__m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), s);
+				if (dither) {
+					const __m128i a = Next(state);
+					state = Next(a);
+					const __m128 fa = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(a, 9), one));
+					const __m128 fb = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(state, 9), one));
+					v = _mm_add_ps(v, _mm_sub_ps(fa, fb));
+				}
+				v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+				_mm_storeu_si128((__m128i*)(out + i), _mm_cvtps_epi32(v));
+			}
+			_mm_storeu_si128((__m128i*)noise, state);
+		}
+#endif
+		for (; i < count; i++) {
+			float v = in[i] * scale;
+			if (dither) {
+				const uint32_t a = NextNoise(noise[0]);
+				noise[0] = NextNoise(a);
+				v += NoiseToFloat(a) - NoiseToFloat(noise[0]);
+			}
+			// written so that NaN ends up at low like the SIMD min/max
+			v = std::min(v > low ? v : low, high);
+			out[i] = (int32_t)std::lrint(v);
+		}
+	}
+
+#if SAMPLE_CONVERT_HAVE_AVX2
+	static __m256i Next(__m256i x) {
+		x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+		x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+		return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+	}
+#endif
+#if SAMPLE_CONVERT_HAVE_SSE2
+	static __m128i Next(__m128i x) {
+		x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+		x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+		return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	}
+#endif
+
+	// the values are already clamped, so saturating packs only narrow
+	static void Narrow16(const int32_t* in, int16_t* out, size_t count) {
+		size_t i = 0;
+#if SAMPLE_CONVERT_HAVE_SSE2
+		for (; i + 8 <= count; i += 8) {
+			const __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+			const __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 4));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+		}
+#endif
+		for (; i < count; i++) {
+			out[i] = (int16_t)in[i];
+		}
+	}
+	static void Narrow8(const int32_t* in, uint8_t* out, size_t count) {
+		size_t i = 0;
+#if SAMPLE_CONVERT_HAVE_SSE2
+		const __m128i bias = _mm_set1_epi8((char)0x80);
+		for (; i + 16 <= count; i += 16) {
+			const __m128i a = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(in + i)), _mm_loadu_si128((const __m128i*)(in + i + 4)));
+			const __m128i b = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)), _mm_loadu_si128((const __m128i*)(in + i + 12)));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(_mm_packs_epi16(a, b), bias));
+		}
+#endif
+		for (; i < count; i++) {
+			out[i] = (uint8_t)(in[i] + 128);
+		}
+	}
+	// little endian: each sample is stored as 4 bytes and the next one overwrites the top
+	static void Narrow24(const int32_t* in, uint8_t* out, size_t count) {
+		if (count == 0) {
+			return;
+		}
+		for (size_t i = 0; i + 1 < count; i++) {
+			memcpy(out + i * 3, &in[i], 4);
+		}
+		const int32_t last = in[count - 1];
+		uint8_t* p = out + (count - 1) * 3;
+		p[0] = (uint8_t)last;
+		p[1] = (uint8_t)(last >> 8);
+		p[2] = (uint8_t)(last >> 16);
+	}
+
+	int bitDepth;
+	float scale;
+	float low;
+	float high;
+	bool isDither;
+	uint32_t noise[Lanes];	// xorshift32 state per SIMD lane, never zero
+};
+
+// One-off conversion without dither.
+inline void ConvertSamples(const float* in, void* out, size_t count, int bitDepth) {
+	SampleConverter(bitDepth).Convert(in, out, count);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Lock-free single producer / single consumer ring buffer.
+//
+// One thread calls Push, another calls Pop/Peek/Skip; neither ever blocks or allocates
+// after construction. Capacity is rounded up to a power of two so that the monotonic
+// read/write counters map to slots with a mask, and each counter sits on its own cache
+// line together with the cached copy of the other side's counter, so the two threads
+// only touch each other's line when the cached value runs out.
+template <class T = float>
+class SampleQueue {
+	static_assert(std::is_trivially_copyable<T>::value, "SampleQueue holds trivially copyable values");
+public:
+	explicit SampleQueue(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		buffer.resize(size);
+		mask = size - 1;
+	}
+	SampleQueue(const SampleQueue&) = delete;
+	SampleQueue& operator=(const SampleQueue&) = delete;
+
+	size_t Capacity() const { return mask + 1; }
+
+	// producer: pushes up to count values, returns how many fit
+	size_t Push(const T* values, size_t count) {
+		const size_t w = producer.position.load(std::memory_order_relaxed);
+		if (Capacity() - (w - producer.cached) < count) {
+			producer.cached = consumer.position.load(std::memory_order_acquire);
+		}
+		count = std::min(count, Capacity() - (w - producer.cached));
+		Copy(values, w, count);
+		producer.position.store(w + count, std::memory_order_release);
+		return count;
+	}
+	bool Push(const T& value) {
+		return Push(&value, 1) == 1;
+	}
+	// producer: free slots
+	size_t Space() {
+		const size_t w = producer.position.load(std::memory_order_relaxed);
+		producer.cached = consumer.position.load(std::memory_order_acquire);
+		return Capacity() - (w - producer.cached);
+	}
+	// producer: values pushed since construction
+	size_t Pushed() const {
+		return producer.position.load(std::memory_order_relaxed);
+	}
+
+	// consumer: copies up to count values without removing them
+	size_t Peek(T* values, size_t count) {
+		const size_t r = consumer.position.load(std::memory_order_relaxed);
+		count = std::min(count, Available(r, count));
+		const size_t index = r & mask;
+		const size_t first = std::min(count, Capacity() - index);
+		memcpy(values, &buffer[index], first * sizeof(T));
+		memcpy(values + first, &buffer[0], (count - first) * sizeof(T));
+		return count;
+	}
+	// consumer: removes up to count values, returns how many were removed
+	size_t Skip(size_t count) {
+		const size_t r = consumer.position.load(std::memory_order_relaxed);
+		count = std::min(count, Available(r, count));
+		consumer.position.store(r + count, std::memory_order_release);
+		return count;
+	}
+	size_t Pop(T* values, size_t count) {
+		return Skip(Peek(values, count));
+	}
+	bool Pop(T& value) {
+		return Pop(&value, 1) == 1;
+	}
+	// consumer: values ready to pop
+	size_t Available() {
+		return Available(consumer.position.load(std::memory_order_relaxed), SIZE_MAX);
+	}
+	// consumer: values popped since construction
+	size_t Popped() const {
+		return consumer.position.load(std::memory_order_relaxed);
+	}
+
+private:
+	// refreshes the view of the producer only when the cached one can not satisfy want
+	size_t Available(size_t r, size_t want) {
+		if (consumer.cached - r < want) {
+			consumer.cached = producer.position.load(std::memory_order_acquire);
+		}
+		return consumer.cached - r;
+	}
+	void Copy(const T* values, size_t position, size_t count) {
+		const size_t index = position & mask;
+		const size_t first = std::min(count, Capacity() - index);
+		memcpy(&buffer[index], values, first * sizeof(T));
+		memcpy(&buffer[0], values + first, (count - first) * sizeof(T));
+	}
+
+	// padded rather than alignas, so that heap allocated queues need no over-aligned new
+	static const size_t CacheLine = 64;
+	struct Side {
+		std::atomic<size_t> position{ 0 };	// written only by the owning side
+		size_t cached = 0;					// owner's last view of the other side
+		char padding[CacheLine];
+	};
+
+	std::vector<T> buffer;
+	size_t mask;
+	char padding[CacheLine];
+	Side producer;
+	Side consumer;
+};
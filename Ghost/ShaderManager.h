@@ -0,0 +1,370 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "ShaderTileRenderer.h"
+
+// Live coding support for sound shaders: ShaderManager watches a shader file, compiles
+// every saved version without stopping the GL thread and hands out programs to swap into
+// a ShaderTileRenderer/ShaderStreamAudio between tiles. Linked programs are cached on disk
+// by ShaderBinaryCache, so a shader that was compiled once (in this or an earlier
+// session) starts without compiling.
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+// ARB/KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_ARB
+#define GL_COMPLETION_STATUS_ARB 0x91B1
+#endif
+
+// Program binaries (glGetProgramBinary) in directory/<key>.bin. The key hashes the sources
+// together with the vendor, renderer and version strings, because a binary only loads on
+// the driver that produced it; a binary the driver rejects anyway is deleted.
+class ShaderBinaryCache {
+public:
+	// GL thread, context current; an empty directory turns the cache off
+	void Open(const std::string& directory) {
+		this->directory = directory;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		isSupported = formats > 0 && !directory.empty();
+		driver.clear();
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			const GLubyte* value = glGetString(name);
+			driver += value ? (const char*)value : "";
+			driver += '\n';
+		}
+		if (isSupported) {
+#ifdef _WIN32
+			_mkdir(directory.c_str());
+#else
+			mkdir(directory.c_str(), 0755);
+#endif
+		}
+	}
+	bool IsEnabled() const { return isSupported; }
+
+	// 64 bit FNV-1a of the driver strings and the sources
+	uint64_t Key(const std::string& vertex, const std::string& fragment) const {
+		uint64_t hash = 14695981039346656037ull;
+		for (const std::string* part : { &driver, &vertex, &fragment }) {
+			for (unsigned char c : *part) {
+				hash = (hash ^ c) * 1099511628211ull;
+			}
+			hash = (hash ^ 0xFF) * 1099511628211ull;	// separator
+		}
+		return hash;
+	}
+
+	// A linked program for key, 0 when there is none that loads.
+	GLuint Load(uint64_t key) {
+		if (!isSupported) {
+			return 0;
+		}
+		std::ifstream file(Path(key), std::ios::binary);
+		uint32_t header[3] = {};
+		if (!file.read((char*)header, sizeof(header)) || header[0] != Magic) {
+			return 0;
+		}
+		std::vector<char> binary(header[2]);
+		if (!file.read(binary.data(), binary.size())) {
+			return 0;
+		}
+		file.close();
+		const GLuint program = glCreateProgram();
+		glProgramBinary(program, (GLenum)header[1], binary.data(), (GLsizei)binary.size());
+		GLint status = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE) {
+			glDeleteProgram(program);
+			remove(Path(key).c_str());
+			return 0;
+		}
+		return program;
+	}
+	// program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	void Save(uint64_t key, GLuint program) {
+		if (!isSupported) {
+			return;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			return;
+		}
+		std::vector<char> binary((size_t)length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+		// written next to the target and renamed, so that a reader never sees half a file
+		const std::string path = Path(key);
+		const std::string temporary = path + ".tmp";
+		const uint32_t header[3] = { Magic, (uint32_t)format, (uint32_t)length };
+		std::ofstream file(temporary, std::ios::binary);
+		file.write((const char*)header, sizeof(header));
+		file.write(binary.data(), length);
+		file.close();
+		if (!file) {
+			remove(temporary.c_str());
+			return;
+		}
+		remove(path.c_str());
+		rename(temporary.c_str(), path.c_str());
+	}
+
+private:
+	static const uint32_t Magic = 0x42505347u;	// "GSPB"
+
+	std::string Path(uint64_t key) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return directory + "/" + name;
+	}
+
+	std::string directory;
+	std::string driver;
+	bool isSupported = false;
+};
+
+// Builds sound shader programs for ShaderTileRenderer, either at once (Build) or from a
+// watched file as it changes (Watch/Update).
+//
+// A background thread polls the file and passes every new version (by content, so
+// touching the file does nothing) to the GL thread. Update starts compiling it there
+// and returns the program once it is linked. With ARB/KHR_parallel_shader_compile the
+// driver compiles on its own threads and Update only polls the completion status, so the
+// frame never waits for the compiler; without it the compile happens inside one Update.
+// A version that fails keeps the previous program and leaves the log in GetError.
+class ShaderManager {
+public:
+	ShaderManager() {}
+	~ShaderManager() {
+		Unwatch();
+		Discard();
+	}
+	ShaderManager(const ShaderManager&) = delete;
+	ShaderManager& operator=(const ShaderManager&) = delete;
+
+	// GL thread, context current; cacheDirectory "" for no binary cache
+	void Open(const std::string& cacheDirectory) {
+		cache.Open(cacheDirectory);
+		isParallel = false;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (name && (strcmp(name, "GL_ARB_parallel_shader_compile") == 0 || strcmp(name, "GL_KHR_parallel_shader_compile") == 0)) {
+				isParallel = true;
+			}
+		}
+	}
+
+	// Compiles source (or loads it from the cache) and waits for the result; throws
+	// std::runtime_error with the log when it fails.
+	GLuint Build(const std::string& source) {
+		Job started = Start(source);
+		return Finish(started);
+	}
+
+	// Starts watching path; the current content counts as a change.
+	void Watch(const std::string& path) {
+		Unwatch();
+		this->path = path;
+		isQuit = false;
+		watcher = std::thread(&ShaderManager::WatchThread, this);
+	}
+	void Unwatch() {
+		if (watcher.joinable()) {
+			isQuit = true;
+			watcher.join();
+		}
+	}
+
+	// GL thread, once per frame: a newly linked program of the watched file (the caller
+	// takes it over), 0 while there is none.
+	GLuint Update() {
+		if (!job.program) {
+			std::string source;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!isChanged) {
+					return 0;
+				}
+				source.swap(changed);
+				isChanged = false;
+			}
+			job = Start(source);
+		}
+		if (isParallel && !job.isCached) {
+			GLint isDone = GL_TRUE;
+			glGetProgramiv(job.program, GL_COMPLETION_STATUS_ARB, &isDone);
+			if (!isDone) {
+				return 0;
+			}
+		}
+		Job done = job;
+		job = Job();
+		try {
+			return Finish(done);
+		}
+		catch (const std::runtime_error&) {
+			return 0;
+		}
+	}
+
+	bool IsCompiling() const { return job.program != 0; }
+	// log of the last version that failed, empty after a success
+	std::string GetError() const { return error; }
+	// versions compiled and loaded from the cache, for the UI
+	int GetCompiled() const { return compiled; }
+	int GetCached() const { return cached; }
+
+private:
+	struct Job {
+		GLuint program = 0;
+		GLuint vertex = 0;
+		GLuint fragment = 0;
+		uint64_t key = 0;
+		bool isCached = false;
+	};
+
+	// Loads the program from the cache, or queues the compile and link without asking
+	// for their status, which is what would wait for the compiler.
+	Job Start(const std::string& source) {
+		const std::string fragmentSource = ShaderTileRenderer::FragmentSource(source);
+		Job started;
+		started.key = cache.Key(ShaderTileRenderer::VertexSource(), fragmentSource);
+		started.program = cache.Load(started.key);
+		if (started.program) {
+			started.isCached = true;
+			return started;
+		}
+		started.vertex = Compile(GL_VERTEX_SHADER, ShaderTileRenderer::VertexSource());
+		started.fragment = Compile(GL_FRAGMENT_SHADER, fragmentSource);
+		started.program = glCreateProgram();
+		if (cache.IsEnabled()) {
+			glProgramParameteri(started.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glAttachShader(started.program, started.vertex);
+		glAttachShader(started.program, started.fragment);
+		glLinkProgram(started.program);
+		return started;
+	}
+	static GLuint Compile(GLenum type, const std::string& source) {
+		const GLuint shader = glCreateShader(type);
+		const GLchar* text = source.c_str();
+		glShaderSource(shader, 1, &text, nullptr);
+		glCompileShader(shader);
+		return shader;
+	}
+	// Checks the outcome of a started job; returns the program or throws with the log.
+	GLuint Finish(Job& done) {
+		if (done.isCached) {
+			cached++;
+			error.clear();
+			return done.program;
+		}
+		GLint status = 0;
+		glGetProgramiv(done.program, GL_LINK_STATUS, &status);
+		std::string log;
+		if (status != GL_TRUE) {
+			for (GLuint shader : { done.vertex, done.fragment }) {
+				GLint isCompiled = 0;
+				glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+				if (isCompiled != GL_TRUE) {
+					log += InfoLog(shader, false);
+				}
+			}
+			if (log.empty()) {
+				log = InfoLog(done.program, true);
+			}
+		}
+		glDetachShader(done.program, done.vertex);
+		glDetachShader(done.program, done.fragment);
+		glDeleteShader(done.vertex);
+		glDeleteShader(done.fragment);
+		if (status != GL_TRUE) {
+			glDeleteProgram(done.program);
+			error = "shader failed to compile: " + log;
+			throw std::runtime_error(error);
+		}
+		cache.Save(done.key, done.program);
+		compiled++;
+		error.clear();
+		return done.program;
+	}
+	static std::string InfoLog(GLuint handle, bool isProgram) {
+		GLint length = 0;
+		isProgram ? glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &length) : glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &length);
+		std::string log(std::max(length, 1), '\0');
+		isProgram ? glGetProgramInfoLog(handle, length, nullptr, &log[0]) : glGetShaderInfoLog(handle, length, nullptr, &log[0]);
+		return log.c_str();
+	}
+	void Discard() {
+		if (job.program) {
+			glDeleteProgram(job.program);
+			if (job.vertex) glDeleteShader(job.vertex);
+			if (job.fragment) glDeleteShader(job.fragment);
+			job = Job();
+		}
+	}
+
+	// Polls the modification time and size, and reads the file when they change; a new
+	// version is only passed on when its content differs from the last one.
+	void WatchThread() {
+		struct stat last = {};
+		std::string lastSource;
+		bool isFirst = true;
+		while (!isQuit) {
+			struct stat info = {};
+			if (stat(path.c_str(), &info) == 0 && (isFirst || info.st_mtime != last.st_mtime || info.st_size != last.st_size)) {
+				std::ifstream file(path, std::ios::binary);
+				std::stringstream source;
+				source << file.rdbuf();
+				if (file && (isFirst || source.str() != lastSource)) {
+					lastSource = source.str();
+					std::lock_guard<std::mutex> lock(mutex);
+					changed = lastSource;
+					isChanged = true;
+				}
+				last = info;
+				isFirst = false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+	ShaderBinaryCache cache;
+	bool isParallel = false;
+	Job job;					// GL thread: version being compiled
+	std::string error;
+	int compiled = 0;
+	int cached = 0;
+	std::string path;
+	std::thread watcher;
+	std::atomic<bool> isQuit{ false };
+	std::mutex mutex;
+	std::string changed;		// watcher -> GL thread, the newest version only
+	bool isChanged = false;
+};
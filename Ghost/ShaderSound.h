@@ -0,0 +1,2204 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <cmath>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "Audio.h"
+
+// Shadertoy style sound shaders on the CPU.
+//
+// A program defines
+//
+//   vec2 mainSound(float time)              or
+//   vec2 mainSound(int samp, float time)
+//
+// in a subset of GLSL: float/int/bool scalars and vectors, arrays, const and global
+// variables, user functions (with in/out/inout parameters), if/for/while/do, break,
+// continue, return, ?:, swizzles and the common built-in functions, plus #define
+// (object and function like), #if/#ifdef/#else/#endif and the iSampleRate uniform.
+// Matrices, structs, switch and bitwise operators are not supported.
+//
+// Registers are floats and int values live in them, exact up to 2^24. samp counts past
+// that from sample 16777217 on (about 6 minutes at 44.1kHz), so the (int samp, float time)
+// form renders only the samples before it and Render throws for any later one.
+//
+// The source is compiled to bytecode for a register machine whose registers hold
+// SHADER_SOUND_LANES samples, one sample per lane, so every instruction is a short loop
+// the compiler vectorizes. User functions are inlined and divergent control flow runs
+// with lane masks like on a GPU: both sides of a branch execute, assignments only land
+// in the active lanes, and branches and loops are skipped once no lane is active.
+// RenderShaderSound spreads blocks of samples over threads.
+#ifndef SHADER_SOUND_LANES
+#define SHADER_SOUND_LANES 16
+#endif
+
+namespace shader_sound_detail {
+	const int Lanes = SHADER_SOUND_LANES;
+
+	enum class Op : uint8_t {
+		// d = f(a, b, c)
+		Mov, Neg, Not, Floor, Ceil, Fract, Trunc, Round, Abs, Sign, Sqrt, InverseSqrt,
+		Sin, Cos, Tan, Asin, Acos, Atan, Exp, Exp2, Log, Log2, Sinh, Cosh, Tanh,
+		Add, Sub, Mul, Div, IDiv, Mod, IMod, Min, Max, Lt, Le, Gt, Ge, Eq, Ne,
+		And, AndNot, Or, Xor, Atan2, Pow, Step,
+		Select, Clamp, Mix, Mad,
+		// control flow, d is the target instruction and a the mask register
+		Jump, JumpIfNone, JumpIfAny,
+	};
+
+	struct Instruction {
+		Op op;
+		int d;
+		int a;
+		int b;
+		int c;
+	};
+
+	// Bytecode of a compiled program. Registers are numbered, constants are loaded once
+	// per thread, time/sample are filled in per block of lanes and the result is read
+	// from output after every run.
+	struct Code {
+		std::vector<Instruction> instructions;
+		std::vector<std::pair<int, float> > constants;
+		int registers = 0;
+		int time = -1;
+		int sample = -1;
+		bool isSampleUsed = false;	// mainSound takes samp
+		int sampleRate = -1;
+		int output[2] = { -1, -1 };
+	};
+
+	// Math functions are branch free, so that the lane loops vectorize.
+	inline float FromBits(int32_t bits) {
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+	inline int32_t ToBits(float f) {
+		int32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+	inline float Floor(float x) {
+		const bool isSmall = std::fabs(x) < 8388608.0f;
+		const float y = isSmall ? x : 0.0f;
+		const float t = (float)(int32_t)y;
+		const float f = t > y ? t - 1.0f : t;
+		return isSmall ? f : x;
+	}
+	inline float Trunc(float x) {
+		const bool isSmall = std::fabs(x) < 8388608.0f;
+		const float t = (float)(int32_t)(isSmall ? x : 0.0f);
+		return isSmall ? t : x;
+	}
+	// Cody-Waite reduction by pi/2 and the Cephes polynomials for [-pi/4, pi/4];
+	// quadrant 1 turns sin into cos
+	inline float SinQuadrant(float x, int32_t quadrant) {
+		const float j = Floor(x * 0.636619772f + 0.5f);
+		float r = x - j * 1.5703125f;
+		r -= j * 4.837512969970703125e-4f;
+		r -= j * 7.54978995489188216e-8f;
+		const int32_t q = (int32_t)std::max(std::min(j, 1073741824.0f), -1073741824.0f) + quadrant;
+		const float z = r * r;
+		const float s = r + r * z * ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f);
+		const float c = 1.0f - 0.5f * z + z * z * ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f);
+		const float v = (q & 1) ? c : s;
+		return (q & 2) ? -v : v;
+	}
+	inline float Sin(float x) {
+		return SinQuadrant(x, 0);
+	}
+	inline float Cos(float x) {
+		return SinQuadrant(x, 1);
+	}
+	inline float Exp2(float x) {
+		x = std::max(std::min(x, 127.0f), -126.0f);
+		const float n = Floor(x + 0.5f);
+		const float f = x - n;
+		const float p = (((((1.535336188319500e-4f * f + 1.339887440266574e-3f) * f + 9.618437357674640e-3f) * f
+			+ 5.550332471162809e-2f) * f + 2.402264791363012e-1f) * f + 6.931472028550421e-1f) * f + 1.0f;
+		return p * FromBits(((int32_t)n + 127) << 23);
+	}
+	inline float Exp(float x) {
+		return Exp2(x * 1.44269504088896f);
+	}
+	// Cephes polynomial on [sqrt(1/2), sqrt(2))
+	inline float Log(float x) {
+		const int32_t bits = ToBits(x);
+		const float m = FromBits((bits & 0x007FFFFF) | 0x3F800000);
+		const bool isLarge = m > 1.41421356f;
+		const float e = (float)(((bits >> 23) & 255) - 127) + (isLarge ? 1.0f : 0.0f);
+		const float t = (isLarge ? m * 0.5f : m) - 1.0f;
+		const float z = t * t;
+		const float y = ((((((((7.0376836292e-2f * t - 1.1514610310e-1f) * t + 1.1676998740e-1f) * t - 1.2420140846e-1f) * t
+			+ 1.4249322787e-1f) * t - 1.6668057665e-1f) * t + 2.0000714765e-1f) * t - 2.4999993993e-1f) * t + 3.3333331174e-1f) * t * z
+			- 0.5f * z;
+		const float result = t + y + e * 0.693147180559945f;
+		const float infinity = std::numeric_limits<float>::infinity();
+		const float special = x == 0.0f ? -infinity : (x > 0.0f ? x : std::numeric_limits<float>::quiet_NaN());
+		return x > 0.0f && x < infinity ? result : special;
+	}
+	inline float Log2(float x) {
+		return Log(x) * 1.44269504088896f;
+	}
+	inline float Atan(float x) {
+		const float t = std::fabs(x);
+		const bool isLarge = t > 2.414213562373095f;
+		const bool isMedium = t > 0.4142135623730950f;
+		const float large = -1.0f / t;
+		const float medium = (t - 1.0f) / (t + 1.0f);
+		const float u = isLarge ? large : (isMedium ? medium : t);
+		const float base = isLarge ? 1.5707963267948966f : (isMedium ? 0.7853981633974483f : 0.0f);
+		const float z = u * u;
+		const float y = base + (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * u + u;
+		return x < 0.0f ? -y : y;
+	}
+	inline float Atan2(float y, float x) {
+		const float a = Atan(y / x);
+		const float r = x < 0.0f ? a + (y < 0.0f ? -3.14159265358979f : 3.14159265358979f) : a;
+		const float axis = y > 0.0f ? 1.5707963267948966f : (y < 0.0f ? -1.5707963267948966f : 0.0f);
+		return x == 0.0f ? axis : r;
+	}
+
+	template <int N>
+	inline void Execute(const Instruction& in, float* r) {
+		float* d = r + (size_t)in.d * N;
+		const float* a = r + (size_t)std::max(in.a, 0) * N;
+		const float* b = r + (size_t)std::max(in.b, 0) * N;
+		const float* c = r + (size_t)std::max(in.c, 0) * N;
+#define SHADER_SOUND_OP1(name, expression) case Op::name: for (int i = 0; i < N; i++) { const float x = a[i]; d[i] = (expression); } break;
+#define SHADER_SOUND_OP2(name, expression) case Op::name: for (int i = 0; i < N; i++) { const float x = a[i], y = b[i]; d[i] = (expression); } break;
+#define SHADER_SOUND_OP3(name, expression) case Op::name: for (int i = 0; i < N; i++) { const float x = a[i], y = b[i], z = c[i]; d[i] = (expression); } break;
+		switch (in.op) {
+		SHADER_SOUND_OP1(Mov, x)
+		SHADER_SOUND_OP1(Neg, -x)
+		SHADER_SOUND_OP1(Not, x == 0.0f ? 1.0f : 0.0f)
+		SHADER_SOUND_OP1(Floor, Floor(x))
+		SHADER_SOUND_OP1(Ceil, -Floor(-x))
+		SHADER_SOUND_OP1(Fract, x - Floor(x))
+		SHADER_SOUND_OP1(Trunc, Trunc(x))
+		SHADER_SOUND_OP1(Round, Floor(x + 0.5f))
+		SHADER_SOUND_OP1(Abs, std::fabs(x))
+		SHADER_SOUND_OP1(Sign, x > 0.0f ? 1.0f : (x < 0.0f ? -1.0f : 0.0f))
+		SHADER_SOUND_OP1(Sqrt, std::sqrt(x))
+		SHADER_SOUND_OP1(InverseSqrt, 1.0f / std::sqrt(x))
+		SHADER_SOUND_OP1(Sin, Sin(x))
+		SHADER_SOUND_OP1(Cos, Cos(x))
+		SHADER_SOUND_OP1(Tan, Sin(x) / Cos(x))
+		SHADER_SOUND_OP1(Asin, Atan2(x, std::sqrt(std::max(1.0f - x * x, 0.0f))))
+		SHADER_SOUND_OP1(Acos, Atan2(std::sqrt(std::max(1.0f - x * x, 0.0f)), x))
+		SHADER_SOUND_OP1(Atan, Atan(x))
+		SHADER_SOUND_OP1(Exp, Exp(x))
+		SHADER_SOUND_OP1(Exp2, Exp2(x))
+		SHADER_SOUND_OP1(Log, Log(x))
+		SHADER_SOUND_OP1(Log2, Log2(x))
+		SHADER_SOUND_OP1(Sinh, (Exp(x) - Exp(-x)) * 0.5f)
+		SHADER_SOUND_OP1(Cosh, (Exp(x) + Exp(-x)) * 0.5f)
+		SHADER_SOUND_OP1(Tanh, 1.0f - 2.0f / (Exp(2.0f * x) + 1.0f))
+		SHADER_SOUND_OP2(Add, x + y)
+		SHADER_SOUND_OP2(Sub, x - y)
+		SHADER_SOUND_OP2(Mul, x * y)
+		SHADER_SOUND_OP2(Div, x / y)
+		SHADER_SOUND_OP2(IDiv, Trunc(x / y))
+		SHADER_SOUND_OP2(Mod, x - y * Floor(x / y))
+		SHADER_SOUND_OP2(IMod, x - y * Trunc(x / y))
+		SHADER_SOUND_OP2(Min, y < x ? y : x)
+		SHADER_SOUND_OP2(Max, x < y ? y : x)
+		SHADER_SOUND_OP2(Lt, x < y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Le, x <= y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Gt, x > y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Ge, x >= y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Eq, x == y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Ne, x != y ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(And, (x != 0.0f) & (y != 0.0f) ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(AndNot, (x != 0.0f) & (y == 0.0f) ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Or, (x != 0.0f) | (y != 0.0f) ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Xor, (x != 0.0f) != (y != 0.0f) ? 1.0f : 0.0f)
+		SHADER_SOUND_OP2(Atan2, Atan2(x, y))
+		SHADER_SOUND_OP2(Pow, Exp2(y * Log2(x)))
+		SHADER_SOUND_OP2(Step, y < x ? 0.0f : 1.0f)
+		SHADER_SOUND_OP3(Select, x != 0.0f ? y : z)
+		SHADER_SOUND_OP3(Clamp, std::min(std::max(x, y), z))
+		SHADER_SOUND_OP3(Mix, x + (y - x) * z)
+		SHADER_SOUND_OP3(Mad, x * y + z)
+		default:
+			break;
+		}
+#undef SHADER_SOUND_OP1
+#undef SHADER_SOUND_OP2
+#undef SHADER_SOUND_OP3
+	}
+
+	template <int N>
+	inline void Run(const std::vector<Instruction>& code, float* r) {
+		const size_t count = code.size();
+		size_t pc = 0;
+		while (pc < count) {
+			const Instruction& in = code[pc];
+			if (in.op == Op::Jump) {
+				pc = (size_t)in.d;
+			}
+			else if (in.op == Op::JumpIfNone || in.op == Op::JumpIfAny) {
+				const float* mask = r + (size_t)in.a * N;
+				bool isAny = false;
+				for (int i = 0; i < N; i++) {
+					isAny |= mask[i] != 0.0f;
+				}
+				pc = isAny == (in.op == Op::JumpIfAny) ? (size_t)in.d : pc + 1;
+			}
+			else {
+				Execute<N>(in, r);
+				pc++;
+			}
+		}
+	}
+
+	struct Token {
+		enum Kind { Identifier, Number, Symbol, Directive, End };
+		Kind kind;
+		std::string text;
+		double number;
+		bool isInt;
+		int line;
+	};
+
+	inline void Error(int line, const std::string& message) {
+		throw std::runtime_error("shader line " + std::to_string(line) + ": " + message);
+	}
+
+	inline bool IsSymbol(const Token& token, const char* symbol) {
+		return token.kind == Token::Symbol && token.text == symbol;
+	}
+
+	// Preprocessor lines become single Directive tokens, comments are dropped.
+	inline std::vector<Token> Tokenize(const std::string& s, int line = 1) {
+		static const char* symbols[] = {
+			"++", "--", "+=", "-=", "*=", "/=", "%=", "==", "!=", "<=", ">=", "&&", "||", "^^",
+			"+", "-", "*", "/", "%", "=", "<", ">", "!", "?", ":", ";", ",", ".", "(", ")", "{", "}", "[", "]",
+		};
+		std::vector<Token> tokens;
+		bool isLineStart = true;
+		size_t i = 0;
+		while (i < s.size()) {
+			const char ch = s[i];
+			if (ch == '\n') {
+				line++;
+				i++;
+				isLineStart = true;
+				continue;
+			}
+			if (isspace((unsigned char)ch)) {
+				i++;
+				continue;
+			}
+			if (s.compare(i, 2, "//") == 0) {
+				while (i < s.size() && s[i] != '\n') {
+					i++;
+				}
+				continue;
+			}
+			if (s.compare(i, 2, "/*") == 0) {
+				const size_t end = s.find("*/", i + 2);
+				if (end == std::string::npos) {
+					Error(line, "unterminated comment");
+				}
+				line += (int)std::count(s.begin() + i, s.begin() + end, '\n');
+				i = end + 2;
+				continue;
+			}
+			if (ch == '#' && isLineStart) {
+				const int start = line;
+				std::string text;
+				for (i++; i < s.size() && s[i] != '\n'; ) {
+					if (s[i] == '\\' && s.find_first_not_of(" \t\r", i + 1) == s.find('\n', i + 1)) {
+						// line continuation
+						i = s.find('\n', i + 1) + 1;
+						line++;
+						text += ' ';
+					}
+					else if (s.compare(i, 2, "//") == 0) {
+						while (i < s.size() && s[i] != '\n') {
+							i++;
+						}
+					}
+					else {
+						text += s[i++];
+					}
+				}
+				tokens.push_back({ Token::Directive, text, 0.0, false, start });
+				continue;
+			}
+			isLineStart = false;
+			if (isalpha((unsigned char)ch) || ch == '_') {
+				const size_t start = i;
+				while (i < s.size() && (isalnum((unsigned char)s[i]) || s[i] == '_')) {
+					i++;
+				}
+				tokens.push_back({ Token::Identifier, s.substr(start, i - start), 0.0, false, line });
+				continue;
+			}
+			if (isdigit((unsigned char)ch) || (ch == '.' && i + 1 < s.size() && isdigit((unsigned char)s[i + 1]))) {
+				const size_t start = i;
+				bool isInt = true;
+				double value;
+				if (s.compare(i, 2, "0x") == 0 || s.compare(i, 2, "0X") == 0) {
+					for (i += 2; i < s.size() && isxdigit((unsigned char)s[i]); i++) {}
+					value = (double)strtoll(s.substr(start, i - start).c_str(), nullptr, 16);
+				}
+				else {
+					while (i < s.size() && isdigit((unsigned char)s[i])) {
+						i++;
+					}
+					if (i < s.size() && s[i] == '.') {
+						isInt = false;
+						for (i++; i < s.size() && isdigit((unsigned char)s[i]); i++) {}
+					}
+					if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+						isInt = false;
+						i++;
+						if (i < s.size() && (s[i] == '+' || s[i] == '-')) {
+							i++;
+						}
+						while (i < s.size() && isdigit((unsigned char)s[i])) {
+							i++;
+						}
+					}
+					value = strtod(s.substr(start, i - start).c_str(), nullptr);
+				}
+				while (i < s.size() && strchr("fFuUlL", s[i])) {
+					isInt &= s[i] != 'f' && s[i] != 'F' && s[i] != 'l' && s[i] != 'L';
+					i++;
+				}
+				tokens.push_back({ Token::Number, "", value, isInt, line });
+				continue;
+			}
+			const char* symbol = nullptr;
+			for (const char* candidate : symbols) {
+				if (s.compare(i, strlen(candidate), candidate) == 0) {
+					symbol = candidate;
+					break;
+				}
+			}
+			if (!symbol) {
+				Error(line, std::string("unexpected character '") + ch + "'");
+			}
+			tokens.push_back({ Token::Symbol, symbol, 0.0, false, line });
+			i += strlen(symbol);
+		}
+		tokens.push_back({ Token::End, "", 0.0, false, line });
+		return tokens;
+	}
+
+	class Preprocessor {
+	public:
+		std::vector<Token> Run(const std::vector<Token>& tokens) {
+			std::vector<Token> out;
+			std::set<std::string> active;
+			for (size_t i = 0; i < tokens.size(); ) {
+				const Token& t = tokens[i];
+				if (t.kind == Token::Directive) {
+					Directive(t);
+					i++;
+				}
+				else if (t.kind == Token::End) {
+					if (!conditions.empty()) {
+						Error(t.line, "missing #endif");
+					}
+					out.push_back(t);
+					break;
+				}
+				else if (!IsActive()) {
+					i++;
+				}
+				else {
+					i = ExpandAt(tokens, i, out, active);
+				}
+			}
+			return out;
+		}
+
+	private:
+		struct Macro {
+			bool isFunction = false;
+			std::vector<std::string> parameters;
+			std::vector<Token> body;
+		};
+		struct Condition {
+			bool isActive;
+			bool isTaken;		// some branch of this #if was active
+			bool isParentActive;
+		};
+
+		bool IsActive() const {
+			return conditions.empty() || conditions.back().isActive;
+		}
+
+		void Directive(const Token& directive) {
+			std::vector<Token> args = Tokenize(directive.text, directive.line);
+			args.pop_back();
+			if (args.empty()) {
+				return;
+			}
+			const std::string name = args[0].text;
+			args.erase(args.begin());
+			const int line = directive.line;
+			if (name == "if" || name == "ifdef" || name == "ifndef") {
+				bool value = false;
+				if (IsActive()) {
+					if (name == "if") {
+						value = Evaluate(args, line);
+					}
+					else {
+						if (args.empty() || args[0].kind != Token::Identifier) {
+							Error(line, "#" + name + " needs a name");
+						}
+						value = (macros.count(args[0].text) != 0) == (name == "ifdef");
+					}
+				}
+				conditions.push_back({ value, value, IsActive() });
+			}
+			else if (name == "elif" || name == "else") {
+				if (conditions.empty()) {
+					Error(line, "#" + name + " without #if");
+				}
+				Condition& c = conditions.back();
+				const bool value = c.isParentActive && !c.isTaken && (name == "else" || Evaluate(args, line));
+				c.isActive = value;
+				c.isTaken |= value;
+			}
+			else if (name == "endif") {
+				if (conditions.empty()) {
+					Error(line, "#endif without #if");
+				}
+				conditions.pop_back();
+			}
+			else if (!IsActive()) {
+				return;
+			}
+			else if (name == "define") {
+				if (args.empty() || args[0].kind != Token::Identifier) {
+					Error(line, "#define needs a name");
+				}
+				Macro macro;
+				size_t body = 1;
+				// function like only when "(" follows the name without a space
+				const size_t namePosition = directive.text.find(args[0].text, directive.text.find("define") + 6);
+				if (args.size() > 1 && IsSymbol(args[1], "(") && directive.text[namePosition + args[0].text.size()] == '(') {
+					macro.isFunction = true;
+					for (body = 2; body < args.size() && !IsSymbol(args[body], ")"); body++) {
+						if (args[body].kind == Token::Identifier) {
+							macro.parameters.push_back(args[body].text);
+						}
+					}
+					body++;
+				}
+				if (body < args.size()) {
+					macro.body.assign(args.begin() + body, args.end());
+				}
+				macros[args[0].text] = macro;
+			}
+			else if (name == "undef") {
+				if (!args.empty()) {
+					macros.erase(args[0].text);
+				}
+			}
+			else if (name != "version" && name != "extension" && name != "pragma" && name != "line") {
+				Error(line, "#" + name + " is not supported");
+			}
+		}
+
+		// #if expression: integers, defined(), ! && || == != < > <= >= + - * / %
+		bool Evaluate(const std::vector<Token>& args, int line) {
+			std::vector<Token> replaced;
+			for (size_t i = 0; i < args.size(); i++) {
+				if (args[i].kind == Token::Identifier && args[i].text == "defined") {
+					const bool isParenthesized = i + 1 < args.size() && IsSymbol(args[i + 1], "(");
+					const size_t n = i + (isParenthesized ? 2 : 1);
+					if (n >= args.size() || args[n].kind != Token::Identifier) {
+						Error(line, "defined needs a name");
+					}
+					replaced.push_back({ Token::Number, "", macros.count(args[n].text) ? 1.0 : 0.0, true, line });
+					i = n + (isParenthesized ? 1 : 0);
+				}
+				else {
+					replaced.push_back(args[i]);
+				}
+			}
+			std::vector<Token> expanded;
+			std::set<std::string> active;
+			ExpandList(replaced, expanded, active);
+			expanded.push_back({ Token::End, "", 0.0, false, line });
+			size_t p = 0;
+			const double value = EvaluateBinary(expanded, p, 0, line);
+			if (expanded[p].kind != Token::End) {
+				Error(line, "bad #if expression");
+			}
+			return value != 0.0;
+		}
+		double EvaluateBinary(const std::vector<Token>& t, size_t& p, size_t level, int line) {
+			static const std::vector<std::vector<std::string> > levels = {
+				{ "||" }, { "&&" }, { "==", "!=" }, { "<", ">", "<=", ">=" }, { "+", "-" }, { "*", "/", "%" },
+			};
+			if (level == levels.size()) {
+				return EvaluateUnary(t, p, line);
+			}
+			double left = EvaluateBinary(t, p, level + 1, line);
+			for (;;) {
+				const std::vector<std::string>& ops = levels[level];
+				if (t[p].kind != Token::Symbol || std::find(ops.begin(), ops.end(), t[p].text) == ops.end()) {
+					return left;
+				}
+				const std::string op = t[p++].text;
+				const double right = EvaluateBinary(t, p, level + 1, line);
+				if (op == "||") left = left != 0.0 || right != 0.0;
+				else if (op == "&&") left = left != 0.0 && right != 0.0;
+				else if (op == "==") left = left == right;
+				else if (op == "!=") left = left != right;
+				else if (op == "<") left = left < right;
+				else if (op == ">") left = left > right;
+				else if (op == "<=") left = left <= right;
+				else if (op == ">=") left = left >= right;
+				else if (op == "+") left += right;
+				else if (op == "-") left -= right;
+				else if (op == "*") left *= right;
+				else if (right == 0.0) Error(line, "division by zero in #if");
+				else if (op == "/") left = (double)((long long)left / (long long)right);
+				else left = (double)((long long)left % (long long)right);
+			}
+		}
+		double EvaluateUnary(const std::vector<Token>& t, size_t& p, int line) {
+			const Token& token = t[p++];
+			if (IsSymbol(token, "!")) {
+				return EvaluateUnary(t, p, line) == 0.0;
+			}
+			if (IsSymbol(token, "-")) {
+				return -EvaluateUnary(t, p, line);
+			}
+			if (IsSymbol(token, "(")) {
+				const double value = EvaluateBinary(t, p, 0, line);
+				if (!IsSymbol(t[p++], ")")) {
+					Error(line, "missing ) in #if");
+				}
+				return value;
+			}
+			if (token.kind == Token::Number) {
+				return token.number;
+			}
+			if (token.kind == Token::Identifier) {
+				return 0.0;	// undefined names are 0 like in C
+			}
+			Error(line, "bad #if expression");
+			return 0.0;
+		}
+
+		// Appends the expansion of the macro use at tokens[i], returns the index after it.
+		size_t ExpandAt(const std::vector<Token>& tokens, size_t i, std::vector<Token>& out, std::set<std::string>& active) {
+			const Token& t = tokens[i];
+			const auto it = t.kind == Token::Identifier && !active.count(t.text) ? macros.find(t.text) : macros.end();
+			if (it == macros.end()) {
+				out.push_back(t);
+				return i + 1;
+			}
+			const Macro& macro = it->second;
+			std::vector<Token> replaced;
+			size_t next = i + 1;
+			if (macro.isFunction) {
+				if (next >= tokens.size() || !IsSymbol(tokens[next], "(")) {
+					out.push_back(t);
+					return i + 1;
+				}
+				std::vector<std::vector<Token> > args(1);
+				int depth = 0;
+				for (next++; ; next++) {
+					if (next >= tokens.size() || tokens[next].kind == Token::End || tokens[next].kind == Token::Directive) {
+						Error(t.line, "unterminated use of macro " + t.text);
+					}
+					const Token& a = tokens[next];
+					if (IsSymbol(a, "(")) {
+						depth++;
+					}
+					else if (IsSymbol(a, ")")) {
+						if (depth == 0) {
+							break;
+						}
+						depth--;
+					}
+					else if (IsSymbol(a, ",") && depth == 0) {
+						args.emplace_back();
+						continue;
+					}
+					args.back().push_back(a);
+				}
+				next++;
+				if (macro.parameters.empty() && args.size() == 1 && args[0].empty()) {
+					args.clear();
+				}
+				if (args.size() != macro.parameters.size()) {
+					Error(t.line, "wrong number of arguments for macro " + t.text);
+				}
+				for (const Token& b : macro.body) {
+					const auto p = b.kind == Token::Identifier ?
+						std::find(macro.parameters.begin(), macro.parameters.end(), b.text) : macro.parameters.end();
+					if (p == macro.parameters.end()) {
+						replaced.push_back(b);
+						replaced.back().line = t.line;
+					}
+					else {
+						ExpandList(args[p - macro.parameters.begin()], replaced, active);
+					}
+				}
+			}
+			else {
+				replaced = macro.body;
+				for (Token& r : replaced) {
+					r.line = t.line;
+				}
+			}
+			active.insert(t.text);
+			ExpandList(replaced, out, active);
+			active.erase(t.text);
+			return next;
+		}
+		void ExpandList(const std::vector<Token>& tokens, std::vector<Token>& out, std::set<std::string>& active) {
+			for (size_t i = 0; i < tokens.size(); ) {
+				i = ExpandAt(tokens, i, out, active);
+			}
+		}
+
+		std::map<std::string, Macro> macros;
+		std::vector<Condition> conditions;
+	};
+
+	enum class BaseType { Void, Bool, Int, Float };
+
+	struct Type {
+		BaseType base = BaseType::Float;
+		int size = 1;		// vector components
+		int length = 0;		// array elements, 0 for a non array
+		int Count() const { return size * std::max(length, 1); }
+		bool operator==(const Type& other) const { return base == other.base && size == other.size && length == other.length; }
+		bool operator!=(const Type& other) const { return !(*this == other); }
+	};
+
+	inline Type MakeType(BaseType base, int size = 1) {
+		Type type;
+		type.base = base;
+		type.size = size;
+		return type;
+	}
+
+	inline std::string TypeName(const Type& type) {
+		static const char* scalars[] = { "void", "bool", "int", "float" };
+		static const char* vectors[] = { "", "bvec", "ivec", "vec" };
+		std::string name = type.size == 1 ? scalars[(int)type.base] : vectors[(int)type.base] + std::to_string(type.size);
+		return type.length ? name + "[" + std::to_string(type.length) + "]" : name;
+	}
+
+	inline bool TypeFromName(const std::string& name, Type& type) {
+		static const std::map<std::string, Type> types = {
+			{ "void", MakeType(BaseType::Void) }, { "bool", MakeType(BaseType::Bool) },
+			{ "int", MakeType(BaseType::Int) }, { "uint", MakeType(BaseType::Int) }, { "float", MakeType(BaseType::Float) },
+			{ "vec2", MakeType(BaseType::Float, 2) }, { "vec3", MakeType(BaseType::Float, 3) }, { "vec4", MakeType(BaseType::Float, 4) },
+			{ "ivec2", MakeType(BaseType::Int, 2) }, { "ivec3", MakeType(BaseType::Int, 3) }, { "ivec4", MakeType(BaseType::Int, 4) },
+			{ "uvec2", MakeType(BaseType::Int, 2) }, { "uvec3", MakeType(BaseType::Int, 3) }, { "uvec4", MakeType(BaseType::Int, 4) },
+			{ "bvec2", MakeType(BaseType::Bool, 2) }, { "bvec3", MakeType(BaseType::Bool, 3) }, { "bvec4", MakeType(BaseType::Bool, 4) },
+		};
+		const auto it = types.find(name);
+		if (it == types.end()) {
+			return false;
+		}
+		type = it->second;
+		return true;
+	}
+
+	// Result of an expression. regs hold the value, one register per component; for an
+	// lvalue they are the variable's own registers. An element picked by an index that
+	// is not constant keeps the whole array in source and the index register, regs are
+	// filled in by Compiler::Load when the value is needed.
+	struct Expr {
+		Type type;
+		std::vector<int> regs;
+		bool isLValue = false;
+		bool isConstant = false;
+		std::vector<float> values;
+		std::vector<int> source;
+		int index = -1;
+	};
+
+	struct Variable {
+		Type type;
+		std::vector<int> regs;
+		bool isConstant = false;
+		bool isReadOnly = false;
+		std::vector<float> values;
+	};
+
+	struct Parameter {
+		Type type;
+		std::string name;
+		bool isIn = true;
+		bool isOut = false;
+	};
+
+	struct Function {
+		std::string name;
+		Type returnType;
+		std::vector<Parameter> parameters;
+		size_t body = 0;	// token index of the opening brace
+	};
+
+	class Compiler {
+	public:
+		Code Compile(const std::string& source) {
+			tokens = Preprocessor().Run(Tokenize(source));
+			code = Code();
+			code.time = NewRegister();
+			code.sample = NewRegister();
+			code.sampleRate = NewRegister();
+			Variable rate;
+			rate.type = MakeType(BaseType::Float);
+			rate.regs = { code.sampleRate };
+			rate.isReadOnly = true;
+			globals["iSampleRate"] = rate;
+
+			Frame root;
+			root.reg = NewRegister();
+			root.isUniform = true;
+			EmitTo(Op::Mov, root.reg, Constant(1.0f));
+			frames.push_back(root);
+
+			std::vector<size_t> declarations;
+			ScanGlobals(declarations);
+			for (size_t declaration : declarations) {
+				pos = declaration;
+				CompileDeclaration();
+			}
+
+			const Function* main = nullptr;
+			for (const Function& f : functions) {
+				if (f.name == "mainSound") {
+					main = &f;
+				}
+			}
+			if (!main) {
+				Error(tokens.back().line, "mainSound is not defined");
+			}
+			Expr time;
+			time.type = MakeType(BaseType::Float);
+			time.regs = { code.time };
+			Expr sample;
+			sample.type = MakeType(BaseType::Int);
+			sample.regs = { code.sample };
+			std::vector<Expr> args;
+			if (main->parameters.size() == 1 && main->parameters[0].type == time.type) {
+				args = { time };
+			}
+			else if (main->parameters.size() == 2 && main->parameters[0].type == sample.type && main->parameters[1].type == time.type) {
+				args = { sample, time };
+				code.isSampleUsed = true;
+			}
+			else {
+				Error(tokens[main->body].line, "mainSound must take (float time) or (int samp, float time)");
+			}
+			const Expr result = CallFunction(*main, args);
+			if (result.type == MakeType(BaseType::Float, 2)) {
+				code.output[0] = result.regs[0];
+				code.output[1] = result.regs[1];
+			}
+			else if (result.type == MakeType(BaseType::Float)) {
+				code.output[0] = code.output[1] = result.regs[0];
+			}
+			else {
+				Error(tokens[main->body].line, "mainSound must return vec2");
+			}
+			return std::move(code);
+		}
+
+	private:
+		struct Frame {
+			int reg;			// lanes that are running
+			bool isUniform;		// known to be all lanes, stores need no mask
+		};
+		struct Call {
+			size_t frame;
+			Type returnType;
+			std::vector<int> result;
+		};
+		struct Loop {
+			size_t breakFrame;
+			size_t continueFrame;
+		};
+
+		// tokens
+		const Token& Peek(size_t ahead = 0) const {
+			return tokens[std::min(pos + ahead, tokens.size() - 1)];
+		}
+		const Token& Next() {
+			const Token& t = Peek();
+			if (t.kind != Token::End) {
+				pos++;
+			}
+			return t;
+		}
+		void Fail(const std::string& message) const {
+			Error(Peek().line, message);
+		}
+		bool IsSymbolAt(const char* symbol) const {
+			return IsSymbol(Peek(), symbol);
+		}
+		bool Accept(const char* symbol) {
+			if (!IsSymbolAt(symbol)) {
+				return false;
+			}
+			pos++;
+			return true;
+		}
+		void Expect(const char* symbol) {
+			if (!Accept(symbol)) {
+				Fail(std::string("expected '") + symbol + "'");
+			}
+		}
+		bool IsWord(const char* word) const {
+			return Peek().kind == Token::Identifier && Peek().text == word;
+		}
+		bool AcceptWord(const char* word) {
+			if (!IsWord(word)) {
+				return false;
+			}
+			pos++;
+			return true;
+		}
+		std::string ExpectIdentifier() {
+			if (Peek().kind != Token::Identifier) {
+				Fail("expected a name");
+			}
+			return Next().text;
+		}
+		bool AcceptPrecision() {
+			return AcceptWord("highp") || AcceptWord("mediump") || AcceptWord("lowp") || AcceptWord("precise");
+		}
+		// skips to the matching closing bracket of the one at pos
+		void SkipBalanced() {
+			int depth = 0;
+			do {
+				const Token& t = Next();
+				if (t.kind == Token::End) {
+					Fail("unbalanced brackets");
+				}
+				if (IsSymbol(t, "(") || IsSymbol(t, "{") || IsSymbol(t, "[")) {
+					depth++;
+				}
+				else if (IsSymbol(t, ")") || IsSymbol(t, "}") || IsSymbol(t, "]")) {
+					depth--;
+				}
+			} while (depth > 0);
+		}
+		void SkipStatement() {
+			while (!IsSymbolAt(";")) {
+				if (Peek().kind == Token::End) {
+					Fail("expected ';'");
+				}
+				if (IsSymbolAt("(") || IsSymbolAt("{") || IsSymbolAt("[")) {
+					SkipBalanced();
+				}
+				else {
+					Next();
+				}
+			}
+			Next();
+		}
+		Type ParseType() {
+			while (AcceptPrecision()) {}
+			const Token& t = Peek();
+			Type type;
+			if (t.kind != Token::Identifier || !TypeFromName(t.text, type)) {
+				if (t.kind == Token::Identifier && (t.text.compare(0, 3, "mat") == 0 || t.text == "struct" || t.text == "double")) {
+					Fail(t.text + " is not supported");
+				}
+				Fail("expected a type");
+			}
+			Next();
+			return type;
+		}
+		int ParseArrayLength() {
+			Expect("[");
+			if (Accept("]")) {
+				return -1;
+			}
+			const Expr length = ParseConditional();
+			if (!length.isConstant || length.type != MakeType(BaseType::Int) || length.values[0] < 1) {
+				Fail("array size must be a positive constant integer");
+			}
+			Expect("]");
+			return (int)length.values[0];
+		}
+
+		// registers and code
+		int NewRegister() {
+			return code.registers++;
+		}
+		std::vector<int> NewRegisters(int count) {
+			std::vector<int> regs(count);
+			for (int& r : regs) {
+				r = NewRegister();
+			}
+			return regs;
+		}
+		int Constant(float value) {
+			const int32_t bits = ToBits(value);
+			const auto it = constants.find(bits);
+			if (it != constants.end()) {
+				return it->second;
+			}
+			const int reg = NewRegister();
+			constants[bits] = reg;
+			code.constants.push_back(std::make_pair(reg, value));
+			return reg;
+		}
+		void EmitTo(Op op, int d, int a, int b = -1, int c = -1) {
+			code.instructions.push_back({ op, d, a, b, c });
+		}
+		int Emit(Op op, int a, int b = -1, int c = -1) {
+			const int d = NewRegister();
+			EmitTo(op, d, a, b, c);
+			return d;
+		}
+		size_t EmitJump(Op op, int mask) {
+			code.instructions.push_back({ op, -1, mask, -1, -1 });
+			return code.instructions.size() - 1;
+		}
+		void EmitJumpTo(Op op, int mask, size_t target) {
+			code.instructions.push_back({ op, (int)target, mask, -1, -1 });
+		}
+		void Patch(size_t jump) {
+			code.instructions[jump].d = (int)code.instructions.size();
+		}
+
+		// masks
+		void PushFrame(int reg) {
+			frames.push_back({ reg, false });
+		}
+		// lanes running now stop in frames[from] and everything inside it
+		void ClearLanes(size_t from) {
+			const int lanes = Emit(Op::Mov, frames.back().reg);
+			for (size_t i = from; i < frames.size(); i++) {
+				EmitTo(Op::AndNot, frames[i].reg, frames[i].reg, lanes);
+				frames[i].isUniform = false;
+			}
+		}
+		void Store(const std::vector<int>& target, std::vector<int> value) {
+			for (size_t i = 0; i < value.size(); i++) {
+				// v.xy = v.yx must read both before writing either
+				if (value[i] != target[i] && std::find(target.begin(), target.end(), value[i]) != target.end()) {
+					for (int& v : value) {
+						v = Emit(Op::Mov, v);
+					}
+					break;
+				}
+			}
+			const Frame& frame = frames.back();
+			for (size_t i = 0; i < target.size(); i++) {
+				if (target[i] == value[i]) {
+					continue;
+				}
+				if (frame.isUniform) {
+					EmitTo(Op::Mov, target[i], value[i]);
+				}
+				else {
+					EmitTo(Op::Select, target[i], frame.reg, value[i], target[i]);
+				}
+			}
+		}
+
+		// expressions
+		Expr MakeConstant(const Type& type, const std::vector<float>& values) {
+			Expr e;
+			e.type = type;
+			e.isConstant = true;
+			e.values = values;
+			for (float v : values) {
+				e.regs.push_back(Constant(v));
+			}
+			return e;
+		}
+		Expr One(BaseType base) {
+			return MakeConstant(MakeType(base), { 1.0f });
+		}
+		Expr Load(Expr e) {
+			if (e.index < 0 || !e.regs.empty()) {
+				return e;
+			}
+			const int size = e.type.Count();
+			const int count = (int)e.source.size() / size;
+			e.regs.assign(e.source.begin(), e.source.begin() + size);
+			for (int k = 1; k < count; k++) {
+				const int isPicked = Emit(Op::Eq, e.index, Constant((float)k));
+				for (int c = 0; c < size; c++) {
+					e.regs[c] = Emit(Op::Select, isPicked, e.source[k * size + c], e.regs[c]);
+				}
+			}
+			return e;
+		}
+		Expr Component(const Expr& e, int i) {
+			Expr c;
+			c.type = MakeType(e.type.base);
+			c.regs = { e.regs[e.type.size == 1 ? 0 : i] };
+			c.isConstant = e.isConstant;
+			if (e.isConstant) {
+				c.values = { e.values[e.type.size == 1 ? 0 : i] };
+			}
+			return c;
+		}
+		static float Fold(Op op, float a, float b, float c) {
+			float r[4] = { a, b, c, 0.0f };
+			const Instruction in = { op, 3, 0, 1, 2 };
+			Execute<1>(in, r);
+			return r[3];
+		}
+		// op applied per component, scalar arguments are broadcast to type.size
+		Expr Map(Op op, std::vector<Expr> args, const Type& type) {
+			bool isConstant = true;
+			for (Expr& a : args) {
+				a = Load(a);
+				if (a.type.length || (a.type.size != 1 && a.type.size != type.size)) {
+					Fail("mismatched operand sizes");
+				}
+				isConstant &= a.isConstant;
+			}
+			Expr result;
+			result.type = type;
+			std::vector<float> values;
+			for (int i = 0; i < type.size; i++) {
+				float v[3] = { 0.0f, 0.0f, 0.0f };
+				int r[3] = { -1, -1, -1 };
+				for (size_t k = 0; k < args.size(); k++) {
+					const Expr c = Component(args[k], i);
+					r[k] = c.regs[0];
+					v[k] = isConstant ? c.values[0] : 0.0f;
+				}
+				if (isConstant) {
+					values.push_back(Fold(op, v[0], v[1], v[2]));
+				}
+				else {
+					result.regs.push_back(Emit(op, r[0], r[1], r[2]));
+				}
+			}
+			return isConstant ? MakeConstant(type, values) : result;
+		}
+		int ResultSize(const Expr& a, const Expr& b) {
+			if (a.type.size != b.type.size && a.type.size != 1 && b.type.size != 1) {
+				Fail("mismatched vector sizes " + TypeName(a.type) + " and " + TypeName(b.type));
+			}
+			return std::max(a.type.size, b.type.size);
+		}
+		void CheckNumeric(const Expr& e) {
+			if (e.type.length || e.type.base == BaseType::Bool || e.type.base == BaseType::Void) {
+				Fail("expected a number, not " + TypeName(e.type));
+			}
+		}
+		void CheckScalar(const Expr& e) {
+			if (e.type.length || e.type.size != 1 || e.type.base == BaseType::Void) {
+				Fail("expected a scalar condition, not " + TypeName(e.type));
+			}
+		}
+		Expr Arithmetic(char op, const Expr& a, const Expr& b) {
+			CheckNumeric(a);
+			CheckNumeric(b);
+			const bool isFloat = a.type.base == BaseType::Float || b.type.base == BaseType::Float;
+			const Type type = MakeType(isFloat ? BaseType::Float : BaseType::Int, ResultSize(a, b));
+			switch (op) {
+			case '+': return Map(Op::Add, { a, b }, type);
+			case '-': return Map(Op::Sub, { a, b }, type);
+			case '*': return Map(Op::Mul, { a, b }, type);
+			case '/': return Map(isFloat ? Op::Div : Op::IDiv, { a, b }, type);
+			default: return Map(isFloat ? Op::Mod : Op::IMod, { a, b }, type);
+			}
+		}
+		Expr BinaryOperator(const std::string& op, const Expr& a, const Expr& b) {
+			if (op == "+" || op == "-" || op == "*" || op == "/" || op == "%") {
+				return Arithmetic(op[0], a, b);
+			}
+			const Type boolean = MakeType(BaseType::Bool);
+			if (op == "&&" || op == "||" || op == "^^") {
+				CheckScalar(a);
+				CheckScalar(b);
+				return Map(op == "&&" ? Op::And : (op == "||" ? Op::Or : Op::Xor), { a, b }, boolean);
+			}
+			if (op == "==" || op == "!=") {
+				if (a.type.size != b.type.size || a.type.length || b.type.length) {
+					Fail("cannot compare " + TypeName(a.type) + " and " + TypeName(b.type));
+				}
+				const bool isEqual = op == "==";
+				const Expr each = Map(isEqual ? Op::Eq : Op::Ne, { a, b }, MakeType(BaseType::Bool, a.type.size));
+				Expr result = Component(each, 0);
+				for (int i = 1; i < a.type.size; i++) {
+					result = Map(isEqual ? Op::And : Op::Or, { result, Component(each, i) }, boolean);
+				}
+				return result;
+			}
+			CheckNumeric(a);
+			CheckNumeric(b);
+			CheckScalar(a);
+			CheckScalar(b);
+			const Op compare = op == "<" ? Op::Lt : (op == "<=" ? Op::Le : (op == ">" ? Op::Gt : Op::Ge));
+			return Map(compare, { a, b }, boolean);
+		}
+		// implicit conversion for assignment, initialization and arguments
+		Expr Convert(Expr e, const Type& type) {
+			if (e.type == type) {
+				return e;
+			}
+			const bool isWidening = type.base == BaseType::Float && e.type.base == BaseType::Int;
+			if (!isWidening || e.type.size != type.size || e.type.length != type.length) {
+				Fail("cannot convert " + TypeName(e.type) + " to " + TypeName(type));
+			}
+			e.type.base = BaseType::Float;
+			e.isLValue = false;
+			return e;
+		}
+		Expr CastScalar(const Expr& c, BaseType base) {
+			if (base == BaseType::Int && c.type.base == BaseType::Float) {
+				return Map(Op::Trunc, { c }, MakeType(BaseType::Int));
+			}
+			if (base == BaseType::Bool && c.type.base != BaseType::Bool) {
+				return Map(Op::Ne, { c, MakeConstant(MakeType(c.type.base), { 0.0f }) }, MakeType(BaseType::Bool));
+			}
+			Expr r = c;
+			r.type.base = base;
+			r.isLValue = false;
+			return r;
+		}
+		Expr Assemble(const Type& type, const std::vector<Expr>& components) {
+			Expr e;
+			e.type = type;
+			e.isConstant = true;
+			for (const Expr& c : components) {
+				e.regs.push_back(c.regs[0]);
+				e.isConstant &= c.isConstant;
+				e.values.push_back(c.isConstant ? c.values[0] : 0.0f);
+			}
+			if (!e.isConstant) {
+				e.values.clear();
+			}
+			return e;
+		}
+		Expr Construct(Type type, const std::vector<Expr>& args) {
+			if (type.base == BaseType::Void) {
+				Fail("cannot construct void");
+			}
+			if (type.length) {
+				std::vector<Expr> components;
+				Type element = type;
+				element.length = 0;
+				for (const Expr& a : args) {
+					const Expr e = Convert(Load(a), element);
+					for (int i = 0; i < element.size; i++) {
+						components.push_back(Component(e, i));
+					}
+				}
+				if (type.length > 0 && type.length != (int)args.size()) {
+					Fail("wrong number of array elements");
+				}
+				type.length = (int)args.size();
+				return Assemble(type, components);
+			}
+			std::vector<Expr> components;
+			for (const Expr& a : args) {
+				const Expr e = Load(a);
+				if (e.type.length || e.type.base == BaseType::Void) {
+					Fail("cannot construct " + TypeName(type) + " from " + TypeName(e.type));
+				}
+				for (int i = 0; i < e.type.size; i++) {
+					components.push_back(CastScalar(Component(e, i), type.base));
+				}
+			}
+			if (args.size() == 1 && args[0].type.size == 1) {
+				components.resize(type.size, components[0]);
+			}
+			if ((int)components.size() < type.size || args.empty()) {
+				Fail("not enough values to construct " + TypeName(type));
+			}
+			components.resize(type.size);
+			return Assemble(type, components);
+		}
+		Expr Swizzle(Expr e, const std::string& name) {
+			static const char* sets[] = { "xyzw", "rgba", "stpq" };
+			if (e.type.length || name.size() > 4) {
+				Fail("bad swizzle ." + name);
+			}
+			e = Load(e);
+			const char* set = nullptr;
+			for (const char* s : sets) {
+				if (strchr(s, name[0])) {
+					set = s;
+				}
+			}
+			Expr r;
+			r.type = MakeType(e.type.base, (int)name.size());
+			r.isConstant = e.isConstant;
+			r.isLValue = e.isLValue && e.index < 0;
+			for (size_t i = 0; i < name.size(); i++) {
+				const char* p = set ? strchr(set, name[i]) : nullptr;
+				if (!p || p - set >= e.type.size) {
+					Fail("bad swizzle ." + name + " on " + TypeName(e.type));
+				}
+				const int k = (int)(p - set);
+				r.isLValue &= name.find(name[i]) == i;
+				r.regs.push_back(e.regs[k]);
+				if (e.isConstant) {
+					r.values.push_back(e.values[k]);
+				}
+			}
+			return r;
+		}
+		Expr Index(Expr e, const Expr& index) {
+			if (index.type != MakeType(BaseType::Int)) {
+				Fail("index must be an int");
+			}
+			Type element = e.type;
+			if (e.type.length) {
+				element.length = 0;
+			}
+			else if (e.type.size > 1) {
+				element.size = 1;
+			}
+			else {
+				Fail("cannot index " + TypeName(e.type));
+			}
+			e = Load(e);
+			const int size = element.Count();
+			const int count = e.type.Count() / size;
+			Expr r;
+			r.type = element;
+			r.isLValue = e.isLValue && e.index < 0;
+			r.isConstant = e.isConstant && index.isConstant;
+			if (index.isConstant) {
+				const int k = (int)index.values[0];
+				if (k < 0 || k >= count) {
+					Fail("index out of range");
+				}
+				r.regs.assign(e.regs.begin() + k * size, e.regs.begin() + (k + 1) * size);
+				if (e.isConstant) {
+					r.values.assign(e.values.begin() + k * size, e.values.begin() + (k + 1) * size);
+				}
+			}
+			else {
+				r.source = e.regs;
+				r.index = index.regs[0];
+			}
+			return r;
+		}
+		void Assign(const Expr& target, Expr value) {
+			if (!target.isLValue) {
+				Fail("cannot assign to this expression");
+			}
+			value = Convert(Load(value), target.type);
+			if (target.index < 0) {
+				Store(target.regs, value.regs);
+				return;
+			}
+			// every element, in the lanes whose index picks it
+			const int size = target.type.Count();
+			const int count = (int)target.source.size() / size;
+			for (int k = 0; k < count; k++) {
+				const int isPicked = Emit(Op::Eq, target.index, Constant((float)k));
+				const int mask = Emit(Op::And, frames.back().reg, isPicked);
+				for (int c = 0; c < size; c++) {
+					const int reg = target.source[k * size + c];
+					EmitTo(Op::Select, reg, mask, value.regs[c], reg);
+				}
+			}
+		}
+
+		Expr ParseExpression() {
+			Expr e = ParseAssignment();
+			while (Accept(",")) {
+				e = ParseAssignment();
+			}
+			return e;
+		}
+		Expr ParseAssignment() {
+			Expr target = ParseConditional();
+			static const char* ops[] = { "=", "+=", "-=", "*=", "/=", "%=" };
+			for (const char* op : ops) {
+				if (Accept(op)) {
+					Expr value = ParseAssignment();
+					if (op[1]) {
+						value = Arithmetic(op[0], Load(target), Load(value));
+					}
+					Assign(target, value);
+					return target;
+				}
+			}
+			return target;
+		}
+		Expr ParseConditional() {
+			Expr condition = ParseBinary(0);
+			if (!Accept("?")) {
+				return condition;
+			}
+			condition = Load(condition);
+			CheckScalar(condition);
+			// side effects of each branch only land in its own lanes
+			const int parent = frames.back().reg;
+			const int thenMask = Emit(Op::And, parent, condition.regs[0]);
+			const int elseMask = Emit(Op::AndNot, parent, condition.regs[0]);
+			PushFrame(thenMask);
+			Expr a = Load(ParseAssignment());
+			frames.pop_back();
+			Expect(":");
+			PushFrame(elseMask);
+			Expr b = Load(ParseAssignment());
+			frames.pop_back();
+			Type type = a.type;
+			if (a.type.base == BaseType::Float || b.type.base == BaseType::Float) {
+				type.base = BaseType::Float;
+			}
+			a = Convert(a, type);
+			b = Convert(b, type);
+			if (type.length) {
+				Fail("?: on arrays is not supported");
+			}
+			return Map(Op::Select, { condition, a, b }, type);
+		}
+		Expr ParseBinary(size_t level) {
+			static const std::vector<std::vector<std::string> > levels = {
+				{ "||" }, { "^^" }, { "&&" }, { "==", "!=" }, { "<", ">", "<=", ">=" }, { "+", "-" }, { "*", "/", "%" },
+			};
+			if (level == levels.size()) {
+				return ParseUnary();
+			}
+			Expr left = ParseBinary(level + 1);
+			for (;;) {
+				const std::vector<std::string>& ops = levels[level];
+				if (Peek().kind != Token::Symbol || std::find(ops.begin(), ops.end(), Peek().text) == ops.end()) {
+					return left;
+				}
+				const std::string op = Next().text;
+				const Expr right = ParseBinary(level + 1);
+				left = BinaryOperator(op, Load(left), Load(right));
+			}
+		}
+		Expr ParseUnary() {
+			if (Accept("-")) {
+				const Expr e = Load(ParseUnary());
+				CheckNumeric(e);
+				return Map(Op::Neg, { e }, e.type);
+			}
+			if (Accept("+")) {
+				Expr e = Load(ParseUnary());
+				CheckNumeric(e);
+				e.isLValue = false;
+				return e;
+			}
+			if (Accept("!")) {
+				const Expr e = Load(ParseUnary());
+				CheckScalar(e);
+				return Map(Op::Not, { e }, MakeType(BaseType::Bool));
+			}
+			if (IsSymbolAt("++") || IsSymbolAt("--")) {
+				const char op = Next().text[0];
+				const Expr e = ParseUnary();
+				Assign(e, Arithmetic(op, Load(e), One(e.type.base)));
+				return e;
+			}
+			return ParsePostfix();
+		}
+		Expr ParsePostfix() {
+			Expr e = ParsePrimary();
+			for (;;) {
+				if (Accept(".")) {
+					const std::string name = ExpectIdentifier();
+					if (name == "length" && Accept("(")) {
+						Expect(")");
+						if (!e.type.length && e.type.size == 1) {
+							Fail("length() of a scalar");
+						}
+						e = MakeConstant(MakeType(BaseType::Int), { (float)(e.type.length ? e.type.length : e.type.size) });
+					}
+					else {
+						e = Swizzle(e, name);
+					}
+				}
+				else if (Accept("[")) {
+					const Expr index = Load(ParseExpression());
+					Expect("]");
+					e = Index(e, index);
+				}
+				else if (IsSymbolAt("++") || IsSymbolAt("--")) {
+					const char op = Next().text[0];
+					const Expr old = Load(e);
+					CheckNumeric(old);
+					Expr value;
+					value.type = old.type;
+					for (int r : old.regs) {
+						value.regs.push_back(Emit(Op::Mov, r));
+					}
+					Assign(e, Arithmetic(op, old, One(e.type.base)));
+					e = value;
+				}
+				else {
+					return e;
+				}
+			}
+		}
+		std::vector<Expr> ParseArguments() {
+			std::vector<Expr> args;
+			if (Accept(")")) {
+				return args;
+			}
+			do {
+				args.push_back(ParseAssignment());
+			} while (Accept(","));
+			Expect(")");
+			return args;
+		}
+		Expr ParsePrimary() {
+			const Token t = Next();
+			if (t.kind == Token::Number) {
+				return MakeConstant(MakeType(t.isInt ? BaseType::Int : BaseType::Float), { (float)t.number });
+			}
+			if (IsSymbol(t, "(")) {
+				Expr e = ParseExpression();
+				Expect(")");
+				return e;
+			}
+			if (t.kind != Token::Identifier) {
+				Error(t.line, "unexpected '" + t.text + "'");
+			}
+			if (t.text == "true" || t.text == "false") {
+				return MakeConstant(MakeType(BaseType::Bool), { t.text == "true" ? 1.0f : 0.0f });
+			}
+			Type type;
+			if (TypeFromName(t.text, type)) {
+				if (IsSymbolAt("[")) {
+					type.length = ParseArrayLength();
+				}
+				Expect("(");
+				return Construct(type, ParseArguments());
+			}
+			if (t.text.compare(0, 3, "mat") == 0 && t.text.size() > 3 && isdigit((unsigned char)t.text[3])) {
+				Error(t.line, t.text + " is not supported");
+			}
+			if (Accept("(")) {
+				return CallNamed(t.text, ParseArguments());
+			}
+			const Variable* v = Lookup(t.text);
+			if (!v) {
+				Error(t.line, "unknown name " + t.text);
+			}
+			Expr e;
+			e.type = v->type;
+			e.regs = v->regs;
+			e.isConstant = v->isConstant;
+			e.values = v->values;
+			e.isLValue = !v->isConstant && !v->isReadOnly;
+			return e;
+		}
+
+		// functions
+		Expr CallNamed(const std::string& name, std::vector<Expr> args) {
+			for (Expr& a : args) {
+				a = Load(a);
+			}
+			const Function* best = nullptr;
+			int bestScore = -1;
+			for (const Function& f : functions) {
+				if (f.name != name || f.parameters.size() != args.size()) {
+					continue;
+				}
+				int score = 1;
+				for (size_t i = 0; i < args.size() && score; i++) {
+					const Type& p = f.parameters[i].type;
+					const Type& a = args[i].type;
+					if (p == a) {
+						score += 2;
+					}
+					else if (p.base != BaseType::Float || a.base != BaseType::Int || p.size != a.size || p.length != a.length || f.parameters[i].isOut) {
+						score = 0;
+					}
+				}
+				if (score > bestScore) {
+					best = &f;
+					bestScore = score;
+				}
+			}
+			if (best && bestScore > 0) {
+				return CallFunction(*best, args);
+			}
+			if (best) {
+				Fail("no matching overload of " + name);
+			}
+			return CallBuiltin(name, args);
+		}
+		// inlined at the call site, under the caller's mask
+		Expr CallFunction(const Function& f, const std::vector<Expr>& args) {
+			if (std::find(inlining.begin(), inlining.end(), &f) != inlining.end()) {
+				Fail("recursion is not supported (" + f.name + ")");
+			}
+			std::vector<Variable> parameters;
+			for (size_t i = 0; i < args.size(); i++) {
+				const Parameter& p = f.parameters[i];
+				Variable v;
+				v.type = p.type;
+				v.regs = NewRegisters(p.type.Count());
+				if (p.isIn) {
+					const Expr value = Convert(Load(args[i]), p.type);
+					for (size_t k = 0; k < v.regs.size(); k++) {
+						EmitTo(Op::Mov, v.regs[k], value.regs[k]);
+					}
+				}
+				if (p.isOut && (!args[i].isLValue || args[i].type != p.type)) {
+					Fail("argument " + std::to_string(i + 1) + " of " + f.name + " must be a variable of type " + TypeName(p.type));
+				}
+				parameters.push_back(v);
+			}
+			std::vector<std::map<std::string, Variable> > callerScopes;
+			callerScopes.swap(scopes);
+			std::vector<Loop> callerLoops;
+			callerLoops.swap(loops);
+			scopes.emplace_back();
+			for (size_t i = 0; i < parameters.size(); i++) {
+				if (!f.parameters[i].name.empty()) {
+					scopes.back()[f.parameters[i].name] = parameters[i];
+				}
+			}
+			Call call;
+			call.frame = frames.size();
+			call.returnType = f.returnType;
+			call.result = NewRegisters(f.returnType.Count());
+			Frame frame;
+			frame.reg = Emit(Op::Mov, frames.back().reg);
+			frame.isUniform = frames.back().isUniform;
+			frames.push_back(frame);
+			calls.push_back(call);
+			inlining.push_back(&f);
+
+			const size_t callerPos = pos;
+			pos = f.body;
+			CompileStatement();
+			pos = callerPos;
+
+			inlining.pop_back();
+			calls.pop_back();
+			frames.pop_back();
+			scopes.swap(callerScopes);
+			loops.swap(callerLoops);
+			for (size_t i = 0; i < args.size(); i++) {
+				if (f.parameters[i].isOut) {
+					Expr value;
+					value.type = parameters[i].type;
+					value.regs = parameters[i].regs;
+					Assign(args[i], value);
+				}
+			}
+			Expr result;
+			result.type = f.returnType;
+			result.regs = call.result;
+			return result;
+		}
+		Expr CallBuiltin(const std::string& name, const std::vector<Expr>& args) {
+			static const std::map<std::string, Op> unary = {
+				{ "sin", Op::Sin }, { "cos", Op::Cos }, { "tan", Op::Tan }, { "asin", Op::Asin }, { "acos", Op::Acos },
+				{ "atan", Op::Atan }, { "exp", Op::Exp }, { "exp2", Op::Exp2 }, { "log", Op::Log }, { "log2", Op::Log2 },
+				{ "sqrt", Op::Sqrt }, { "inversesqrt", Op::InverseSqrt }, { "abs", Op::Abs }, { "sign", Op::Sign },
+				{ "floor", Op::Floor }, { "ceil", Op::Ceil }, { "fract", Op::Fract }, { "trunc", Op::Trunc },
+				{ "round", Op::Round }, { "roundEven", Op::Round }, { "sinh", Op::Sinh }, { "cosh", Op::Cosh }, { "tanh", Op::Tanh },
+			};
+			static const std::map<std::string, Op> binary = {
+				{ "pow", Op::Pow }, { "mod", Op::Mod }, { "min", Op::Min }, { "max", Op::Max }, { "step", Op::Step }, { "atan", Op::Atan2 },
+			};
+			const auto checkArgs = [&](size_t count) {
+				if (args.size() != count) {
+					Fail("wrong number of arguments for " + name);
+				}
+				for (const Expr& a : args) {
+					CheckNumeric(a);
+				}
+			};
+			// genType result: float unless every argument is int and the function keeps ints
+			const auto resultType = [&](bool isIntKept) {
+				Type type = MakeType(BaseType::Float, 1);
+				bool isInt = isIntKept;
+				for (const Expr& a : args) {
+					type.size = std::max(type.size, a.type.size);
+					isInt &= a.type.base == BaseType::Int;
+				}
+				for (const Expr& a : args) {
+					if (a.type.size != 1 && a.type.size != type.size) {
+						Fail("mismatched argument sizes for " + name);
+					}
+				}
+				type.base = isInt ? BaseType::Int : BaseType::Float;
+				return type;
+			};
+			const auto unaryIt = unary.find(name);
+			if (unaryIt != unary.end() && args.size() == 1) {
+				checkArgs(1);
+				return Map(unaryIt->second, args, resultType(name == "abs" || name == "sign"));
+			}
+			const auto binaryIt = binary.find(name);
+			if (binaryIt != binary.end()) {
+				checkArgs(2);
+				return Map(binaryIt->second, args, resultType(name == "min" || name == "max"));
+			}
+			const Type one = MakeType(BaseType::Float);
+			if (name == "radians" || name == "degrees") {
+				checkArgs(1);
+				const float scale = name == "radians" ? 0.017453292519943295f : 57.29577951308232f;
+				return Map(Op::Mul, { args[0], MakeConstant(one, { scale }) }, resultType(false));
+			}
+			if (name == "clamp") {
+				checkArgs(3);
+				return Map(Op::Clamp, args, resultType(true));
+			}
+			if (name == "mix") {
+				if (args.size() == 3 && args[2].type.base == BaseType::Bool) {
+					return Map(Op::Select, { args[2], args[1], args[0] }, resultType(false));
+				}
+				checkArgs(3);
+				return Map(Op::Mix, args, resultType(false));
+			}
+			if (name == "smoothstep") {
+				checkArgs(3);
+				const Type type = resultType(false);
+				const Expr t = Map(Op::Clamp, { Arithmetic('/', Arithmetic('-', args[2], args[0]), Arithmetic('-', args[1], args[0])),
+					MakeConstant(one, { 0.0f }), MakeConstant(one, { 1.0f }) }, type);
+				return Arithmetic('*', Arithmetic('*', t, t), Arithmetic('-', MakeConstant(one, { 3.0f }), Arithmetic('*', MakeConstant(one, { 2.0f }), t)));
+			}
+			if (name == "dot") {
+				checkArgs(2);
+				return Dot(args[0], args[1]);
+			}
+			if (name == "length") {
+				checkArgs(1);
+				return Map(Op::Sqrt, { Dot(args[0], args[0]) }, one);
+			}
+			if (name == "distance") {
+				checkArgs(2);
+				const Expr d = Arithmetic('-', args[0], args[1]);
+				return Map(Op::Sqrt, { Dot(d, d) }, one);
+			}
+			if (name == "normalize") {
+				checkArgs(1);
+				return Arithmetic('*', args[0], Map(Op::InverseSqrt, { Dot(args[0], args[0]) }, one));
+			}
+			if (name == "cross") {
+				checkArgs(2);
+				if (args[0].type.size != 3 || args[1].type.size != 3) {
+					Fail("cross needs vec3 arguments");
+				}
+				std::vector<Expr> components;
+				for (int i = 0; i < 3; i++) {
+					const int j = (i + 1) % 3, k = (i + 2) % 3;
+					components.push_back(Arithmetic('-', Arithmetic('*', Component(args[0], j), Component(args[1], k)),
+						Arithmetic('*', Component(args[0], k), Component(args[1], j))));
+				}
+				return Assemble(MakeType(BaseType::Float, 3), components);
+			}
+			Fail("unknown function " + name);
+			return Expr();
+		}
+		Expr Dot(const Expr& a, const Expr& b) {
+			if (a.type.size != b.type.size) {
+				Fail("dot of different sizes");
+			}
+			Expr sum = Arithmetic('*', Component(a, 0), Component(b, 0));
+			for (int i = 1; i < a.type.size; i++) {
+				sum = Map(Op::Mad, { Component(a, i), Component(b, i), Convert(sum, MakeType(BaseType::Float)) }, MakeType(BaseType::Float));
+			}
+			return Convert(sum, MakeType(BaseType::Float));
+		}
+
+		// declarations and statements
+		Variable* Lookup(const std::string& name) {
+			for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+				const auto it = scope->find(name);
+				if (it != scope->end()) {
+					return &it->second;
+				}
+			}
+			const auto it = globals.find(name);
+			return it == globals.end() ? nullptr : &it->second;
+		}
+		void Declare(const std::string& name, const Variable& v) {
+			std::map<std::string, Variable>& scope = scopes.empty() ? globals : scopes.back();
+			if (scope.count(name)) {
+				Fail(name + " is already declared");
+			}
+			scope[name] = v;
+		}
+		bool IsDeclarationStart() const {
+			const Token& t = Peek();
+			Type type;
+			if (t.kind != Token::Identifier) {
+				return false;
+			}
+			if (t.text == "const" || t.text == "highp" || t.text == "mediump" || t.text == "lowp" || t.text == "precise") {
+				return true;
+			}
+			return TypeFromName(t.text, type) && (Peek(1).kind == Token::Identifier || IsSymbol(Peek(1), "["));
+		}
+		void CompileDeclaration() {
+			bool isConst = false;
+			for (;;) {
+				if (AcceptWord("const")) {
+					isConst = true;
+				}
+				else if (!AcceptPrecision()) {
+					break;
+				}
+			}
+			Type base = ParseType();
+			if (base.base == BaseType::Void) {
+				Fail("variables cannot be void");
+			}
+			if (IsSymbolAt("[")) {
+				base.length = ParseArrayLength();
+			}
+			do {
+				const std::string name = ExpectIdentifier();
+				Variable v;
+				v.type = base;
+				if (IsSymbolAt("[")) {
+					v.type.length = ParseArrayLength();
+				}
+				if (Accept("=")) {
+					Expr init = Load(ParseAssignment());
+					if (v.type.length < 0) {
+						v.type.length = init.type.length;
+					}
+					init = Convert(init, v.type);
+					if (isConst && init.isConstant) {
+						v.isConstant = true;
+						v.values = init.values;
+						v.regs = init.regs;
+					}
+					else {
+						v.regs = NewRegisters(v.type.Count());
+						v.isReadOnly = isConst;
+						for (size_t i = 0; i < v.regs.size(); i++) {
+							EmitTo(Op::Mov, v.regs[i], init.regs[i]);
+						}
+					}
+				}
+				else {
+					if (isConst) {
+						Fail("const " + name + " needs a value");
+					}
+					if (v.type.length < 0) {
+						Fail("array " + name + " needs a size");
+					}
+					// undefined in GLSL, zero keeps renders reproducible
+					v.regs = NewRegisters(v.type.Count());
+					for (int r : v.regs) {
+						EmitTo(Op::Mov, r, Constant(0.0f));
+					}
+				}
+				Declare(name, v);
+			} while (Accept(","));
+			Expect(";");
+		}
+		Expr ParseCondition() {
+			const Expr c = Load(ParseExpression());
+			CheckScalar(c);
+			return c;
+		}
+		void CompileStatement() {
+			if (Accept("{")) {
+				scopes.emplace_back();
+				while (!Accept("}")) {
+					if (Peek().kind == Token::End) {
+						Fail("expected '}'");
+					}
+					CompileStatement();
+				}
+				scopes.pop_back();
+				return;
+			}
+			if (Accept(";")) {
+				return;
+			}
+			if (AcceptWord("if")) {
+				Expect("(");
+				const Expr c = ParseCondition();
+				Expect(")");
+				const int parent = frames.back().reg;
+				const int thenMask = Emit(Op::And, parent, c.regs[0]);
+				const int elseMask = Emit(Op::AndNot, parent, c.regs[0]);
+				const size_t skipThen = EmitJump(Op::JumpIfNone, thenMask);
+				PushFrame(thenMask);
+				CompileStatement();
+				frames.pop_back();
+				if (AcceptWord("else")) {
+					const size_t skipOver = EmitJump(Op::Jump, -1);
+					Patch(skipThen);
+					const size_t skipElse = EmitJump(Op::JumpIfNone, elseMask);
+					PushFrame(elseMask);
+					CompileStatement();
+					frames.pop_back();
+					Patch(skipElse);
+					code.instructions[skipOver].d = (int)skipElse;
+				}
+				else {
+					Patch(skipThen);
+				}
+				return;
+			}
+			if (AcceptWord("for")) {
+				Expect("(");
+				scopes.emplace_back();
+				if (!Accept(";")) {
+					if (IsDeclarationStart()) {
+						CompileDeclaration();
+					}
+					else {
+						ParseExpression();
+						Expect(";");
+					}
+				}
+				const int loopMask = Emit(Op::Mov, frames.back().reg);
+				PushFrame(loopMask);
+				const size_t top = code.instructions.size();
+				if (!IsSymbolAt(";")) {
+					const Expr c = ParseCondition();
+					EmitTo(Op::And, loopMask, loopMask, c.regs[0]);
+				}
+				Expect(";");
+				const size_t exit = EmitJump(Op::JumpIfNone, loopMask);
+				// the step is compiled after the body
+				const size_t step = pos;
+				while (!IsSymbolAt(")")) {
+					if (Peek().kind == Token::End) {
+						Fail("expected ')'");
+					}
+					if (IsSymbolAt("(") || IsSymbolAt("[")) {
+						SkipBalanced();
+					}
+					else {
+						Next();
+					}
+				}
+				Expect(")");
+				CompileLoopBody(loopMask);
+				const size_t end = pos;
+				pos = step;
+				if (!IsSymbolAt(")")) {
+					ParseExpression();
+				}
+				pos = end;
+				EmitJumpTo(Op::Jump, -1, top);
+				Patch(exit);
+				frames.pop_back();
+				scopes.pop_back();
+				return;
+			}
+			if (AcceptWord("while")) {
+				Expect("(");
+				const int loopMask = Emit(Op::Mov, frames.back().reg);
+				PushFrame(loopMask);
+				const size_t top = code.instructions.size();
+				const Expr c = ParseCondition();
+				EmitTo(Op::And, loopMask, loopMask, c.regs[0]);
+				Expect(")");
+				const size_t exit = EmitJump(Op::JumpIfNone, loopMask);
+				CompileLoopBody(loopMask);
+				EmitJumpTo(Op::Jump, -1, top);
+				Patch(exit);
+				frames.pop_back();
+				return;
+			}
+			if (AcceptWord("do")) {
+				const int loopMask = Emit(Op::Mov, frames.back().reg);
+				PushFrame(loopMask);
+				const size_t top = code.instructions.size();
+				CompileLoopBody(loopMask);
+				if (!AcceptWord("while")) {
+					Fail("expected while");
+				}
+				Expect("(");
+				const Expr c = ParseCondition();
+				Expect(")");
+				Expect(";");
+				EmitTo(Op::And, loopMask, loopMask, c.regs[0]);
+				EmitJumpTo(Op::JumpIfAny, loopMask, top);
+				frames.pop_back();
+				return;
+			}
+			if (AcceptWord("return")) {
+				if (calls.empty()) {
+					Fail("return outside of a function");
+				}
+				// a copy, calls in the expression grow the stack
+				const Call call = calls.back();
+				if (!Accept(";")) {
+					const Expr value = Convert(Load(ParseExpression()), call.returnType);
+					Expect(";");
+					Store(call.result, value.regs);
+				}
+				else if (call.returnType.base != BaseType::Void) {
+					Fail("return needs a value");
+				}
+				ClearLanes(call.frame);
+				return;
+			}
+			if (AcceptWord("break") || AcceptWord("continue")) {
+				const bool isBreak = tokens[pos - 1].text == "break";
+				if (loops.empty()) {
+					Fail(std::string(isBreak ? "break" : "continue") + " outside of a loop");
+				}
+				Expect(";");
+				ClearLanes(isBreak ? loops.back().breakFrame : loops.back().continueFrame);
+				return;
+			}
+			if (IsWord("switch") || IsWord("discard") || IsWord("struct")) {
+				Fail(Peek().text + " is not supported");
+			}
+			if (IsDeclarationStart()) {
+				CompileDeclaration();
+				return;
+			}
+			ParseExpression();
+			Expect(";");
+		}
+		// runs in the loop frame; continue stops lanes until the next iteration only
+		void CompileLoopBody(int loopMask) {
+			PushFrame(Emit(Op::Mov, loopMask));
+			loops.push_back({ frames.size() - 2, frames.size() - 1 });
+			CompileStatement();
+			loops.pop_back();
+			frames.pop_back();
+		}
+
+		// Collects functions and the positions of global declarations. Bodies are
+		// compiled when they are called, so functions may be defined in any order.
+		void ScanGlobals(std::vector<size_t>& declarations) {
+			pos = 0;
+			while (Peek().kind != Token::End) {
+				if (Accept(";")) {
+					continue;
+				}
+				if (AcceptWord("precision")) {
+					SkipStatement();
+					continue;
+				}
+				const size_t start = pos;
+				bool isUniform = false;
+				for (;;) {
+					if (AcceptWord("uniform")) {
+						isUniform = true;
+					}
+					else if (!AcceptWord("const") && !AcceptPrecision()) {
+						break;
+					}
+				}
+				if (isUniform) {
+					// iSampleRate is built in, other uniforms have no value here
+					SkipStatement();
+					continue;
+				}
+				const Type type = ParseType();
+				if (IsSymbolAt("[")) {
+					SkipBalanced();
+				}
+				const std::string name = ExpectIdentifier();
+				if (!Accept("(")) {
+					pos = start;
+					SkipStatement();
+					declarations.push_back(start);
+					continue;
+				}
+				Function f;
+				f.name = name;
+				f.returnType = type;
+				if (IsWord("void") && IsSymbol(Peek(1), ")")) {
+					Next();
+				}
+				if (!Accept(")")) {
+					do {
+						Parameter p;
+						for (;;) {
+							if (AcceptWord("in")) {
+								p.isIn = true;
+							}
+							else if (AcceptWord("out")) {
+								p.isIn = false;
+								p.isOut = true;
+							}
+							else if (AcceptWord("inout")) {
+								p.isIn = p.isOut = true;
+							}
+							else if (!AcceptWord("const") && !AcceptPrecision()) {
+								break;
+							}
+						}
+						p.type = ParseType();
+						if (Peek().kind == Token::Identifier) {
+							p.name = Next().text;
+						}
+						if (IsSymbolAt("[")) {
+							p.type.length = ParseArrayLength();
+						}
+						f.parameters.push_back(p);
+					} while (Accept(","));
+					Expect(")");
+				}
+				if (Accept(";")) {
+					continue;	// prototype
+				}
+				if (!IsSymbolAt("{")) {
+					Fail("expected '{'");
+				}
+				f.body = pos;
+				SkipBalanced();
+				functions.push_back(f);
+			}
+		}
+
+		std::vector<Token> tokens;
+		size_t pos = 0;
+		Code code;
+		std::unordered_map<int32_t, int> constants;
+		std::map<std::string, Variable> globals;
+		std::vector<std::map<std::string, Variable> > scopes;
+		std::vector<Function> functions;
+		std::vector<Frame> frames;
+		std::vector<Call> calls;
+		std::vector<Loop> loops;
+		std::vector<const Function*> inlining;
+	};
+}
+
+// A compiled sound shader. Compile throws std::runtime_error with the line number on
+// errors; Render may be called from any number of threads at once.
+class ShaderSoundProgram {
+public:
+	void Compile(const std::string& source) {
+		code = shader_sound_detail::Compiler().Compile(source);
+	}
+	bool IsCompiled() const {
+		return code.output[0] >= 0;
+	}
+	// Last sample samp holds exactly in a float register.
+	static const int64_t MaxExactSample = 16777216;
+	// Throws when the program takes samp and frames [start, start + count) go past
+	// MaxExactSample on either side of 0.
+	void CheckRange(int64_t start, int64_t count) const {
+		if (code.isSampleUsed && count > 0 && (start < -MaxExactSample || start + count - 1 > MaxExactSample)) {
+			throw std::runtime_error("mainSound(int samp, float time) is exact only up to sample 16777216, use mainSound(float time) for longer renders");
+		}
+	}
+
+	// Evaluates frames [start, start + count) into interleaved stereo. registers is
+	// scratch space that can be kept between calls of the same thread.
+	void Render(float* out, int64_t start, int64_t count, int sampleRate, std::vector<float>& registers) const {
+		using namespace shader_sound_detail;
+		if (!IsCompiled()) {
+			return;
+		}
+		CheckRange(start, count);
+		registers.assign((size_t)code.registers * Lanes, 0.0f);
+		float* r = registers.data();
+		for (const auto& c : code.constants) {
+			std::fill_n(r + (size_t)c.first * Lanes, Lanes, c.second);
+		}
+		std::fill_n(r + (size_t)code.sampleRate * Lanes, Lanes, (float)sampleRate);
+		float* time = r + (size_t)code.time * Lanes;
+		float* sample = r + (size_t)code.sample * Lanes;
+		const float* left = r + (size_t)code.output[0] * Lanes;
+		const float* right = r + (size_t)code.output[1] * Lanes;
+		for (int64_t f = 0; f < count; f += Lanes) {
+			for (int i = 0; i < Lanes; i++) {
+				// in double and rounded once, so time does not drift over long renders;
+				// samp is exact up to MaxExactSample, which CheckRange enforces
+				const int64_t s = start + f + i;
+				time[i] = (float)((double)s / sampleRate);
+				sample[i] = (float)s;
+			}
+			Run<Lanes>(code.instructions, r);
+			const int n = (int)std::min<int64_t>(Lanes, count - f);
+			for (int i = 0; i < n; i++) {
+				out[(f + i) * 2] = left[i];
+				out[(f + i) * 2 + 1] = right[i];
+			}
+		}
+	}
+	void Render(float* out, int64_t start, int64_t count, int sampleRate) const {
+		std::vector<float> registers;
+		Render(out, start, count, sampleRate, registers);
+	}
+
+private:
+	shader_sound_detail::Code code;
+};
+
+// Renders frames [start, start + count) into interleaved stereo, blocks of samples handed
+// out to threads (0 = all cores) one at a time.
+inline void RenderShaderSound(const ShaderSoundProgram& program, float* out, int64_t start, int64_t count, int sampleRate, int threads = 0) {
+	// before the workers start, Render throwing on one of them would terminate
+	program.CheckRange(start, count);
+	const int64_t blockFrames = 8192;
+	const int64_t blocks = (count + blockFrames - 1) / blockFrames;
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	threads = (int)std::max<int64_t>(1, std::min<int64_t>(threads, blocks));
+	std::atomic<int64_t> next{ 0 };
+	auto worker = [&]() {
+		std::vector<float> registers;
+		for (int64_t b = next++; b < blocks; b = next++) {
+			const int64_t offset = b * blockFrames;
+			program.Render(out + offset * 2, start + offset, std::min(blockFrames, count - offset), sampleRate, registers);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : pool) {
+		t.join();
+	}
+}
+
+// A sound shader rendered into memory, like the other generated sources.
+class ShaderSoundAudio : public PCMAudio {
+public:
+	ShaderSoundAudio() {}
+	void Create(const std::string& source, double seconds, int sampleRate = 44100, int threads = 0) {
+		ShaderSoundProgram program;
+		program.Compile(source);
+		const double frames = std::floor(seconds * sampleRate);
+		if (!(frames >= 1.0) || frames * 2 > INT32_MAX) {
+			throw std::runtime_error("shader sound length out of range");
+		}
+		data.assign((size_t)frames * 2, 0.0f);
+		RenderShaderSound(program, data.data(), 0, (int64_t)frames, sampleRate, threads);
+		Initialize(data.data(), 2, 16, sampleRate, (int)data.size());
+	}
+	void LoadFromFile(std::string filename, double seconds, int sampleRate = 44100, int threads = 0) {
+		std::ifstream file(filename, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("shader failed to load");
+		}
+		std::stringstream source;
+		source << file.rdbuf();
+		Create(source.str(), seconds, sampleRate, threads);
+	}
+private:
+	std::vector<float> data;
+};
@@ -0,0 +1,483 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <regex>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "Audio.h"
+#include "SampleQueue.h"
+
+// GPU renderer for Shadertoy style sound shaders.
+//
+// The GL declarations come from the loader included before this header (gl3w in Ghost),
+// any GL 3.3 core context works, including Mesa llvmpipe through EGL or OSMesa on
+// machines without a GPU.
+//
+// The sound is rendered as a sequence of width x height tiles into an RG32F texture,
+// one sample per pixel in row order. The fragment shader gets
+//
+//   uniform float iSampleRate;    sample rate
+//   uniform float iTimeOffset;    time of the first sample of the tile
+//   uniform int   iSampleOffset;  index of the first sample of the tile
+//
+// and calls vec2 mainSound(float time) or vec2 mainSound(int samp, float time). Every
+// tile is read back into one of two pixel buffer objects with a fence behind it, and
+// handed out one Pump later, so the copy of one tile overlaps the rendering of the
+// next instead of stalling like a synchronous glGetTexImage.
+class ShaderTileRenderer {
+public:
+	ShaderTileRenderer() {}
+	~ShaderTileRenderer() {
+		Destroy();
+	}
+	ShaderTileRenderer(const ShaderTileRenderer&) = delete;
+	ShaderTileRenderer& operator=(const ShaderTileRenderer&) = delete;
+
+	// Needs the context current; throws std::runtime_error with the info log when the
+	// shader does not compile.
+	void Create(const std::string& source, int sampleRate = 44100, int width = 512, int height = 512) {
+		Create(Link(source), sampleRate, width, height);
+	}
+	// Takes over a program linked from VertexSource and FragmentSource.
+	void Create(GLuint linked, int sampleRate = 44100, int width = 512, int height = 512) {
+		Destroy();
+		if (sampleRate <= 0 || width <= 0 || height <= 0) {
+			glDeleteProgram(linked);
+			throw std::runtime_error("bad shader tile format");
+		}
+		this->sampleRate = sampleRate;
+		this->width = width;
+		this->height = height;
+		SetProgram(linked);
+
+		GLint previousTexture = 0, previousFramebuffer = 0, previousPack = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previousPack);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		const bool isComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glGenVertexArrays(1, &vertexArray);
+		for (Slot& slot : slots) {
+			glGenBuffers(1, &slot.buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)GetTileFrames() * 2 * sizeof(float), nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, (GLuint)previousPack);
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+		glBindTexture(GL_TEXTURE_2D, (GLuint)previousTexture);
+		if (!isComplete) {
+			Destroy();
+			throw std::runtime_error("RG32F render target is not supported");
+		}
+		Seek(0);
+	}
+	void Destroy() {
+		if (!program) {
+			return;
+		}
+		for (Slot& slot : slots) {
+			Drop(slot);
+			glDeleteBuffers(1, &slot.buffer);
+			slot.buffer = 0;
+		}
+		glDeleteVertexArrays(1, &vertexArray);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &texture);
+		glDeleteProgram(program);
+		vertexArray = framebuffer = texture = program = 0;
+	}
+	// Takes over linked, which renders from the next tile on; the previous program is
+	// deleted.
+	void SetProgram(GLuint linked) {
+		if (program) {
+			glDeleteProgram(program);
+		}
+		program = linked;
+		sampleRateLocation = glGetUniformLocation(program, "iSampleRate");
+		timeOffsetLocation = glGetUniformLocation(program, "iTimeOffset");
+		sampleOffsetLocation = glGetUniformLocation(program, "iSampleOffset");
+		tileWidthLocation = glGetUniformLocation(program, "iTileWidth");
+	}
+	bool IsCreated() const { return program != 0; }
+	int GetSampleRate() const { return sampleRate; }
+	int GetTileFrames() const { return width * height; }
+	// frame the next Pump renders
+	int64_t GetPosition() const { return position; }
+
+	// Continues at frame; a tile still in flight is dropped.
+	void Seek(int64_t frame) {
+		for (Slot& slot : slots) {
+			Drop(slot);
+		}
+		position = frame;
+	}
+
+	// Renders the next tile and hands the previous one, if any, to
+	// sink(const float* stereo, int64_t start, int frames). Returns the frames handed out.
+	template <class Sink>
+	int Pump(Sink&& sink) {
+		Slot& issued = slots[next];
+		Issue(issued);
+		next ^= 1;
+		return Retrieve(slots[next], sink);
+	}
+	// Hands out the tile in flight without rendering another.
+	template <class Sink>
+	int Flush(Sink&& sink) {
+		next ^= 1;
+		return Retrieve(slots[next], sink);
+	}
+
+	// Renders frames [start, start + count) through Pump/Flush.
+	template <class Sink>
+	void Render(int64_t start, int64_t count, Sink&& sink) {
+		const int64_t end = start + count;
+		auto clip = [&](const float* stereo, int64_t tileStart, int frames) {
+			const int n = (int)std::min<int64_t>(frames, end - tileStart);
+			if (n > 0) {
+				sink(stereo, tileStart, n);
+			}
+		};
+		Seek(start);
+		while (position < end) {
+			Pump(clip);
+		}
+		Flush(clip);
+	}
+
+	// a full screen triangle strip without attributes
+	static const char* VertexSource() {
+		return
+			"#version 330\n"
+			"void main() {\n"
+			"    vec2 position = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;\n"
+			"    gl_Position = vec4(position, 0.0, 1.0);\n"
+			"}\n";
+	}
+	// Wraps the sound shader in a main that maps the pixel to a sample. A #version line
+	// of the source is kept, 330 otherwise.
+	static std::string FragmentSource(const std::string& source) {
+		std::string version = "#version 330\n";
+		std::string body = source;
+		const size_t start = source.find_first_not_of(" \t\r\n");
+		if (start != std::string::npos && source.compare(start, 8, "#version") == 0) {
+			const size_t end = std::min(source.find('\n', start), source.size());
+			version = source.substr(start, end - start) + "\n";
+			// keep the line count, so that the log lines match the source
+			body = "\n" + source.substr(std::min(end + 1, source.size()));
+		}
+		const bool hasSampleIndex = std::regex_search(source,
+			std::regex("\\bmainSound\\s*\\(\\s*((const|in|highp|mediump|lowp)\\s+)*int\\b"));
+		return version +
+			"uniform float iSampleRate;\n"
+			"uniform float iTimeOffset;\n"
+			"uniform int iSampleOffset;\n"
+			"uniform int iTileWidth;\n"
+			"layout(location = 0) out vec4 ghostSoundOutput;\n"
+			"#line 1\n" + body + "\n"
+			"void main() {\n"
+			"    int index = int(gl_FragCoord.y) * iTileWidth + int(gl_FragCoord.x);\n"
+			"    float time = iTimeOffset + float(index) / iSampleRate;\n" +
+			(hasSampleIndex ?
+				"    ghostSoundOutput = vec4(vec2(mainSound(iSampleOffset + index, time)), 0.0, 1.0);\n" :
+				"    ghostSoundOutput = vec4(vec2(mainSound(time)), 0.0, 1.0);\n") +
+			"}\n";
+	}
+private:
+	struct Slot {
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		int64_t start = 0;
+	};
+
+	static std::string InfoLog(GLuint handle, bool isProgram) {
+		GLint length = 0;
+		isProgram ? glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &length) : glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &length);
+		std::string log(std::max(length, 1), '\0');
+		isProgram ? glGetProgramInfoLog(handle, length, nullptr, &log[0]) : glGetShaderInfoLog(handle, length, nullptr, &log[0]);
+		return log.c_str();
+	}
+	static GLuint CompileShader(GLenum type, const std::string& source) {
+		const GLuint shader = glCreateShader(type);
+		const GLchar* text = source.c_str();
+		glShaderSource(shader, 1, &text, nullptr);
+		glCompileShader(shader);
+		GLint status = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+		if (status != GL_TRUE) {
+			const std::string log = InfoLog(shader, false);
+			glDeleteShader(shader);
+			throw std::runtime_error("shader failed to compile: " + log);
+		}
+		return shader;
+	}
+
+	static GLuint Link(const std::string& source) {
+		const GLuint vertex = CompileShader(GL_VERTEX_SHADER, VertexSource());
+		GLuint fragment = 0;
+		try {
+			fragment = CompileShader(GL_FRAGMENT_SHADER, FragmentSource(source));
+		}
+		catch (...) {
+			glDeleteShader(vertex);
+			throw;
+		}
+		const GLuint program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glLinkProgram(program);
+		glDetachShader(program, vertex);
+		glDetachShader(program, fragment);
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		GLint status = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE) {
+			const std::string log = InfoLog(program, true);
+			glDeleteProgram(program);
+			throw std::runtime_error("shader failed to link: " + log);
+		}
+		return program;
+	}
+
+	// Draws the tile at position and starts its copy into slot; the state the rest of
+	// the application relies on (framebuffer, program, viewport, ...) is restored.
+	void Issue(Slot& slot) {
+		GLint previousFramebuffer = 0, previousProgram = 0, previousVertexArray = 0, previousPack = 0, previousAlignment = 0;
+		GLint previousViewport[4] = {};
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previousPack);
+		glGetIntegerv(GL_PACK_ALIGNMENT, &previousAlignment);
+		glGetIntegerv(GL_VIEWPORT, previousViewport);
+		const GLboolean wasBlend = glIsEnabled(GL_BLEND);
+		const GLboolean wasScissor = glIsEnabled(GL_SCISSOR_TEST);
+		const GLboolean wasDepth = glIsEnabled(GL_DEPTH_TEST);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		glDisable(GL_BLEND);
+		glDisable(GL_SCISSOR_TEST);
+		glDisable(GL_DEPTH_TEST);
+		glUseProgram(program);
+		// the offset in double, so that time stays exact to the sample within a tile
+		glUniform1f(sampleRateLocation, (float)sampleRate);
+		glUniform1f(timeOffsetLocation, (float)((double)position / sampleRate));
+		glUniform1i(sampleOffsetLocation, (GLint)position);
+		glUniform1i(tileWidthLocation, width);
+		glBindVertexArray(vertexArray);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, width, height, GL_RG, GL_FLOAT, nullptr);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.start = position;
+		position += GetTileFrames();
+
+		glPixelStorei(GL_PACK_ALIGNMENT, previousAlignment);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, (GLuint)previousPack);
+		glBindVertexArray((GLuint)previousVertexArray);
+		glUseProgram((GLuint)previousProgram);
+		glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+		if (wasBlend) glEnable(GL_BLEND);
+		if (wasScissor) glEnable(GL_SCISSOR_TEST);
+		if (wasDepth) glEnable(GL_DEPTH_TEST);
+	}
+	template <class Sink>
+	int Retrieve(Slot& slot, Sink& sink) {
+		if (!slot.fence) {
+			return 0;
+		}
+		// flushes once, then waits for the copy in steps of 1 ms
+		GLenum state = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (state == GL_TIMEOUT_EXPIRED) {
+			state = glClientWaitSync(slot.fence, 0, 1000000);
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		if (state == GL_WAIT_FAILED) {
+			return 0;
+		}
+		GLint previousPack = 0;
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previousPack);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		const int frames = GetTileFrames();
+		const float* stereo = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)frames * 2 * sizeof(float), GL_MAP_READ_BIT);
+		if (stereo) {
+			sink(stereo, slot.start, frames);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, (GLuint)previousPack);
+		return stereo ? frames : 0;
+	}
+	static void Drop(Slot& slot) {
+		if (slot.fence) {
+			glDeleteSync(slot.fence);
+			slot.fence = nullptr;
+		}
+	}
+
+	GLuint program = 0;
+	GLuint texture = 0;
+	GLuint framebuffer = 0;
+	GLuint vertexArray = 0;
+	GLint sampleRateLocation = -1;
+	GLint timeOffsetLocation = -1;
+	GLint sampleOffsetLocation = -1;
+	GLint tileWidthLocation = -1;
+	Slot slots[2];
+	int next = 0;			// slot the next tile is drawn into
+	int64_t position = 0;
+	int sampleRate = 44100;
+	int width = 512;
+	int height = 512;
+};
+
+// A sound shader played as it renders.
+//
+// The thread that owns the GL context calls Update once per frame, which renders tiles
+// into a lock-free queue while there is room for them; the player's render thread
+// reads from the queue. Read never waits for the GL thread (which may itself be waiting
+// for the player in Stop): what is not rendered yet plays as silence, and the queue
+// catches up with the read position when it arrives. Reading anywhere else than the
+// next sample asks Update to continue from there, with the tile rendered right away.
+class ShaderStreamAudio : public PCMAudio {
+public:
+	// the queue holds a few tiles of the default size
+	ShaderStreamAudio(int queueSamples = 1 << 21) : queue(queueSamples) {}
+
+	// GL thread, context current
+	void Create(const std::string& source, double seconds, int sampleRate = 44100, int width = 512, int height = 512) {
+		renderer.Create(source, sampleRate, width, height);
+		Start(seconds, sampleRate);
+	}
+	// takes over a program linked from the ShaderTileRenderer sources
+	void Create(GLuint linked, double seconds, int sampleRate = 44100, int width = 512, int height = 512) {
+		renderer.Create(linked, sampleRate, width, height);
+		Start(seconds, sampleRate);
+	}
+	// GL thread: tiles rendered from now on use linked; what is queued still plays
+	void SetProgram(GLuint linked) {
+		renderer.SetProgram(linked);
+	}
+	bool IsValid() override {
+		return isOpen;
+	}
+
+	// GL thread: renders at most one tile, so a frame never waits for more than one.
+	void Update() {
+		if (!isOpen) {
+			return;
+		}
+		auto push = [&](const float* stereo, int64_t start, int frames) {
+			const int64_t n = std::min<int64_t>(frames, totalFrames - start);
+			if (n > 0) {
+				queue.Push(stereo, (size_t)n * 2);
+			}
+		};
+		const int64_t request = requestedSeek;
+		if (request != seek) {
+			renderer.Seek(seekPosition / channels);
+			seek = request;
+			isEnd = false;
+			isSeeking = true;
+			seekQueuePosition = queue.Pushed();
+			decodedSeek = seek;
+		}
+		// the reader drops what is left of the previous seek, which makes room
+		if (isEnd || queue.Space() < (size_t)renderer.GetTileFrames() * 2) {
+			return;
+		}
+		if (renderer.GetPosition() >= totalFrames) {
+			renderer.Flush(push);
+			isEnd = true;
+		}
+		else if (isSeeking) {
+			// the reader is waiting on this one, it does not go through the pipeline
+			renderer.Pump(push);
+			renderer.Flush(push);
+			isSeeking = false;
+		}
+		else {
+			renderer.Pump(push);
+		}
+	}
+
+	int Read(float* dst, int position, int count) override {
+		if (!isOpen || position < 0 || position >= samples) {
+			return 0;
+		}
+		count = std::min(count, samples - position);
+		if (position != cursor) {
+			const bool isQueued = requestedSeek == decodedSeek && position > cursor && (size_t)(position - cursor) <= queue.Available();
+			if (!isQueued) {
+				seekPosition = position - position % channels;
+				requestedSeek++;
+				// make room for the new position right away
+				queue.Skip(queue.Available());
+			}
+			cursor = position;
+		}
+		int copied = 0;
+		if (requestedSeek == decodedSeek) {
+			// the queue holds the samples from seekPosition on; drop those before the cursor
+			const int64_t queued = seekPosition + (int64_t)(queue.Popped() - seekQueuePosition);
+			if (queued < cursor) {
+				queue.Skip((size_t)(cursor - queued));
+			}
+			if (seekPosition + (int64_t)(queue.Popped() - seekQueuePosition) == cursor) {
+				copied = (int)queue.Pop(dst, count);
+			}
+		}
+		std::fill(dst + copied, dst + count, 0.0f);
+		cursor += count;
+		return count;
+	}
+
+private:
+	void Start(double seconds, int sampleRate) {
+		if ((size_t)renderer.GetTileFrames() * 2 > queue.Capacity()) {
+			renderer.Destroy();
+			throw std::runtime_error("shader tile does not fit the queue");
+		}
+		const double frames = std::floor(seconds * sampleRate);
+		if (!(frames >= 1.0) || frames * 2 > INT32_MAX) {
+			renderer.Destroy();
+			throw std::runtime_error("shader sound length out of range");
+		}
+		totalFrames = (int64_t)frames;
+		Initialize(nullptr, 2, 16, sampleRate, (int)totalFrames * 2);
+		cursor = 0;
+		seekPosition = 0;
+		requestedSeek++;
+		isOpen = true;
+		Update();
+	}
+
+	ShaderTileRenderer renderer;
+	SampleQueue<float> queue;
+	int64_t totalFrames = 0;
+	int64_t seek = -1;							// GL thread: request being rendered
+	bool isEnd = false;							// GL thread: all of seek is queued
+	bool isSeeking = false;						// GL thread: nothing of seek is queued yet
+	int cursor = 0;								// reader: position of the next sample
+	std::atomic<int> seekPosition{ 0 };
+	std::atomic<int64_t> requestedSeek{ 0 };	// reader -> GL thread
+	std::atomic<int64_t> decodedSeek{ -1 };		// GL thread -> reader
+	std::atomic<size_t> seekQueuePosition{ 0 };	// queue position where decodedSeek starts
+	bool isOpen = false;
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "stft.h"
+#include "PngWriter.h"
+
+// Whole-file spectrogram export for batch processing.
+//
+// The frames are computed in tiles of tileFrames consecutive frames, handed out to worker
+// threads that each own an fft::Stft (plan, window and scratch) and read their part of
+// the source on their own. The calling thread writes finished tiles in order, and at most
+// two tiles per worker are in flight, so memory does not grow with the length of the
+// source and threads > 1 needs a source whose Read allows concurrent random access.
+//
+// The binary file is the "GSPC" format of GhostCli: a header of eight little endian
+// uint32 ("GSPC", version, sample rate, fft size, hop, frames, bins, format) and the
+// frames * bins values row-major. Float32 writes version 1 as before (format 0). Version 2
+// adds two float32, floorDb and ceilingDb, to the header and stores float16 dB (format 1)
+// or uint8 (format 2), where 0 is floorDb and 255 ceilingDb.
+//
+// The PNG has time left to right and frequency bottom to top through a dark to bright
+// palette over floorDb to ceilingDb. Sources longer than imageWidth frames are max-pooled
+// to imageWidth columns, so the image stays bounded too.
+enum class SpectrogramFormat {
+	Float32,
+	Float16,
+	UInt8,
+};
+
+struct SpectrogramExportSettings {
+	size_t fftSize = 2048;
+	size_t hop = 512;
+	fft::Window window = fft::Window::Hann;
+	SpectrogramFormat format = SpectrogramFormat::Float32;
+	float floorDb = -120.0f;	// range of UInt8 and of the image
+	float ceilingDb = 0.0f;
+	size_t tileFrames = 256;
+	int threads = 0;		// 0 = hardware concurrency
+	int imageWidth = 4096;	// most columns of the PNG
+};
+
+namespace spectrogram_export_detail {
+	// round to nearest even; overflow becomes infinity
+	inline uint16_t FloatToHalf(float value) {
+		uint32_t x;
+		memcpy(&x, &value, sizeof(x));
+		const uint16_t sign = (uint16_t)((x >> 16) & 0x8000u);
+		x &= 0x7fffffffu;
+		if (x >= 0x7f800000u) {
+			return sign | 0x7c00u | (x > 0x7f800000u ? 0x200u : 0u);
+		}
+		if (x >= 0x477ff000u) {
+			return sign | 0x7c00u;
+		}
+		if (x >= 0x38800000u) {
+			x -= 0x38000000u;
+			return (uint16_t)(sign | ((x + 0xfffu + ((x >> 13) & 1u)) >> 13));
+		}
+		if (x <= 0x33000000u) {
+			return sign;
+		}
+		// subnormal
+		const int shift = 126 - (int)(x >> 23);
+		const uint32_t mantissa = (x & 0x7fffffu) | 0x800000u;
+		uint32_t result = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1u), half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (result & 1u))) {
+			result++;
+		}
+		return (uint16_t)(sign | result);
+	}
+
+	inline uint8_t Quantize(float db, float floorDb, float scale) {
+		const float v = (db - floorDb) * scale + 0.5f;
+		return (uint8_t)(v <= 0.0f ? 0.0f : v >= 255.0f ? 255.0f : v);
+	}
+
+	inline size_t BytesPerValue(SpectrogramFormat format) {
+		return format == SpectrogramFormat::Float32 ? 4 : format == SpectrogramFormat::Float16 ? 2 : 1;
+	}
+
+	// black through purple, red and orange to pale yellow
+	inline std::vector<uint8_t> Palette() {
+		static const float stops[][3] = {
+			{ 0, 0, 4 }, { 40, 11, 84 }, { 101, 21, 110 }, { 159, 42, 99 },
+			{ 212, 72, 66 }, { 245, 125, 21 }, { 250, 193, 39 }, { 252, 255, 164 },
+		};
+		const int last = (int)(sizeof(stops) / sizeof(stops[0])) - 1;
+		std::vector<uint8_t> palette(256 * 3);
+		for (int i = 0; i < 256; i++) {
+			const float at = i * last / 255.0f;
+			const int s = std::min((int)at, last - 1);
+			const float t = at - s;
+			for (int c = 0; c < 3; c++) {
+				palette[i * 3 + c] = (uint8_t)std::lround(stops[s][c] + (stops[s + 1][c] - stops[s][c]) * t);
+			}
+		}
+		return palette;
+	}
+
+	struct Tile {
+		std::vector<float> decibels;
+		std::vector<uint8_t> bytes;
+		size_t frames = 0;
+		bool isReady = false;
+	};
+}
+
+// binaryPath or pngPath may be empty to skip that output. Throws std::runtime_error when
+// a file can not be written.
+template <class Source>
+void ExportSpectrogram(Source& source, const std::string& binaryPath, const std::string& pngPath, const SpectrogramExportSettings& settings = SpectrogramExportSettings()) {
+	using namespace spectrogram_export_detail;
+	if (settings.hop == 0 || settings.fftSize < 2 || !(settings.ceilingDb > settings.floorDb)) {
+		throw std::runtime_error("spectrogram: invalid settings");
+	}
+	const int channels = std::max(source.GetChannels(), 1);
+	const size_t length = (size_t)std::max(source.GetSamples(), 0) / channels;
+	const size_t bins = settings.fftSize / 2 + 1;
+	const size_t frames = (length + settings.hop - 1) / settings.hop;
+	const size_t tileFrames = std::max<size_t>(settings.tileFrames, 1);
+	const size_t tiles = (frames + tileFrames - 1) / tileFrames;
+	int threads = settings.threads > 0 ? settings.threads : (int)std::thread::hardware_concurrency();
+	threads = (int)std::max<size_t>(std::min<size_t>((size_t)std::max(threads, 1), tiles), 1);
+	const size_t slots = (size_t)threads * 2;
+	const float scale = 255.0f / (settings.ceilingDb - settings.floorDb);
+	const size_t valueBytes = BytesPerValue(settings.format);
+
+	FILE* binary = nullptr;
+	bool isFailed = false;
+	if (!binaryPath.empty()) {
+		binary = fopen(binaryPath.c_str(), "wb");
+		if (!binary) {
+			throw std::runtime_error("failed to create " + binaryPath);
+		}
+		const bool isVersion1 = settings.format == SpectrogramFormat::Float32;
+		uint32_t header[10] = {
+			0x43505347u,	// "GSPC"
+			isVersion1 ? 1u : 2u,
+			(uint32_t)source.GetSampleRate(),
+			(uint32_t)settings.fftSize,
+			(uint32_t)settings.hop,
+			(uint32_t)frames,
+			(uint32_t)bins,
+			(uint32_t)settings.format,
+		};
+		memcpy(&header[8], &settings.floorDb, 4);
+		memcpy(&header[9], &settings.ceilingDb, 4);
+		const size_t count = isVersion1 ? 8 : 10;
+		isFailed = fwrite(header, sizeof(uint32_t), count, binary) != count;
+	}
+	PngWriter png;
+	const int imageWidth = (int)std::max<size_t>(std::min<size_t>(frames, (size_t)std::max(settings.imageWidth, 1)), 1);
+	std::vector<uint8_t> image;
+	if (!pngPath.empty()) {
+		png.Open(pngPath, imageWidth, (int)bins, 1, Palette());
+		image.assign((size_t)imageWidth * bins, 0);
+	}
+
+	std::vector<Tile> ring(slots);
+	std::mutex mutex;
+	std::condition_variable changed;
+	size_t next = 0, written = 0;
+	bool isAborted = false;
+	auto worker = [&]() {
+		fft::Stft stft(settings.fftSize, settings.hop, settings.window);
+		std::vector<float> block;
+		for (;;) {
+			size_t t;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				t = next++;
+				changed.wait(lock, [&] { return isAborted || t < written + slots; });
+				if (isAborted || t >= tiles) {
+					return;
+				}
+			}
+			Tile& tile = ring[t % slots];
+			const size_t first = t * tileFrames;
+			tile.frames = std::min(tileFrames, frames - first);
+			tile.decibels.resize(tile.frames * bins);
+			fft::detail::spectrogramFrames(source, stft, first, first + tile.frames, tile.decibels.data(), true, block);
+			const size_t count = tile.decibels.size();
+			if (settings.format == SpectrogramFormat::Float16) {
+				tile.bytes.resize(count * 2);
+				uint16_t* out = reinterpret_cast<uint16_t*>(tile.bytes.data());
+				for (size_t i = 0; i < count; i++) {
+					out[i] = FloatToHalf(tile.decibels[i]);
+				}
+			}
+			else if (settings.format == SpectrogramFormat::UInt8) {
+				tile.bytes.resize(count);
+				for (size_t i = 0; i < count; i++) {
+					tile.bytes[i] = Quantize(tile.decibels[i], settings.floorDb, scale);
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			tile.isReady = true;
+			changed.notify_all();
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads && tiles > 0; i++) {
+		pool.emplace_back(worker);
+	}
+
+	// tiles go out in order; the image column of frame f is f * imageWidth / frames
+	for (size_t t = 0; t < tiles && !isFailed; t++) {
+		Tile& tile = ring[t % slots];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&] { return tile.isReady; });
+		}
+		if (binary) {
+			const void* data = settings.format == SpectrogramFormat::Float32 ? (const void*)tile.decibels.data() : (const void*)tile.bytes.data();
+			const size_t count = tile.frames * bins;
+			isFailed = fwrite(data, valueBytes, count, binary) != count;
+		}
+		if (!image.empty()) {
+			for (size_t f = 0; f < tile.frames; f++) {
+				const size_t column = (t * tileFrames + f) * imageWidth / frames;
+				const float* in = &tile.decibels[f * bins];
+				for (size_t k = 0; k < bins; k++) {
+					uint8_t& pixel = image[(bins - 1 - k) * imageWidth + column];
+					pixel = std::max(pixel, Quantize(in[k], settings.floorDb, scale));
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		tile.isReady = false;
+		written++;
+		changed.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isAborted = true;
+		changed.notify_all();
+	}
+	for (auto& t : pool) {
+		t.join();
+	}
+
+	if (binary && fclose(binary) != 0) {
+		isFailed = true;
+	}
+	if (isFailed) {
+		throw std::runtime_error("failed to write " + binaryPath);
+	}
+	if (png.IsOpen()) {
+		for (size_t row = 0; row < bins; row++) {
+			png.WriteRow(&image[row * imageWidth]);
+		}
+		if (!png.Close()) {
+			throw std::runtime_error("failed to write " + pngPath);
+		}
+	}
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "SampleConvert.h"
+
+// Containers WaveWriter can produce. Riff is promoted to RF64 on Close when the sizes do
+// not fit in 32 bits; RF64 (EBU Tech 3306) and Sony Wave64 are 64 bit from the start.
+enum class WaveContainer {
+	Riff,
+	RF64,
+	Wave64,
+};
+
+// Streaming WAV writer.
+//
+// Blocks of interleaved float frames are converted (SampleConverter, or copied as is for
+// 32 bit float output) straight into one large write buffer, which goes to the file
+// with a single unbuffered fwrite whenever it fills up, so memory stays at the buffer
+// size for renders of any length. The header is written with zero sizes on Open and
+// patched on Close. For RIFF a JUNK chunk the size of an RF64 ds64 chunk is reserved in
+// front of fmt, so that a file that grows past 4 GB is turned into RF64 in place.
+class WaveWriter {
+public:
+	WaveWriter() {}
+	~WaveWriter() {
+		Close();
+	}
+	WaveWriter(const WaveWriter&) = delete;
+	WaveWriter& operator=(const WaveWriter&) = delete;
+
+	// bitDepth 8, 16, 24 or 32 integer PCM, or 32 with isFloat for IEEE float
+	void Open(const std::string& filename, int channels, int sampleRate, int bitDepth, bool isFloat = false,
+		WaveContainer container = WaveContainer::Riff, size_t bufferBytes = 1 << 20) {
+		Close();
+		if (channels <= 0 || sampleRate <= 0 || (isFloat && bitDepth != 32)) {
+			throw std::runtime_error("Not support this wave format");
+		}
+		converter.SetBitDepth(bitDepth);
+		this->channels = channels;
+		this->sampleRate = sampleRate;
+		this->bitDepth = bitDepth;
+		this->isFloat = isFloat;
+		this->container = container;
+		blockAlign = channels * (bitDepth / 8);
+		buffer.resize(std::max(bufferBytes / blockAlign, (size_t)1) * blockAlign);
+		used = 0;
+		frames = 0;
+		isFailed = false;
+		file = fopen(filename.c_str(), "wb");
+		if (!file) {
+			throw std::runtime_error("failed to create " + filename);
+		}
+		setvbuf(file, nullptr, _IONBF, 0);
+		std::vector<uint8_t> header = MakeHeader();
+		if (fwrite(header.data(), 1, header.size(), file) != header.size()) {
+			isFailed = true;
+		}
+	}
+
+	bool IsOpen() const { return file != nullptr; }
+	int64_t GetFrames() const { return frames; }
+	int GetChannels() const { return channels; }
+	// TPDF dither for 8, 16 and 24 bit output
+	void SetDither(bool dither) { converter.SetDither(dither); }
+
+	// count frames of interleaved float samples
+	bool Write(const float* samples, int64_t count) {
+		if (!file) {
+			return false;
+		}
+		while (count > 0) {
+			const int64_t n = std::min<int64_t>(count, (int64_t)((buffer.size() - used) / blockAlign));
+			if (isFloat) {
+				memcpy(&buffer[used], samples, (size_t)n * blockAlign);
+			}
+			else {
+				converter.Convert(samples, &buffer[used], (size_t)n * channels);
+			}
+			used += (size_t)n * blockAlign;
+			samples += n * channels;
+			count -= n;
+			frames += n;
+			if (used == buffer.size()) {
+				Flush();
+			}
+		}
+		return !isFailed;
+	}
+	// count frames already in the output format
+	bool WriteRaw(const void* data, int64_t count) {
+		if (!file) {
+			return false;
+		}
+		const uint8_t* p = (const uint8_t*)data;
+		size_t bytes = (size_t)count * blockAlign;
+		while (bytes > 0) {
+			const size_t n = std::min(bytes, buffer.size() - used);
+			memcpy(&buffer[used], p, n);
+			used += n;
+			p += n;
+			bytes -= n;
+			if (used == buffer.size()) {
+				Flush();
+			}
+		}
+		frames += count;
+		return !isFailed;
+	}
+
+	// Flushes, pads the data chunk (to 2 bytes, 8 for Wave64) and patches the sizes in the
+	// header.
+	// Returns false when any write failed.
+	bool Close() {
+		if (!file) {
+			return false;
+		}
+		Flush();
+		const size_t pad = (size_t)(Padded((uint64_t)frames * blockAlign) - (uint64_t)frames * blockAlign);
+		if (pad > 0) {
+			const uint8_t zeros[8] = {};
+			isFailed |= fwrite(zeros, 1, pad, file) != pad;
+		}
+		std::vector<uint8_t> header = MakeHeader();
+		isFailed |= fseek(file, 0, SEEK_SET) != 0 || fwrite(header.data(), 1, header.size(), file) != header.size();
+		isFailed |= fclose(file) != 0;
+		file = nullptr;
+		buffer.clear();
+		buffer.shrink_to_fit();
+		return !isFailed;
+	}
+
+private:
+	void Flush() {
+		if (used > 0 && fwrite(buffer.data(), 1, used, file) != used) {
+			isFailed = true;
+		}
+		used = 0;
+	}
+
+	uint64_t Padded(uint64_t bytes) const {
+		const uint64_t alignment = container == WaveContainer::Wave64 ? 8 : 2;
+		return (bytes + alignment - 1) / alignment * alignment;
+	}
+
+	static void Put(std::vector<uint8_t>& out, const char* id) {
+		out.insert(out.end(), id, id + 4);
+	}
+	static void Put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+		for (int i = 0; i < bytes; i++) {
+			out.push_back((uint8_t)(value >> (8 * i)));
+		}
+	}
+	static void Patch(std::vector<uint8_t>& out, size_t offset, uint64_t value, int bytes) {
+		for (int i = 0; i < bytes; i++) {
+			out[offset + i] = (uint8_t)(value >> (8 * i));
+		}
+	}
+	// Wave64 chunk ids are GUIDs that start with the RIFF four character code
+	static void PutGuid(std::vector<uint8_t>& out, const char* id) {
+		static const uint8_t riff[12] = { 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 };
+		static const uint8_t other[12] = { 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A };
+		const uint8_t* tail = memcmp(id, "riff", 4) == 0 ? riff : other;
+		Put(out, id);
+		out.insert(out.end(), tail, tail + 12);
+	}
+
+	// WAVEFORMATEX without the chunk header
+	std::vector<uint8_t> MakeFormat() const {
+		std::vector<uint8_t> f;
+		Put(f, isFloat ? 3 : 1, 2);	// WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+		Put(f, channels, 2);
+		Put(f, sampleRate, 4);
+		Put(f, (uint64_t)sampleRate * blockAlign, 4);
+		Put(f, blockAlign, 2);
+		Put(f, bitDepth, 2);
+		if (isFloat) {
+			Put(f, 0, 2);	// cbSize
+		}
+		return f;
+	}
+
+	// The header has the same size on Open and Close, only the sizes change.
+	std::vector<uint8_t> MakeHeader() const {
+		const uint64_t dataBytes = (uint64_t)frames * blockAlign;
+		const std::vector<uint8_t> format = MakeFormat();
+		std::vector<uint8_t> h;
+		if (container == WaveContainer::Wave64) {
+			// sizes include the 24 byte chunk headers, chunks start on 8 byte boundaries
+			PutGuid(h, "riff");
+			Put(h, 0, 8);
+			PutGuid(h, "wave");
+			PutGuid(h, "fmt ");
+			Put(h, 24 + format.size(), 8);
+			h.insert(h.end(), format.begin(), format.end());
+			h.resize((h.size() + 7) / 8 * 8, 0);
+			if (isFloat) {
+				PutGuid(h, "fact");
+				Put(h, 24 + 8, 8);
+				Put(h, (uint64_t)frames, 8);
+			}
+			PutGuid(h, "data");
+			Put(h, 24 + dataBytes, 8);
+			Patch(h, 16, h.size() + Padded(dataBytes), 8);
+			return h;
+		}
+
+		const uint64_t riffBytes = 4 + 36 + 8 + format.size() + (isFloat ? 12 : 0) + 8 + Padded(dataBytes);
+		const bool isRF64 = container == WaveContainer::RF64 || riffBytes > 0xFFFFFFFF;
+		Put(h, isRF64 ? "RF64" : "RIFF");
+		Put(h, isRF64 ? 0xFFFFFFFF : riffBytes, 4);
+		Put(h, "WAVE");
+		if (isRF64) {
+			Put(h, "ds64");
+			Put(h, 28, 4);
+			Put(h, riffBytes, 8);
+			Put(h, dataBytes, 8);
+			Put(h, (uint64_t)frames, 8);
+			Put(h, 0, 4);	// no table of other chunk sizes
+		}
+		else {
+			Put(h, "JUNK");
+			Put(h, 28, 4);
+			h.insert(h.end(), 28, 0);
+		}
+		Put(h, "fmt ");
+		Put(h, format.size(), 4);
+		h.insert(h.end(), format.begin(), format.end());
+		if (isFloat) {
+			Put(h, "fact");
+			Put(h, 4, 4);
+			Put(h, isRF64 ? 0xFFFFFFFF : (uint64_t)frames, 4);
+		}
+		Put(h, "data");
+		Put(h, isRF64 ? 0xFFFFFFFF : dataBytes, 4);
+		return h;
+	}
+
+	FILE* file = nullptr;
+	SampleConverter converter;
+	std::vector<uint8_t> buffer;
+	size_t used = 0;
+	int64_t frames = 0;
+	int channels = 0;
+	int sampleRate = 0;
+	int bitDepth = 16;
+	int blockAlign = 0;
+	bool isFloat = false;
+	WaveContainer container = WaveContainer::Riff;
+	bool isFailed = false;
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "Audio.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WAVEFORM_PYRAMID_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Multi-resolution waveform overview.
+//
+// Level 0 keeps min, max and the sum of squares of every BaseFrames frames per channel,
+// each further level merges two buckets of the one below, up to a single bucket for the
+// whole source. GetColumns picks the level whose buckets are at most one display column
+// wide, so every column merges at most three buckets and a view of any range costs
+// O(columns); zoomed in closer than BaseFrames frames per column it reads the source
+// itself, at most BaseFrames frames per column. Level 0 is built in ranges over threads,
+// which read the source concurrently (like fft::spectrogram), and the pyramid can be
+// saved next to the source and loaded instead of rebuilt.
+struct WaveformColumn {
+	float minimum;
+	float maximum;
+	float rms;
+};
+
+namespace waveform_pyramid_detail {
+	const int BaseFrames = 256;
+	const uint32_t Magic = 0x59505747u;	// "GWPY"
+	const uint32_t Version = 1;
+
+	struct Bucket {
+		float minimum;
+		float maximum;
+		float power;	// sum of squares
+	};
+
+	// frames of interleaved samples into one bucket per channel
+	inline void Reduce(const float* samples, int frames, int channels, Bucket* out) {
+		int i = 0;
+		const int count = frames * channels;
+#if WAVEFORM_PYRAMID_HAVE_SSE2
+		// four lanes hold whole frames for 1, 2 and 4 channels: lane l is channel l % channels
+		if (4 % channels == 0 && count >= 4) {
+			__m128 low = _mm_loadu_ps(samples), high = low, power = _mm_setzero_ps();
+			for (; i + 4 <= count; i += 4) {
+				const __m128 x = _mm_loadu_ps(samples + i);
+				low = _mm_min_ps(low, x);
+				high = _mm_max_ps(high, x);
+				power = _mm_add_ps(power, _mm_mul_ps(x, x));
+			}
+			float lows[4], highs[4], powers[4];
+			_mm_storeu_ps(lows, low);
+			_mm_storeu_ps(highs, high);
+			_mm_storeu_ps(powers, power);
+			for (int c = 0; c < channels; c++) {
+				out[c] = { lows[c], highs[c], 0.0f };
+			}
+			for (int l = 0; l < 4; l++) {
+				Bucket& b = out[l % channels];
+				b.minimum = std::min(b.minimum, lows[l]);
+				b.maximum = std::max(b.maximum, highs[l]);
+				b.power += powers[l];
+			}
+		}
+		else
+#endif
+		{
+			for (int c = 0; c < channels; c++) {
+				out[c] = { count ? samples[c] : 0.0f, count ? samples[c] : 0.0f, 0.0f };
+			}
+		}
+		for (; i < count; i++) {
+			Bucket& b = out[i % channels];
+			const float x = samples[i];
+			b.minimum = std::min(b.minimum, x);
+			b.maximum = std::max(b.maximum, x);
+			b.power += x * x;
+		}
+	}
+
+	inline void Merge(Bucket& a, const Bucket& b) {
+		a.minimum = std::min(a.minimum, b.minimum);
+		a.maximum = std::max(a.maximum, b.maximum);
+		a.power += b.power;
+	}
+
+	// FNV-1a over the format and 64 blocks spread over the source, to tell a saved
+	// pyramid of other content apart without reading everything
+	inline uint64_t Fingerprint(PCMAudio& source) {
+		const int channels = std::max(source.GetChannels(), 1);
+		const int64_t frames = source.GetSamples() / channels;
+		uint64_t hash = 1469598103934665603ull;
+		auto mix = [&](const void* data, size_t size) {
+			const uint8_t* p = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ p[i]) * 1099511628211ull;
+			}
+		};
+		const int32_t format[3] = { channels, source.GetSampleRate(), source.GetSamples() };
+		mix(format, sizeof(format));
+		std::vector<float> block((size_t)BaseFrames * channels);
+		for (int i = 0; i < 64 && frames > 0; i++) {
+			const int64_t frame = frames * i / 64;
+			const int n = source.Read(block.data(), (int)(frame * channels), (int)block.size());
+			mix(block.data(), (size_t)std::max(n, 0) * sizeof(float));
+		}
+		return hash;
+	}
+}
+
+class WaveformPyramid {
+public:
+	bool IsValid() const { return source != nullptr && !levels.empty(); }
+	int64_t GetFrames() const { return frames; }
+	int GetChannels() const { return channels; }
+	void Clear() {
+		source = nullptr;
+		levels.clear();
+		frames = 0;
+	}
+
+	// threads = 0 uses all cores
+	void Build(PCMAudio& source, int threads = 0) {
+		using namespace waveform_pyramid_detail;
+		Clear();
+		if (!source.IsValid() || source.GetChannels() <= 0) {
+			throw std::runtime_error("waveform: source not loaded");
+		}
+		channels = source.GetChannels();
+		sampleRate = source.GetSampleRate();
+		frames = source.GetSamples() / channels;
+		const int64_t buckets = (frames + BaseFrames - 1) / BaseFrames;
+		levels.push_back(std::vector<Bucket>((size_t)buckets * channels));
+		if (threads <= 0) {
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+		}
+		threads = (int)std::max<int64_t>(std::min<int64_t>(threads, buckets / 64), 1);
+		auto worker = [&](int64_t first, int64_t last) {
+			const int64_t blockBuckets = 64;
+			std::vector<float> block((size_t)(blockBuckets * BaseFrames * channels));
+			for (int64_t b = first; b < last; b += blockBuckets) {
+				const int64_t start = b * BaseFrames;
+				const int64_t n = std::min(std::min(last, b + blockBuckets) * BaseFrames, frames) - start;
+				const int read = source.Read(block.data(), (int)(start * channels), (int)(n * channels));
+				std::fill(block.begin() + std::max(read, 0), block.begin() + n * channels, 0.0f);
+				for (int64_t i = 0; i * BaseFrames < n; i++) {
+					const int count = (int)std::min<int64_t>(BaseFrames, n - i * BaseFrames);
+					Reduce(&block[(size_t)(i * BaseFrames * channels)], count, channels, &levels[0][(size_t)((b + i) * channels)]);
+				}
+			}
+		};
+		std::vector<std::thread> pool;
+		for (int i = 1; i < threads; i++) {
+			pool.emplace_back(worker, buckets * i / threads, buckets * (i + 1) / threads);
+		}
+		worker(0, buckets / threads);
+		for (auto& t : pool) {
+			t.join();
+		}
+		while (levels.back().size() > (size_t)channels) {
+			const std::vector<Bucket>& below = levels.back();
+			const size_t count = below.size() / channels;
+			std::vector<Bucket> level((count + 1) / 2 * channels);
+			for (size_t i = 0; i < count; i += 2) {
+				for (int c = 0; c < channels; c++) {
+					Bucket b = below[i * channels + c];
+					if (i + 1 < count) {
+						Merge(b, below[(i + 1) * channels + c]);
+					}
+					level[i / 2 * channels + c] = b;
+				}
+			}
+			levels.push_back(std::move(level));
+		}
+		fingerprint = Fingerprint(source);
+		this->source = &source;
+	}
+
+	bool Save(const std::string& path) const {
+		using namespace waveform_pyramid_detail;
+		if (!IsValid()) {
+			return false;
+		}
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (!fp) {
+			return false;
+		}
+		const uint32_t header[6] = { Magic, Version, (uint32_t)channels, (uint32_t)sampleRate, (uint32_t)BaseFrames, (uint32_t)levels.size() };
+		const uint64_t tail[2] = { (uint64_t)frames, fingerprint };
+		bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(tail, sizeof(tail), 1, fp) == 1;
+		for (const auto& level : levels) {
+			ok = ok && fwrite(level.data(), sizeof(Bucket), level.size(), fp) == level.size();
+		}
+		return fclose(fp) == 0 && ok;
+	}
+
+	// Loads a pyramid saved for the same content as source; false when there is none or
+	// it belongs to something else.
+	bool Load(const std::string& path, PCMAudio& source) {
+		using namespace waveform_pyramid_detail;
+		Clear();
+		if (!source.IsValid() || source.GetChannels() <= 0) {
+			return false;
+		}
+		FILE* fp = fopen(path.c_str(), "rb");
+		if (!fp) {
+			return false;
+		}
+		uint32_t header[6];
+		uint64_t tail[2];
+		const int sourceChannels = source.GetChannels();
+		bool ok = fread(header, sizeof(header), 1, fp) == 1 && fread(tail, sizeof(tail), 1, fp) == 1 &&
+			header[0] == Magic && header[1] == Version && header[2] == (uint32_t)sourceChannels &&
+			header[3] == (uint32_t)source.GetSampleRate() && header[4] == (uint32_t)BaseFrames && header[5] < 64 &&
+			tail[0] == (uint64_t)(source.GetSamples() / sourceChannels) && tail[1] == Fingerprint(source);
+		size_t count = (size_t)((tail[0] + BaseFrames - 1) / BaseFrames);
+		for (uint32_t l = 0; ok && l < header[5]; l++) {
+			levels.push_back(std::vector<Bucket>(count * sourceChannels));
+			ok = fread(levels.back().data(), sizeof(Bucket), levels.back().size(), fp) == levels.back().size();
+			count = (count + 1) / 2;
+		}
+		fclose(fp);
+		if (!ok || levels.empty()) {
+			levels.clear();
+			return false;
+		}
+		channels = sourceChannels;
+		sampleRate = source.GetSampleRate();
+		frames = (int64_t)tail[0];
+		fingerprint = tail[1];
+		this->source = &source;
+		return true;
+	}
+
+	// Loads cachePath if it matches the source, otherwise builds and saves it there.
+	// Returns true when the cache was used.
+	bool LoadOrBuild(PCMAudio& source, const std::string& cachePath, int threads = 0) {
+		if (Load(cachePath, source)) {
+			return true;
+		}
+		Build(source, threads);
+		Save(cachePath);
+		return false;
+	}
+
+	// Fills columns entries for the frames firstFrame to lastFrame, one column per
+	// (lastFrame - firstFrame) / columns frames; channel -1 merges all channels. Columns
+	// outside the source are zero.
+	void GetColumns(double firstFrame, double lastFrame, int columns, WaveformColumn* out, int channel = -1) {
+		using namespace waveform_pyramid_detail;
+		if (columns <= 0) {
+			return;
+		}
+		const double span = (lastFrame - firstFrame) / columns;
+		if (!IsValid() || !(span > 0.0)) {
+			std::fill(out, out + columns, WaveformColumn{ 0.0f, 0.0f, 0.0f });
+			return;
+		}
+		const int c0 = channel < 0 ? 0 : std::min(channel, channels - 1);
+		const int c1 = channel < 0 ? channels : c0 + 1;
+		if (span < BaseFrames) {
+			// closer than level 0: straight from the source
+			const int64_t first = std::max<int64_t>((int64_t)std::floor(firstFrame), 0);
+			const int64_t last = std::min<int64_t>((int64_t)std::ceil(lastFrame), frames);
+			raw.assign((size_t)std::max<int64_t>(last - first, 0) * channels, 0.0f);
+			if (last > first) {
+				source->Read(raw.data(), (int)(first * channels), (int)raw.size());
+			}
+			for (int i = 0; i < columns; i++) {
+				const int64_t a = std::max<int64_t>((int64_t)std::floor(firstFrame + i * span), first);
+				const int64_t b = std::min<int64_t>(std::max<int64_t>((int64_t)std::floor(firstFrame + (i + 1) * span), a + 1), last);
+				Bucket sum = Empty();
+				for (int64_t f = a; f < b; f++) {
+					for (int c = c0; c < c1; c++) {
+						const float x = raw[(size_t)(f - first) * channels + c];
+						Merge(sum, { x, x, x * x });
+					}
+				}
+				out[i] = ToColumn(sum, (double)(std::max<int64_t>(b - a, 0) * (c1 - c0)));
+			}
+			return;
+		}
+		const int level = std::min((int)std::floor(std::log2(span / BaseFrames)), (int)levels.size() - 1);
+		const std::vector<Bucket>& buckets = levels[level];
+		const int64_t bucketFrames = (int64_t)BaseFrames << level;
+		const int64_t count = (int64_t)(buckets.size() / channels);
+		for (int i = 0; i < columns; i++) {
+			const double a = firstFrame + i * span, b = a + span;
+			const int64_t first = std::max<int64_t>((int64_t)std::floor(a / bucketFrames), 0);
+			const int64_t last = std::min<int64_t>((int64_t)std::ceil(b / bucketFrames), count);
+			// min and max take whole buckets, the power only the part inside the column
+			Bucket sum = Empty();
+			double power = 0.0, covered = 0.0;
+			for (int64_t k = first; k < last; k++) {
+				const double start = (double)(k * bucketFrames);
+				const double length = (double)std::min(bucketFrames, frames - k * bucketFrames);
+				const double inside = std::min(b, start + length) - std::max(a, start);
+				for (int c = c0; c < c1; c++) {
+					const Bucket& bucket = buckets[(size_t)(k * channels + c)];
+					Merge(sum, bucket);
+					power += bucket.power * std::max(inside, 0.0) / length;
+				}
+				covered += std::max(inside, 0.0);
+			}
+			sum.power = (float)power;
+			out[i] = ToColumn(sum, covered * (c1 - c0));
+		}
+	}
+
+private:
+	static waveform_pyramid_detail::Bucket Empty() {
+		return { HUGE_VALF, -HUGE_VALF, 0.0f };
+	}
+	static WaveformColumn ToColumn(const waveform_pyramid_detail::Bucket& b, double samples) {
+		if (!(samples > 0.0)) {
+			return { 0.0f, 0.0f, 0.0f };
+		}
+		return { b.minimum, b.maximum, (float)std::sqrt(b.power / samples) };
+	}
+
+	PCMAudio* source = nullptr;
+	int channels = 0;
+	int sampleRate = 0;
+	int64_t frames = 0;
+	uint64_t fingerprint = 0;
+	std::vector<std::vector<waveform_pyramid_detail::Bucket> > levels;
+	std::vector<float> raw;
+};
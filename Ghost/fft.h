@@ -30,68 +30,517 @@
 #include <complex>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
 #ifndef	M_PI
 #define	M_PI	3.14159265358979323846
 #endif	// M_PI
 
+#if defined(__AVX__)
+#define FFT_HAVE_AVX 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FFT_HAVE_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define FFT_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace fft {
-	class FftArray {
-		typedef std::complex<double> Complex;
-		std::vector<Complex> m_x;
+	namespace detail {
+		// One radix-2 DIT pass over n points: every block of 2*half points is combined
+		// with the twiddles w[0..half).
+		template <class T>
+		inline void radix2Pass(std::complex<T>* x, size_t n, size_t half, const std::complex<T>* w)
+		{
+			for (size_t i = 0u; i < n; i += 2u * half) {
+				std::complex<T>* a = x + i;
+				std::complex<T>* b = a + half;
+				for (size_t j = 0u; j < half; ++j) {
+					const T tr = w[j].real() * b[j].real() - w[j].imag() * b[j].imag();
+					const T ti = w[j].real() * b[j].imag() + w[j].imag() * b[j].real();
+					const T ar = a[j].real(), ai = a[j].imag();
+					b[j] = std::complex<T>(ar - tr, ai - ti);
+					a[j] = std::complex<T>(ar + tr, ai + ti);
+				}
+			}
+		}
 
-		static size_t next2n(size_t x)
-		{	// x ȏ̍ŏ 2^n (n ͎R) Ԃ
-			size_t y = 1u;
-			for (; y < x; y <<= 1u);
-			return y;
-		}
-
-		void bitReverse()
-		{	// vf̈ʒuAYrbg]ʒuɈړ
-			for (size_t i = 0u; i < m_x.size(); ++i) {
-				size_t j = 0u;
-				size_t bL = 1u, bR = m_x.size() >> 1u;
-				for (; bL < m_x.size(); bL <<= 1u, bR >>= 1u) {	// bit reverse
-					if ((i & bL) != 0u) {
-						j |= bR;
-					}
+		// Complex arithmetic on one or more packed values, so that the radix 3/4/5
+		// butterflies are written once for the scalar and the SIMD paths.
+		template <class T>
+		struct ScalarOps {
+			typedef std::complex<T> Complex;
+			typedef std::complex<T> V;
+			enum { width = 1 };
+			static inline V load(const Complex* p) { return *p; }
+			static inline void store(Complex* p, V v) { *p = v; }
+			static inline V add(V a, V b) { return V(a.real() + b.real(), a.imag() + b.imag()); }
+			static inline V sub(V a, V b) { return V(a.real() - b.real(), a.imag() - b.imag()); }
+			static inline V mul(V a, V w) { return V(a.real() * w.real() - a.imag() * w.imag(), a.real() * w.imag() + a.imag() * w.real()); }
+			static inline V scale(V a, T s) { return V(a.real() * s, a.imag() * s); }
+			static inline V mulI(V a) { return V(-a.imag(), a.real()); }	// a * i
+		};
+
+		template <class T>
+		struct VectorOps {
+			typedef ScalarOps<T> type;
+		};
+
+#if FFT_HAVE_AVX
+		struct AvxFloatOps {
+			typedef std::complex<float> Complex;
+			typedef __m256 V;
+			enum { width = 4 };
+			static inline V load(const Complex* p) { return _mm256_loadu_ps(reinterpret_cast<const float*>(p)); }
+			static inline void store(Complex* p, V v) { _mm256_storeu_ps(reinterpret_cast<float*>(p), v); }
+			static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+			static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+			static inline V mul(V a, V w) {
+				return _mm256_addsub_ps(_mm256_mul_ps(a, _mm256_moveldup_ps(w)), _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), _mm256_movehdup_ps(w)));
+			}
+			static inline V scale(V a, float s) { return _mm256_mul_ps(a, _mm256_set1_ps(s)); }
+			static inline V mulI(V a) {
+				return _mm256_xor_ps(_mm256_permute_ps(a, 0xB1), _mm256_set_ps(0.f, -0.f, 0.f, -0.f, 0.f, -0.f, 0.f, -0.f));
+			}
+		};
+
+		struct AvxDoubleOps {
+			typedef std::complex<double> Complex;
+			typedef __m256d V;
+			enum { width = 2 };
+			static inline V load(const Complex* p) { return _mm256_loadu_pd(reinterpret_cast<const double*>(p)); }
+			static inline void store(Complex* p, V v) { _mm256_storeu_pd(reinterpret_cast<double*>(p), v); }
+			static inline V add(V a, V b) { return _mm256_add_pd(a, b); }
+			static inline V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+			static inline V mul(V a, V w) {
+				return _mm256_addsub_pd(_mm256_mul_pd(a, _mm256_movedup_pd(w)), _mm256_mul_pd(_mm256_permute_pd(a, 0x5), _mm256_permute_pd(w, 0xF)));
+			}
+			static inline V scale(V a, double s) { return _mm256_mul_pd(a, _mm256_set1_pd(s)); }
+			static inline V mulI(V a) { return _mm256_xor_pd(_mm256_permute_pd(a, 0x5), _mm256_set_pd(0., -0., 0., -0.)); }
+		};
+
+		template <> struct VectorOps<float> { typedef AvxFloatOps type; };
+		template <> struct VectorOps<double> { typedef AvxDoubleOps type; };
+#elif FFT_HAVE_SSE
+		struct SseFloatOps {
+			typedef std::complex<float> Complex;
+			typedef __m128 V;
+			enum { width = 2 };
+			static inline V load(const Complex* p) { return _mm_loadu_ps(reinterpret_cast<const float*>(p)); }
+			static inline void store(Complex* p, V v) { _mm_storeu_ps(reinterpret_cast<float*>(p), v); }
+			static inline V add(V a, V b) { return _mm_add_ps(a, b); }
+			static inline V sub(V a, V b) { return _mm_sub_ps(a, b); }
+			static inline V mul(V a, V w) {
+				const V re = _mm_mul_ps(a, _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0)));
+				const V im = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1)));
+				return _mm_add_ps(re, _mm_xor_ps(im, _mm_set_ps(0.f, -0.f, 0.f, -0.f)));
+			}
+			static inline V scale(V a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+			static inline V mulI(V a) { return _mm_xor_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(0.f, -0.f, 0.f, -0.f)); }
+		};
+
+		struct SseDoubleOps {
+			typedef std::complex<double> Complex;
+			typedef __m128d V;
+			enum { width = 1 };
+			static inline V load(const Complex* p) { return _mm_loadu_pd(reinterpret_cast<const double*>(p)); }
+			static inline void store(Complex* p, V v) { _mm_storeu_pd(reinterpret_cast<double*>(p), v); }
+			static inline V add(V a, V b) { return _mm_add_pd(a, b); }
+			static inline V sub(V a, V b) { return _mm_sub_pd(a, b); }
+			static inline V mul(V a, V w) {
+				const V re = _mm_mul_pd(a, _mm_unpacklo_pd(w, w));
+				const V im = _mm_mul_pd(_mm_shuffle_pd(a, a, 1), _mm_unpackhi_pd(w, w));
+				return _mm_add_pd(re, _mm_xor_pd(im, _mm_set_pd(0., -0.)));
+			}
+			static inline V scale(V a, double s) { return _mm_mul_pd(a, _mm_set1_pd(s)); }
+			static inline V mulI(V a) { return _mm_xor_pd(_mm_shuffle_pd(a, a, 1), _mm_set_pd(0., -0.)); }
+		};
+
+		template <> struct VectorOps<float> { typedef SseFloatOps type; };
+		template <> struct VectorOps<double> { typedef SseDoubleOps type; };
+#elif FFT_HAVE_NEON
+		struct NeonFloatOps {
+			typedef std::complex<float> Complex;
+			typedef float32x4_t V;
+			enum { width = 2 };
+			static inline V load(const Complex* p) { return vld1q_f32(reinterpret_cast<const float*>(p)); }
+			static inline void store(Complex* p, V v) { vst1q_f32(reinterpret_cast<float*>(p), v); }
+			static inline V add(V a, V b) { return vaddq_f32(a, b); }
+			static inline V sub(V a, V b) { return vsubq_f32(a, b); }
+			static inline V sign() {
+				static const float signs[4] = { -1.f, 1.f, -1.f, 1.f };
+				return vld1q_f32(signs);
+			}
+			static inline V mul(V a, V w) {
+				const float32x4x2_t vw = vtrnq_f32(w, w);
+				return vmlaq_f32(vmulq_f32(a, vw.val[0]), vmulq_f32(vrev64q_f32(a), vw.val[1]), sign());
+			}
+			static inline V scale(V a, float s) { return vmulq_n_f32(a, s); }
+			static inline V mulI(V a) { return vmulq_f32(vrev64q_f32(a), sign()); }
+		};
+
+		template <> struct VectorOps<float> { typedef NeonFloatOps type; };
+#endif
+
+		// Columns [kBegin, kEnd) of one mixed radix DIT block: radix sub-DFTs of length m,
+		// stored one after another, are combined into one DFT of length radix * m.
+		// tw holds W^(q * k) for q = 1 .. radix - 1 and k < m, q-major.
+		template <class Ops>
+		inline void radixColumns(typename Ops::Complex* x, size_t m, size_t radix, const typename Ops::Complex* tw, bool inverse, size_t kBegin, size_t kEnd)
+		{
+			typedef typename Ops::V V;
+			typedef typename Ops::Complex::value_type T;
+			const T dir = inverse ? (T)1 : (T)-1;	// sign of the exponent
+			switch (radix) {
+			case 3: {
+				const T c = (T)-0.5, s = dir * (T)0.86602540378443864676;
+				for (size_t k = kBegin; k < kEnd; k += Ops::width) {
+					const V a0 = Ops::load(x + k);
+					const V a1 = Ops::mul(Ops::load(x + m + k), Ops::load(tw + k));
+					const V a2 = Ops::mul(Ops::load(x + 2u * m + k), Ops::load(tw + m + k));
+					const V t1 = Ops::add(a1, a2);
+					const V t2 = Ops::add(a0, Ops::scale(t1, c));
+					const V t3 = Ops::scale(Ops::mulI(Ops::sub(a1, a2)), s);
+					Ops::store(x + k, Ops::add(a0, t1));
+					Ops::store(x + m + k, Ops::add(t2, t3));
+					Ops::store(x + 2u * m + k, Ops::sub(t2, t3));
 				}
-				if (i < j) {
-					std::swap(m_x[i], m_x[j]);
+				break;
+			}
+			case 4: {
+				for (size_t k = kBegin; k < kEnd; k += Ops::width) {
+					const V a0 = Ops::load(x + k);
+					const V a1 = Ops::mul(Ops::load(x + m + k), Ops::load(tw + k));
+					const V a2 = Ops::mul(Ops::load(x + 2u * m + k), Ops::load(tw + m + k));
+					const V a3 = Ops::mul(Ops::load(x + 3u * m + k), Ops::load(tw + 2u * m + k));
+					const V s02 = Ops::add(a0, a2), d02 = Ops::sub(a0, a2);
+					const V s13 = Ops::add(a1, a3);
+					const V r13 = Ops::scale(Ops::mulI(Ops::sub(a1, a3)), dir);
+					Ops::store(x + k, Ops::add(s02, s13));
+					Ops::store(x + m + k, Ops::add(d02, r13));
+					Ops::store(x + 2u * m + k, Ops::sub(s02, s13));
+					Ops::store(x + 3u * m + k, Ops::sub(d02, r13));
 				}
+				break;
+			}
+			case 5: {
+				const T c1 = (T)0.30901699437494742410, c2 = (T)-0.80901699437494742410;
+				const T s1 = dir * (T)0.95105651629515357212, s2 = dir * (T)0.58778525229247312917;
+				for (size_t k = kBegin; k < kEnd; k += Ops::width) {
+					const V a0 = Ops::load(x + k);
+					const V a1 = Ops::mul(Ops::load(x + m + k), Ops::load(tw + k));
+					const V a2 = Ops::mul(Ops::load(x + 2u * m + k), Ops::load(tw + m + k));
+					const V a3 = Ops::mul(Ops::load(x + 3u * m + k), Ops::load(tw + 2u * m + k));
+					const V a4 = Ops::mul(Ops::load(x + 4u * m + k), Ops::load(tw + 3u * m + k));
+					const V b1 = Ops::add(a1, a4), b2 = Ops::add(a2, a3);
+					const V d1 = Ops::sub(a1, a4), d2 = Ops::sub(a2, a3);
+					const V e1 = Ops::add(a0, Ops::add(Ops::scale(b1, c1), Ops::scale(b2, c2)));
+					const V e2 = Ops::add(a0, Ops::add(Ops::scale(b1, c2), Ops::scale(b2, c1)));
+					const V f1 = Ops::mulI(Ops::add(Ops::scale(d1, s1), Ops::scale(d2, s2)));
+					const V f2 = Ops::mulI(Ops::sub(Ops::scale(d1, s2), Ops::scale(d2, s1)));
+					Ops::store(x + k, Ops::add(a0, Ops::add(b1, b2)));
+					Ops::store(x + m + k, Ops::add(e1, f1));
+					Ops::store(x + 2u * m + k, Ops::add(e2, f2));
+					Ops::store(x + 3u * m + k, Ops::sub(e2, f2));
+					Ops::store(x + 4u * m + k, Ops::sub(e1, f1));
+				}
+				break;
+			}
+			default:
+				throw std::logic_error("fft: unsupported radix");
+			}
+		}
+
+		// One radix 3/4/5 pass over n points, vectorized across the columns of each block.
+		template <class T>
+		void radixPass(std::complex<T>* x, size_t n, size_t m, size_t radix, const std::complex<T>* tw, bool inverse)
+		{
+			typedef typename VectorOps<T>::type Vec;
+			const size_t vectorEnd = m - m % Vec::width;
+			for (size_t i = 0u; i < n; i += radix * m) {
+				radixColumns<Vec>(x + i, m, radix, tw, inverse, 0u, vectorEnd);
+				radixColumns<ScalarOps<T> >(x + i, m, radix, tw, inverse, vectorEnd, m);
 			}
 		}
+	}
 
-		void doFft(bool isInverse = false) {
-			bitReverse();
-			for (size_t m = 2u; m <= m_x.size(); m *= 2u) {
-				const double arg = (isInverse ? 2. * M_PI : -2. * M_PI) / static_cast<double>(m);
-				const Complex w(std::cos(arg), std::sin(arg));
-				for (size_t i = 0u; i < m_x.size(); i += m) {
-					Complex wj(1., 0.);
-					for (size_t j = 0u; j < m / 2u; ++j) {
-						const size_t a = i + j;
-						const size_t b = i + j + m / 2u;
-						const Complex t(wj * m_x[b]);
-						m_x[b] = m_x[a] - t;
-						m_x[a] = m_x[a] + t;
-						wj *= w;
+	// Precomputed complex FFT of a fixed size.
+	// Sizes of the form 2^a 3^b 5^c run as mixed radix 2/3/4/5 DIT stages after a digit
+	// reversal permutation; any other size is computed exactly with Bluestein's algorithm
+	// on a power-of-two convolution. Everything size dependent is built once, so
+	// forward()/inverse() only run the butterflies. inverse() is not normalized.
+	template <class T>
+	class Plan {
+	public:
+		typedef std::complex<T> Complex;
+
+		explicit Plan(size_t n) :
+			m_n(n)
+		{
+			if (n == 0u) {
+				throw std::invalid_argument("fft::Plan: size must not be zero");
+			}
+			std::vector<size_t> radices;
+			size_t rest = n;
+			for (; rest % 4u == 0u; rest /= 4u) {
+				radices.push_back(4u);
+			}
+			if (rest % 2u == 0u) {	// only ever the first stage, m = 1, so radix2Pass is scalar
+				radices.insert(radices.begin(), 2u);
+				rest /= 2u;
+			}
+			for (; rest % 3u == 0u; rest /= 3u) {
+				radices.push_back(3u);
+			}
+			for (; rest % 5u == 0u; rest /= 5u) {
+				radices.push_back(5u);
+			}
+			if (rest != 1u) {
+				initBluestein();
+				return;
+			}
+
+			// stage s combines radix sub-DFTs of length m = r_0 * ... * r_(s-1)
+			size_t m = 1u;
+			for (size_t s = 0u; s < radices.size(); ++s) {
+				const size_t radix = radices[s], length = radix * m;
+				m_stages.push_back(Stage{ radix, m, m_forward.size() });
+				for (size_t q = 1u; q < radix; ++q) {
+					for (size_t k = 0u; k < m; ++k) {
+						const double arg = -2. * M_PI * static_cast<double>(q * k % length) / static_cast<double>(length);
+						m_forward.push_back(Complex((T)std::cos(arg), (T)std::sin(arg)));
+						m_inverse.push_back(Complex((T)std::cos(arg), (T)-std::sin(arg)));
 					}
 				}
+				m = length;
+			}
+
+			// digit reversal: position p of the first stage input takes x[source[p]]
+			std::vector<uint32_t> source(n);
+			for (size_t p = 0u; p < n; ++p) {
+				size_t pos = p, index = 0u, stride = 1u, length = n;
+				for (size_t s = radices.size(); s-- > 0u; ) {
+					length /= radices[s];
+					index += pos / length * stride;
+					pos %= length;
+					stride *= radices[s];
+				}
+				source[p] = (uint32_t)index;
+			}
+			// stored as cycles (length, positions...) so it can be applied in place
+			std::vector<bool> visited(n, false);
+			for (size_t p = 0u; p < n; ++p) {
+				if (visited[p] || source[p] == p) {
+					continue;
+				}
+				const size_t head = m_cycles.size();
+				m_cycles.push_back(0u);
+				for (size_t i = p; !visited[i]; i = source[i]) {
+					visited[i] = true;
+					m_cycles.push_back((uint32_t)i);
+				}
+				m_cycles[head] = (uint32_t)(m_cycles.size() - head - 1u);
 			}
 		}
 
+		inline size_t size() const {
+			return m_n;
+		}
+
+		void forward(Complex* x) const {
+			transform(x, m_forward, false);
+		}
+
+		void inverse(Complex* x) const {
+			transform(x, m_inverse, true);
+		}
+
+	private:
+		struct Stage {
+			size_t radix;
+			size_t m;
+			size_t twiddle;	// offset into m_forward/m_inverse
+		};
+
+		void transform(Complex* x, const std::vector<Complex>& twiddle, bool inverse) const {
+			if (m_convolution) {
+				bluestein(x, inverse);
+				return;
+			}
+			for (size_t i = 0u; i < m_cycles.size(); i += m_cycles[i] + 1u) {
+				const uint32_t* cycle = &m_cycles[i + 1u];
+				const Complex first = x[cycle[0]];
+				for (uint32_t j = 1u; j < m_cycles[i]; ++j) {
+					x[cycle[j - 1u]] = x[cycle[j]];
+				}
+				x[cycle[m_cycles[i] - 1u]] = first;
+			}
+			for (size_t s = 0u; s < m_stages.size(); ++s) {
+				const Stage& stage = m_stages[s];
+				const Complex* w = twiddle.data() + stage.twiddle;
+				if (stage.radix == 2u) {
+					detail::radix2Pass(x, m_n, stage.m, w);
+				}
+				else {
+					detail::radixPass(x, m_n, stage.m, stage.radix, w, inverse);
+				}
+			}
+		}
+
+		// X[k] = w[k] * sum_j (x[j] w[j]) conj(w[k - j]) with w[j] = exp(-pi i j^2 / n):
+		// a circular convolution of length >= 2n - 1 done with power-of-two FFTs.
+		void initBluestein() {
+			size_t length = 1u;
+			for (; length < 2u * m_n - 1u; length *= 2u);
+			m_convolution = std::make_shared<const Plan>(length);
+			for (size_t j = 0u; j < m_n; ++j) {
+				const double arg = -M_PI * static_cast<double>((uint64_t)j * j % (2u * m_n)) / static_cast<double>(m_n);
+				m_chirp.push_back(Complex((T)std::cos(arg), (T)std::sin(arg)));
+			}
+			m_chirpSpectrum.assign(length, Complex());
+			const T scale = (T)1 / (T)length;	// folds in the normalization of the inverse FFT
+			m_chirpSpectrum[0] = std::conj(m_chirp[0]) * scale;
+			for (size_t j = 1u; j < m_n; ++j) {
+				m_chirpSpectrum[j] = m_chirpSpectrum[length - j] = std::conj(m_chirp[j]) * scale;
+			}
+			m_convolution->forward(m_chirpSpectrum.data());
+		}
+
+		// inverse(x) = conj(forward(conj(x)))
+		void bluestein(Complex* x, bool inverse) const {
+			typedef detail::ScalarOps<T> Ops;
+			static thread_local std::vector<Complex> work;
+			work.assign(m_chirpSpectrum.size(), Complex());
+			for (size_t j = 0u; j < m_n; ++j) {
+				work[j] = Ops::mul(inverse ? std::conj(x[j]) : x[j], m_chirp[j]);
+			}
+			m_convolution->forward(work.data());
+			for (size_t i = 0u; i < work.size(); ++i) {
+				work[i] = Ops::mul(work[i], m_chirpSpectrum[i]);
+			}
+			m_convolution->inverse(work.data());
+			for (size_t k = 0u; k < m_n; ++k) {
+				const Complex y = Ops::mul(work[k], m_chirp[k]);
+				x[k] = inverse ? std::conj(y) : y;
+			}
+		}
+
+		size_t m_n;
+		std::vector<Stage> m_stages;
+		std::vector<uint32_t> m_cycles;
+		std::vector<Complex> m_forward;
+		std::vector<Complex> m_inverse;
+		// Bluestein
+		std::shared_ptr<const Plan> m_convolution;
+		std::vector<Complex> m_chirp;
+		std::vector<Complex> m_chirpSpectrum;
+	};
+
+	// FFT of n (even) real samples through an n/2 point complex FFT.
+	// forward() writes the n/2 + 1 non-negative frequency bins, inverse() takes them back
+	// to n real samples (not normalized, like Plan::inverse).
+	template <class T>
+	class RealPlan {
+	public:
+		typedef std::complex<T> Complex;
+
+		explicit RealPlan(size_t n) :
+			m_n(n),
+			m_half(std::max<size_t>(n / 2u, 1u))
+		{
+			if (n < 2u || n % 2u != 0u) {
+				throw std::invalid_argument("fft::RealPlan: size must be even");
+			}
+			for (size_t k = 0u; k < n / 2u; ++k) {
+				const double arg = -2. * M_PI * static_cast<double>(k) / static_cast<double>(n);
+				m_twiddle.push_back(Complex((T)std::cos(arg), (T)std::sin(arg)));
+			}
+		}
+
+		inline size_t size() const {
+			return m_n;
+		}
+
+		// in: n samples, out: n / 2 + 1 bins (out doubles as the work buffer)
+		void forward(const T* in, Complex* out) const {
+			const size_t h = m_n / 2u;
+			for (size_t i = 0u; i < h; ++i) {
+				out[i] = Complex(in[2u * i], in[2u * i + 1u]);
+			}
+			m_half.forward(out);
+			const Complex z0 = out[0];
+			out[0] = Complex(z0.real() + z0.imag(), 0);
+			out[h] = Complex(z0.real() - z0.imag(), 0);
+			// X[h - k] = conj(E[k] - W^k O[k]), so bins are produced in pairs in place
+			for (size_t k = 1u; k <= h / 2u; ++k) {
+				const Complex a = out[k];
+				const Complex b = std::conj(out[h - k]);
+				const Complex even = (a + b) * (T)0.5;
+				const Complex odd = m_twiddle[k] * ((a - b) * Complex(0, (T)-0.5));
+				out[k] = even + odd;
+				out[h - k] = std::conj(even - odd);
+			}
+		}
+
+		// in: n / 2 + 1 bins, out: n samples (out doubles as the work buffer)
+		void inverse(const Complex* in, T* out) const {
+			const size_t h = m_n / 2u;
+			Complex* z = reinterpret_cast<Complex*>(out);
+			for (size_t k = 0u; k < h; ++k) {
+				const Complex a = in[k];
+				const Complex b = std::conj(in[h - k]);
+				const Complex odd = (a - b) * std::conj(m_twiddle[k]);
+				z[k] = (a + b) + Complex(-odd.imag(), odd.real());
+			}
+			m_half.inverse(z);
+		}
+
+	private:
+		size_t m_n;
+		Plan<T> m_half;
+		std::vector<Complex> m_twiddle;
+	};
+
+	// Plans are immutable after construction, so one per size can be shared between threads.
+	template <class P>
+	std::shared_ptr<const P> getPlan(size_t n)
+	{
+		static std::mutex mutex;
+		static std::map<size_t, std::shared_ptr<const P> > plans;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<const P>& plan = plans[n];
+		if (!plan) {
+			plan = std::make_shared<const P>(n);
+		}
+		return plan;
+	}
+
+	class FftArray {
+		typedef std::complex<double> Complex;
+		std::vector<Complex> m_x;
+		std::shared_ptr<const Plan<double> > m_plan;
+
 	public:
 		typedef std::vector<Complex>::iterator iterator;
 
 		FftArray(size_t n) :
-			m_x(next2n(n))
+			m_x(std::max<size_t>(n, 1u)),
+			m_plan(getPlan<Plan<double> >(m_x.size()))
 		{
 		}
 
 		template <class Iterator>
 		FftArray(Iterator first, Iterator last)
-			: m_x(next2n(std::distance(first, last)))
+			: m_x(std::max<size_t>(std::distance(first, last), 1u)),
+			m_plan(getPlan<Plan<double> >(m_x.size()))
 		{
 			for (iterator it = m_x.begin(); first != last; *it++ = *first++);
 		}
@@ -117,18 +566,19 @@ namespace fft {
 		}
 
 		void resize(size_t s, Complex v = Complex()) {
-			m_x.resize(next2n(s), v);
+			m_x.resize(std::max<size_t>(s, 1u), v);
+			m_plan = getPlan<Plan<double> >(m_x.size());
 		}
 
 		inline void fft() {
-			doFft();
+			m_plan->forward(m_x.data());
 		}
 
 		void ifft() {
-			doFft(true);
+			m_plan->inverse(m_x.data());
 			for (iterator it = begin(); it != end(); ++it) {
 				*it /= static_cast<double>(m_x.size());
 			}
 		}
 	};
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -9,7 +9,13 @@
 #define NOMINMAX
 #include <stdio.h>
 #include "Audio.h"
+#include "AudioGraph.h"
+#include "MP3Stream.h"
+#include "SampleQueue.h"
 #include "fft.h"
+#include "stft.h"
+#include "WaveformPyramid.h"
+#include "AnalysisCache.h"
 #include <string>
 
 #include <windows.h>
@@ -35,6 +41,7 @@ using namespace gl;
 
 // Include glfw3.h after our OpenGL definitions
 #include <GLFW/glfw3.h>
+#include "ShaderManager.h"
 
 // [Win32] Our example includes a copy of glfw3.lib pre-compiled with VS2010 to maximize ease of testing and compatibility with old VS compilers.
 // To link with VS2010-era libraries, VS2015+ requires linking with legacy_stdio_definitions.lib, which we do using this pragma.
@@ -66,45 +73,19 @@ std::string openReadFile() {
 	return filename;
 }
 
-bool CheckShader(GLuint handle, const char* desc)
-{
-	GLint status = 0, log_length = 0;
-	glGetShaderiv(handle, GL_COMPILE_STATUS, &status);
-	glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &log_length);
-	if ((GLboolean)status == GL_FALSE)
-		fprintf(stderr, "ERROR: ImGui_ImplOpenGL3_CreateDeviceObjects: failed to compile %s!\n", desc);
-	if (log_length > 1)
-	{
-		ImVector<char> buf;
-		buf.resize((int)(log_length + 1));
-		glGetShaderInfoLog(handle, log_length, NULL, (GLchar*)buf.begin());
-		fprintf(stderr, "%s\n", buf.begin());
-	}
-	return (GLboolean)status == GL_TRUE;
-}
-
-bool CheckProgram(GLuint handle, const char* desc)
-{
-	GLint status = 0, log_length = 0;
-	glGetProgramiv(handle, GL_LINK_STATUS, &status);
-	glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &log_length);
-	if ((GLboolean)status == GL_FALSE)
-		fprintf(stderr, "ERROR: ImGui_ImplOpenGL3_CreateDeviceObjects: failed to link %s! (with GLSL '%s')\n", desc, "g_GlslVersionString");
-	if (log_length > 1)
-	{
-		ImVector<char> buf;
-		buf.resize((int)(log_length + 1));
-		glGetProgramInfoLog(handle, log_length, NULL, (GLchar*)buf.begin());
-		fprintf(stderr, "%s\n", buf.begin());
-	}
-	return (GLboolean)status == GL_TRUE;
-}
-
 //auto mp3 = new MP3Audio();
+//auto mp3 = new MP3StreamAudio();
 //auto mp3 = new SinAudio();
 //auto mp3 = new NokogiriAudio();
 auto mp3 = new NoiseAudio();
+// about two tiles of 512x64 in the queue, so that a reloaded shader is heard within 1.5 s
+auto shaderAudio = new ShaderStreamAudio(1 << 17);
+auto shaderManager = new ShaderManager();
+PCMAudio* playing = mp3;
 auto player = new PCMAudioPlayer();
+auto overview = new WaveformPyramid();
+auto analysisCache = new AnalysisCache();
+SampleQueue<float> analyzerTap(1 << 16);
 
 int main(int, char**)
 {
@@ -186,111 +167,21 @@ int main(int, char**)
 	//ImFont* font = io.Fonts->AddFontFromFileTTF("c:\\Windows\\Fonts\\ArialUni.ttf", 18.0f, NULL, io.Fonts->GetGlyphRangesJapanese());
 	//IM_ASSERT(font != NULL);
 
-	const GLchar* vertex_shader =
-		"#version 410\n"
-		"layout (location = 0) in vec2 Position;\n"
-		"layout (location = 1) in vec2 UV;\n"
-		"layout (location = 2) in vec4 Color;\n"
-		"const vec2[4] POSITIONS = vec2[](\n"
-			"vec2(-1.0, -1.0), \n"
-			"vec2(1.0, -1.0), \n"
-			"vec2(-1.0, 1.0), \n"
-			"vec2(1.0, 1.0)\n"
-		"); \n"
-		"const int[6] INDICES = int[](\n"
-			"0, 1, 2, \n"
-			"3, 2, 1\n"
-		"); \n"
-		"void main(void) {\n"
-			"vec2 position = POSITIONS[INDICES[gl_VertexID]]; \n"
-			"gl_Position = vec4(position, 0.0, 1.0); \n"
-		"}\n";
-	const GLchar* fragment_shader =
-		"#version 410\n"
-		"in vec2 Frag_UV;\n"
-		"in vec4 Frag_Color;\n"
-		"uniform sampler2D Texture;\n"
-		"layout (location = 0) out vec4 Out_Color;\n"
-		"void main()\n"
-		"{\n"
-		"    Out_Color = vec4(1.0, .75, .5, .25);\n"
-		"}\n";
-
-	GLuint       g_ShaderHandle = 0, g_VertHandle = 0, g_FragHandle = 0;
-	// Shader Compile Test
-	// Create shaders
-	const GLchar* vertex_shader_with_version[1] = { vertex_shader };
-	g_VertHandle = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(g_VertHandle, 1, vertex_shader_with_version, NULL);
-	glCompileShader(g_VertHandle);
-	CheckShader(g_VertHandle, "vertex shader");
-
-	const GLchar* fragment_shader_with_version[1] = { fragment_shader };
-	g_FragHandle = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(g_FragHandle, 1, fragment_shader_with_version, NULL);
-	glCompileShader(g_FragHandle);
-	CheckShader(g_FragHandle, "fragment shader");
-
-	g_ShaderHandle = glCreateProgram();
-	glAttachShader(g_ShaderHandle, g_VertHandle);
-	glAttachShader(g_ShaderHandle, g_FragHandle);
-	glLinkProgram(g_ShaderHandle);
-	CheckProgram(g_ShaderHandle, "shader program");
-	glUseProgram(g_ShaderHandle);
-
-	int width = 512;
-	int height = 512;
-	int duration = 5;
-
-	// create a texture object
-	GLuint textureId;
-	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE); // automatic mipmap
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, 0);
-	//glBindTexture(GL_TEXTURE_2D, 0);
-
-	// create a framebuffer object
-	GLuint fboId;
-	glGenFramebuffers(1, &fboId);
-	glBindFramebuffer(GL_FRAMEBUFFER, fboId);
-
-	// attach the texture to FBO color attachment point
-	glFramebufferTexture2D(GL_FRAMEBUFFER,        // 1. fbo target: GL_FRAMEBUFFER
-		GL_COLOR_ATTACHMENT0,  // 2. attachment point
-		GL_TEXTURE_2D,         // 3. tex target: GL_TEXTURE_2D
-		textureId,             // 4. tex ID
-		0);                    // 5. mipmap level: 0(base)
-
-	glViewport(0, 0, width, height);
-	GLuint vao([]() { GLuint vao; glGenVertexArrays(1, &vao); return vao; } ());
-	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-
-	float *buffer = new float[width * height * duration * 2];
-
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, buffer);
-
-	printf("%f\n", buffer[0]);
-	printf("%f\n", buffer[1]);
-	printf("%f\n", buffer[2]);
-	printf("%f\n", buffer[3]);
-
-	if (g_ShaderHandle && g_VertHandle) { glDetachShader(g_ShaderHandle, g_VertHandle); }
-	if (g_ShaderHandle && g_FragHandle) { glDetachShader(g_ShaderHandle, g_FragHandle); }
-	if (g_VertHandle) { glDeleteShader(g_VertHandle); g_VertHandle = 0; }
-	if (g_FragHandle) { glDeleteShader(g_FragHandle); g_FragHandle = 0; }
-	if (g_ShaderHandle) { glDeleteProgram(g_ShaderHandle); g_ShaderHandle = 0; }
-	if (textureId) { glDeleteTextures(1, &textureId); textureId = 0; }
-	if (fboId) { glDeleteFramebuffers(1, &fboId); fboId = 0; }
-	if (vao) { glDeleteVertexArrays(1, &vao); vao = 0; }
-	delete buffer;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	/////////
+	// Sound shader rendered on the GPU tile by tile while it plays; saving sound.glsl next
+	// to the executable swaps it in
+	try {
+		shaderManager->Open("shadercache");
+		const GLuint program = shaderManager->Build(
+			"vec2 mainSound(float time) {\n"
+			"    return vec2(sin(6.2831 * 440.0 * time) * exp(-3.0 * fract(time)));\n"
+			"}\n");
+		shaderAudio->Create(program, 60.0, 44100, 512, 64);
+		shaderManager->Watch("sound.glsl");
+	}
+	catch (const std::runtime_error& e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+	analysisCache->Open("analysiscache");
 
 	// Our state
 	bool show_another_window = false;
@@ -305,6 +196,10 @@ int main(int, char**)
 		// - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
 		// Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
 		glfwPollEvents();
+		shaderAudio->Update();
+		if (GLuint program = shaderManager->Update()) {
+			shaderAudio->SetProgram(program);
+		}
 
 		// Start the Dear ImGui frame
 		ImGui_ImplOpenGL3_NewFrame();
@@ -322,66 +217,70 @@ int main(int, char**)
 			const int plotWaveNum = 256;
 			const int plotFFTNum = 512;
 			static float values[plotWaveNum] = {};
-			static fft::FftArray z(plotFFTNum);
+			static fft::Stft stft(plotFFTNum, plotFFTNum);
 			static float freqValues[plotFFTNum];
-			if (mp3->IsValid()) {
-				int postion = player->GetPosition();
-				int lastIndex = mp3->GetSamples() / mp3->GetChannels() - 1;
-				for (int i = 0; i < plotWaveNum; i++) {
-					int off = std::min(postion, lastIndex - plotWaveNum);
-					int index = std::min(i + off, lastIndex);
-					switch (mp3->GetChannels())
-					{
-					case 1:
-						values[i] = mp3->GetBuffer()[index];
-						break;
-					case 2:
-						values[i] = (mp3->GetBuffer()[index * 2] + mp3->GetBuffer()[index * 2 + 1]) * 0.5f;
-						break;
-					default:
-						break;
-					}
+			if (playing->IsValid()) {
+				// the newest frames rendered by the player, ahead of the speaker by the output latency
+				const int channels = playing->GetChannels();
+				const size_t historySize = (size_t)plotFFTNum * channels;
+				static std::vector<float> history, incoming(analyzerTap.Capacity());
+				history.resize(historySize, 0.0f);
+				size_t n = analyzerTap.Pop(incoming.data(), incoming.size());
+				if (n >= historySize) {
+					std::copy(incoming.begin() + (n - historySize), incoming.begin() + n, history.begin());
+				}
+				else if (n > 0) {
+					std::move(history.begin() + n, history.end(), history.begin());
+					std::copy(incoming.begin(), incoming.begin() + n, history.end() - n);
 				}
 
-				for (int i = 0; i < plotFFTNum; i++) {
-					int off = std::min(postion, lastIndex - plotFFTNum);
-					int index = std::min(i + off, lastIndex);
-					switch (mp3->GetChannels())
+				for (int i = 0; i < plotWaveNum; i++) {
+					const float* frame = &history[(size_t)(plotFFTNum - plotWaveNum + i) * channels];
+					switch (channels)
 					{
 					case 1:
-						z[i] = mp3->GetBuffer()[index];
+						values[i] = frame[0];
 						break;
 					case 2:
-						z[i] = ((double)mp3->GetBuffer()[index * 2] + (double)mp3->GetBuffer()[index * 2 + 1]) * 0.5;
+						values[i] = (frame[0] + frame[1]) * 0.5f;
 						break;
 					default:
 						break;
 					}
-					// Hann Window
-					z[i] *= 0.5 - 0.5 * cos(2.0 * 3.14159265358979323846 * i / plotFFTNum);
-					// nŖʐς1/2ɂȂ̂œ{
-					z[i] *= 2.0;
 				}
-				z.fft();
-				int count = 0;
-				for (fft::FftArray::iterator it = z.begin(); it != z.end(); ++it) {
-					float re = (*it).real(), im = (*it).imag();
-					//freqValues[count] = 10.0f * log10(re*re+im*im) + 20.0f;
-
-					// p[XyNgiБXyNgȂ̂œ{j
-					//freqValues[count] = 2.0 * ((re * re + im * im) / (double)(plotFFTNum * plotFFTNum));
-					//freqValues[count] = 10.0 * log10(2.0 * ((re * re + im * im) / (double)(plotFFTNum * plotFFTNum)));  // fVx
-
-					// UiБXyNgȂ̂œ{j
-					//freqValues[count] = 2.0 * (sqrt(re * re + im * im) / (double)(plotFFTNum));
-					freqValues[count] = 20.0 * log10(2.0 * (sqrt(re * re + im * im) / (double)(plotFFTNum)));			// fVx
 
+				// one Hann windowed frame of the latest samples, amplitude in dB
+				stft.reset();
+				stft.push(history.data(), plotFFTNum, channels);
+				stft.pullMagnitude(freqValues);
+			}
+			ImGui::PlotLines("Wave", values, IM_ARRAYSIZE(values), 0, "", -1.0f, 1.0f, ImVec2(0, 160));
 
-					//freqValues[count] = sqrt(re * re + im * im) / (double)plotFFTNum;
-					count++;
+			// the whole file around the play head, min/max and RMS per pixel from the pyramid
+			if (overview->IsValid() && overview->GetFrames() > 0) {
+				static float zoom = 1.0f;
+				static std::vector<WaveformColumn> columns;
+				const ImVec2 size(std::max(ImGui::GetContentRegionAvail().x, 1.0f), 80.0f);
+				const ImVec2 origin = ImGui::GetCursorScreenPos();
+				ImGui::InvisibleButton("Overview", size);
+				columns.resize((size_t)size.x);
+				const double frames = (double)overview->GetFrames();
+				const double visible = frames / zoom;
+				const double head = (double)player->GetPosition();
+				const double first = std::min(std::max(head - visible * 0.5, 0.0), frames - visible);
+				overview->GetColumns(first, first + visible, (int)columns.size(), columns.data());
+				ImDrawList* draw = ImGui::GetWindowDrawList();
+				const float middle = origin.y + size.y * 0.5f, scale = size.y * 0.5f;
+				const ImU32 peakColor = ImGui::GetColorU32(ImGuiCol_PlotLines), rmsColor = ImGui::GetColorU32(ImGuiCol_PlotHistogram);
+				for (size_t x = 0; x < columns.size(); x++) {
+					const float px = origin.x + (float)x;
+					draw->AddLine(ImVec2(px, middle - columns[x].maximum * scale), ImVec2(px, middle - columns[x].minimum * scale + 1.0f), peakColor);
+					draw->AddLine(ImVec2(px, middle - columns[x].rms * scale), ImVec2(px, middle + columns[x].rms * scale + 1.0f), rmsColor);
 				}
+				const float headX = origin.x + (float)((head - first) / visible * size.x);
+				draw->AddLine(ImVec2(headX, origin.y), ImVec2(headX, origin.y + size.y), IM_COL32(255, 255, 255, 255));
+				ImGui::SliderFloat("Zoom", &zoom, 1.0f, 4096.0f, "%.0fx");
 			}
-			ImGui::PlotLines("Wave", values, IM_ARRAYSIZE(values), 0, "", -1.0f, 1.0f, ImVec2(0, 160));
 			ImGui::PlotHistogram("Frequency", freqValues, IM_ARRAYSIZE(freqValues)/2, 0, "-52dB ~ 1dB", -52.0f, 1.0f, ImVec2(0, 160));
 			//ImGui::PlotHistogram("Frequency", freqValues, IM_ARRAYSIZE(freqValues) / 2, 0, "-60dB ~ 1dB", 0.0, 1.0f, ImVec2(0, 160));
 
@@ -398,13 +297,38 @@ int main(int, char**)
 					
 					mp3->Create(2200.0f);
 					//mp3->LoadFromFile(filename);
+					playing = mp3;
+					player->SetTap(&analyzerTap);
 					player->SetAudio(*mp3);
 					player->Start();
+					// built once per file content and kept in the cache; generators have no buffer to scan
+					if (mp3->GetBuffer()) {
+						const std::string key = AnalysisCache::GetKey(filename);
+						const std::string path = analysisCache->GetPath(key, "peaks");
+						if (key.empty() || !analysisCache->Touch(path) || !overview->Load(path, *mp3)) {
+							overview->Build(*mp3);
+							if (!key.empty()) {
+								analysisCache->Store(path, [](const std::string& temporary) { return overview->Save(temporary); });
+							}
+						}
+					}
+					else {
+						overview->Clear();
+					}
 					//SaveAudioToWaveFile(*mp3, "test.wav");
 				}
 			}
 
 
+			ImGui::SameLine();
+			if (ImGui::Button("Shader") && shaderAudio->IsValid()) {
+				playing = shaderAudio;
+				overview->Clear();
+				player->SetTap(&analyzerTap);
+				player->SetAudio(*shaderAudio);
+				player->Start();
+			}
+
 			ImGui::SameLine();
 			if (ImGui::Button("Start")) {
 				player->Start();
@@ -421,6 +345,9 @@ int main(int, char**)
 
 			ImGui::SameLine();
 			ImGui::Text("samples = %d", player->GetPosition());
+			if (!shaderManager->GetError().empty()) {
+				ImGui::TextWrapped("%s", shaderManager->GetError().c_str());
+			}
 
 			ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 			ImGui::End();
@@ -1209,6 +1209,9 @@ static int L3_restore_reservoir(mp3dec_t *h, bs_t *bs, mp3dec_scratch_t *s, int
     int bytes_have = MINIMP3_MIN(h->reserv, main_data_begin);
     memcpy(s->maindata, h->reserv_buf + MINIMP3_MAX(0, h->reserv - main_data_begin), MINIMP3_MIN(h->reserv, main_data_begin));
     memcpy(s->maindata + bytes_have, bs->buf + bs->pos/8, frame_bytes);
+    /* the huffman decoder may read past the main data; make that zeros rather than
+       whatever the previous frame left in the scratch, so output does not depend on history */
+    memset(s->maindata + bytes_have + frame_bytes, 0, sizeof(s->maindata) - bytes_have - frame_bytes);
     bs_init(&s->bs, s->maindata, bytes_have + frame_bytes);
     return h->reserv >= main_data_begin;
 }
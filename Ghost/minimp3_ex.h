@@ -71,7 +71,7 @@ int mp3dec_ex_open_buf(mp3dec_ex_t *dec, const uint8_t *buf, size_t buf_size, in
 /*int mp3dec_ex_open_cb(mp3dec_ex_t *dec, MP3D_READ_CB cb, void *user_data, uint64_t file_size, int seek_method);*/
 void mp3dec_ex_close(mp3dec_ex_t *dec);
 void mp3dec_ex_seek(mp3dec_ex_t *dec, uint64_t position);
-size_t mp3dec_ex_read(mp3dec_ex_t *dec, int16_t *buf, size_t samples);
+size_t mp3dec_ex_read(mp3dec_ex_t *dec, mp3d_sample_t *buf, size_t samples);
 #ifndef MINIMP3_NO_STDIO
 /* stdio versions with file pre-load */
 int mp3dec_load(mp3dec_t *dec, const char *file_name, mp3dec_file_info_t *info, MP3D_PROGRESS_CB progress_cb, void *user_data);
@@ -84,7 +84,8 @@ int mp3dec_ex_open(mp3dec_ex_t *dec, const char *file_name, int seek_method);
 #endif
 #endif /*MINIMP3_EXT_H*/
 
-#ifdef MINIMP3_IMPLEMENTATION
+#if defined(MINIMP3_IMPLEMENTATION) && !defined(_MINIMP3_EX_IMPLEMENTATION_GUARD)
+#define _MINIMP3_EX_IMPLEMENTATION_GUARD
 
 static void mp3dec_skip_id3(const uint8_t **pbuf, size_t *pbuf_size)
 {
@@ -281,7 +282,7 @@ void mp3dec_ex_seek(mp3dec_ex_t *dec, uint64_t position)
     mp3dec_init(&dec->mp3d);
 }
 
-size_t mp3dec_ex_read(mp3dec_ex_t *dec, int16_t *buf, size_t samples)
+size_t mp3dec_ex_read(mp3dec_ex_t *dec, mp3d_sample_t *buf, size_t samples)
 {
     size_t samples_requested = samples;
     mp3dec_frame_info_t frame_info;
@@ -289,7 +290,7 @@ size_t mp3dec_ex_read(mp3dec_ex_t *dec, int16_t *buf, size_t samples)
     if (dec->buffer_consumed < dec->buffer_samples)
     {
         size_t to_copy = MINIMP3_MIN((size_t)(dec->buffer_samples - dec->buffer_consumed), samples);
-        memcpy(buf, dec->buffer + dec->buffer_consumed, to_copy*sizeof(int16_t));
+        memcpy(buf, dec->buffer + dec->buffer_consumed, to_copy*sizeof(mp3d_sample_t));
         buf += to_copy;
         dec->buffer_consumed += to_copy;
         samples -= to_copy;
@@ -312,7 +313,7 @@ size_t mp3dec_ex_read(mp3dec_ex_t *dec, int16_t *buf, size_t samples)
                 dec->to_skip -= skip;
             }
             size_t to_copy = MINIMP3_MIN((size_t)(dec->buffer_samples - dec->buffer_consumed), samples);
-            memcpy(buf, dec->buffer + dec->buffer_consumed, to_copy*sizeof(int16_t));
+            memcpy(buf, dec->buffer + dec->buffer_consumed, to_copy*sizeof(mp3d_sample_t));
             buf += to_copy;
             dec->buffer_consumed += to_copy;
             samples -= to_copy;
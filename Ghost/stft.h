@@ -0,0 +1,311 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <tuple>
+#include <thread>
+#include <stdexcept>
+#include <cmath>
+#include "fft.h"
+
+// Short-time Fourier transform built on fft::RealPlan.
+//
+// Samples are pushed in any block size (interleaved input is mixed down to mono) and
+// frames of fftSize samples, hop samples apart, are pulled as complex bins or
+// magnitudes. Window tables and FFT plans are cached per size and shared, so any
+// number of Stft objects can run on different threads.
+namespace fft {
+	enum class Window {
+		Hann,
+		Hamming,
+		BlackmanHarris,	// 4 term, -92 dB side lobes
+		Kaiser,
+	};
+
+	namespace detail {
+		// zeroth order modified Bessel function of the first kind
+		inline double besselI0(double x)
+		{
+			double sum = 1., term = 1.;
+			for (int k = 1; k < 64 && term > sum * 1e-17; ++k) {
+				term *= (x / (2. * k)) * (x / (2. * k));
+				sum += term;
+			}
+			return sum;
+		}
+	}
+
+	// Periodic window of the given size, computed once and shared.
+	// beta is only used by Kaiser.
+	inline std::shared_ptr<const std::vector<float> > getWindow(Window type, size_t size, double beta = 8.6)
+	{
+		static std::mutex mutex;
+		static std::map<std::tuple<int, size_t, double>, std::shared_ptr<const std::vector<float> > > windows;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<const std::vector<float> >& window = windows[std::make_tuple((int)type, size, type == Window::Kaiser ? beta : 0.)];
+		if (!window) {
+			std::vector<float> w(size);
+			for (size_t i = 0u; i < size; ++i) {
+				const double x = 2. * M_PI * static_cast<double>(i) / static_cast<double>(size);
+				switch (type) {
+				case Window::Hann:
+					w[i] = (float)(0.5 - 0.5 * std::cos(x));
+					break;
+				case Window::Hamming:
+					w[i] = (float)(0.54 - 0.46 * std::cos(x));
+					break;
+				case Window::BlackmanHarris:
+					w[i] = (float)(0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2. * x) - 0.01168 * std::cos(3. * x));
+					break;
+				case Window::Kaiser: {
+					const double r = 2. * static_cast<double>(i) / static_cast<double>(size) - 1.;
+					w[i] = (float)(detail::besselI0(beta * std::sqrt(std::max(0., 1. - r * r))) / detail::besselI0(beta));
+					break;
+				}
+				}
+			}
+			window = std::make_shared<const std::vector<float> >(std::move(w));
+		}
+		return window;
+	}
+
+	class Stft {
+	public:
+		typedef std::complex<float> Complex;
+
+		Stft(size_t fftSize, size_t hop, Window window = Window::Hann, double kaiserBeta = 8.6) :
+			m_size(fftSize),
+			m_hop(hop),
+			m_plan(getPlan<RealPlan<float> >(fftSize)),
+			m_window(getWindow(window, fftSize, kaiserBeta)),
+			m_frame(fftSize)
+		{
+			if (hop == 0u) {
+				throw std::invalid_argument("fft::Stft: hop must not be zero");
+			}
+			double sum = 0.;
+			for (size_t i = 0u; i < fftSize; ++i) {
+				sum += (*m_window)[i];
+			}
+			// one sided amplitude of a full scale sine is 1 (0 dB) at any window
+			m_gain = (float)(2. / sum);
+			reset();
+		}
+
+		// overlap in [0, 1): 0.75 gives hop = fftSize / 4
+		static Stft withOverlap(size_t fftSize, double overlap, Window window = Window::Hann, double kaiserBeta = 8.6) {
+			const size_t hop = static_cast<size_t>(std::lround(static_cast<double>(fftSize) * (1. - overlap)));
+			return Stft(fftSize, std::max<size_t>(hop, 1u), window, kaiserBeta);
+		}
+
+		inline size_t fftSize() const {
+			return m_size;
+		}
+
+		inline size_t hop() const {
+			return m_hop;
+		}
+
+		// number of bins per frame
+		inline size_t bins() const {
+			return m_size / 2u + 1u;
+		}
+
+		// Discards all buffered input. The next pushed sample is the start of frame 0.
+		void reset() {
+			m_input.clear();
+			m_inputStart = 0u;
+			m_pushed = 0u;
+			m_nextFrame = 0u;
+			m_flushed = false;
+		}
+
+		// frames: number of sample frames in samples (count / channels)
+		void push(const float* samples, size_t frames, int channels = 1) {
+			const size_t offset = m_input.size();
+			m_input.resize(offset + frames);
+			if (channels == 1) {
+				std::copy(samples, samples + frames, m_input.begin() + offset);
+			}
+			else {
+				const float scale = 1.f / (float)channels;
+				for (size_t i = 0u; i < frames; ++i) {
+					float sum = 0.f;
+					for (int c = 0; c < channels; ++c) {
+						sum += samples[i * channels + c];
+					}
+					m_input[offset + i] = sum * scale;
+				}
+			}
+			m_pushed += frames;
+		}
+
+		// Pads the end of the input with zeros, so that every frame that starts before the
+		// last pushed sample becomes ready.
+		void flush() {
+			if (m_flushed || m_nextFrame >= m_pushed) {
+				return;
+			}
+			const size_t last = m_nextFrame + (m_pushed - 1u - m_nextFrame) / m_hop * m_hop;
+			m_input.resize(last + m_size - m_inputStart, 0.f);
+			m_flushed = true;
+		}
+
+		// number of frames that can be pulled now
+		size_t ready() const {
+			const size_t end = m_inputStart + m_input.size();
+			if (end < m_nextFrame + m_size) {
+				return 0u;
+			}
+			size_t frames = (end - m_nextFrame - m_size) / m_hop + 1u;
+			if (m_flushed) {	// only frames that start before the end of the real input
+				frames = std::min(frames, m_nextFrame < m_pushed ? (m_pushed - 1u - m_nextFrame) / m_hop + 1u : 0u);
+			}
+			return frames;
+		}
+
+		// start of the next frame in samples since reset()
+		inline size_t position() const {
+			return m_nextFrame;
+		}
+
+		// bins(): n / 2 + 1 complex values, not scaled
+		bool pull(Complex* out) {
+			if (ready() == 0u) {
+				return false;
+			}
+			const float* in = &m_input[m_nextFrame - m_inputStart];
+			const float* w = m_window->data();
+			for (size_t i = 0u; i < m_size; ++i) {
+				m_frame[i] = in[i] * w[i];
+			}
+			m_plan->forward(m_frame.data(), out);
+			advance();
+			return true;
+		}
+
+		// Pulls up to maxFrames frames of bins() magnitudes each, in dBFS or linear.
+		// Returns the number of frames written.
+		size_t pullMagnitudes(float* out, size_t maxFrames, bool decibels = true) {
+			if (m_spectrum.size() < bins()) {
+				m_spectrum.resize(bins());
+			}
+			size_t frames = 0u;
+			for (; frames < maxFrames && pull(m_spectrum.data()); ++frames, out += bins()) {
+				for (size_t k = 0u; k < bins(); ++k) {
+					const float re = m_spectrum[k].real(), im = m_spectrum[k].imag();
+					const float magnitude = std::sqrt(re * re + im * im) * m_gain;
+					out[k] = decibels ? 20.f * std::log10(magnitude + 1e-10f) : magnitude;
+				}
+			}
+			return frames;
+		}
+
+		inline bool pullMagnitude(float* out, bool decibels = true) {
+			return pullMagnitudes(out, 1u, decibels) == 1u;
+		}
+
+	private:
+		void advance() {
+			m_nextFrame += m_hop;
+			// drop consumed input once it is worth moving the rest
+			const size_t consumed = std::min(m_nextFrame - m_inputStart, m_input.size());
+			if (consumed >= m_size && consumed * 2u >= m_input.size()) {
+				m_input.erase(m_input.begin(), m_input.begin() + consumed);
+				m_inputStart += consumed;
+			}
+		}
+
+		size_t m_size;
+		size_t m_hop;
+		float m_gain;
+		std::shared_ptr<const RealPlan<float> > m_plan;
+		std::shared_ptr<const std::vector<float> > m_window;
+		std::vector<float> m_frame;
+		std::vector<Complex> m_spectrum;
+		std::vector<float> m_input;	// mono samples from m_inputStart on
+		size_t m_inputStart;
+		size_t m_pushed;
+		size_t m_nextFrame;
+		bool m_flushed;
+	};
+
+	namespace detail {
+		// Frames first to last (exclusive) of the spectrogram of source into out, last - first
+		// rows of bins() values; stft is reset and then fed from the source.
+		template <class Source>
+		void spectrogramFrames(Source& source, Stft& stft, size_t first, size_t last, float* out, bool decibels, std::vector<float>& block)
+		{
+			const int channels = std::max(source.GetChannels(), 1);
+			const size_t length = (size_t)source.GetSamples() / channels;
+			const size_t blockFrames = 1u << 14;
+			const size_t bins = stft.bins();
+			const size_t hop = stft.hop();
+			size_t position = first * hop;
+			const size_t end = std::min(length, (last - 1u) * hop + stft.fftSize());
+			size_t remaining = last - first;
+			stft.reset();
+			while (remaining > 0u) {
+				if (position < end) {
+					const size_t n = std::min(blockFrames, end - position);
+					block.resize(n * channels);
+					const int read = source.Read(block.data(), (int)(position * channels), (int)(n * channels));
+					std::fill(block.begin() + std::max(read, 0), block.end(), 0.f);
+					stft.push(block.data(), n, channels);
+					position += n;
+				}
+				else {
+					stft.flush();
+				}
+				const size_t pulled = stft.pullMagnitudes(out, remaining, decibels);
+				out += pulled * bins;
+				remaining -= pulled;
+				if (!pulled && position >= end && stft.ready() == 0u) {
+					break;
+				}
+			}
+		}
+	}
+
+	// Magnitude spectrogram of a whole source (PCMAudio or anything else with GetSamples,
+	// GetChannels and Read): ceil(length / hop) frames of bins() values, row-major, the
+	// last frames zero padded. Frame ranges are split over threads (0 = hardware
+	// concurrency), each reading its own part of the source, so threads > 1 needs a
+	// source whose Read allows concurrent random access like the in-memory PCMAudio.
+	template <class Source>
+	std::vector<float> spectrogram(Source& source, size_t fftSize, size_t hop, Window window = Window::Hann, int threads = 1, bool decibels = true)
+	{
+		const int channels = std::max(source.GetChannels(), 1);
+		const size_t length = (size_t)source.GetSamples() / channels;
+		const size_t bins = fftSize / 2u + 1u;
+		const size_t frames = (length + hop - 1u) / hop;
+		std::vector<float> result(frames * bins);
+		if (threads <= 0) {
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+		}
+		threads = (int)std::min<size_t>((size_t)threads, std::max<size_t>(frames / 64u, 1u));
+
+		auto worker = [&](size_t first, size_t last) {
+			if (first < last) {
+				Stft stft(fftSize, hop, window);
+				std::vector<float> block;
+				detail::spectrogramFrames(source, stft, first, last, result.data() + first * bins, decibels, block);
+			}
+		};
+		std::vector<std::thread> pool;
+		for (int i = 1; i < threads; i++) {
+			pool.emplace_back(worker, frames * i / threads, frames * (i + 1) / threads);
+		}
+		if (frames) {
+			worker(0u, frames / threads);
+		}
+		for (auto& t : pool) {
+			t.join();
+		}
+		return result;
+	}
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "Noise.h"
+#include "Resampler.h"
+
+// Micro benchmarks of the sample generators and the resampler, run by GhostCli --benchmark.
+// Every case works in blocks of 512 and reports the best of three runs, generators in
+// millions of samples per second; "baseline" rows are the code that was replaced.
+// MP3 files given with --benchmark time the parallel decode against mp3dec_load
+// (BenchmarkMP3Load in MP3Parallel.h).
+
+namespace benchmark_detail {
+	const int BlockFrames = 512;
+	const size_t Samples = (size_t)1 << 22;
+
+	// the per sample hash of the first NoiseAudio
+	inline float Hash11(float p) {
+		p = fmodf(p * 0.1031f, 1.0f);
+		p *= p + 33.33f;
+		p *= p + p;
+		return fmodf(p, 1.0f) * 2.0f - 1.0f;
+	}
+	inline float HardRain(float t) {
+		const float g = fmodf(sinf(t * 10000.0f) * 10000.0f, 1.0f) + 6.0f;
+		return expf(-0.08f * g * g) * 40.0f - 1.0f;
+	}
+
+	// render(out, first, frames) fills one block; returns samples per second
+	template <class F>
+	double Measure(F render) {
+		std::vector<float> block(BlockFrames);
+		double best = 0.0;
+		volatile float sink = 0.0f;
+		for (int run = 0; run < 3; run++) {
+			const auto start = std::chrono::steady_clock::now();
+			for (size_t first = 0; first < Samples; first += BlockFrames) {
+				render(block.data(), first, BlockFrames);
+				sink = sink + block[0];
+			}
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			best = std::max(best, Samples / seconds);
+		}
+		return best;
+	}
+
+	inline void Report(const char* name, double samplesPerSecond, double baseline) {
+		printf("  %-34s %9.1f Msamples/s %8.1fx\n", name, samplesPerSecond / 1e6, samplesPerSecond / baseline);
+	}
+}
+
+inline void BenchmarkNoise() {
+	using namespace benchmark_detail;
+	printf("noise (%zu samples, blocks of %d)\n", Samples, BlockFrames);
+	const double baseline = Measure([](float* out, size_t first, int frames) {
+		for (int i = 0; i < frames; i++) {
+			const double t = (first + i) / 44100.0;
+			out[i] = Hash11((float)floor(t * 440.0f));
+		}
+	});
+	Report("baseline hash11", baseline, baseline);
+	Report("baseline hardRain", Measure([](float* out, size_t first, int frames) {
+		for (int i = 0; i < frames; i++) {
+			out[i] = HardRain((float)((first + i) / 44100.0));
+		}
+	}), baseline);
+	std::mt19937 mt(1);
+	std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+	Report("baseline mt19937", Measure([&](float* out, size_t, int frames) {
+		for (int i = 0; i < frames; i++) {
+			out[i] = uniform(mt);
+		}
+	}), baseline);
+	Report("NoiseValue per sample", Measure([](float* out, size_t first, int frames) {
+		for (int i = 0; i < frames; i++) {
+			out[i] = NoiseValue(1, 0, first + i);
+		}
+	}), baseline);
+	const NoiseShape shapes[] = { NoiseShape::White, NoiseShape::Pink, NoiseShape::Brown, NoiseShape::Velvet };
+	const char* names[] = { "NoiseGenerator white", "NoiseGenerator pink", "NoiseGenerator brown", "NoiseGenerator velvet" };
+	for (int s = 0; s < 4; s++) {
+		NoiseGenerator generator(shapes[s], 1);
+		Report(names[s], Measure([&](float* out, size_t first, int frames) {
+			if (first == 0) {
+				generator.Seek(0);
+			}
+			generator.Generate(out, frames);
+		}), baseline);
+	}
+
+	// blocks are independent, so threads can fill one buffer without coordination
+	const int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	std::vector<float> buffer(Samples);
+	double best = 0.0;
+	for (int run = 0; run < 3; run++) {
+		const auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> pool;
+		for (int t = 0; t < threads; t++) {
+			pool.emplace_back([&, t]() {
+				const size_t begin = Samples * t / threads, end = Samples * (t + 1) / threads;
+				FillNoise(buffer.data() + begin, begin, end - begin, 0, 1);
+			});
+		}
+		for (auto& thread : pool) {
+			thread.join();
+		}
+		best = std::max(best, Samples / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	const std::string name = "FillNoise white, " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+	Report(name.c_str(), best, baseline);
+}
+
+// Stereo conversion of the rates MP3s and the generators come in, reported as how many
+// times faster than real time the output is produced.
+inline void BenchmarkResampler() {
+	using namespace benchmark_detail;
+	const int seconds = 10;
+	printf("resampler (%d s of stereo, blocks of %d)\n", seconds, BlockFrames);
+	const int pairs[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 32000, 44100 } };
+	for (const auto& pair : pairs) {
+		const int inputRate = pair[0], outputRate = pair[1];
+		std::vector<float> input((size_t)inputRate * seconds * 2);
+		FillNoise(input.data(), 0, input.size(), 0, 1);
+		const size_t inputFrames = input.size() / 2;
+		std::vector<float> output((size_t)(BlockFrames * (double)outputRate / inputRate + 2) * 2);
+		auto measure = [&](std::function<size_t(const float*, int)> process) {
+			double best = 0.0;
+			for (int run = 0; run < 3; run++) {
+				const auto start = std::chrono::steady_clock::now();
+				size_t produced = 0;
+				for (size_t first = 0; first + BlockFrames <= inputFrames; first += BlockFrames) {
+					produced += process(input.data() + first * 2, BlockFrames);
+				}
+				const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				best = std::max(best, produced / (double)outputRate / elapsed);
+			}
+			return best;
+		};
+		// the linear interpolation a naive player would do
+		double at = 0.0;
+		float last[2] = { 0.0f, 0.0f };
+		const double step = (double)inputRate / outputRate;
+		const double linear = measure([&](const float* in, int frames) {
+			size_t n = 0;
+			for (; at < frames; at += step, n++) {
+				const int i = (int)at;
+				const float t = (float)(at - i);
+				for (int c = 0; c < 2; c++) {
+					const float a = i == 0 ? last[c] : in[(i - 1) * 2 + c];
+					output[n * 2 + c] = a + (in[i * 2 + c] - a) * t;
+				}
+			}
+			at -= frames;
+			last[0] = in[(frames - 1) * 2];
+			last[1] = in[(frames - 1) * 2 + 1];
+			return n;
+		});
+		printf("  %d -> %d\n", inputRate, outputRate);
+		printf("  %-34s %9.0fx real time\n", "baseline linear", linear);
+		const ResamplerQuality qualities[] = { ResamplerQuality::Fast, ResamplerQuality::Medium, ResamplerQuality::Best };
+		const char* names[] = { "fast", "medium", "best" };
+		for (int q = 0; q < 3; q++) {
+			Resampler resampler(2, inputRate, outputRate, qualities[q]);
+			const double speed = measure([&](const float* in, int frames) {
+				return resampler.Process(in, frames, output.data(), output.size() / 2);
+			});
+			const std::string name = std::string(names[q]) + ", " + std::to_string(resampler.GetTaps()) + " taps";
+			printf("  %-34s %9.0fx real time\n", name.c_str(), speed);
+		}
+	}
+}
+
+// threads = 0 decodes the MP3 files on all cores
+inline void RunBenchmarks(const std::vector<std::string>& mp3Files = std::vector<std::string>(), int threads = 0) {
+	BenchmarkNoise();
+	BenchmarkResampler();
+	for (const auto& filename : mp3Files) {
+		BenchmarkMP3Load(filename, threads);
+	}
+}
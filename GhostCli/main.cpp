@@ -0,0 +1,503 @@
+// Ghost command line analyzer.
+//
+// Runs the analysis pipeline of Ghost (Analysis.h) over WAV/AIFF/MP3 files and sound
+// shaders (.glsl/.frag, rendered on the CPU by ShaderSound.h) without a window, an audio
+// device or a GPU, one file per worker thread:
+//
+//   GhostCli [options] file... [@listfile...]
+//
+//   -o dir            output directory (default: current directory)
+//   -j n              worker threads (default: all cores)
+//   --fft n           FFT size (default 2048)
+//   --hop n           hop size (default 512)
+//   --peaks n         spectral peaks to report (default 8)
+//   --no-spectrogram  only write the summary
+//   --format f        spectrogram values: f32 (default), f16 or u8 (dB over --floor to 0)
+//   --floor dB        bottom of the u8 and PNG range (default -120)
+//   --png             also write the spectrogram to name.png
+//   --png-width n     most columns of the PNG, longer files are max-pooled (default 4096)
+//   --skip-existing   skip files whose summary already exists, to resume a sweep
+//   --duration s      seconds rendered from a sound shader (default 10)
+//   --rate n          sample rate of sound shaders (default 44100)
+//   --render          also write sound shaders to name.wav
+//   --cache dir       keep decoded audio, summaries and spectrograms in dir, keyed by the
+//                     file contents, and reuse them for files seen before (AnalysisCache.h)
+//   --cache-size MB   least recently used cache files are deleted beyond this (default 4096)
+//   --benchmark       time the sample generators against their baselines and exit; MP3
+//                     files given with it time the parallel decode (-j) against mp3dec_load
+//
+// For every input name.ext it writes name.json (peaks, RMS, loudness, spectral peaks)
+// and name.spectrogram, in the output directory under the input's path below the deepest
+// directory all inputs share (a/x.wav and b/x.wav become a/x.json and b/x.json; a name
+// that still repeats, like x.wav next to x.mp3, keeps its extension: x.wav.json).
+// name.spectrogram is a 32 byte header ("GSPC", version, sample rate, fft size, hop,
+// frames, bins, format; little endian uint32) followed by frames * bins float32 dBFS.
+// f16 and u8 write version 2, whose header has floorDb and ceilingDb (float32) appended
+// (SpectrogramExport.h). The spectrogram is computed in tiles and streamed to the file,
+// so memory stays bounded for files of any length.
+// A list file holds one path per line. Builds on its own with any C++14 compiler, e.g.
+//   g++ -std=c++14 -O2 -pthread -I../Ghost main.cpp -o ghostcli
+
+#define NOMINMAX
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include "Audio.h"
+#include "Analysis.h"
+#include "SpectrogramExport.h"
+#include "AnalysisCache.h"
+#include "ShaderSound.h"
+#include "Benchmark.h"
+
+struct Options {
+	std::string outputDirectory = ".";
+	int threads = 0;
+	AnalysisSettings settings;
+	SpectrogramFormat format = SpectrogramFormat::Float32;
+	float floorDb = -120.0f;
+	bool isPng = false;
+	int pngWidth = 4096;
+	bool isSkipExisting = false;
+	double shaderSeconds = 10.0;
+	int shaderSampleRate = 44100;
+	bool isRender = false;
+	bool isBenchmark = false;
+	std::string cacheDirectory;
+	uint64_t cacheBytes = (uint64_t)4096 << 20;
+};
+
+static void PrintUsage() {
+	fprintf(stderr,
+		"usage: GhostCli [-o dir] [-j threads] [--fft n] [--hop n] [--peaks n]\n"
+		"                [--no-spectrogram] [--format f32|f16|u8] [--floor dB] [--png]\n"
+		"                [--png-width n] [--skip-existing] [--duration s] [--rate n]\n"
+		"                [--render] [--cache dir] [--cache-size MB] file... [@listfile...]\n"
+		"       GhostCli --benchmark [-j threads] [file.mp3...]\n");
+}
+
+static std::string BaseName(const std::string& path) {
+	const size_t slash = path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+static std::vector<std::string> SplitPath(const std::string& path) {
+	std::vector<std::string> parts(1);
+	for (char c : path) {
+		if (c == '/' || c == '\\') {
+			parts.emplace_back();
+		}
+		else {
+			parts.back() += c;
+		}
+	}
+	return parts;
+}
+
+static void MakeDirectory(const std::string& path) {
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+// Output path of every input without the extension of what is written. outputDirectory
+// and the directories below it that the paths need are created here, before the workers
+// start. Names are compared case insensitively for Windows and macOS file systems.
+static std::vector<std::string> MakeOutputStems(const std::vector<std::string>& inputs, const std::string& outputDirectory) {
+	std::vector<std::vector<std::string> > paths;
+	for (const auto& input : inputs) {
+		paths.push_back(SplitPath(input));
+	}
+	// directory components all inputs share
+	size_t common = paths.empty() ? 0 : paths[0].size() - 1;
+	for (const auto& parts : paths) {
+		size_t n = 0;
+		while (n < common && n + 1 < parts.size() && parts[n] == paths[0][n]) {
+			n++;
+		}
+		common = n;
+	}
+	auto lower = [](std::string s) {
+		std::transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+		return s;
+	};
+	std::vector<std::string> directories, names;
+	std::map<std::string, int> uses;
+	std::set<std::string> created;
+	MakeDirectory(outputDirectory);
+	for (const auto& parts : paths) {
+		std::string directory = outputDirectory;
+		for (size_t k = common; k + 1 < parts.size(); k++) {
+			std::string part = parts[k];
+			if (part.empty() || part == ".") {
+				continue;
+			}
+			// stays inside the output directory; drive letters lose their colon
+			part = part == ".." ? "__" : part;
+			part.erase(std::remove(part.begin(), part.end(), ':'), part.end());
+			directory += "/" + part;
+			if (created.insert(directory).second) {
+				MakeDirectory(directory);
+			}
+		}
+		directories.push_back(directory);
+		names.push_back(BaseName(parts.back()));
+		uses[lower(directory + "/" + names.back())]++;
+	}
+	std::vector<std::string> stems;
+	for (size_t i = 0; i < paths.size(); i++) {
+		const bool isRepeated = uses[lower(directories[i] + "/" + names[i])] > 1;
+		stems.push_back(directories[i] + "/" + (isRepeated ? paths[i].back() : names[i]));
+	}
+	return stems;
+}
+
+static bool IsShader(const std::string& path) {
+	const size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	return extension == ".glsl" || extension == ".frag";
+}
+
+static bool FileExists(const std::string& path) {
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp) {
+		fclose(fp);
+	}
+	return fp != nullptr;
+}
+
+static std::string JsonString(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+// JSON has no infinity, silence is written as null
+static std::string JsonNumber(double value) {
+	if (!std::isfinite(value)) {
+		return "null";
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.3f", value);
+	return buf;
+}
+
+static std::string Decibels(double linear) {
+	return JsonNumber(linear > 0.0 ? 20.0 * std::log10(linear) : -HUGE_VAL);
+}
+
+static bool WriteSummary(const std::string& path, const std::string& input, const AudioAnalysis& a) {
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	std::string peak, rms;
+	for (int c = 0; c < a.channels; c++) {
+		peak += (c ? ", " : "") + Decibels(a.peak[c]);
+		rms += (c ? ", " : "") + Decibels(a.rms[c]);
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"file\": %s,\n", JsonString(input).c_str());
+	fprintf(fp, "  \"channels\": %d,\n", a.channels);
+	fprintf(fp, "  \"sampleRate\": %d,\n", a.sampleRate);
+	fprintf(fp, "  \"frames\": %lld,\n", (long long)a.frames);
+	fprintf(fp, "  \"duration\": %s,\n", JsonNumber(a.sampleRate ? (double)a.frames / a.sampleRate : 0.0).c_str());
+	fprintf(fp, "  \"peakDbfs\": [%s],\n", peak.c_str());
+	fprintf(fp, "  \"rmsDbfs\": [%s],\n", rms.c_str());
+	fprintf(fp, "  \"integratedLufs\": %s,\n", JsonNumber(a.integratedLoudness).c_str());
+	fprintf(fp, "  \"maxMomentaryLufs\": %s,\n", JsonNumber(a.maxMomentaryLoudness).c_str());
+	fprintf(fp, "  \"loudnessRangeLu\": %s,\n", JsonNumber(a.loudnessRange).c_str());
+	fprintf(fp, "  \"fftSize\": %zu,\n", a.fftSize);
+	fprintf(fp, "  \"hop\": %zu,\n", a.hop);
+	fprintf(fp, "  \"spectralPeaks\": [");
+	for (size_t i = 0; i < a.spectralPeaks.size(); i++) {
+		fprintf(fp, "%s\n    { \"frequency\": %s, \"levelDbfs\": %s }", i ? "," : "",
+			JsonNumber(a.spectralPeaks[i].frequency).c_str(), JsonNumber(a.spectralPeaks[i].level).c_str());
+	}
+	fprintf(fp, "%s]\n}\n", a.spectralPeaks.empty() ? "" : "\n  ");
+	return fclose(fp) == 0;
+}
+
+static bool CopyFileContents(const std::string& from, const std::string& to) {
+	FILE* in = fopen(from.c_str(), "rb");
+	if (!in) {
+		return false;
+	}
+	FILE* out = fopen(to.c_str(), "wb");
+	if (!out) {
+		fclose(in);
+		return false;
+	}
+	std::vector<char> buffer(1 << 20);
+	bool ok = true;
+	size_t n;
+	while (ok && (n = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+		ok = fwrite(buffer.data(), 1, n, out) == n;
+	}
+	ok = ok && !ferror(in);
+	fclose(in);
+	return fclose(out) == 0 && ok;
+}
+
+static bool ParseArguments(int argc, char** argv, Options& options, std::vector<std::string>& inputs) {
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "-o" && hasValue) {
+			options.outputDirectory = argv[++i];
+		}
+		else if (arg == "-j" && hasValue) {
+			options.threads = atoi(argv[++i]);
+		}
+		else if (arg == "--fft" && hasValue) {
+			options.settings.fftSize = (size_t)std::max(atoi(argv[++i]), 2);
+		}
+		else if (arg == "--hop" && hasValue) {
+			options.settings.hop = (size_t)std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--peaks" && hasValue) {
+			options.settings.spectralPeaks = std::max(atoi(argv[++i]), 0);
+		}
+		else if (arg == "--no-spectrogram") {
+			options.settings.isSpectrogram = false;
+		}
+		else if (arg == "--format" && hasValue) {
+			const std::string format = argv[++i];
+			if (format == "f32") {
+				options.format = SpectrogramFormat::Float32;
+			}
+			else if (format == "f16") {
+				options.format = SpectrogramFormat::Float16;
+			}
+			else if (format == "u8") {
+				options.format = SpectrogramFormat::UInt8;
+			}
+			else {
+				fprintf(stderr, "unknown format %s\n", format.c_str());
+				return false;
+			}
+		}
+		else if (arg == "--floor" && hasValue) {
+			options.floorDb = std::min((float)atof(argv[++i]), -1.0f);
+		}
+		else if (arg == "--png") {
+			options.isPng = true;
+		}
+		else if (arg == "--png-width" && hasValue) {
+			options.pngWidth = std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--skip-existing") {
+			options.isSkipExisting = true;
+		}
+		else if (arg == "--duration" && hasValue) {
+			options.shaderSeconds = atof(argv[++i]);
+		}
+		else if (arg == "--rate" && hasValue) {
+			options.shaderSampleRate = std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--render") {
+			options.isRender = true;
+		}
+		else if (arg == "--cache" && hasValue) {
+			options.cacheDirectory = argv[++i];
+		}
+		else if (arg == "--cache-size" && hasValue) {
+			options.cacheBytes = (uint64_t)std::max(atoll(argv[++i]), 1LL) << 20;
+		}
+		else if (arg == "--benchmark") {
+			options.isBenchmark = true;
+		}
+		else if (arg[0] == '@') {
+			std::ifstream list(arg.substr(1));
+			if (!list) {
+				fprintf(stderr, "cannot open list %s\n", arg.c_str() + 1);
+				return false;
+			}
+			std::string line;
+			while (std::getline(list, line)) {
+				while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+					line.pop_back();
+				}
+				if (!line.empty()) {
+					inputs.push_back(line);
+				}
+			}
+		}
+		else if (arg[0] == '-' && arg.size() > 1) {
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+		else {
+			inputs.push_back(arg);
+		}
+	}
+	if (options.settings.fftSize % 2 != 0) {
+		fprintf(stderr, "fft size must be even\n");
+		return false;
+	}
+	return !inputs.empty() || options.isBenchmark;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	std::vector<std::string> inputs;
+	if (!ParseArguments(argc, argv, options, inputs)) {
+		PrintUsage();
+		return 2;
+	}
+	if (options.isBenchmark) {
+		RunBenchmarks(inputs, options.threads);
+		return 0;
+	}
+	int threads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+	threads = std::max(1, std::min(threads, (int)inputs.size()));
+	const std::vector<std::string> stems = MakeOutputStems(inputs, options.outputDirectory);
+
+	AnalysisCache cache;
+	cache.Open(options.cacheDirectory, options.cacheBytes);
+
+	// files are handed out one at a time, so long and short files balance over the workers
+	std::atomic<size_t> next{ 0 };
+	std::atomic<int> failed{ 0 };
+	std::atomic<int> skipped{ 0 };
+	std::mutex logMutex;
+	const auto start = std::chrono::steady_clock::now();
+	auto worker = [&]() {
+		for (size_t i = next++; i < inputs.size(); i = next++) {
+			const std::string& input = inputs[i];
+			const std::string& stem = stems[i];
+			const std::string summaryPath = stem + ".json";
+			if (options.isSkipExisting && FileExists(summaryPath)) {
+				skipped++;
+				continue;
+			}
+			std::string error;
+			try {
+				std::unique_ptr<PCMAudio> audio;
+				std::string key;
+				if (IsShader(input)) {
+					// a single shader renders on all the threads, a batch on one each
+					std::unique_ptr<ShaderSoundAudio> shader(new ShaderSoundAudio());
+					shader->LoadFromFile(input, options.shaderSeconds, options.shaderSampleRate, threads == 1 ? options.threads : 1);
+					if (options.isRender) {
+						SaveAudioToWaveFile(*shader, stem + ".wav");
+					}
+					audio = std::move(shader);
+				}
+				else if (cache.IsEnabled()) {
+					key = AnalysisCache::GetKey(input);
+				}
+				// with the cache the file is only decoded when something has to be computed; a
+				// single MP3 decodes on all the threads, a batch on one each
+				auto source = [&]() -> PCMAudio& {
+					if (!audio) {
+						audio = cache.LoadAudio(input, threads == 1 ? options.threads : 1, key);
+					}
+					return *audio;
+				};
+
+				// the analysis only needs the average spectrum, the frames are streamed by the export
+				AnalysisSettings settings = options.settings;
+				settings.isSpectrogram = false;
+				AudioAnalysis analysis;
+				char kind[96];
+				snprintf(kind, sizeof(kind), "analysis-%zu-%zu-%d-%d", settings.fftSize, settings.hop, (int)settings.window, settings.spectralPeaks);
+				const std::string analysisPath = key.empty() ? "" : cache.GetPath(key, kind);
+				if (key.empty() || !cache.Touch(analysisPath) || !LoadAnalysis(analysisPath, analysis)) {
+					analysis = AnalyzeAudio(source(), settings);
+					if (!key.empty()) {
+						cache.Store(analysisPath, [&](const std::string& path) { return SaveAnalysis(path, analysis); });
+					}
+				}
+
+				if (options.settings.isSpectrogram || options.isPng) {
+					SpectrogramExportSettings exportSettings;
+					exportSettings.fftSize = options.settings.fftSize;
+					exportSettings.hop = options.settings.hop;
+					exportSettings.window = options.settings.window;
+					exportSettings.format = options.format;
+					exportSettings.floorDb = options.floorDb;
+					exportSettings.threads = threads == 1 ? options.threads : 1;
+					exportSettings.imageWidth = options.pngWidth;
+					const std::string binaryPath = options.settings.isSpectrogram ? stem + ".spectrogram" : "";
+					const std::string pngPath = options.isPng ? stem + ".png" : "";
+					snprintf(kind, sizeof(kind), "%zu-%zu-%d-%d-%g", exportSettings.fftSize, exportSettings.hop, (int)exportSettings.window, (int)exportSettings.format, exportSettings.floorDb);
+					const std::string cachedBinary = key.empty() || binaryPath.empty() ? "" : cache.GetPath(key, std::string("spectrogram-") + kind);
+					const std::string cachedPng = key.empty() || pngPath.empty() ? "" : cache.GetPath(key, std::string("png-") + kind + "-" + std::to_string(exportSettings.imageWidth));
+					const bool isHit = !key.empty() && (cachedBinary.empty() || cache.Touch(cachedBinary)) && (cachedPng.empty() || cache.Touch(cachedPng));
+					if (isHit) {
+						if ((!cachedBinary.empty() && !CopyFileContents(cachedBinary, binaryPath)) || (!cachedPng.empty() && !CopyFileContents(cachedPng, pngPath))) {
+							throw std::runtime_error("cannot copy the spectrogram from the cache");
+						}
+					}
+					else {
+						ExportSpectrogram(source(), binaryPath, pngPath, exportSettings);
+						for (const auto& copy : { std::make_pair(binaryPath, cachedBinary), std::make_pair(pngPath, cachedPng) }) {
+							if (!copy.second.empty()) {
+								cache.Store(copy.second, [&](const std::string& path) { return CopyFileContents(copy.first, path); });
+							}
+						}
+					}
+				}
+				audio.reset();
+				// the summary goes last, so that --skip-existing never trusts a half written result
+				if (!WriteSummary(summaryPath, input, analysis)) {
+					error = "cannot write " + summaryPath;
+				}
+			}
+			catch (const std::exception& e) {
+				error = e.what();
+			}
+			std::lock_guard<std::mutex> lock(logMutex);
+			if (error.empty()) {
+				printf("[%zu/%zu] %s\n", i + 1, inputs.size(), input.c_str());
+			}
+			else {
+				failed++;
+				fprintf(stderr, "[%zu/%zu] %s: %s\n", i + 1, inputs.size(), input.c_str(), error.c_str());
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : pool) {
+		t.join();
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%zu files, %d failed, %d skipped, %.1f s on %d threads\n", inputs.size(), (int)failed, (int)skipped, seconds, threads);
+	return failed ? 1 : 0;
+}